@@ -1537,6 +1537,8 @@ void		trap_CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
 void		trap_CM_CapsuleTrace( trace_t *results, const vec3_t start, const vec3_t end,
 					  const vec3_t mins, const vec3_t maxs,
 					  clipHandle_t model, int brushmask );
+// traces each request against one model, the passEntityNum of the requests is ignored
+void		trap_CM_BoxTraceBatch( trace_t *results, const traceRequest_t *requests, int count, clipHandle_t model );
 void		trap_CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
 					  const vec3_t mins, const vec3_t maxs,
 					  clipHandle_t model, int brushmask,
@@ -165,6 +165,10 @@ void	trap_CM_CapsuleTrace( trace_t *results, const vec3_t start, const vec3_t en
 	syscall( CG_CM_CAPSULETRACE, results, start, end, mins, maxs, model, brushmask );
 }
 
+void	trap_CM_BoxTraceBatch( trace_t *results, const traceRequest_t *requests, int count, clipHandle_t model ) {
+	syscall( CG_CM_BOXTRACEBATCH, results, requests, count, model );
+}
+
 void	trap_CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
 						  const vec3_t mins, const vec3_t maxs,
 						  clipHandle_t model, int brushmask,
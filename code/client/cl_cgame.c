@@ -516,6 +516,11 @@ intptr_t CL_CgameSystemCalls( intptr_t *args ) {
 	case CG_CM_TRANSFORMEDCAPSULETRACE:
 		CM_TransformedBoxTrace( VMA(1), VMA(2), VMA(3), VMA(4), VMA(5), args[6], args[7], VMA(8), VMA(9), /*int capsule*/ qtrue );
 		return 0;
+	case CG_CM_BOXTRACEBATCH:
+		VM_CheckArray( args[1], args[3], sizeof( trace_t ), "CG_CM_BOXTRACEBATCH" );
+		VM_CheckArray( args[2], args[3], sizeof( traceRequest_t ), "CG_CM_BOXTRACEBATCH" );
+		CM_BoxTraceBatch( VMA(1), VMA(2), args[3], args[4] );
+		return 0;
 	case CG_CM_MARKFRAGMENTS:
 		return re.MarkFragments( args[1], VMA(2), VMA(3), args[4], VMA(5), args[6], VMA(7) );
 	case CG_S_STARTSOUND:
@@ -842,6 +847,10 @@ Adjustments are only made when a new snapshot arrives with a rational
 latency, which keeps the adjustment process framerate independent and
 prevents massive overadjustment during times of significant packet loss
 or bursted delayed packets.
+
+Servers with sv_subframeSnapshots send extra snapshots between frames that
+repeat the frame's serverTime.  Only the first snapshot of a server frame
+is used, as the later ones would look late and drag the delta down.
 =================
 */
 
@@ -858,6 +867,11 @@ void CL_AdjustTimeDelta( void ) {
 		return;
 	}
 
+	if ( cl.snap.serverTime == cl.adjustedServerTime ) {
+		return;
+	}
+	cl.adjustedServerTime = cl.snap.serverTime;
+
 	newDelta = cl.snap.serverTime - cls.realtime;
 	deltaDelta = abs( newDelta - cl.serverTimeDelta );
 
@@ -912,6 +926,7 @@ void CL_FirstSnapshot( void ) {
 	// set the timedelta so we are exactly on this first frame
 	cl.serverTimeDelta = cl.snap.serverTime - cls.realtime;
 	cl.oldServerTime = cl.snap.serverTime;
+	cl.adjustedServerTime = cl.snap.serverTime;
 
 	clc.timeDemoBaseTime = cl.snap.serverTime;
 
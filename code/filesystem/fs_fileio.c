@@ -244,10 +244,18 @@ qboolean FS_FileExists(const char *file) {
 // File read cache
 /* ******************************************************************************** */
 
+// The lookup table and ring bookkeeping are guarded by cache_mutex, so fs_prefetch_data can
+//    fill the cache from a worker thread while the main thread reads from it. File data is
+//    extracted with the lock released, and entries are pinned by lock_count meanwhile.
+// fs_read_data and fs_free_data are still main thread only, since they do reference tracking,
+//    debug prints, and Com_Error.
+
 typedef struct cache_entry_s {
 	unsigned int size;
 	int lock_count;
 	int stage;
+	int usage;			// Eviction sweeps this entry survives, raised on each hit
+	qboolean ready;		// Data is fully loaded and the entry can be returned from lookups
 
 	const fsc_file_t *file;
 	unsigned int file_size;
@@ -264,6 +272,24 @@ typedef struct cache_entry_s {
 #define CACHE_LOOKUP_TABLE_SIZE 4096
 static cache_entry_t *cache_lookup_table[CACHE_LOOKUP_TABLE_SIZE];
 
+static sysMutex_t *cache_mutex;
+
+static struct {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int evictions;
+	unsigned int second_chances;
+	unsigned int uncached;		// Reads too large for the cache or with no space available
+} cache_stats;
+
+static void cache_lock(void) {
+	// The mutex is created in fs_cache_initialize; config files read before then
+	//    are always read from the main thread
+	if(cache_mutex) Sys_LockMutex(cache_mutex); }
+
+static void cache_unlock(void) {
+	if(cache_mutex) Sys_UnlockMutex(cache_mutex); }
+
 static unsigned int fs_cache_hash(const fsc_file_t *file) {
 	if(!file) return 0;
 	return fsc_string_hash((const char *)STACKPTR(file->qp_name_ptr), (const char *)STACKPTR(file->qp_dir_ptr)); }
@@ -284,6 +310,7 @@ static void cache_lookup_table_deregister(cache_entry_t *entry) {
 static void cache_lookup_table_deregister_range(cache_entry_t *start, cache_entry_t *end) {
 	while(start && start != end) {
 		cache_lookup_table_deregister(start);
+		++cache_stats.evictions;
 		start = start->next_position; } }
 
 static qboolean cache_entry_matches_file(const fsc_file_t *file, const cache_entry_t *cache_entry) {
@@ -300,7 +327,7 @@ static cache_entry_t *cache_lookup_search(const fsc_file_t *file) {
 	cache_entry_t *best_entry = 0;
 
 	while(entry) {
-		if((!best_entry || entry->stage > best_entry->stage) && cache_entry_matches_file(file, entry)) {
+		if(entry->ready && (!best_entry || entry->stage > best_entry->stage) && cache_entry_matches_file(file, entry)) {
 			best_entry = entry; }
 		entry = entry->next_lookup; }
 
@@ -311,6 +338,10 @@ static cache_entry_t *cache_lookup_search(const fsc_file_t *file) {
 #define CACHE_ENTRY_DATA(cache_entry) ((char *)(cache_entry) + sizeof(cache_entry_t))
 #define CACHE_ALIGN(ptr) (((uintptr_t)(ptr) + 15) & ~15)
 
+// Entries are evicted in ring order like a CLOCK sweep; each hit buys an entry one more
+//    pass of the sweep, up to this many, so files reread on every map load stay resident
+#define CACHE_MAX_USAGE 3
+
 int cache_stage = 0;
 int cache_size = 0;
 cache_entry_t *base_entry;
@@ -334,14 +365,20 @@ static cache_entry_t *cache_allocate(const fsc_file_t *file, unsigned int size)
 		if(end_point - start_point >= required_space) break;
 
 		// Wraparound check
+		// Every pass of the sweep lowers the usage of the entries it skips, so after
+		//    CACHE_MAX_USAGE passes only locked entries can still be in the way
 		if(!limit_entry) {
-			if(!head_entry || wrapped_around++) return 0;
+			if(!head_entry || wrapped_around++ > CACHE_MAX_USAGE) return 0;
 			lead_entry = 0;
 			limit_entry = base_entry;
 			continue; }
 
-		// Don't advance limit over a locked entry
-		while(limit_entry && limit_entry->lock_count) {
+		// Don't advance limit over a locked entry, and give recently used entries
+		//    another pass instead of evicting them
+		while(limit_entry && (limit_entry->lock_count || limit_entry->usage)) {
+			if(!limit_entry->lock_count) {
+				--limit_entry->usage;
+				++cache_stats.second_chances; }
 			lead_entry = limit_entry;
 			limit_entry = lead_entry->next_position; }
 
@@ -364,6 +401,8 @@ static cache_entry_t *cache_allocate(const fsc_file_t *file, unsigned int size)
 	new_entry->size = size;
 	new_entry->lock_count = 0;
 	new_entry->stage = cache_stage;
+	new_entry->usage = 0;
+	new_entry->ready = qfalse;
 	new_entry->file = file;
 	new_entry->file_size = file ? file->filesize : 0;
 	new_entry->file_timestamp = file && file->sourcetype == FSC_SOURCETYPE_DIRECT ? ((fsc_file_direct_t *)file)->os_timestamp : 0;
@@ -387,13 +426,19 @@ void fs_cache_initialize(void) {
 
 	cache_size = cache_megs << 20;
 	base_entry = (cache_entry_t *)fsc_malloc(cache_size);
-	head_entry = 0; }
+	head_entry = 0;
+	cache_mutex = Sys_CreateMutex(); }
+
+unsigned int fs_cache_capacity(void) {
+	return (unsigned int)cache_size; }
 
 void fs_advance_cache_stage(void) {
 	// Causes existing files in cache to be recopied to the front of the cache on reference
 	// This may be called between level loads to help with performance
 	// It should not have any functional impact; it is only for optimization purposes
-	++cache_stage; }
+	cache_lock();
+	++cache_stage;
+	cache_unlock(); }
 
 // ***** Cache debugging *****
 
@@ -428,20 +473,23 @@ void fs_readcache_debug(void) {
 	fsc_stream_t stream = {data, 0, sizeof(data), 0};
 	int index_counter = 0;
 
-	if(!head_entry) return;
+	cache_lock();
+	if(!head_entry) {
+		cache_unlock();
+		return; }
 
 	#define ADD_STRING(string) fsc_stream_append_string(&stream, string)
 
 	do {
 		stream.position = 0;
 		if(!entry->file) {
-			ADD_STRING(va("Null File Index(%i) Position(%i) Size(%i) Stage(%i) Lockcount(%i)",
-					index_counter, (int)((char *)entry - (char *)base_entry), entry->size, entry->stage, entry->lock_count));
+			ADD_STRING(va("Null File Index(%i) Position(%i) Size(%i) Stage(%i) Lockcount(%i) Usage(%i)",
+					index_counter, (int)((char *)entry - (char *)base_entry), entry->size, entry->stage, entry->lock_count, entry->usage));
 		} else {
 			ADD_STRING("File(");
 			fs_file_to_stream(entry->file, &stream, qtrue, qtrue, qtrue, qfalse);
-			ADD_STRING(va(") Index(%i) Position(%i) Size(%i) Stage(%i) Lockcount(%i)",
-					index_counter, (int)((char *)entry - (char *)base_entry), entry->size, entry->stage, entry->lock_count)); }
+			ADD_STRING(va(") Index(%i) Position(%i) Size(%i) Stage(%i) Lockcount(%i) Usage(%i)",
+					index_counter, (int)((char *)entry - (char *)base_entry), entry->size, entry->stage, entry->lock_count, entry->usage)); }
 		if(entry == head_entry) ADD_STRING(" <head entry>");
 		ADD_STRING("\n\n");
 		Com_Printf("%s", stream.data);
@@ -449,7 +497,10 @@ void fs_readcache_debug(void) {
 	} while((entry = entry->next_position));
 
 	Com_Printf("entry count from direct iteration: %i\n", fs_cache_entrycount_direct());
-	Com_Printf("entry count from lookup table: %i\n", fs_cache_entrycount_lookuptable()); }
+	Com_Printf("entry count from lookup table: %i\n", fs_cache_entrycount_lookuptable());
+	Com_Printf("hits: %u misses: %u evictions: %u second chances: %u uncached reads: %u\n",
+			cache_stats.hits, cache_stats.misses, cache_stats.evictions, cache_stats.second_chances, cache_stats.uncached);
+	cache_unlock(); }
 
 /* ******************************************************************************** */
 // Data reading
@@ -467,6 +518,10 @@ static cache_entry_t *cache_search_current_stage(const fsc_file_t *file) {
 		--entry->lock_count;
 		if(new_entry) {
 			fsc_memcpy(CACHE_ENTRY_DATA(new_entry), CACHE_ENTRY_DATA(entry), entry->size);
+			new_entry->usage = entry->usage;
+			new_entry->ready = qtrue;
+			// The old copy is now only taking up space
+			entry->usage = 0;
 			return new_entry; } }
 
 	return entry; }
@@ -502,9 +557,16 @@ char *fs_read_data(const fsc_file_t *file, const char *path, unsigned int *size_
 
 	// Check if file is already available from cache
 	if(file) {
+		cache_lock();
 		cache_entry = cache_search_current_stage(file);
 		if(cache_entry) {
 			++cache_entry->lock_count;
+			if(cache_entry->usage < CACHE_MAX_USAGE) ++cache_entry->usage;
+			++cache_stats.hits; }
+		else ++cache_stats.misses;
+		cache_unlock();
+
+		if(cache_entry) {
 			if(size_out) *size_out = cache_entry->size - 1;
 			if(fs_debug_fileio->integer) FS_DPrintf("  result: loaded %u bytes from cache\n", cache_entry->size - 1);
 			return CACHE_ENTRY_DATA(cache_entry); } }
@@ -534,12 +596,16 @@ char *fs_read_data(const fsc_file_t *file, const char *path, unsigned int *size_
 		goto error; }
 
 	// Obtain buffer from cache or malloc
+	// The new entry stays locked and out of lookups until its data is loaded
+	cache_lock();
 	if(size < cache_size / 3) {
 		// Don't use more than 1/3 of the cache for a single file to avoid flushing smaller files
 		cache_entry = cache_allocate(file, size + 1); }
-	if(cache_entry) {
-		++cache_entry->lock_count;
-		data = CACHE_ENTRY_DATA(cache_entry); }
+	if(cache_entry) ++cache_entry->lock_count;
+	else ++cache_stats.uncached;
+	cache_unlock();
+
+	if(cache_entry) data = CACHE_ENTRY_DATA(cache_entry);
 	else data = (char *)fsc_malloc(size + 1);
 
 	// Extract data into buffer
@@ -551,6 +617,11 @@ char *fs_read_data(const fsc_file_t *file, const char *path, unsigned int *size_
 		if(fsc_extract_file(file, data, &fs, 0)) goto error; }
 	data[size] = 0;
 
+	if(cache_entry) {
+		cache_lock();
+		cache_entry->ready = qtrue;
+		cache_unlock(); }
+
 	if(size_out) *size_out = size;
 	if(fs_debug_fileio->integer) FS_DPrintf("  result: loaded %u bytes from file\n", size);
 	return data;
@@ -559,8 +630,10 @@ char *fs_read_data(const fsc_file_t *file, const char *path, unsigned int *size_
 	error:
 	if(fs_debug_fileio->integer) FS_DPrintf("  result: failed to load file\n");
 	if(cache_entry) {
+		cache_lock();
 		cache_entry->file = 0;
-		cache_entry->lock_count = 0; }
+		cache_entry->lock_count = 0;
+		cache_unlock(); }
 	else if(data) fsc_free(data);
 	if(size_out) *size_out = 0;
 	return 0; }
@@ -569,11 +642,46 @@ void fs_free_data(char *data) {
 	FSC_ASSERT(data);
 	if(data >= (char *)base_entry && data < (char *)base_entry + cache_size) {
 		cache_entry_t *cache_entry = (cache_entry_t *)(data - sizeof(cache_entry_t));
-		if(cache_entry->lock_count <= 0) Com_Error(ERR_DROP, "fs_free_data on invalid or already freed entry.");
-		--cache_entry->lock_count; }
+		qboolean valid;
+		cache_lock();
+		valid = cache_entry->lock_count > 0 ? qtrue : qfalse;
+		if(valid) --cache_entry->lock_count;
+		cache_unlock();
+		if(!valid) Com_Error(ERR_DROP, "fs_free_data on invalid or already freed entry."); }
 	else {
 		fsc_free(data); } }
 
+qboolean fs_prefetch_data(const fsc_file_t *file) {
+	// Loads a file into the cache ahead of use, for the prefetch thread
+	// Skips reference tracking and debug prints, which are not thread safe; the real read
+	//    done later by the consumer takes care of those
+	// Returns qfalse if the file could not be cached
+	cache_entry_t *cache_entry = 0;
+	FSC_ASSERT(file);
+
+	cache_lock();
+	if(cache_search_current_stage(file)) {
+		cache_unlock();
+		return qtrue; }
+	if(file->filesize < cache_size / 3) cache_entry = cache_allocate(file, file->filesize + 1);
+	if(cache_entry) ++cache_entry->lock_count;
+	cache_unlock();
+	if(!cache_entry) return qfalse;
+
+	if(fsc_extract_file(file, CACHE_ENTRY_DATA(cache_entry), &fs, 0)) {
+		cache_lock();
+		cache_entry->file = 0;
+		cache_entry->lock_count = 0;
+		cache_unlock();
+		return qfalse; }
+	CACHE_ENTRY_DATA(cache_entry)[file->filesize] = 0;
+
+	cache_lock();
+	cache_entry->ready = qtrue;
+	--cache_entry->lock_count;
+	cache_unlock();
+	return qtrue; }
+
 char *fs_read_shader(const fsc_shader_t *shader) {
 	// Returns shader text allocated in Z_Malloc, or null if there was an error
 	unsigned int size;
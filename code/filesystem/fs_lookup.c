@@ -707,6 +707,98 @@ void debug_resource_comparison(int resource1_position, int resource2_position) {
 
 	Com_Printf("%s\n", stream.data); }
 
+/* ******************************************************************************** */
+// Lookup Result Cache - Stores results of repeated lookups until the filesystem state changes
+/* ******************************************************************************** */
+
+// Level loads look up the same shader, image, and model names many times, and each uncached
+//   lookup runs the full precedence comparison over every candidate resource. Results only
+//   depend on the query and the filesystem state, so they can be reused until fs_generation
+//   or one of the cvars checked in lookup_cache_ready changes.
+
+typedef enum {
+	LOOKUP_CACHE_GENERAL,
+	LOOKUP_CACHE_SHADER,
+	LOOKUP_CACHE_IMAGE,
+	LOOKUP_CACHE_SOUND
+} lookup_cache_type_t;
+
+typedef struct {
+	fs_hashtable_entry_t hte;
+	lookup_cache_type_t type;
+	int lookup_flags;
+	query_result_t result;
+	char name[1];	// Allocated to fit
+} lookup_cache_entry_t;
+
+#define LOOKUP_CACHE_BUCKETS 4096
+#define LOOKUP_CACHE_MAX_ENTRIES 8192
+
+static fs_hashtable_t lookup_cache;
+static int lookup_cache_generation;
+static int lookup_cache_inactive_mods_count;
+#ifdef FS_SERVERCFG_ENABLED
+static int lookup_cache_servercfg_count;
+#endif
+
+static qboolean lookup_cache_ready(void) {
+	// Clears the cache if it is out of date
+	// Returns qtrue if the cache can be used, qfalse if it is disabled
+	if(!fs_lookup_cache->integer) return qfalse;
+	if(!lookup_cache.bucket_count) {
+		fs_hashtable_initialize(&lookup_cache, LOOKUP_CACHE_BUCKETS);
+		lookup_cache_generation = fs_generation - 1; }
+
+	if(lookup_cache_generation != fs_generation ||
+			lookup_cache_inactive_mods_count != fs_read_inactive_mods->modificationCount ||
+#ifdef FS_SERVERCFG_ENABLED
+			lookup_cache_servercfg_count != fs_servercfg->modificationCount ||
+#endif
+			lookup_cache.element_count >= LOOKUP_CACHE_MAX_ENTRIES) {
+		fs_hashtable_reset(&lookup_cache, 0);
+		lookup_cache_generation = fs_generation;
+		lookup_cache_inactive_mods_count = fs_read_inactive_mods->modificationCount;
+#ifdef FS_SERVERCFG_ENABLED
+		lookup_cache_servercfg_count = fs_servercfg->modificationCount;
+#endif
+	}
+	return qtrue; }
+
+static unsigned int lookup_cache_hash(lookup_cache_type_t type, const char *name, int lookup_flags) {
+	return fsc_string_hash(name, 0) ^ ((unsigned int)type << 24) ^ (unsigned int)lookup_flags; }
+
+static qboolean lookup_cache_get(lookup_cache_type_t type, const char *name, int lookup_flags, query_result_t *output) {
+	// Returns qtrue and writes output on cache hit, qfalse otherwise
+	fs_hashtable_iterator_t it;
+	lookup_cache_entry_t *entry;
+	if(!lookup_cache_ready()) return qfalse;
+
+	it = fs_hashtable_iterate(&lookup_cache, lookup_cache_hash(type, name, lookup_flags), qfalse);
+	while((entry = (lookup_cache_entry_t *)fs_hashtable_next(&it))) {
+		if(entry->type == type && entry->lookup_flags == lookup_flags && !strcmp(entry->name, name)) {
+			*output = entry->result;
+			return qtrue; } }
+	return qfalse; }
+
+static void lookup_cache_insert(lookup_cache_type_t type, const char *name, int lookup_flags, const query_result_t *result) {
+	int name_length = strlen(name);
+	lookup_cache_entry_t *entry;
+	if(!lookup_cache_ready()) return;
+
+	entry = (lookup_cache_entry_t *)Z_Malloc(sizeof(*entry) + name_length);
+	entry->type = type;
+	entry->lookup_flags = lookup_flags;
+	entry->result = *result;
+	Com_Memcpy(entry->name, name, name_length + 1);
+	fs_hashtable_insert(&lookup_cache, &entry->hte, lookup_cache_hash(type, name, lookup_flags)); }
+
+static void cached_lookup(lookup_cache_type_t type, const char *name, const lookup_query_t *query,
+		query_result_t *output) {
+	// Equivalent to perform_lookup for a single non-vm query
+	if(lookup_cache_get(type, name, query->lookup_flags, output)) return;
+	perform_lookup(query, 1, qfalse, output);
+	lookup_cache_insert(type, name, query->lookup_flags, output); }
+
 /* ******************************************************************************** */
 // Wrapper functions - Generates query and calls query handling functions
 /* ******************************************************************************** */
@@ -751,7 +843,7 @@ const fsc_file_t *fs_general_lookup(const char *name, int lookup_flags, qboolean
 		debug_lookup(&query, 1, qfalse);
 		return 0; }
 
-	perform_lookup(&query, 1, qfalse, &lookup_result);
+	cached_lookup(LOOKUP_CACHE_GENERAL, name, &query, &lookup_result);
 	if(fs_debug_lookup->integer) {
 		FS_DPrintf("********** general lookup **********\n");
 		fs_debug_indent_start();
@@ -767,6 +859,7 @@ static void shader_or_image_lookup(const char *name, qboolean image_only, int lo
 	lookup_query_t query;
 	fsc_qpath_buffer_t qpath_split;
 	const char *exts[] = {".dds", ".png", ".tga", ".jpg", ".jpeg", ".pcx", ".bmp"};
+	const char *full_name = name;	// Shader names keep any leading slash
 
 	Com_Memset(&query, 0, sizeof(query));
 	query.lookup_flags = lookup_flags;
@@ -783,7 +876,7 @@ static void shader_or_image_lookup(const char *name, qboolean image_only, int lo
 	query.extension_count = (lookup_flags & LOOKUPFLAG_ENABLE_DDS) ? ARRAY_LEN(exts) : ARRAY_LEN(exts) - 1;
 
 	if(debug) debug_lookup(&query, 1, qfalse);
-	else perform_lookup(&query, 1, qfalse, output); }
+	else cached_lookup(image_only ? LOOKUP_CACHE_IMAGE : LOOKUP_CACHE_SHADER, full_name, &query, output); }
 
 const fsc_shader_t *fs_shader_lookup(const char *name, int lookup_flags, qboolean debug) {
 	// Input name should be extension-free (call COM_StripExtension first)
@@ -849,7 +942,7 @@ const fsc_file_t *fs_sound_lookup(const char *name, int lookup_flags, qboolean d
 		debug_lookup(&query, 1, qfalse);
 		return 0; }
 
-	perform_lookup(&query, 1, qfalse, &lookup_result);
+	cached_lookup(LOOKUP_CACHE_SOUND, name, &query, &lookup_result);
 	if(fs_debug_lookup->integer) {
 		FS_DPrintf("********** sound lookup **********\n");
 		fs_debug_indent_start();
@@ -34,6 +34,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 cvar_t *fs_dirs;
 cvar_t *fs_mod_settings;
 cvar_t *fs_index_cache;
+cvar_t *fs_index_threads;
+cvar_t *fs_index_watch;
 cvar_t *fs_read_inactive_mods;
 cvar_t *fs_list_inactive_mods;
 cvar_t *fs_download_manifest;
@@ -42,6 +44,8 @@ cvar_t *fs_redownload_across_mods;
 cvar_t *fs_full_pure_validation;
 cvar_t *fs_download_mode;
 cvar_t *fs_auto_refresh_enabled;
+cvar_t *fs_lookup_cache;
+cvar_t *fs_prefetch;
 #ifdef FS_SERVERCFG_ENABLED
 cvar_t *fs_servercfg;
 cvar_t *fs_servercfg_listlimit;
@@ -71,6 +75,10 @@ int checksum_feed;
 int connected_server_sv_pure;
 pk3_list_t connected_server_pure_list;
 
+// Incremented whenever the index or any of the state above changes, so results derived
+// from them (such as cached lookups) can tell when they are out of date
+int fs_generation;
+
 /* ******************************************************************************** */
 // Filesystem State Accessors
 /* ******************************************************************************** */
@@ -105,6 +113,7 @@ void fs_register_current_map(const char *name) {
 	const fsc_file_t *bsp_file = fs_general_lookup(name, LOOKUPFLAG_IGNORE_CURRENT_MAP, qfalse);
 	if(!bsp_file || bsp_file->sourcetype != FSC_SOURCETYPE_PK3) current_map_pk3 = 0;
 	else current_map_pk3 = fsc_get_base_file(bsp_file, &fs);
+	++fs_generation;
 
 	if(fs_debug_state->integer) {
 		char buffer[FS_FILE_BUFFER_SIZE];
@@ -115,6 +124,7 @@ void fs_register_current_map(const char *name) {
 
 void fs_set_connected_server_sv_pure_value(int sv_pure) {
 	connected_server_sv_pure = sv_pure;
+	++fs_generation;
 	if(fs_debug_state->integer) {
 		Com_Printf("fs_state: connected_server_sv_pure set to %i\n", sv_pure); } }
 
@@ -131,6 +141,7 @@ void FS_PureServerSetLoadedPaks(const char *hash_list, const char *name_list) {
 
 	for(i=0; i<count; ++i) {
 		pk3_list_insert(&connected_server_pure_list, atoi(Cmd_Argv(i))); }
+	++fs_generation;
 
 	if(fs_debug_state->integer) Com_Printf("fs_state: connected_server_pure_list set to '%s'\n", hash_list); }
 
@@ -138,6 +149,7 @@ void fs_disconnect_cleanup(void) {
 	current_map_pk3 = 0;
 	connected_server_sv_pure = 0;
 	pk3_list_free(&connected_server_pure_list);
+	++fs_generation;
 	if(fs_debug_state->integer) Com_Printf("fs_state: disconnect cleanup\n   > current_map_pk3 cleared"
 		"\n   > connected_server_sv_pure set to 0\n   > connected_server_pure_list cleared\n"); }
 
@@ -156,6 +168,7 @@ static void fs_update_mod_dir_ext(qboolean move_pid) {
 	fs_sanitize_mod_dir(fs_game->string, current_mod_dir);
 	if(!Q_stricmp(current_mod_dir, "basemod")) current_mod_dir[0] = 0;
 	if(!Q_stricmp(current_mod_dir, com_basegame->string)) current_mod_dir[0] = 0;
+	++fs_generation;
 
 	// Move pid file to new mod dir if necessary
 	if(move_pid && strcmp(old_pid_dir, fs_pid_file_directory())) {
@@ -344,13 +357,18 @@ static void refresh_errorhandler(int id, const char *msg, void *current_element,
 
 #define NON_PK3_FILES(stats) (stats.total_file_count - stats.pk3_subfile_count - stats.valid_pk3_count)
 
+static void index_run_jobs(void (*function)(void *context, int index, int thread), void *context, int count) {
+	Com_RunJobs(function, context, count, fs_index_threads->integer); }
+
 static void index_directory(const char *directory, int dir_id, qboolean quiet) {
 	fsc_errorhandler_t errorhandler = {refresh_errorhandler, 0};
 	fsc_stats_t old_active_stats = fs.active_stats;
 	fsc_stats_t old_total_stats = fs.total_stats;
 	void *os_path = fsc_string_to_os_path(directory);
 
-	fsc_load_directory(&fs, os_path, dir_id, &errorhandler);
+	// Reading pk3 central directories on multiple threads mainly helps cold starts with many pk3s
+	if(fs_index_threads->integer > 1) fsc_load_directory_parallel(&fs, os_path, dir_id, index_run_jobs, &errorhandler);
+	else fsc_load_directory(&fs, os_path, dir_id, &errorhandler);
 	fsc_free(os_path);
 
 	if(!quiet) {
@@ -365,6 +383,54 @@ static void index_directory(const char *directory, int dir_id, qboolean quiet) {
 				fs.total_stats.valid_pk3_count - old_total_stats.valid_pk3_count,
 				fs.total_stats.shader_count - old_total_stats.shader_count); } }
 
+static void *fs_watchers[FS_MAX_SOURCEDIRS];
+static qboolean fs_watch_unavailable;
+
+static qboolean update_watched_directories(qboolean quiet) {
+	// Applies changes reported by the source directory watchers since the last refresh
+	// Returns qtrue on success, qfalse if a full refresh is needed
+	fsc_errorhandler_t errorhandler = {refresh_errorhandler, 0};
+	qboolean complete = qtrue;
+	int i;
+	if(!fs_index_watch->integer || fs_watch_unavailable) return qfalse;
+	fsc_filesystem_reset_incremental(&fs);
+
+	for(i=0; i<FS_MAX_SOURCEDIRS; ++i) {
+		int count;
+		if(!fs_sourcedirs[i].active) continue;
+		if(!fs_watchers[i]) {
+			complete = qfalse;
+			continue; }
+		count = fsc_update_directory(&fs, fs_watchers[i], i, &errorhandler);
+		if(count < 0) {
+			if(!quiet) Com_Printf("Rescanning %s due to directory changes.\n", fs_sourcedirs[i].name);
+			fsc_watch_free(fs_watchers[i]);
+			fs_watchers[i] = 0;
+			complete = qfalse; }
+		else if(!quiet) {
+			Com_Printf("Updated %i changed files in %s.\n", count, fs_sourcedirs[i].name); } }
+
+	if(!complete) {
+		// Start watching before the full refresh so nothing changed during it is missed
+		for(i=0; i<FS_MAX_SOURCEDIRS; ++i) {
+			void *os_path;
+			if(!fs_sourcedirs[i].active || fs_watchers[i]) continue;
+			os_path = fsc_string_to_os_path(fs_sourcedirs[i].path);
+			fs_watchers[i] = fsc_watch_directory(os_path);
+			fsc_free(os_path);
+			if(!fs_watchers[i]) {
+				Com_Printf("WARNING: Failed to watch %s for changes. Using full filesystem refreshes.\n",
+						fs_sourcedirs[i].name);
+				fs_watch_unavailable = qtrue;
+				break; } }
+
+		if(fs_watch_unavailable) {
+			for(i=0; i<FS_MAX_SOURCEDIRS; ++i) {
+				if(fs_watchers[i]) fsc_watch_free(fs_watchers[i]);
+				fs_watchers[i] = 0; } } }
+
+	return complete; }
+
 extern int com_frameNumber;
 static int fs_refresh_frame = 0;
 
@@ -374,16 +440,22 @@ void fs_refresh(qboolean quiet) {
 	if(fs_debug_refresh->integer) quiet = qfalse;
 	if(!quiet) Com_Printf("----- fs_refresh -----\n");
 
-	fsc_filesystem_reset(&fs);
+	// The prefetch thread reads from the index being replaced
+	fs_prefetch_wait();
 
-	for(i=0; i<FS_MAX_SOURCEDIRS; ++i) {
-		if(!fs_sourcedirs[i].active) continue;
-		if(!quiet) Com_Printf("Indexing %s...\n", fs_sourcedirs[i].name);
-		index_directory(fs_sourcedirs[i].path, i, quiet); }
+	// With fs_index_watch, only files reported as changed need to be processed
+	if(!update_watched_directories(quiet)) {
+		fsc_filesystem_reset(&fs);
+
+		for(i=0; i<FS_MAX_SOURCEDIRS; ++i) {
+			if(!fs_sourcedirs[i].active) continue;
+			if(!quiet) Com_Printf("Indexing %s...\n", fs_sourcedirs[i].name);
+			index_directory(fs_sourcedirs[i].path, i, quiet); } }
 
 	if(!quiet) Com_Printf("Index memory usage at %iMB.\n",
 			fsc_fs_size_estimate(&fs) / 1048576 + 1);
 
+	++fs_generation;
 	fs_refresh_frame = com_frameNumber;
 	fs_readback_tracker_reset(); }
 
@@ -408,16 +480,23 @@ void fs_auto_refresh(void) {
 // Filesystem Initialization
 /* ******************************************************************************** */
 
-static void *get_fscache_path(void) {
+static void *get_fscache_path(const char *filename) {
 	char path[FS_MAX_PATH];
-	if(!fs_generate_path_sourcedir(0, "fscache.dat", 0, 0, 0, path, sizeof(path))) return 0;
+	if(!fs_generate_path_sourcedir(0, filename, 0, 0, 0, path, sizeof(path))) return 0;
 	return fsc_string_to_os_path(path); }
 
 void fs_indexcache_write(void) {
-	void *ospath = get_fscache_path();
-	if(!ospath) return;
-	fsc_cache_export_file(&fs, ospath, 0);
-	fsc_free(ospath); }
+	// The current fscache.dat may be mapped by this or other processes, so write
+	// a new file and rename it into place instead of overwriting it
+	void *ospath = get_fscache_path("fscache.dat");
+	void *temp_ospath = get_fscache_path("fscache.tmp");
+	if(ospath && temp_ospath && !fsc_cache_export_file(&fs, temp_ospath, 0)) {
+		if(fsc_rename_file(temp_ospath, ospath)) {
+			// Windows won't rename over an existing file
+			fsc_delete_file(ospath);
+			if(fsc_rename_file(temp_ospath, ospath)) fsc_delete_file(temp_ospath); } }
+	if(ospath) fsc_free(ospath);
+	if(temp_ospath) fsc_free(temp_ospath); }
 
 static qboolean fs_filesystem_refresh_tracked(void) {
 	// Calls fs_refresh, returns qtrue if enough changed to justify rewriting fscache.dat,
@@ -436,7 +515,7 @@ static void fs_initialize_index(void) {
 	qboolean cache_loaded = qfalse;
 
 	if(fs_index_cache->integer) {
-		void *path = get_fscache_path();
+		void *path = get_fscache_path("fscache.dat");
 		Com_Printf("Loading fscache.dat...\n");
 		if(path) {
 			if(!fsc_cache_import_file(path, &fs, 0)) cache_loaded = qtrue;
@@ -471,6 +550,8 @@ void fs_startup(void) {
 #endif
 	fs_mod_settings = Cvar_Get("fs_mod_settings", "0", CVAR_INIT);
 	fs_index_cache = Cvar_Get("fs_index_cache", "1", CVAR_INIT);
+	fs_index_threads = Cvar_Get("fs_index_threads", "4", CVAR_INIT);
+	fs_index_watch = Cvar_Get("fs_index_watch", "0", CVAR_INIT);
 	fs_read_inactive_mods = Cvar_Get("fs_read_inactive_mods", "1", CVAR_ARCHIVE);
 	fs_list_inactive_mods = Cvar_Get("fs_list_inactive_mods", "1", CVAR_ARCHIVE);
 	fs_download_manifest = Cvar_Get("fs_download_manifest",
@@ -480,6 +561,8 @@ void fs_startup(void) {
 	fs_full_pure_validation = Cvar_Get("fs_full_pure_validation", "0", CVAR_ARCHIVE);
 	fs_download_mode = Cvar_Get("fs_download_mode", "0", CVAR_ARCHIVE);
 	fs_auto_refresh_enabled = Cvar_Get("fs_auto_refresh_enabled", "1", 0);
+	fs_lookup_cache = Cvar_Get("fs_lookup_cache", "1", 0);
+	fs_prefetch = Cvar_Get("fs_prefetch", "1", 0);
 #ifdef FS_SERVERCFG_ENABLED
 	fs_servercfg = Cvar_Get("fs_servercfg", "servercfg", 0);
 	fs_servercfg_listlimit = Cvar_Get("fs_servercfg_listlimit", "0", 0);
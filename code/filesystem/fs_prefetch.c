@@ -0,0 +1,192 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+Copyright (C) 2017 Noah Metzger (chomenor@gmail.com)
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+
+#ifdef NEW_FILESYSTEM
+#include "fslocal.h"
+
+/* ******************************************************************************** */
+// Map Asset Prefetch
+/* ******************************************************************************** */
+
+// When a map is loaded, the files it references are looked up on the main thread and then
+//    extracted into the read cache by a background thread, so the bot library, renderer,
+//    and sound system mostly find their data already decompressed when they get to it.
+// Lookups and the file index are not thread safe, so the thread only ever touches files
+//    resolved beforehand, and it is stopped before anything that modifies the index.
+
+#define MAX_PREFETCH_FILES 4096
+#define PREFETCH_SET_SIZE 8192		// Power of two, larger than MAX_PREFETCH_FILES
+
+static struct {
+	sysThread_t *thread;
+	volatile qboolean cancel;
+	const fsc_file_t *files[MAX_PREFETCH_FILES];
+	int count;
+	unsigned int total_size;
+	unsigned int size_limit;
+	const fsc_file_t *set[PREFETCH_SET_SIZE];	// Queued files, for duplicate checks
+} prefetch;
+
+static void prefetch_thread(void *arg) {
+	int i;
+	for(i=0; i<prefetch.count && !prefetch.cancel; ++i) {
+		fs_prefetch_data(prefetch.files[i]); } }
+
+void fs_prefetch_wait(void) {
+	// Stops the prefetch thread if it is running
+	// Must be called before modifying the file index
+	if(!prefetch.thread) return;
+	prefetch.cancel = qtrue;
+	Sys_JoinThread(prefetch.thread);
+	prefetch.thread = 0; }
+
+static void prefetch_queue_file(const fsc_file_t *file) {
+	unsigned int position;
+	if(!file || prefetch.count >= MAX_PREFETCH_FILES) return;
+
+	// Skip files that wouldn't fit in the budget; the cache won't take files over 1/3 of its size
+	//    anyway, and filling it completely would evict the earlier prefetched files again
+	if(prefetch.total_size + file->filesize > prefetch.size_limit) return;
+
+	position = (unsigned int)(((uintptr_t)file >> 4) * 2654435761u) & (PREFETCH_SET_SIZE - 1);
+	while(prefetch.set[position]) {
+		if(prefetch.set[position] == file) return;
+		position = (position + 1) & (PREFETCH_SET_SIZE - 1); }
+	prefetch.set[position] = file;
+
+	prefetch.files[prefetch.count++] = file;
+	prefetch.total_size += file->filesize; }
+
+static void prefetch_queue_image(const char *name) {
+	char stripped[MAX_QPATH];
+	if(!*name || *name == '$' || *name == '*') return;
+	COM_StripExtension(name, stripped, sizeof(stripped));
+	prefetch_queue_file(fs_image_lookup(stripped, 0, qfalse)); }
+
+static void prefetch_queue_sound(const char *name) {
+	char stripped[MAX_QPATH];
+	// '*' sounds are player specific and resolved by cgame
+	if(!*name || *name == '*') return;
+	COM_StripExtension(name, stripped, sizeof(stripped));
+	prefetch_queue_file(fs_sound_lookup(stripped, 0, qfalse)); }
+
+static void prefetch_queue_shader(const char *name) {
+	// Queues the images a shader uses, or the image with the shader name for implicit shaders
+	char stripped[MAX_QPATH];
+	const fsc_shader_t *shader;
+	char *text, *position, *token;
+
+	COM_StripExtension(name, stripped, sizeof(stripped));
+	shader = fs_shader_lookup(stripped, 0, qfalse);
+	if(!shader) {
+		prefetch_queue_image(stripped);
+		return; }
+
+	text = fs_read_shader(shader);
+	if(!text) return;
+	position = text;
+	while(1) {
+		token = COM_ParseExt(&position, qtrue);
+		if(!*token) break;
+		if(!Q_stricmp(token, "map") || !Q_stricmp(token, "clampmap")) {
+			prefetch_queue_image(COM_ParseExt(&position, qfalse)); }
+		else if(!Q_stricmp(token, "animmap")) {
+			// Skip the frequency, then queue every frame on the line
+			COM_ParseExt(&position, qfalse);
+			while(1) {
+				token = COM_ParseExt(&position, qfalse);
+				if(!*token) break;
+				prefetch_queue_image(token); } } }
+	Z_Free(text); }
+
+static const void *prefetch_lump(const void *bsp_data, int length, int lump, int *lump_length) {
+	// Returns null if the lump is out of range
+	const lump_t *lumps = ((const dheader_t *)bsp_data)->lumps;
+	int offset = LittleLong(lumps[lump].fileofs);
+	*lump_length = LittleLong(lumps[lump].filelen);
+	if(offset < 0 || *lump_length < 0 || offset > length || *lump_length > length - offset) return 0;
+	return (const char *)bsp_data + offset; }
+
+static void prefetch_queue_entities(const char *entities, int length) {
+	// Queues models and sounds named by entity keys
+	char *text = (char *)Z_Malloc(length + 1);
+	char *position = text;
+	char key[MAX_TOKEN_CHARS];
+	char *value;
+	fsc_memcpy(text, entities, length);
+	text[length] = 0;
+
+	while(1) {
+		Q_strncpyz(key, COM_ParseExt(&position, qtrue), sizeof(key));
+		if(!*key) break;
+		if(!strcmp(key, "{") || !strcmp(key, "}")) continue;
+		value = COM_ParseExt(&position, qtrue);
+		if(!Q_stricmp(key, "model") || !Q_stricmp(key, "model2")) {
+			// Inline models are named '*<number>'
+			if(*value && *value != '*') prefetch_queue_file(fs_general_lookup(value, 0, qfalse)); }
+		else if(!Q_stricmp(key, "noise")) {
+			prefetch_queue_sound(value); } }
+	Z_Free(text); }
+
+void fs_prefetch_map(const char *name, const void *bsp_data, int length) {
+	// Starts prefetching the files referenced by a newly loaded bsp
+	char aas_name[MAX_QPATH];
+	int start_time = Sys_Milliseconds();
+	int i;
+
+	fs_prefetch_wait();
+	if(!fs_prefetch->integer || length < sizeof(dheader_t)) return;
+
+	Com_Memset(prefetch.set, 0, sizeof(prefetch.set));
+	prefetch.cancel = qfalse;
+	prefetch.count = 0;
+	prefetch.total_size = 0;
+	prefetch.size_limit = fs_cache_capacity() / 2;
+
+	// Bot navigation data is read by the server right after the bsp
+	COM_StripExtension(name, aas_name, sizeof(aas_name));
+	Q_strcat(aas_name, sizeof(aas_name), ".aas");
+	prefetch_queue_file(fs_general_lookup(aas_name, 0, qfalse));
+
+	// Textures, models, and sounds are only needed when the map is rendered
+	if(!com_dedicated->integer) {
+		int lump_length;
+		const dshader_t *shaders = (const dshader_t *)prefetch_lump(bsp_data, length, LUMP_SHADERS, &lump_length);
+		const char *entities;
+
+		if(shaders) {
+			for(i=0; i<lump_length/sizeof(dshader_t); ++i) {
+				char shader_name[MAX_QPATH];
+				Q_strncpyz(shader_name, shaders[i].shader, sizeof(shader_name));
+				prefetch_queue_shader(shader_name); } }
+
+		entities = (const char *)prefetch_lump(bsp_data, length, LUMP_ENTITIES, &lump_length);
+		if(entities) prefetch_queue_entities(entities, lump_length); }
+
+	if(fs_debug_fileio->integer) {
+		FS_DPrintf("prefetch: queued %i files (%u bytes) for %s in %i ms\n", prefetch.count, prefetch.total_size,
+				name, Sys_Milliseconds() - start_time); }
+
+	if(prefetch.count) prefetch.thread = Sys_CreateThread(prefetch_thread, 0); }
+
+#endif	// NEW_FILESYSTEM
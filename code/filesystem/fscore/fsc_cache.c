@@ -173,6 +173,20 @@ void fscache_build_filesystem(export_work_t *xw) {
 	fsc_hashtable_initialize(&xw->export_files, &xw->export_stack, hashtable_target_size);
 	fsc_hashtable_initialize(&xw->export_directories, &xw->export_stack, hashtable_target_size / 4);
 
+	// Convert the direct files first so they end up next to each other in the export stack
+	// Every refresh writes refresh_count and the other per-refresh fields of the direct files,
+	//    and in an imported cache those writes copy the page of the mapping they are on, so
+	//    clustering them keeps the pk3 contents, strings, and shaders on pages that stay shared
+	for(i=0; i<xw->source_fs->files.bucket_count; ++i) {
+		fsc_hashtable_open(&xw->source_fs->files, i, &hti);
+		while((source_file_ptr = fsc_hashtable_next(&hti))) {
+			fsc_file_t *source_file = (fsc_file_t *)STACKPTR_SRC(source_file_ptr);
+			if(!fsc_is_file_enabled(source_file, xw->source_fs)) continue;
+			if(source_file->sourcetype == FSC_SOURCETYPE_PK3) {
+				convert_file(((fsc_file_frompk3_t *)source_file)->source_pk3, xw); }
+			else if(source_file->sourcetype == FSC_SOURCETYPE_DIRECT && source_file->contents_cache) {
+				convert_file(source_file_ptr, xw); } } }
+
 	// Iterate and process all files in filesystem
 	for(i=0; i<xw->source_fs->files.bucket_count; ++i) {
 		fsc_hashtable_open(&xw->source_fs->files, i, &hti);
@@ -288,9 +302,16 @@ void fscache_build_pk3_hash_lookup(export_work_t *xw) {
 // Main
 /* ******************************************************************************** */
 
+typedef struct {
+	unsigned int version;
+	unsigned int size;	// including header
+} fscache_header_t;
+
 static int fsc_cache_export_data(fsc_filesystem_t *source_fs, fsc_stream_t *stream) {
 	// Returns 1 on error, 0 on success. stream->data must be freed by caller on success.
+	// The stream starts with the file header so alignment within the stream matches the file.
 	int error_state = 0;
+	fscache_header_t header;
 	export_work_t xw;
 	xw.source_fs = source_fs;
 
@@ -305,7 +326,8 @@ static int fsc_cache_export_data(fsc_filesystem_t *source_fs, fsc_stream_t *stre
 	fsc_hashtable_free(&xw.filemap);
 
 	// Set up export stream
-	stream->size = fsc_stack_get_export_size(&xw.export_stack)
+	stream->size = sizeof(header)
+			+ fsc_stack_get_export_size(&xw.export_stack)
 			+ fsc_hashtable_get_export_size(&xw.export_string_repository)
 			+ fsc_hashtable_get_export_size(&xw.export_files)
 			+ fsc_hashtable_get_export_size(&xw.export_directories)
@@ -313,7 +335,8 @@ static int fsc_cache_export_data(fsc_filesystem_t *source_fs, fsc_stream_t *stre
 			+ fsc_hashtable_get_export_size(&xw.export_crosshairs)
 			+ fsc_hashtable_get_export_size(&xw.export_pk3_hash_lookup);
 	stream->data = (char *)fsc_malloc(stream->size);
-	stream->position = 0;
+	stream->position = sizeof(header);
+	stream->overflowed = 0;
 
 	// Write export data to stream
 	if(!error_state) if(fsc_stack_export(&xw.export_stack, stream)) error_state = 1;
@@ -324,6 +347,11 @@ static int fsc_cache_export_data(fsc_filesystem_t *source_fs, fsc_stream_t *stre
 	if(!error_state) if(fsc_hashtable_export(&xw.export_crosshairs, stream)) error_state = 1;
 	if(!error_state) if(fsc_hashtable_export(&xw.export_pk3_hash_lookup, stream)) error_state = 1;
 
+	// Fill in the header
+	header.version = FSC_CACHE_VERSION;
+	header.size = stream->position;
+	fsc_memcpy(stream->data, &header, sizeof(header));
+
 	// Free export data
 	fsc_stack_free(&xw.export_stack);
 	fsc_hashtable_free(&xw.export_string_repository);
@@ -338,6 +366,8 @@ static int fsc_cache_export_data(fsc_filesystem_t *source_fs, fsc_stream_t *stre
 
 static int fsc_cache_import_data(fsc_stream_t *stream, fsc_filesystem_t *target_fs) {
 	// Returns 1 on error, 0 on success.
+	// The filesystem references the stream data directly, so it must stay valid until
+	//    the filesystem is freed.
 	fsc_memset(target_fs, 0, sizeof(*target_fs));
 
 	if(fsc_stack_import(&target_fs->general_stack, stream)) goto error;
@@ -358,14 +388,10 @@ static int fsc_cache_import_data(fsc_stream_t *stream, fsc_filesystem_t *target_
 	fsc_filesystem_free(target_fs);
 	return 1; }
 
-typedef struct {
-	unsigned int version;
-	unsigned int size;
-} fscache_header_t;
-
 int fsc_cache_export_file(fsc_filesystem_t *source_fs, void *os_path, fsc_errorhandler_t *eh) {
 	// Returns 1 on error, 0 on success.
-	fscache_header_t header;
+	// The file may be mapped by running processes, so it should be written to a temporary
+	//    path and renamed over the old one rather than overwritten directly.
 	fsc_stream_t stream;
 	void *fp;
 
@@ -373,18 +399,19 @@ int fsc_cache_export_file(fsc_filesystem_t *source_fs, void *os_path, fsc_errorh
 		fsc_report_error(eh, FSC_ERROR_GENERAL, "error generating cache file data", 0);
 		return 1; }
 
-	// Open the output file and write header
+	// Open the output file
 	fp = fsc_open_file(os_path, "wb");
 	if(!fp) {
 		fsc_free(stream.data);
 		fsc_report_error(eh, FSC_ERROR_GENERAL, "failed to open output file", 0);
 		return 1; }
-	header.version = FSC_CACHE_VERSION;
-	header.size = stream.position;
-	fsc_fwrite(&header, sizeof(header), fp);
 
 	// Write the data
-	fsc_fwrite(stream.data, header.size, fp);
+	if(fsc_fwrite(stream.data, stream.position, fp) != stream.position) {
+		fsc_fclose(fp);
+		fsc_free(stream.data);
+		fsc_report_error(eh, FSC_ERROR_GENERAL, "error writing cache file data", 0);
+		return 1; }
 
 	// Close file and free data
 	fsc_fclose(fp);
@@ -393,40 +420,42 @@ int fsc_cache_export_file(fsc_filesystem_t *source_fs, void *os_path, fsc_errorh
 
 int fsc_cache_import_file(void *os_path, fsc_filesystem_t *target_fs, fsc_errorhandler_t *eh) {
 	// Returns 1 on error, 0 on success. On error filesystem will not be initialized.
-	void *fp;
+	// The file is mapped copy-on-write and used in place, so nothing is deserialized and
+	//    pages which are never modified are shared between server processes. Refreshes write
+	//    to the direct file entries, which the export keeps together on a few pages.
+	void *image;
 	fscache_header_t header;
 	fsc_stream_t stream;
 
-	// Open the input file and read header
-	fp = fsc_open_file(os_path, "rb");
-	if(!fp) {
-		fsc_report_error(eh, FSC_ERROR_GENERAL, "failed to open input file", 0);
+	// Map the file and check header
+	image = fsc_map_file_private(os_path, &stream.size, &stream.data);
+	if(!image) {
+		fsc_report_error(eh, FSC_ERROR_GENERAL, "failed to map input file", 0);
 		return 1; }
-	if(fsc_fread(&header, sizeof(header), fp) != sizeof(header)) {
+	if(stream.size < sizeof(header)) {
 		fsc_report_error(eh, FSC_ERROR_GENERAL, "failed to read cache file header", 0);
-		fsc_fclose(fp);
+		fsc_unmap_file(image);
 		return 1; }
+	fsc_memcpy(&header, stream.data, sizeof(header));
 	if(header.version != FSC_CACHE_VERSION) {
 		fsc_report_error(eh, FSC_ERROR_GENERAL, "cache file has wrong version", 0);
-		fsc_fclose(fp);
+		fsc_unmap_file(image);
 		return 1; }
-
-	// Read data and close file
-	stream.data = (char *)fsc_malloc(header.size);
-	if(fsc_fread(stream.data, header.size, fp) != header.size) {
-		fsc_report_error(eh, FSC_ERROR_GENERAL, "error reading cache file data", 0);
+	if(header.size != stream.size) {
+		fsc_report_error(eh, FSC_ERROR_GENERAL, "cache file has wrong size", 0);
+		fsc_unmap_file(image);
 		return 1; }
-	fsc_fclose(fp);
 
 	// Load data into filesystem
-	stream.position = 0;
-	stream.size = header.size;
+	stream.position = sizeof(header);
+	stream.overflowed = 0;
 	if(fsc_cache_import_data(&stream, target_fs)) {
 		fsc_report_error(eh, FSC_ERROR_GENERAL, "error loading cache data", 0);
+		fsc_unmap_file(image);
 		return 1; }
 
-	// Free the data
-	fsc_free(stream.data);
+	// The filesystem now owns the mapping
+	target_fs->cache_image = image;
 	return 0; }
 
 #endif	// NEW_FILESYSTEM
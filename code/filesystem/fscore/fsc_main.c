@@ -161,6 +161,32 @@ static void fsc_merge_stats(const fsc_stats_t *source, fsc_stats_t *target) {
 	target->total_file_count += source->total_file_count;
 	target->cacheable_file_count += source->cacheable_file_count; }
 
+static void fsc_get_file_stats(const fsc_file_direct_t *file, fsc_stats_t *stats) {
+	// Generates the stats a direct file and its pk3 contents contribute to the filesystem
+	fsc_memset(stats, 0, sizeof(*stats));
+
+	stats->total_file_count = 1 + file->pk3_subfile_count;
+
+	stats->cacheable_file_count = file->pk3_subfile_count;
+	if(file->shader_count || file->pk3_subfile_count) ++stats->cacheable_file_count;
+
+	stats->pk3_subfile_count = file->pk3_subfile_count;
+
+	// By design, this field records only *valid* pk3s with a nonzero hash.
+	// Perhaps create another field that includes invalid pk3s?
+	if(file->pk3_hash) stats->valid_pk3_count = 1;
+
+	stats->shader_file_count = file->shader_file_count;
+	stats->shader_count = file->shader_count; }
+
+static void fsc_unmerge_stats(const fsc_stats_t *source, fsc_stats_t *target) {
+	target->valid_pk3_count -= source->valid_pk3_count;
+	target->pk3_subfile_count -= source->pk3_subfile_count;
+	target->shader_file_count -= source->shader_file_count;
+	target->shader_count -= source->shader_count;
+	target->total_file_count -= source->total_file_count;
+	target->cacheable_file_count -= source->cacheable_file_count; }
+
 int fsc_sanity_limit(unsigned int size, unsigned int *limit_value, fsc_sanity_limit_t *sanity_limit, fsc_errorhandler_t *eh) {
 	// Returns 1 if limit hit, otherwise decrements limit and returns 0
 	FSC_ASSERT(sanity_limit);
@@ -223,24 +249,17 @@ static int fsc_nstring_compare(const char *s1, const char *s2) {
 	if(!s1 || !s2) return 0;
 	return !fsc_strcmp(s1, s2); }
 
-void fsc_load_file(int source_dir_id, const void *os_path, const char *mod_dir, const char *pk3dir_name,
+static fsc_stackptr_t fsc_find_direct_file(const void *os_path, const char *mod_dir, const char *pk3dir_name,
 		const char *qp_dir, const char *qp_name, const char *qp_ext, unsigned int os_timestamp, unsigned int filesize,
-		fsc_filesystem_t *fs, fsc_errorhandler_t *eh) {
+		int update_reusable, fsc_filesystem_t *fs) {
+	// Searches filesystem to see if a sufficiently equivalent entry already exists
+	// If update_reusable is set, a reusable entry for a modified file is updated to the new size and timestamp
 	fsc_stackptr_t file_ptr;
-	fsc_file_direct_t *file = 0;
 	fsc_hashtable_iterator_t hti;
-	unsigned int fs_hash = fsc_string_hash(qp_name, qp_dir);
-	int unindexed_file = 0;		// File was not present in the index at all
-	int new_file = 0;	// File was not present in last refresh, but may have been in the index
-
-	FSC_ASSERT(os_path);
-	FSC_ASSERT(qp_name);
-	FSC_ASSERT(fs);
 
-	// Search filesystem to see if a sufficiently equivalent entry already exists
-	fsc_hashtable_open(&fs->files, fs_hash, &hti);
+	fsc_hashtable_open(&fs->files, fsc_string_hash(qp_name, qp_dir), &hti);
 	while((file_ptr = fsc_hashtable_next(&hti))) {
-		file = (fsc_file_direct_t *)STACKPTR(file_ptr);
+		fsc_file_direct_t *file = (fsc_file_direct_t *)STACKPTR(file_ptr);
 		if(file->f.sourcetype != FSC_SOURCETYPE_DIRECT) continue;
 		if(!fsc_nstring_compare((char *)STACKPTR(file->f.qp_name_ptr), qp_name)) continue;
 		if(!fsc_nstring_compare((char *)STACKPTR(file->f.qp_dir_ptr), qp_dir)) continue;
@@ -252,15 +271,40 @@ void fsc_load_file(int source_dir_id, const void *os_path, const char *mod_dir,
 			if(file->os_path_ptr && !(file->f.flags & FSC_FILEFLAG_LINKED_CONTENT) && !file->f.contents_cache) {
 				// Reuse the same file object to save memory (this prevents files actively written
 				// by the game such as logs generating a new file object every refresh)
-				file->f.filesize = filesize;
-				file->os_timestamp = os_timestamp;
+				if(update_reusable) {
+					file->f.filesize = filesize;
+					file->os_timestamp = os_timestamp; }
 				break; }
 			else {
 				// Otherwise treat the file as non-matching
 				continue; } }
 		break; }
 
+	return file_ptr; }
+
+static int fsc_is_indexed_pk3(const char *qp_dir, const char *qp_ext) {
+	// Returns 1 if file is a pk3 with contents that should be indexed
+	return !fsc_stricmp(qp_ext, ".pk3") && (!*qp_dir || !fsc_stricmp(qp_dir, "downloads/")); }
+
+static void fsc_load_file2(int source_dir_id, const void *os_path, const char *mod_dir, const char *pk3dir_name,
+		const char *qp_dir, const char *qp_name, const char *qp_ext, unsigned int os_timestamp, unsigned int filesize,
+		const fsc_pk3_index_t *pk3_index, fsc_filesystem_t *fs, fsc_errorhandler_t *eh) {
+	// pk3_index can be a preloaded index of the pk3 at os_path, or null to read it here if needed
+	fsc_stackptr_t file_ptr;
+	fsc_file_direct_t *file = 0;
+	int unindexed_file = 0;		// File was not present in the index at all
+	int new_file = 0;	// File was not present in last refresh, but may have been in the index
+
+	FSC_ASSERT(os_path);
+	FSC_ASSERT(qp_name);
+	FSC_ASSERT(fs);
+
+	// Search filesystem to see if a sufficiently equivalent entry already exists
+	file_ptr = fsc_find_direct_file(os_path, mod_dir, pk3dir_name, qp_dir, qp_name, qp_ext, os_timestamp, filesize, 1, fs);
+
 	if(file_ptr) {
+		file = (fsc_file_direct_t *)STACKPTR(file_ptr);
+
 		// Have existing entry
 		if(file->refresh_count == fs->refresh_count) {
 			// Existing file already active. This can happen with if there are duplicate source directories
@@ -304,32 +348,24 @@ void fsc_load_file(int source_dir_id, const void *os_path, const char *mod_dir,
 	// Register file and load contents
 	if(unindexed_file) {
 		fsc_register_file(file_ptr, 0, fs, eh);
-		if(!fsc_stricmp(qp_ext, ".pk3") && (!*qp_dir || !fsc_stricmp(qp_dir, "downloads/"))) {
-			fsc_load_pk3(STACKPTR(file->os_path_ptr), fs, file_ptr, eh, 0, 0);
+		if(fsc_is_indexed_pk3(qp_dir, qp_ext)) {
+			if(pk3_index) fsc_register_pk3_index(pk3_index, fs, file_ptr, eh);
+			else fsc_load_pk3(STACKPTR(file->os_path_ptr), fs, file_ptr, eh, 0, 0);
 			file->f.flags |= FSC_FILEFLAG_LINKED_CONTENT; } }
 
 	// Update stats
 	{	fsc_stats_t stats;
-		fsc_memset(&stats, 0, sizeof(stats));
-
-		stats.total_file_count = 1 + file->pk3_subfile_count;
-
-		stats.cacheable_file_count = file->pk3_subfile_count;
-		if(file->shader_count || file->pk3_subfile_count) ++stats.cacheable_file_count;
-
-		stats.pk3_subfile_count = file->pk3_subfile_count;
-
-		// By design, this field records only *valid* pk3s with a nonzero hash.
-		// Perhaps create another field that includes invalid pk3s?
-		if(file->pk3_hash) stats.valid_pk3_count = 1;
-
-		stats.shader_file_count = file->shader_file_count;
-		stats.shader_count = file->shader_count;
-
+		fsc_get_file_stats(file, &stats);
 		fsc_merge_stats(&stats, &fs->active_stats);
 		if(unindexed_file) fsc_merge_stats(&stats, &fs->total_stats);
 		if(new_file) fsc_merge_stats(&stats, &fs->new_stats); } }
 
+void fsc_load_file(int source_dir_id, const void *os_path, const char *mod_dir, const char *pk3dir_name,
+		const char *qp_dir, const char *qp_name, const char *qp_ext, unsigned int os_timestamp, unsigned int filesize,
+		fsc_filesystem_t *fs, fsc_errorhandler_t *eh) {
+	fsc_load_file2(source_dir_id, os_path, mod_dir, pk3dir_name, qp_dir, qp_name, qp_ext,
+			os_timestamp, filesize, 0, fs, eh); }
+
 static int fsc_app_extension(const char *name) {
 	// Returns 1 if name matches mac app bundle extension, 0 otherwise
 	int length = fsc_strlen(name);
@@ -337,35 +373,47 @@ static int fsc_app_extension(const char *name) {
 	if(!fsc_stricmp(name + (length - 4), ".app")) return 1;
 	return 0; }
 
-void fsc_load_file_full_path(int source_dir_id, const void *os_path, const char *full_qpath, unsigned int os_timestamp,
-		unsigned int filesize, fsc_filesystem_t *fs, fsc_errorhandler_t *eh) {
+typedef struct {
 	char qp_mod[FSC_MAX_MODDIR];
-	const char *qpath_start = 0;
-	int file_in_pk3dir = 0;
 	char pk3dir_buffer[FSC_MAX_QPATH];
-	const char *pk3dir_remainder = 0;
+	const char *pk3dir;		// Null if file is not in a pk3dir
 	fsc_qpath_buffer_t qpath_split;
+} full_qpath_t;
+
+static int fsc_parse_full_qpath(const char *full_qpath, full_qpath_t *output) {
+	// Returns 1 on success, 0 if file should not be indexed
+	const char *qpath_start = 0;
+	const char *pk3dir_remainder = 0;
 
 	// Process mod directory prefix
-	if(!fsc_get_leading_directory(full_qpath, qp_mod, sizeof(qp_mod), &qpath_start)) return;
-	if(!qpath_start) return;
-	if(fsc_app_extension(qp_mod)) return;	// Don't index mac app bundles as mods
+	if(!fsc_get_leading_directory(full_qpath, output->qp_mod, sizeof(output->qp_mod), &qpath_start)) return 0;
+	if(!qpath_start) return 0;
+	if(fsc_app_extension(output->qp_mod)) return 0;	// Don't index mac app bundles as mods
 
 	// Process pk3dir prefix
-	if(fsc_get_leading_directory(qpath_start, pk3dir_buffer, sizeof(pk3dir_buffer), &pk3dir_remainder)) {
+	output->pk3dir = 0;
+	if(fsc_get_leading_directory(qpath_start, output->pk3dir_buffer, sizeof(output->pk3dir_buffer), &pk3dir_remainder)) {
 		if(pk3dir_remainder) {
-			int length = fsc_strlen(pk3dir_buffer);
-			if(length >= 7 && !fsc_stricmp(pk3dir_buffer + length - 7, ".pk3dir")) {
-				pk3dir_buffer[length - 7] = 0;
-				file_in_pk3dir = 1;
+			int length = fsc_strlen(output->pk3dir_buffer);
+			if(length >= 7 && !fsc_stricmp(output->pk3dir_buffer + length - 7, ".pk3dir")) {
+				output->pk3dir_buffer[length - 7] = 0;
+				output->pk3dir = output->pk3dir_buffer;
 				qpath_start = pk3dir_remainder; } } }
 
 	// Process qpath
-	fsc_split_qpath(qpath_start, &qpath_split, 0);
+	fsc_split_qpath(qpath_start, &output->qpath_split, 0);
+	return 1; }
 
-	// Load file
-	fsc_load_file(source_dir_id, os_path, qp_mod, file_in_pk3dir ? pk3dir_buffer : 0, qpath_split.dir,
-			qpath_split.name, qpath_split.ext, os_timestamp, filesize, fs, eh); }
+static void fsc_load_file_full_path2(int source_dir_id, const void *os_path, const char *full_qpath, unsigned int os_timestamp,
+		unsigned int filesize, const fsc_pk3_index_t *pk3_index, fsc_filesystem_t *fs, fsc_errorhandler_t *eh) {
+	full_qpath_t qpath;
+	if(!fsc_parse_full_qpath(full_qpath, &qpath)) return;
+	fsc_load_file2(source_dir_id, os_path, qpath.qp_mod, qpath.pk3dir, qpath.qpath_split.dir,
+			qpath.qpath_split.name, qpath.qpath_split.ext, os_timestamp, filesize, pk3_index, fs, eh); }
+
+void fsc_load_file_full_path(int source_dir_id, const void *os_path, const char *full_qpath, unsigned int os_timestamp,
+		unsigned int filesize, fsc_filesystem_t *fs, fsc_errorhandler_t *eh) {
+	fsc_load_file_full_path2(source_dir_id, os_path, full_qpath, os_timestamp, filesize, 0, fs, eh); }
 
 typedef struct {
 	int source_dir_id;
@@ -373,6 +421,27 @@ typedef struct {
 	fsc_errorhandler_t *eh;
 } iterate_context_t;
 
+static void fsc_disable_file_full_path(const void *os_path, const char *full_qpath, fsc_filesystem_t *fs) {
+	// Deactivates the active entry for a file on disk, if there is one
+	full_qpath_t qpath;
+	fsc_stackptr_t file_ptr;
+	fsc_hashtable_iterator_t hti;
+	if(!fsc_parse_full_qpath(full_qpath, &qpath)) return;
+
+	fsc_hashtable_open(&fs->files, fsc_string_hash(qpath.qpath_split.name, qpath.qpath_split.dir), &hti);
+	while((file_ptr = fsc_hashtable_next(&hti))) {
+		fsc_file_direct_t *file = (fsc_file_direct_t *)STACKPTR(file_ptr);
+		fsc_stats_t stats;
+		if(file->f.sourcetype != FSC_SOURCETYPE_DIRECT) continue;
+		if(file->refresh_count != fs->refresh_count) continue;
+		if(!file->os_path_ptr || fsc_compare_os_path(STACKPTR(file->os_path_ptr), os_path)) continue;
+
+		// Refresh count 0 is never current, and keeps the entry from being counted
+		// as carried over from the previous refresh if it is activated again
+		file->refresh_count = 0;
+		fsc_get_file_stats(file, &stats);
+		fsc_unmerge_stats(&stats, &fs->active_stats); } }
+
 static void load_file_from_iteration(iterate_data_t *file_data, void *iterate_context) {
 	iterate_context_t *iterate_context_typed = (iterate_context_t *)iterate_context;
 	fsc_load_file_full_path(iterate_context_typed->source_dir_id, file_data->os_path, file_data->qpath_with_mod_dir,
@@ -390,17 +459,27 @@ void fsc_filesystem_initialize(fsc_filesystem_t *fs) {
 
 void fsc_filesystem_free(fsc_filesystem_t *fs) {
 	// Can be called on a nulled, freed, initialized, or in some cases partially initialized filesystem
+	fsc_pk3_flush_mappings();
 	fsc_stack_free(&fs->general_stack);
 	fsc_hashtable_free(&fs->files);
 	fsc_hashtable_free(&fs->string_repository);
 	fsc_hashtable_free(&fs->directories);
 	fsc_hashtable_free(&fs->shaders);
 	fsc_hashtable_free(&fs->crosshairs);
-	fsc_hashtable_free(&fs->pk3_hash_lookup); }
+	fsc_hashtable_free(&fs->pk3_hash_lookup);
+	if(fs->cache_image) {
+		fsc_unmap_file(fs->cache_image);
+		fs->cache_image = 0; } }
 
 void fsc_filesystem_reset(fsc_filesystem_t *fs) {
 	++fs->refresh_count;
 	fsc_memset(&fs->active_stats, 0, sizeof(fs->active_stats));
+	fsc_filesystem_reset_incremental(fs); }
+
+void fsc_filesystem_reset_incremental(fsc_filesystem_t *fs) {
+	// Prepares for fsc_update_directory calls, which stay in the current refresh cycle
+	//    and keep the active stats, but release pk3 mappings like a full refresh does
+	fsc_pk3_flush_mappings();
 	fsc_memset(&fs->new_stats, 0, sizeof(fs->new_stats)); }
 
 void fsc_load_directory(fsc_filesystem_t *fs, void *os_path, int source_dir_id, fsc_errorhandler_t *eh) {
@@ -410,4 +489,126 @@ void fsc_load_directory(fsc_filesystem_t *fs, void *os_path, int source_dir_id,
 	context.eh = eh;
 	iterate_directory(os_path, load_file_from_iteration, &context); }
 
+/* ******************************************************************************** */
+// Incremental Directory Updates
+/* ******************************************************************************** */
+
+typedef struct {
+	iterate_context_t iterate;
+	int change_count;
+} watch_context_t;
+
+static void update_file_from_watch(iterate_data_t *file_data, int removed, void *watch_context) {
+	watch_context_t *context = (watch_context_t *)watch_context;
+	// A changed file may still match its old entry, which is then reactivated by the load
+	fsc_disable_file_full_path(file_data->os_path, file_data->qpath_with_mod_dir, context->iterate.fs);
+	if(!removed) {
+		fsc_load_file_full_path(context->iterate.source_dir_id, file_data->os_path, file_data->qpath_with_mod_dir,
+				file_data->os_timestamp, file_data->filesize, context->iterate.fs, context->iterate.eh); }
+	++context->change_count; }
+
+int fsc_update_directory(fsc_filesystem_t *fs, void *watcher, int source_dir_id, fsc_errorhandler_t *eh) {
+	// Applies the changes reported by a fsc_watch_directory watcher to files loaded from its directory,
+	//    without starting a new refresh cycle
+	// Returns number of files updated, or -1 if the directory needs to be reloaded with a full refresh
+	watch_context_t context;
+	context.iterate.source_dir_id = source_dir_id;
+	context.iterate.fs = fs;
+	context.iterate.eh = eh;
+	context.change_count = 0;
+	if(fsc_watch_poll(watcher, update_file_from_watch, &context)) return -1;
+	return context.change_count; }
+
+/* ******************************************************************************** */
+// Parallel Directory Loading
+/* ******************************************************************************** */
+
+// The directory listing is recorded first, then the central directories of pk3s that aren't
+//    already indexed are read on worker threads. The recorded files are then loaded in their
+//    original order on the calling thread using the preloaded pk3 indexes, so the resulting
+//    filesystem is identical to the one from fsc_load_directory.
+
+typedef struct {
+	void *os_path;
+	char *qpath_with_mod_dir;
+	unsigned int os_timestamp;
+	unsigned int filesize;
+	int pk3_index;		// Position in preloaded pk3 list, or -1 if not preloaded
+} listed_file_t;
+
+typedef struct {
+	listed_file_t *files;
+	int file_count;
+	int file_alloc;
+
+	fsc_pk3_index_t *pk3s;
+	void **pk3_paths;
+	int pk3_count;
+} directory_listing_t;
+
+static void list_file_from_iteration(iterate_data_t *file_data, void *iterate_context) {
+	directory_listing_t *listing = (directory_listing_t *)iterate_context;
+	listed_file_t *file;
+	int os_path_size = fsc_os_path_size(file_data->os_path);
+	int qpath_size = fsc_strlen(file_data->qpath_with_mod_dir) + 1;
+
+	if(listing->file_count >= listing->file_alloc) {
+		listed_file_t *old_files = listing->files;
+		listing->file_alloc = listing->file_alloc ? listing->file_alloc * 2 : 1024;
+		listing->files = (listed_file_t *)fsc_malloc(listing->file_alloc * sizeof(*listing->files));
+		if(old_files) {
+			fsc_memcpy(listing->files, old_files, listing->file_count * sizeof(*listing->files));
+			fsc_free(old_files); } }
+
+	file = &listing->files[listing->file_count++];
+	file->os_path = fsc_malloc(os_path_size);
+	fsc_memcpy(file->os_path, file_data->os_path, os_path_size);
+	file->qpath_with_mod_dir = (char *)fsc_malloc(qpath_size);
+	fsc_memcpy(file->qpath_with_mod_dir, file_data->qpath_with_mod_dir, qpath_size);
+	file->os_timestamp = file_data->os_timestamp;
+	file->filesize = file_data->filesize;
+	file->pk3_index = -1; }
+
+static void read_pk3_index_job(void *context, int index, int thread) {
+	directory_listing_t *listing = (directory_listing_t *)context;
+	fsc_read_pk3_index(listing->pk3_paths[index], &listing->pk3s[index]); }
+
+void fsc_load_directory_parallel(fsc_filesystem_t *fs, void *os_path, int source_dir_id, fsc_run_jobs_t run_jobs,
+		fsc_errorhandler_t *eh) {
+	directory_listing_t listing;
+	int i;
+	fsc_memset(&listing, 0, sizeof(listing));
+
+	iterate_directory(os_path, list_file_from_iteration, &listing);
+
+	// Select pk3s that will need their contents indexed
+	// This uses the same checks as fsc_load_file, but if it guesses wrong the file is just loaded normally
+	listing.pk3s = (fsc_pk3_index_t *)fsc_calloc((listing.file_count + 1) * sizeof(*listing.pk3s));
+	listing.pk3_paths = (void **)fsc_malloc((listing.file_count + 1) * sizeof(*listing.pk3_paths));
+	for(i=0; i<listing.file_count; ++i) {
+		listed_file_t *file = &listing.files[i];
+		full_qpath_t qpath;
+		if(!fsc_parse_full_qpath(file->qpath_with_mod_dir, &qpath)) continue;
+		if(!fsc_is_indexed_pk3(qpath.qpath_split.dir, qpath.qpath_split.ext)) continue;
+		if(fsc_find_direct_file(file->os_path, qpath.qp_mod, qpath.pk3dir, qpath.qpath_split.dir, qpath.qpath_split.name,
+				qpath.qpath_split.ext, file->os_timestamp, file->filesize, 0, fs)) continue;
+		file->pk3_index = listing.pk3_count;
+		listing.pk3_paths[listing.pk3_count++] = file->os_path; }
+
+	// Read central directories
+	if(listing.pk3_count) run_jobs(read_pk3_index_job, &listing, listing.pk3_count);
+
+	// Load files in directory order
+	for(i=0; i<listing.file_count; ++i) {
+		listed_file_t *file = &listing.files[i];
+		fsc_load_file_full_path2(source_dir_id, file->os_path, file->qpath_with_mod_dir, file->os_timestamp,
+				file->filesize, file->pk3_index >= 0 ? &listing.pk3s[file->pk3_index] : 0, fs, eh);
+		fsc_free(file->os_path);
+		fsc_free(file->qpath_with_mod_dir); }
+
+	for(i=0; i<listing.pk3_count; ++i) fsc_free_pk3_index(&listing.pk3s[i]);
+	fsc_free(listing.pk3s);
+	fsc_free(listing.pk3_paths);
+	if(listing.files) fsc_free(listing.files); }
+
 #endif	// NEW_FILESYSTEM
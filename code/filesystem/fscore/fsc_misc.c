@@ -150,6 +150,7 @@ void fsc_stack_initialize(fsc_stack_t *stack) {
 	stack->buckets_position = -1;	// stack_add_bucket will increment to 0
 	stack->buckets_size = STACK_INITIAL_BUCKETS;
 	stack->buckets = (fsc_stack_bucket_t **)fsc_malloc(stack->buckets_size * sizeof(fsc_stack_bucket_t *));
+	stack->imported_buckets = 0;
 	stack_add_bucket(stack); }
 
 void *fsc_stack_retrieve(const fsc_stack_t *stack, const fsc_stackptr_t pointer, int allow_null,
@@ -198,23 +199,41 @@ void fsc_stack_free(fsc_stack_t *stack) {
 	FSC_ASSERT(stack);
 
 	if(stack->buckets) {
-		for(i=0; i<=stack->buckets_position; ++i) {
+		// Imported buckets belong to the import stream
+		for(i=stack->imported_buckets; i<=stack->buckets_position; ++i) {
 			if(stack->buckets[i]) fsc_free(stack->buckets[i]); }
 		fsc_free(stack->buckets);
 		stack->buckets = 0; } }
 
+static int stream_align(fsc_stream_t *stream, int write) {
+	// Advances stream to the next FSC_STREAM_ALIGNMENT boundary, zero filling if write is set
+	// Returns 1 on error, 0 on success
+	static const char zeros[64] = {0};
+	while(stream->position % FSC_STREAM_ALIGNMENT) {
+		unsigned int length = FSC_STREAM_ALIGNMENT - stream->position % FSC_STREAM_ALIGNMENT;
+		if(length > sizeof(zeros)) length = sizeof(zeros);
+		if(write) {
+			if(fsc_write_stream_data(stream, zeros, length)) return 1; }
+		else {
+			if(stream->position + length > stream->size) return 1;
+			stream->position += length; } }
+	return 0; }
+
 unsigned int fsc_stack_get_export_size(fsc_stack_t *stack) {
+	// Upper bound, as the actual alignment padding depends on the stream position
 	unsigned int size = 4;	// 4 bytes for bucket count field
 	int i;
 	FSC_ASSERT(stack);
 
-	// Then add the actual length of each bucket + 4 bytes for position field
+	// Then add the actual length of each bucket + 4 bytes for position field + alignment
 	for(i=0; i<=stack->buckets_position; ++i) {
-		size += stack->buckets[i]->position + 4; }
+		size += stack->buckets[i]->position + 4 + FSC_STREAM_ALIGNMENT; }
 
 	return size; }
 
 int fsc_stack_export(fsc_stack_t *stack, fsc_stream_t *stream) {
+	// Writes each bucket the same way it is laid out in memory, starting on an aligned
+	//    stream position, so fsc_stack_import can use the stream data directly
 	// Returns 1 on error, 0 on success
 	int i;
 	FSC_ASSERT(stack);
@@ -225,13 +244,15 @@ int fsc_stack_export(fsc_stack_t *stack, fsc_stream_t *stream) {
 
 	// Write each bucket (current position followed by data)
 	for(i=0; i<=stack->buckets_position; ++i) {
-		if(fsc_write_stream_data(stream, &stack->buckets[i]->position, 4)) return 1;
-		if(fsc_write_stream_data(stream, (char *)stack->buckets[i] + sizeof(fsc_stack_bucket_t),
+		if(stream_align(stream, 1)) return 1;
+		if(fsc_write_stream_data(stream, stack->buckets[i], sizeof(fsc_stack_bucket_t) +
 				stack->buckets[i]->position)) return 1; }
 
 	return 0; }
 
 int fsc_stack_import(fsc_stack_t *stack, fsc_stream_t *stream) {
+	// Points the stack buckets directly into the stream data, which must stay valid and
+	//    writable until the stack is freed. Allocations made after the import go to a new bucket.
 	// Returns 1 on error, 0 on success
 	int i;
 	FSC_ASSERT(stack);
@@ -239,20 +260,27 @@ int fsc_stack_import(fsc_stack_t *stack, fsc_stream_t *stream) {
 
 	// Read number of active buckets
 	if(fsc_read_stream_data(stream, &stack->buckets_position, 4)) return 1;
-	if(stack->buckets_position < 0 || stack->buckets_position >= STACK_MAX_BUCKETS) return 1;
+	if(stack->buckets_position < 0 || stack->buckets_position >= STACK_MAX_BUCKETS - 1) return 1;
 
 	// Allocate bucket array
-	stack->buckets_size = stack->buckets_position + 1;
+	stack->buckets_size = stack->buckets_position + 2;
 	if(stack->buckets_size < STACK_INITIAL_BUCKETS) stack->buckets_size = STACK_INITIAL_BUCKETS;
 	stack->buckets = (fsc_stack_bucket_t **)fsc_calloc(stack->buckets_size * sizeof(fsc_stack_bucket_t *));
+	stack->imported_buckets = stack->buckets_position + 1;
 
-	// Read data for each bucket
+	// Locate each bucket
 	for(i=0; i<=stack->buckets_position; ++i) {
-		stack->buckets[i] = (fsc_stack_bucket_t *)fsc_calloc(STACK_BUCKET_SIZE);
-		if(fsc_read_stream_data(stream, &stack->buckets[i]->position, 4)) goto error;
-		if(stack->buckets[i]->position >= STACK_BUCKET_SIZE) goto error;
-		if(fsc_read_stream_data(stream, (char *)stack->buckets[i] + sizeof(fsc_stack_bucket_t),
-				stack->buckets[i]->position)) goto error; }
+		fsc_stack_bucket_t *bucket;
+		if(stream_align(stream, 0)) goto error;
+		if(stream->size - stream->position < sizeof(fsc_stack_bucket_t)) goto error;
+		bucket = (fsc_stack_bucket_t *)(stream->data + stream->position);
+		if(bucket->position > STACK_BUCKET_DATA_SIZE) goto error;
+		if(stream->size - stream->position - sizeof(fsc_stack_bucket_t) < bucket->position) goto error;
+		stack->buckets[i] = bucket;
+		stream->position += sizeof(fsc_stack_bucket_t) + bucket->position; }
+
+	// Imported buckets can't grow, so start a fresh one for new allocations
+	stack_add_bucket(stack);
 	return 0;
 
 	error:
@@ -269,6 +297,7 @@ void fsc_hashtable_initialize(fsc_hashtable_t *ht, fsc_stack_t *stack, int bucke
 	ht->bucket_count = bucket_count;
 	ht->buckets = (fsc_stackptr_t *)fsc_calloc(sizeof(fsc_stackptr_t) * bucket_count);
 	ht->utilization = 0;
+	ht->imported = 0;
 	ht->stack = stack; }
 
 void fsc_hashtable_open(fsc_hashtable_t *ht, unsigned int hash, fsc_hashtable_iterator_t *iterator) {
@@ -290,28 +319,33 @@ void fsc_hashtable_insert(fsc_stackptr_t entry_ptr, unsigned int hash, fsc_hasht
 
 void fsc_hashtable_free(fsc_hashtable_t *ht) {
 	// Can be called on a nulled, freed, initialized, or in some cases partially initialized hashtable
-	if(ht->buckets) fsc_free(ht->buckets);
+	// Imported buckets belong to the import stream
+	if(ht->buckets && !ht->imported) fsc_free(ht->buckets);
 	ht->buckets = 0; }
 
 unsigned int fsc_hashtable_get_export_size(fsc_hashtable_t *ht) {
-	return 8 + ht->bucket_count * sizeof(*ht->buckets); }
+	// Upper bound, as the actual alignment padding depends on the stream position
+	return 8 + FSC_STREAM_ALIGNMENT + ht->bucket_count * sizeof(*ht->buckets); }
 
 int fsc_hashtable_export(fsc_hashtable_t *ht, fsc_stream_t *stream) {
 	// Returns 1 on error, 0 on success.
 	if(fsc_write_stream_data(stream, &ht->bucket_count, 4)) return 1;
 	if(fsc_write_stream_data(stream, &ht->utilization, 4)) return 1;
+	if(stream_align(stream, 1)) return 1;
 	if(fsc_write_stream_data(stream, ht->buckets, ht->bucket_count * sizeof(*ht->buckets))) return 1;
 	return 0; }
 
 int fsc_hashtable_import(fsc_hashtable_t *ht, fsc_stack_t *stack, fsc_stream_t *stream) {
+	// Uses the bucket array in place, same as fsc_stack_import
 	// Returns 1 on error, 0 on success.
 	if(fsc_read_stream_data(stream, &ht->bucket_count, 4)) return 1;
 	if(ht->bucket_count < 1 || ht->bucket_count > FSC_HASHTABLE_MAX_BUCKETS) return 1;
 	if(fsc_read_stream_data(stream, &ht->utilization, 4)) return 1;
-	ht->buckets = (fsc_stackptr_t *)fsc_malloc(ht->bucket_count * sizeof(*ht->buckets));
-	if(fsc_read_stream_data(stream, ht->buckets, ht->bucket_count * sizeof(*ht->buckets))) {
-		fsc_hashtable_free(ht);
-		return 1; }
+	if(stream_align(stream, 0)) return 1;
+	if(stream->size - stream->position < ht->bucket_count * sizeof(*ht->buckets)) return 1;
+	ht->buckets = (fsc_stackptr_t *)(stream->data + stream->position);
+	ht->imported = 1;
+	stream->position += ht->bucket_count * sizeof(*ht->buckets);
 	ht->stack = stack;
 	return 0; }
 
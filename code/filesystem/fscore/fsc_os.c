@@ -42,6 +42,15 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <dirent.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <setjmp.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 #endif
 // Common defines
 #include <stdio.h>
@@ -201,6 +210,240 @@ void fsc_free(void *allocation) {
 	FSC_ASSERT(allocation);
 	free(allocation); }
 
+/* ******************************************************************************** */
+// Memory Mapped Files
+/* ******************************************************************************** */
+
+typedef struct {
+	void *base;
+	unsigned int size;
+	int heap;	// base is a heap copy instead of a view
+} fsc_mapping_t;
+
+void *fsc_map_file(const void *os_path, unsigned int offset, unsigned int *length, const char **data_out) {
+	// Maps a read-only view of the file starting at offset. Length is clamped to the end of the file.
+	// Returns handle to be freed by fsc_unmap_file, or null on error
+	fsc_mapping_t *mapping;
+	unsigned int alignment;
+	unsigned int aligned_offset;
+	unsigned int file_size;
+	FSC_ASSERT(os_path && length && data_out);
+	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		LARGE_INTEGER size;
+		HANDLE file, file_mapping;
+		void *view;
+
+		file = CreateFile((LPCTSTR)os_path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		if(file == INVALID_HANDLE_VALUE) return 0;
+		if(!GetFileSizeEx(file, &size) || size.HighPart || offset >= size.LowPart) {
+			CloseHandle(file);
+			return 0; }
+		file_size = size.LowPart;
+		if(*length > file_size - offset) *length = file_size - offset;
+
+		GetSystemInfo(&info);
+		alignment = info.dwAllocationGranularity;
+		aligned_offset = offset - offset % alignment;
+
+		file_mapping = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0);
+		CloseHandle(file);
+		if(!file_mapping) return 0;
+		view = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, aligned_offset, offset - aligned_offset + *length);
+		// The view keeps the mapping object alive
+		CloseHandle(file_mapping);
+		if(!view) return 0;
+#else
+		struct stat st;
+		void *view;
+		int fd = open((const char *)os_path, O_RDONLY);
+		if(fd == -1) return 0;
+		if(fstat(fd, &st) == -1 || st.st_size > 4294967295u || offset >= st.st_size) {
+			close(fd);
+			return 0; }
+		file_size = (unsigned int)st.st_size;
+		if(*length > file_size - offset) *length = file_size - offset;
+
+		alignment = (unsigned int)sysconf(_SC_PAGESIZE);
+		aligned_offset = offset - offset % alignment;
+
+		view = mmap(0, offset - aligned_offset + *length, PROT_READ, MAP_SHARED, fd, aligned_offset);
+		// The mapping stays valid after the descriptor is closed
+		close(fd);
+		if(view == MAP_FAILED) return 0;
+#endif
+		mapping = (fsc_mapping_t *)fsc_malloc(sizeof(*mapping));
+		mapping->base = view;
+		mapping->size = offset - aligned_offset + *length;
+		mapping->heap = 0;
+		*data_out = (const char *)view + (offset - aligned_offset);
+		return mapping; } }
+
+void *fsc_map_file_private(const void *os_path, unsigned int *size_out, char **data_out) {
+	// Maps a copy-on-write view of the whole file. Pages stay shared with other processes
+	//    mapping the same file until they are written to.
+	// The file should be replaced by renaming rather than rewritten while mapped.
+	// Returns handle to be freed by fsc_unmap_file, or null on error
+	fsc_mapping_t *mapping;
+	FSC_ASSERT(os_path && size_out && data_out);
+	{
+#ifdef _WIN32
+		// Windows won't replace a file with an open view, which would keep the file from
+		//    being updated, so use a heap copy instead
+		void *fp = fsc_open_file(os_path, "rb");
+		unsigned int size;
+		char *data;
+		if(!fp) return 0;
+		if(fsc_fseek(fp, 0, FSC_SEEK_END) || (size = fsc_ftell(fp)) == 4294967295u || !size ||
+				fsc_fseek(fp, 0, FSC_SEEK_SET)) {
+			fsc_fclose(fp);
+			return 0; }
+		data = (char *)fsc_malloc(size);
+		if(fsc_fread(data, size, fp) != size) {
+			fsc_free(data);
+			fsc_fclose(fp);
+			return 0; }
+		fsc_fclose(fp);
+
+		mapping = (fsc_mapping_t *)fsc_malloc(sizeof(*mapping));
+		mapping->base = data;
+		mapping->size = size;
+		mapping->heap = 1;
+#else
+		struct stat st;
+		void *view;
+		int fd = open((const char *)os_path, O_RDONLY);
+		if(fd == -1) return 0;
+		if(fstat(fd, &st) == -1 || st.st_size > 4294967295u || !st.st_size) {
+			close(fd);
+			return 0; }
+
+		view = mmap(0, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(view == MAP_FAILED) return 0;
+
+		mapping = (fsc_mapping_t *)fsc_malloc(sizeof(*mapping));
+		mapping->base = view;
+		mapping->size = (unsigned int)st.st_size;
+		mapping->heap = 0;
+#endif
+		*size_out = mapping->size;
+		*data_out = (char *)mapping->base;
+		return mapping; } }
+
+int fsc_get_file_info(const void *os_path, unsigned int *size_out, unsigned int *timestamp_out) {
+	// Gets the size and timestamp in the same form as directory iteration
+	// Returns 1 on error, 0 otherwise
+	FSC_ASSERT(os_path && size_out && timestamp_out);
+	{
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if(!GetFileAttributesEx((LPCTSTR)os_path, GetFileExInfoStandard, &data) || data.nFileSizeHigh) return 1;
+		*size_out = data.nFileSizeLow;
+		*timestamp_out = data.ftLastWriteTime.dwLowDateTime;
+#else
+		struct stat st;
+		if(stat((const char *)os_path, &st) == -1 || st.st_size > 4294967295u) return 1;
+		*size_out = (unsigned int)st.st_size;
+		*timestamp_out = (unsigned int)st.st_mtime;
+#endif
+		return 0; } }
+
+void fsc_unmap_file(void *mapping) {
+	fsc_mapping_t *Mapping = (fsc_mapping_t *)mapping;
+	FSC_ASSERT(mapping);
+	if(Mapping->heap) {
+		fsc_free(Mapping->base);
+		fsc_free(mapping);
+		return; }
+#ifdef _WIN32
+	UnmapViewOfFile(Mapping->base);
+#else
+	munmap(Mapping->base, Mapping->size);
+#endif
+	fsc_free(mapping); }
+
+/* ******************************************************************************** */
+// Mapped Memory Fault Guard
+/* ******************************************************************************** */
+
+// Reading pages of a mapped file that was truncated raises SIGBUS rather than a read error.
+// Code reading a mapping that other programs may modify runs through fsc_guarded_call, which
+//    turns such a fault into an error return. The handler only acts on threads inside a guarded
+//    call and passes everything else on to the previous handler.
+// Windows refuses to truncate a file with a mapped view, so it needs no guard.
+
+#ifdef _WIN32
+int fsc_guarded_call(void (*function)(void *context), void *context) {
+	function(context);
+	return 0; }
+#else
+static __thread sigjmp_buf *fsc_guard_jump;
+static struct sigaction fsc_guard_previous;
+static volatile int fsc_guard_installed;
+
+static void fsc_guard_handler(int sig, siginfo_t *info, void *context) {
+	if(fsc_guard_jump) siglongjmp(*fsc_guard_jump, 1);
+
+	if(fsc_guard_previous.sa_flags & SA_SIGINFO) {
+		fsc_guard_previous.sa_sigaction(sig, info, context); }
+	else if(fsc_guard_previous.sa_handler != SIG_DFL && fsc_guard_previous.sa_handler != SIG_IGN) {
+		fsc_guard_previous.sa_handler(sig); }
+	else {
+		// The faulting access is retried on return and gets the default action
+		sigaction(SIGBUS, &fsc_guard_previous, 0); } }
+
+int fsc_guarded_call(void (*function)(void *context), void *context) {
+	// Returns 1 if the call was cut short by a fault, 0 otherwise
+	sigjmp_buf jump;
+
+	if(!fsc_guard_installed) {
+		fsc_lock();
+		if(!fsc_guard_installed) {
+			struct sigaction action;
+			fsc_memset(&action, 0, sizeof(action));
+			action.sa_sigaction = fsc_guard_handler;
+			// Not blocked in the handler, so jumping out leaves the signal mask as it was
+			action.sa_flags = SA_SIGINFO | SA_NODEFER;
+			sigemptyset(&action.sa_mask);
+			sigaction(SIGBUS, &action, &fsc_guard_previous);
+			fsc_guard_installed = 1; }
+		fsc_unlock(); }
+
+	if(sigsetjmp(jump, 0)) {
+		fsc_guard_jump = 0;
+		return 1; }
+	fsc_guard_jump = &jump;
+	function(context);
+	fsc_guard_jump = 0;
+	return 0; }
+#endif
+
+/* ******************************************************************************** */
+// Locking
+/* ******************************************************************************** */
+
+// Process-wide lock for short critical sections, usable without initialization
+
+#ifdef _WIN32
+static volatile LONG fsc_lock_state;
+
+void fsc_lock(void) {
+	while(InterlockedCompareExchange(&fsc_lock_state, 1, 0)) Sleep(0); }
+
+void fsc_unlock(void) {
+	InterlockedExchange(&fsc_lock_state, 0); }
+#else
+static pthread_mutex_t fsc_lock_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void fsc_lock(void) {
+	pthread_mutex_lock(&fsc_lock_mutex); }
+
+void fsc_unlock(void) {
+	pthread_mutex_unlock(&fsc_lock_mutex); }
+#endif
+
 /* ******************************************************************************** */
 // OS Path Handling
 /* ******************************************************************************** */
@@ -391,4 +634,149 @@ void iterate_directory(void *search_os_path, void (operation)(iterate_data_t *fi
 
 	iterate_directory2(&iw, 0); }
 
+/* ******************************************************************************** */
+// Directory Change Notification
+/* ******************************************************************************** */
+
+// Reports files created, changed, or removed under a directory tree since the last poll,
+//    so a refresh only has to process the changed files instead of rescanning everything.
+// Only implemented on Linux (inotify); elsewhere fsc_watch_directory returns null and
+//    callers stay on full rescans.
+
+#ifdef __linux__
+#define WATCH_EVENTS (IN_CLOSE_WRITE|IN_CREATE|IN_ATTRIB|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF)
+
+typedef struct {
+	int fd;
+	int base_length;
+	FSC_CHAR **paths;	// indexed by watch descriptor
+	int path_count;
+} watcher_t;
+
+static int watch_add_directory(watcher_t *watcher, const FSC_CHAR *path) {
+	// Adds watches for path and all subdirectories, matching the directories iterate_directory visits
+	// Returns 1 on error, 0 on success
+	int wd = inotify_add_watch(watcher->fd, path, WATCH_EVENTS);
+	DIR *dir;
+	if(wd < 0) return 1;
+
+	if(wd >= watcher->path_count) {
+		int new_count = wd * 2 + 16;
+		FSC_CHAR **new_paths = (FSC_CHAR **)fsc_calloc(new_count * sizeof(*new_paths));
+		if(watcher->paths) {
+			fsc_memcpy(new_paths, watcher->paths, watcher->path_count * sizeof(*new_paths));
+			fsc_free(watcher->paths); }
+		watcher->paths = new_paths;
+		watcher->path_count = new_count; }
+	if(!watcher->paths[wd]) {
+		int size = fsc_os_path_size(path);
+		watcher->paths[wd] = (FSC_CHAR *)fsc_malloc(size);
+		fsc_memcpy(watcher->paths[wd], path, size); }
+
+	dir = opendir(path);
+	if(!dir) return 0;
+	while(1) {
+		FSC_CHAR subpath[SEARCH_PATH_LIMIT];
+		struct dirent *entry = readdir(dir);
+		if(!entry) break;
+		if(!(entry->d_type & DT_DIR)) continue;
+		if(entry->d_name[0] == '.' && (!entry->d_name[1] ||
+				(entry->d_name[1] == '.' && !entry->d_name[2]))) continue;
+		if(snprintf(subpath, sizeof(subpath), "%s/%s", path, entry->d_name) >= sizeof(subpath)) continue;
+		if(watch_add_directory(watcher, subpath)) {
+			closedir(dir);
+			return 1; } }
+	closedir(dir);
+	return 0; }
+
+void *fsc_watch_directory(const void *os_path) {
+	// Returns handle to be freed by fsc_watch_free, or null if not supported or on error
+	watcher_t *watcher;
+	FSC_ASSERT(os_path);
+
+	watcher = (watcher_t *)fsc_calloc(sizeof(*watcher));
+	watcher->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	watcher->base_length = fsc_strlen((const char *)os_path);
+	if(watcher->fd < 0 || watch_add_directory(watcher, (const FSC_CHAR *)os_path)) {
+		// Most likely out of watches (fs.inotify.max_user_watches)
+		fsc_watch_free(watcher);
+		return 0; }
+	return watcher; }
+
+int fsc_watch_poll(void *watcher, void (operation)(iterate_data_t *file_data, int removed,
+			void *watch_context), void *watch_context) {
+	// Calls operation for each file changed since the last poll, with the same data
+	//    iterate_directory would report. Removed files have zero timestamp and size.
+	// Returns 1 if changes were missed or directories changed so a full rescan is needed, 0 otherwise
+	watcher_t *Watcher = (watcher_t *)watcher;
+	char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int rescan = 0;
+	FSC_ASSERT(watcher);
+
+	while(1) {
+		char *position;
+		ssize_t length = read(Watcher->fd, buffer, sizeof(buffer));
+		if(length <= 0) {
+			if(length < 0 && errno != EAGAIN && errno != EINTR) rescan = 1;
+			break; }
+
+		for(position = buffer; position < buffer + length;
+				position += sizeof(struct inotify_event) + ((struct inotify_event *)position)->len) {
+			const struct inotify_event *event = (const struct inotify_event *)position;
+			FSC_CHAR path[SEARCH_PATH_LIMIT];
+			iterate_data_t file_data;
+			struct stat st;
+			int removed;
+
+			if(event->mask & (IN_Q_OVERFLOW|IN_IGNORED|IN_DELETE_SELF|IN_MOVE_SELF|IN_UNMOUNT)) {
+				rescan = 1;
+				continue; }
+			if(event->mask & IN_ISDIR) {
+				// Directories appearing or disappearing would need their whole contents processed,
+				//    but attribute changes leave their contents alone
+				if(!(event->mask & ~(IN_ATTRIB|IN_ISDIR))) continue;
+				rescan = 1;
+				continue; }
+			if(!event->len || event->wd < 0 || event->wd >= Watcher->path_count || !Watcher->paths[event->wd]) continue;
+			if(snprintf(path, sizeof(path), "%s/%s", Watcher->paths[event->wd], event->name) >= sizeof(path)) continue;
+
+			if(event->mask & (IN_DELETE|IN_MOVED_FROM)) {
+				removed = 1; }
+			else {
+				// New files are reported on creation as well, since symbolic and hard links are never
+				//    written. Files still being written are reported again once closed, and timestamp
+				//    changes without writes come through as attribute changes.
+				removed = stat(path, &st) == -1; }
+			if(!removed && (S_ISDIR(st.st_mode) || st.st_size > 4294967295u)) continue;
+
+			file_data.os_path = path;
+			file_data.qpath_with_mod_dir = fsc_os_path_to_string(path + Watcher->base_length + 1);
+			file_data.os_timestamp = removed ? 0 : (unsigned int)st.st_mtime;
+			file_data.filesize = removed ? 0 : (unsigned int)st.st_size;
+			operation(&file_data, removed, watch_context);
+			fsc_free(file_data.qpath_with_mod_dir); } }
+
+	return rescan; }
+
+void fsc_watch_free(void *watcher) {
+	watcher_t *Watcher = (watcher_t *)watcher;
+	int i;
+	FSC_ASSERT(watcher);
+	if(Watcher->fd >= 0) close(Watcher->fd);
+	if(Watcher->paths) {
+		for(i=0; i<Watcher->path_count; ++i) {
+			if(Watcher->paths[i]) fsc_free(Watcher->paths[i]); }
+		fsc_free(Watcher->paths); }
+	fsc_free(watcher); }
+#else
+void *fsc_watch_directory(const void *os_path) {
+	return 0; }
+
+int fsc_watch_poll(void *watcher, void (operation)(iterate_data_t *file_data, int removed,
+			void *watch_context), void *watch_context) {
+	return 1; }
+
+void fsc_watch_free(void *watcher) {}
+#endif
+
 #endif	// NEW_FILESYSTEM
@@ -139,35 +139,29 @@ static int get_pk3_central_directory_fp(void *fp, unsigned int file_length, cent
 
 	return 0; }
 
-static int get_pk3_central_directory_path(void *os_path, central_directory_t *output,
-			fsc_file_direct_t *source_file, fsc_errorhandler_t *eh) {
-	// Returns 1 on error, 0 on success
+static const char *get_pk3_central_directory_path(void *os_path, central_directory_t *output) {
+	// Returns error message on error, null on success
 	void *fp = 0;
 	unsigned int length;
 
 	// Open file
 	fp = fsc_open_file(os_path, "rb");
-	if(!fp) {
-		fsc_report_error(eh, FSC_ERROR_PK3FILE, "error opening pk3", source_file);
-		return 1; }
+	if(!fp) return "error opening pk3";
 
 	// Get size
 	fsc_fseek(fp, 0, FSC_SEEK_END);
 	length = fsc_ftell(fp);
 	if(!length) {
 		fsc_fclose(fp);
-		fsc_report_error(eh, FSC_ERROR_PK3FILE, "zero size pk3", source_file);
-		return 1; }
+		return "zero size pk3"; }
 	if(length > FSC_MAX_PK3_SIZE) {
 		fsc_fclose(fp);
-		fsc_report_error(eh, FSC_ERROR_PK3FILE, "excessively large pk3", source_file);
-		return 1; }
+		return "excessively large pk3"; }
 
 	// Get central directory
 	if(get_pk3_central_directory_fp(fp, length, output)) {
 		fsc_fclose(fp);
-		fsc_report_error(eh, FSC_ERROR_PK3FILE, "error retrieving pk3 central directory", source_file);
-		return 1; }
+		return "error retrieving pk3 central directory"; }
 	fsc_fclose(fp);
 
 	return 0; }
@@ -179,7 +173,7 @@ void register_pk3_hash_lookup_entry(fsc_stackptr_t pk3_file_ptr, fsc_hashtable_t
 	hash_map_entry->pk3 = pk3_file_ptr;
 	fsc_hashtable_insert(hash_map_entry_ptr, pk3_file->pk3_hash, pk3_hash_lookup); }
 
-static void register_file_from_pk3(fsc_filesystem_t *fs, char *filename, int filename_length, fsc_stackptr_t sourcefile_ptr,
+static void register_file_from_pk3(fsc_filesystem_t *fs, const char *filename, int filename_length, fsc_stackptr_t sourcefile_ptr,
 			unsigned int header_position, unsigned int compressed_size, unsigned int uncompressed_size,
 			short compression_method, fsc_sanity_limit_t *sanity_limit, fsc_errorhandler_t *eh) {
 	fsc_file_direct_t *sourcefile = (fsc_file_direct_t *)STACKPTR(sourcefile_ptr);
@@ -213,11 +207,10 @@ static void register_file_from_pk3(fsc_filesystem_t *fs, char *filename, int fil
 	fsc_register_file(file_ptr, sanity_limit, fs, eh);
 	++sourcefile->pk3_subfile_count; }
 
-void fsc_load_pk3(void *os_path, fsc_filesystem_t *fs, fsc_stackptr_t sourcefile_ptr, fsc_errorhandler_t *eh,
-				void (*receive_hash_data)(void *context, char *data, int size), void *receive_hash_data_context ) {
-	// In normal usage, this is used to load pk3 files into the index. It can also be called with
-	//    receive_hash_data set to generate pk3 hash data without indexing anything.
-	fsc_file_direct_t *sourcefile = (fsc_file_direct_t *)STACKPTRN(sourcefile_ptr);
+void fsc_read_pk3_index(void *os_path, fsc_pk3_index_t *index) {
+	// Reads the central directory into an entry list without touching the filesystem,
+	//    so this can run on any thread. Free result with fsc_free_pk3_index.
+	// On error the entries read before the error are still returned, and index->error is set.
 	central_directory_t cd;
 	int entry_position = 0;		// Position of current entry relative to central directory data
 	int entry_counter = 0;		// Number of current entry
@@ -228,41 +221,28 @@ void fsc_load_pk3(void *os_path, fsc_filesystem_t *fs, fsc_stackptr_t sourcefile
 	unsigned int compressed_size;
 	unsigned int header_position;
 
-	int *crcs_for_hash;
-	int crcs_for_hash_buffer[1024];
-	int crcs_for_hash_count = 0;
-
-	fsc_sanity_limit_t sanity_limit = {0};
-
-	if(!receive_hash_data) {
-		FSC_ASSERT(sourcefile_ptr);
-
-		// Set sanity limits to prevent pk3s with excessively large contents from causing freezes/overflows
-		sanity_limit.content_index_memory = (sourcefile->f.filesize < 1048576 ? sourcefile->f.filesize : 1048576) * 5 + 16384;
-		sanity_limit.content_cache_memory = (sourcefile->f.filesize < 1048576 ? sourcefile->f.filesize : 1048576);
-		sanity_limit.data_read = (sourcefile->f.filesize < 1048576 ? sourcefile->f.filesize : 1048576) * 40 + 1048576;
-		sanity_limit.pk3file = sourcefile; }
+	fsc_memset(index, 0, sizeof(*index));
 
 	// Load central directory
-	if(get_pk3_central_directory_path(os_path, &cd, sourcefile, eh)) return;
+	index->error = get_pk3_central_directory_path(os_path, &cd);
+	if(index->error) return;
+	index->cd_data = cd.data;
 
-	// Try to use the stack buffer, but if it's not big enough resort to malloc
-	if(cd.entry_count > sizeof(crcs_for_hash_buffer) / sizeof(*crcs_for_hash_buffer)) {
-		crcs_for_hash = (int *)fsc_malloc((cd.entry_count + 1) * 4); }
-	else crcs_for_hash = crcs_for_hash_buffer;
+	index->entries = (fsc_pk3_entry_t *)fsc_malloc((cd.entry_count + 1) * sizeof(*index->entries));
+	index->crcs = (int *)fsc_malloc((cd.entry_count + 1) * 4);
 
 	// Process each file
 	while(1) {
 		// Make sure there is enough space to read the entry (minimum 47 bytes if filename is 1 byte)
 		if(entry_position + 47 > cd.cd_length) {
-			fsc_report_error(eh, FSC_ERROR_PK3FILE, "invalid file cd entry position", sourcefile);
-			goto freemem; }
+			index->error = "invalid file cd entry position";
+			return; }
 
 		// Verify magic number
 		if(cd.data[entry_position] != 0x50 || cd.data[entry_position+1] != 0x4b
 				|| cd.data[entry_position+2] != 0x01 || cd.data[entry_position+3] != 0x02) {
-			fsc_report_error(eh, FSC_ERROR_PK3FILE, "file cd entry does not have correct signature", sourcefile);
-			goto freemem; }
+			index->error = "file cd entry does not have correct signature";
+			return; }
 
 		#define CD_ENTRY_SHORT(offset) fsc_endian_convert_short(*(unsigned short *)(cd.data + entry_position + offset))
 		#define CD_ENTRY_INT(offset) fsc_endian_convert_int(*(unsigned int *)(cd.data + entry_position + offset))
@@ -274,9 +254,8 @@ void fsc_load_pk3(void *os_path, fsc_filesystem_t *fs, fsc_stackptr_t sourcefile
 			int comment_length = (int)CD_ENTRY_SHORT(32);
 			entry_length = 46 + filename_length + extrafield_length + comment_length;
 			if(entry_position + entry_length > cd.cd_length) {
-				fsc_report_error(eh, FSC_ERROR_PK3FILE,
-					"invalid file cd entry position 2", sourcefile);
-				goto freemem; } }
+				index->error = "invalid file cd entry position 2";
+				return; } }
 
 		// Get compressed_size and uncompressed_size
 		compressed_size = CD_ENTRY_INT(20);
@@ -287,34 +266,185 @@ void fsc_load_pk3(void *os_path, fsc_filesystem_t *fs, fsc_stackptr_t sourcefile
 
 		// Sanity checks
 		if(header_position + compressed_size < header_position) {
-			fsc_report_error(eh, FSC_ERROR_PK3FILE, "invalid file local entry position 1", sourcefile); goto freemem; }
+			index->error = "invalid file local entry position 1";
+			return; }
 		if(header_position + compressed_size > FSC_MAX_PK3_SIZE) {
-			fsc_report_error(eh, FSC_ERROR_PK3FILE, "invalid file local entry position 2", sourcefile); goto freemem; }
+			index->error = "invalid file local entry position 2";
+			return; }
 
 		if(uncompressed_size) {
-			crcs_for_hash[crcs_for_hash_count++] = CD_ENTRY_INT_LE(16); }
-
-		if(!(void *)receive_hash_data && !(!uncompressed_size && *(cd.data+entry_position+46+filename_length-1) == '/')) {
-			// Not in hash mode and not a directory entry - load the file
-			register_file_from_pk3(fs, cd.data+entry_position+46, filename_length, sourcefile_ptr,
-					header_position, compressed_size, CD_ENTRY_INT(24), CD_ENTRY_SHORT(10), &sanity_limit, eh); }
+			index->crcs[index->crc_count++] = CD_ENTRY_INT_LE(16); }
+
+		if(!(!uncompressed_size && *(cd.data+entry_position+46+filename_length-1) == '/')) {
+			// Not a directory entry - add the file
+			fsc_pk3_entry_t *entry = &index->entries[index->entry_count++];
+			entry->filename = cd.data + entry_position + 46;
+			entry->filename_length = filename_length;
+			entry->header_position = header_position;
+			entry->compressed_size = compressed_size;
+			entry->uncompressed_size = uncompressed_size;
+			entry->compression_method = CD_ENTRY_SHORT(10); }
 
 		++entry_counter;
 		entry_position += entry_length;
 		if(entry_counter >= cd.entry_count) break; }		// Abort if that was the last file
 
-	if((void *)receive_hash_data) {
-		receive_hash_data(receive_hash_data_context, (char *)crcs_for_hash, crcs_for_hash_count * 4);
-		goto freemem; }
+	index->pk3_hash = fsc_block_checksum(index->crcs, index->crc_count * 4); }
+
+void fsc_free_pk3_index(fsc_pk3_index_t *index) {
+	if(index->cd_data) fsc_free(index->cd_data);
+	if(index->entries) fsc_free(index->entries);
+	if(index->crcs) fsc_free(index->crcs);
+	fsc_memset(index, 0, sizeof(*index)); }
+
+void fsc_register_pk3_index(const fsc_pk3_index_t *index, fsc_filesystem_t *fs, fsc_stackptr_t sourcefile_ptr, fsc_errorhandler_t *eh) {
+	// Adds the files from a pk3 index to the filesystem
+	fsc_file_direct_t *sourcefile = (fsc_file_direct_t *)STACKPTR(sourcefile_ptr);
+	fsc_sanity_limit_t sanity_limit = {0};
+	int i;
+
+	// Set sanity limits to prevent pk3s with excessively large contents from causing freezes/overflows
+	sanity_limit.content_index_memory = (sourcefile->f.filesize < 1048576 ? sourcefile->f.filesize : 1048576) * 5 + 16384;
+	sanity_limit.content_cache_memory = (sourcefile->f.filesize < 1048576 ? sourcefile->f.filesize : 1048576);
+	sanity_limit.data_read = (sourcefile->f.filesize < 1048576 ? sourcefile->f.filesize : 1048576) * 40 + 1048576;
+	sanity_limit.pk3file = sourcefile;
+
+	for(i=0; i<index->entry_count; ++i) {
+		const fsc_pk3_entry_t *entry = &index->entries[i];
+		register_file_from_pk3(fs, entry->filename, entry->filename_length, sourcefile_ptr, entry->header_position,
+				entry->compressed_size, entry->uncompressed_size, entry->compression_method, &sanity_limit, eh); }
+
+	if(index->error) {
+		fsc_report_error(eh, FSC_ERROR_PK3FILE, index->error, sourcefile);
+		return; }
 
-	sourcefile->pk3_hash = fsc_block_checksum(crcs_for_hash, crcs_for_hash_count * 4);
+	sourcefile->pk3_hash = index->pk3_hash;
 
 	// Add the pk3 to the hash lookup table
-	register_pk3_hash_lookup_entry(sourcefile_ptr, &fs->pk3_hash_lookup, &fs->general_stack);
+	register_pk3_hash_lookup_entry(sourcefile_ptr, &fs->pk3_hash_lookup, &fs->general_stack); }
 
-	freemem:
-	fsc_free(cd.data);
-	if(crcs_for_hash != crcs_for_hash_buffer) fsc_free(crcs_for_hash); }
+void fsc_load_pk3(void *os_path, fsc_filesystem_t *fs, fsc_stackptr_t sourcefile_ptr, fsc_errorhandler_t *eh,
+				void (*receive_hash_data)(void *context, char *data, int size), void *receive_hash_data_context ) {
+	// In normal usage, this is used to load pk3 files into the index. It can also be called with
+	//    receive_hash_data set to generate pk3 hash data without indexing anything.
+	fsc_pk3_index_t index;
+	fsc_read_pk3_index(os_path, &index);
+
+	if((void *)receive_hash_data) {
+		if(index.error) fsc_report_error(eh, FSC_ERROR_PK3FILE, index.error, STACKPTRN(sourcefile_ptr));
+		else receive_hash_data(receive_hash_data_context, (char *)index.crcs, index.crc_count * 4); }
+	else {
+		FSC_ASSERT(sourcefile_ptr);
+		fsc_register_pk3_index(&index, fs, sourcefile_ptr, eh); }
+
+	fsc_free_pk3_index(&index); }
+
+/* ******************************************************************************** */
+// PK3 Memory Mapping
+/* ******************************************************************************** */
+
+// Recently used pk3s are kept mapped, so extracting many files from the same pk3 (such as
+//    the textures for a map) reuses one mapping instead of reopening the file every time.
+// Mappings are dropped on each filesystem refresh so the files aren't held open indefinitely.
+// A pk3 can still be rewritten while mapped, so the file's size and timestamp are checked again
+//    each time a mapping is reused, and reads from the mapping are guarded against the fault
+//    a truncated file raises.
+
+#define PK3_MAPPING_SLOTS 8
+
+typedef struct {
+	void *os_path;				// Copy of source pk3 path; null if slot is empty
+	unsigned int filesize;
+	unsigned int os_timestamp;
+	unsigned int disk_size;		// Size and timestamp of the file when it was mapped
+	unsigned int disk_timestamp;
+	void *mapping;
+	const char *data;
+	int refcount;
+	int stale;					// Unmap once no longer referenced
+	unsigned int last_used;
+} pk3_mapping_t;
+
+static pk3_mapping_t pk3_mappings[PK3_MAPPING_SLOTS];
+static unsigned int pk3_mapping_counter;
+
+static void fsc_pk3_free_mapping(pk3_mapping_t *mapping) {
+	// Caller must hold fsc_lock
+	fsc_unmap_file(mapping->mapping);
+	fsc_free(mapping->os_path);
+	fsc_memset(mapping, 0, sizeof(*mapping)); }
+
+static pk3_mapping_t *fsc_pk3_acquire_mapping(const fsc_file_direct_t *source_pk3, const fsc_filesystem_t *fs) {
+	// Returns mapping of the entire pk3 to be released by fsc_pk3_release_mapping, or null on error
+	const void *os_path = STACKPTR(source_pk3->os_path_ptr);
+	pk3_mapping_t *slot = 0;
+	unsigned int disk_size, disk_timestamp;
+	int i;
+
+	if(fsc_get_file_info(os_path, &disk_size, &disk_timestamp)) return 0;
+
+	fsc_lock();
+
+	for(i=0; i<PK3_MAPPING_SLOTS; ++i) {
+		pk3_mapping_t *mapping = &pk3_mappings[i];
+		if(mapping->os_path && !mapping->stale && mapping->filesize == source_pk3->f.filesize &&
+				mapping->os_timestamp == source_pk3->os_timestamp && !fsc_compare_os_path(mapping->os_path, os_path)) {
+			if(mapping->disk_size != disk_size || mapping->disk_timestamp != disk_timestamp) {
+				// The file changed since it was mapped
+				if(mapping->refcount) mapping->stale = 1;
+				else fsc_pk3_free_mapping(mapping);
+				continue; }
+			++mapping->refcount;
+			mapping->last_used = ++pk3_mapping_counter;
+			fsc_unlock();
+			return mapping; }
+
+		// Track least recently used unreferenced slot for replacement
+		if(!mapping->refcount && (!slot || (slot->os_path && (!mapping->os_path || mapping->last_used < slot->last_used))))
+			slot = mapping; }
+
+	if(slot) {
+		unsigned int length = source_pk3->f.filesize;
+		const char *data;
+		void *handle;
+		if(slot->os_path) fsc_pk3_free_mapping(slot);
+
+		handle = fsc_map_file(os_path, 0, &length, &data);
+		if(handle && length == source_pk3->f.filesize) {
+			int os_path_size = fsc_os_path_size(os_path);
+			slot->os_path = fsc_malloc(os_path_size);
+			fsc_memcpy(slot->os_path, os_path, os_path_size);
+			slot->filesize = source_pk3->f.filesize;
+			slot->os_timestamp = source_pk3->os_timestamp;
+			slot->disk_size = disk_size;
+			slot->disk_timestamp = disk_timestamp;
+			slot->mapping = handle;
+			slot->data = data;
+			slot->refcount = 1;
+			slot->last_used = ++pk3_mapping_counter; }
+		else {
+			if(handle) fsc_unmap_file(handle);
+			slot = 0; } }
+
+	fsc_unlock();
+	return slot; }
+
+static void fsc_pk3_release_mapping(pk3_mapping_t *mapping, int faulted) {
+	// Faulted means reading the mapping failed, so it shouldn't be reused
+	fsc_lock();
+	--mapping->refcount;
+	if(faulted) mapping->stale = 1;
+	if(mapping->stale && !mapping->refcount) fsc_pk3_free_mapping(mapping);
+	fsc_unlock(); }
+
+void fsc_pk3_flush_mappings(void) {
+	int i;
+	fsc_lock();
+	for(i=0; i<PK3_MAPPING_SLOTS; ++i) {
+		if(!pk3_mappings[i].os_path) continue;
+		if(pk3_mappings[i].refcount) pk3_mappings[i].stale = 1;
+		else fsc_pk3_free_mapping(&pk3_mappings[i]); }
+	fsc_unlock(); }
 
 /* ******************************************************************************** */
 // PK3 Extraction Support
@@ -323,40 +453,91 @@ void fsc_load_pk3(void *os_path, fsc_filesystem_t *fs, fsc_stackptr_t sourcefile
 typedef struct {
 	void *input_handle;
 	int compression_method;
-	unsigned int input_remaining;	// Remaining to be read from input handle
+	unsigned int input_remaining;	// Remaining to be read from input handle or mapping
 
-	// For zlib streams only
+	// For memory mapped pk3s only
+	pk3_mapping_t *mapping;
+	const char *mapped_input;		// Current position in mapping
+	int faulted;					// The mapping couldn't be read, the file was probably truncated
+
+	// For zlib streams read through input handle only
 	unsigned int input_buffer_size;
 	char *input_buffer;
+
+	// For zlib streams only
 	z_stream zlib_stream;
 } pk3_handle_t;
 
+typedef struct {
+	void *dst;
+	const void *src;
+	unsigned int size;
+} pk3_copy_t;
+
+static void fsc_pk3_mapped_copy2(void *context) {
+	pk3_copy_t *copy = (pk3_copy_t *)context;
+	fsc_memcpy(copy->dst, copy->src, copy->size); }
+
+static int fsc_pk3_mapped_copy(void *dst, const void *src, unsigned int size) {
+	// Returns 1 on error, 0 otherwise
+	pk3_copy_t copy;
+	copy.dst = dst;
+	copy.src = src;
+	copy.size = size;
+	return fsc_guarded_call(fsc_pk3_mapped_copy2, &copy); }
+
+static void fsc_pk3_mapped_inflate(void *context) {
+	z_stream *stream = (z_stream *)context;
+	while(stream->avail_out) {
+		if(inflate(stream, Z_SYNC_FLUSH) != Z_OK) break; } }
+
 static int fsc_pk3_handle_open2(pk3_handle_t *handle, const fsc_file_frompk3_t *file, int input_buffer_size,
 		const fsc_filesystem_t *fs, fsc_errorhandler_t *eh) {
 	// Returns 1 on error, 0 otherwise
 	const fsc_file_direct_t *source_pk3 = (const fsc_file_direct_t *)STACKPTR(file->source_pk3);
 	char localheader[30];
-	unsigned int data_position;
+	unsigned int data_offset;
+	#define LH_SHORT(offset) fsc_endian_convert_short(*(unsigned short *)(localheader + offset))
 
-	// Open the file
-	handle->input_handle = fsc_open_file(STACKPTR(source_pk3->os_path_ptr), "rb");
-	if(!handle->input_handle) {
-		fsc_report_error(eh, FSC_ERROR_EXTRACT, "pk3_handle_open - failed to open pk3 file", 0);
-		return 1; }
+	// Use a mapping of the pk3 if possible, which avoids the stdio and zlib input buffering
+	//    Fall back to regular file access if the pk3 can't be mapped
+	handle->mapping = fsc_pk3_acquire_mapping(source_pk3, fs);
+	if(handle->mapping) {
+		// Read the local header to get data position
+		if(file->header_position + 30 > source_pk3->f.filesize) {
+			fsc_report_error(eh, FSC_ERROR_EXTRACT, "pk3_handle_open - failed to read local header", 0);
+			return 1; }
+		handle->mapped_input = handle->mapping->data + file->header_position;
+		if(fsc_pk3_mapped_copy(localheader, handle->mapped_input, 30)) {
+			handle->faulted = 1;
+			fsc_report_error(eh, FSC_ERROR_EXTRACT, "pk3_handle_open - failed to read local header", 0);
+			return 1; } }
+	else {
+		// Open the file
+		handle->input_handle = fsc_open_file(STACKPTR(source_pk3->os_path_ptr), "rb");
+		if(!handle->input_handle) {
+			fsc_report_error(eh, FSC_ERROR_EXTRACT, "pk3_handle_open - failed to open pk3 file", 0);
+			return 1; }
+
+		// Read the local header to get data position
+		fsc_fseek_set(handle->input_handle, file->header_position);
+		if(fsc_fread(localheader, 30, handle->input_handle) != 30) {
+			fsc_report_error(eh, FSC_ERROR_EXTRACT, "pk3_handle_open - failed to read local header", 0);
+			return 1; } }
 
-	// Read the local header to get data position
-	fsc_fseek_set(handle->input_handle, file->header_position);
-	if(fsc_fread(localheader, 30, handle->input_handle) != 30) {
-		fsc_report_error(eh, FSC_ERROR_EXTRACT, "pk3_handle_open - failed to read local header", 0);
-		return 1; }
 	if(localheader[0] != 0x50 || localheader[1] != 0x4b || localheader[2] != 0x03 || localheader[3] != 0x04) {
 		fsc_report_error(eh, FSC_ERROR_EXTRACT, "pk3_handle_open - incorrect signature in local header", 0);
 		return 1; }
-	#define LH_SHORT(offset) fsc_endian_convert_short(*(unsigned short *)(localheader + offset))
-	data_position = file->header_position + LH_SHORT(26) + LH_SHORT(28) + 30;
+	data_offset = LH_SHORT(26) + LH_SHORT(28) + 30;
 
 	// Seek to data start position
-	fsc_fseek_set(handle->input_handle, data_position);
+	if(handle->mapping) {
+		unsigned int available = source_pk3->f.filesize - file->header_position;
+		if(data_offset > available || file->compressed_size > available - data_offset) {
+			fsc_report_error(eh, FSC_ERROR_EXTRACT, "pk3_handle_open - file data past end of pk3", 0);
+			return 1; }
+		handle->mapped_input += data_offset; }
+	else fsc_fseek_set(handle->input_handle, file->header_position + data_offset);
 
 	// Configure the handle
 	handle->input_remaining = file->compressed_size;
@@ -366,8 +547,14 @@ static int fsc_pk3_handle_open2(pk3_handle_t *handle, const fsc_file_frompk3_t *
 			return 1; }
 
 		handle->compression_method = 8;
-		handle->input_buffer_size = input_buffer_size;
-		handle->input_buffer = (char *)fsc_malloc(input_buffer_size); }
+		if(handle->mapping) {
+			// Inflate straight from the mapping
+			handle->zlib_stream.next_in = (Bytef *)handle->mapped_input;
+			handle->zlib_stream.avail_in = handle->input_remaining;
+			handle->input_remaining = 0; }
+		else {
+			handle->input_buffer_size = input_buffer_size;
+			handle->input_buffer = (char *)fsc_malloc(input_buffer_size); } }
 	else if(file->compression_method != 0) {
 		fsc_report_error(eh, FSC_ERROR_EXTRACT, "pk3_handle_open - unknown compression method", 0);
 		return 1; }
@@ -379,6 +566,7 @@ void *fsc_pk3_handle_open(const fsc_file_frompk3_t *file, int input_buffer_size,
 	pk3_handle_t *handle = (pk3_handle_t *)fsc_calloc(sizeof(*handle));
 	if(fsc_pk3_handle_open2(handle, file, input_buffer_size, fs, eh)) {
 		if(handle->input_handle) fsc_fclose(handle->input_handle);
+		if(handle->mapping) fsc_pk3_release_mapping(handle->mapping, handle->faulted);
 		fsc_free(handle);
 		return 0; }
 	return (void *)handle; }
@@ -386,24 +574,34 @@ void *fsc_pk3_handle_open(const fsc_file_frompk3_t *file, int input_buffer_size,
 void fsc_pk3_handle_close(void *handle) {
 	pk3_handle_t *Handle = (pk3_handle_t *)handle;
 	if(Handle->input_handle) fsc_fclose(Handle->input_handle);
+	if(Handle->mapping) fsc_pk3_release_mapping(Handle->mapping, Handle->faulted);
 	if(Handle->compression_method == 8) {
-		fsc_free(Handle->input_buffer);
+		if(Handle->input_buffer) fsc_free(Handle->input_buffer);
 		inflateEnd(&Handle->zlib_stream); }
 	fsc_free(handle); }
 
 unsigned int fsc_pk3_handle_read(void *handle, char *buffer, unsigned int length) {
 	// Returns number of bytes read
 	pk3_handle_t *Handle = (pk3_handle_t *)handle;
+	if(Handle->faulted) return 0;
 	if(Handle->compression_method == 8) {
 		Handle->zlib_stream.next_out = (Bytef *)buffer;
 		Handle->zlib_stream.avail_out = length;
 
+		if(Handle->mapping) {
+			// Mapped input is loaded all at once when the handle is opened
+			// A fault leaves the zlib stream unusable, so nothing more is read from it
+			if(fsc_guarded_call(fsc_pk3_mapped_inflate, &Handle->zlib_stream)) {
+				Handle->faulted = 1;
+				return 0; }
+			return length - Handle->zlib_stream.avail_out; }
+
 		while(Handle->zlib_stream.avail_out) {
-			if(!Handle->zlib_stream.avail_in) {
+			if(!Handle->zlib_stream.avail_in && Handle->input_remaining) {
 				// Load new batch of data into input
+				// Once input runs out, inflate can still have buffered output to flush
 				unsigned int feed_amount = Handle->input_remaining;
 				if(feed_amount > Handle->input_buffer_size) feed_amount = Handle->input_buffer_size;
-				if(!feed_amount) break;		// Ran out of input
 				if(fsc_fread(Handle->input_buffer, (int)feed_amount, Handle->input_handle) != feed_amount) break;
 				Handle->zlib_stream.avail_in += feed_amount;
 				Handle->input_remaining -= feed_amount;
@@ -412,6 +610,14 @@ unsigned int fsc_pk3_handle_read(void *handle, char *buffer, unsigned int length
 			if(inflate(&Handle->zlib_stream, Z_SYNC_FLUSH) != Z_OK) break; }
 
 		return length - Handle->zlib_stream.avail_out; }
+	else if(Handle->mapping) {
+		if(length > Handle->input_remaining) length = Handle->input_remaining;
+		if(fsc_pk3_mapped_copy(buffer, Handle->mapped_input, length)) {
+			Handle->faulted = 1;
+			return 0; }
+		Handle->mapped_input += length;
+		Handle->input_remaining -= length;
+		return length; }
 	else {
 		return fsc_fread(buffer, length, Handle->input_handle); } }
 
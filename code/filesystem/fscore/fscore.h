@@ -24,7 +24,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 // Definitions
 /* ******************************************************************************** */
 
-#define FSC_CACHE_VERSION 12
+#define FSC_CACHE_VERSION 13
 
 #define FSC_MAX_QPATH 256	// Buffer size including null terminator
 #define FSC_MAX_MODDIR 32	// Buffer size including null terminator
@@ -52,6 +52,10 @@ typedef struct {
 	int overflowed;
 } fsc_stream_t;
 
+// Stack buckets and hashtable arrays are exported on this boundary so an imported
+// stream can be used in place, with untouched pages shared between processes
+#define FSC_STREAM_ALIGNMENT 4096
+
 int fsc_read_stream_data(fsc_stream_t *stream, void *output, unsigned int length);
 int fsc_write_stream_data(fsc_stream_t *stream, const void *data, unsigned int length);
 void fsc_stream_append_string_substituted(fsc_stream_t *stream, const char *string, const char *substitution_table);
@@ -70,6 +74,7 @@ typedef struct {
 	fsc_stack_bucket_t **buckets;
 	int buckets_position;
 	int buckets_size;
+	int imported_buckets;	// buckets below this index point into import stream data
 } fsc_stack_t;
 
 void fsc_stack_initialize(fsc_stack_t *stack);
@@ -98,6 +103,7 @@ typedef struct {
 	fsc_stack_t *stack;
 	int bucket_count;
 	int utilization;
+	int imported;	// buckets point into import stream data
 } fsc_hashtable_t;
 
 typedef struct {
@@ -197,6 +203,10 @@ int fsc_compare_os_path(const void *path1, const void *path2);
 
 void iterate_directory(void *search_os_path, void (operation)(iterate_data_t *file_data,
 			void *iterate_context), void *iterate_context);
+void *fsc_watch_directory(const void *os_path);
+int fsc_watch_poll(void *watcher, void (operation)(iterate_data_t *file_data, int removed,
+			void *watch_context), void *watch_context);
+void fsc_watch_free(void *watcher);
 
 void fsc_error_abort(const char *msg);
 int fsc_rename_file(void *source_os_path, void *target_os_path);
@@ -210,6 +220,13 @@ void fsc_fflush(void *fp);
 int fsc_fseek(void *fp, int offset, fsc_seek_type_t type);
 int fsc_fseek_set(void *fp, unsigned int offset);
 unsigned int fsc_ftell(void *fp);
+void *fsc_map_file(const void *os_path, unsigned int offset, unsigned int *length, const char **data_out);
+void *fsc_map_file_private(const void *os_path, unsigned int *size_out, char **data_out);
+void fsc_unmap_file(void *mapping);
+int fsc_get_file_info(const void *os_path, unsigned int *size_out, unsigned int *timestamp_out);
+int fsc_guarded_call(void (*function)(void *context), void *context);
+void fsc_lock(void);
+void fsc_unlock(void);
 void fsc_memcpy(void *dst, const void *src, unsigned int size);
 int fsc_memcmp(const void *str1, const void *str2, unsigned int size);
 void fsc_memset(void *dst, int value, unsigned int size);
@@ -334,6 +351,9 @@ typedef struct fsc_filesystem_s {
 	// PK3 Hash Lookup - Useful to determine files needed to download
 	fsc_hashtable_t pk3_hash_lookup;
 
+	// Cache Image - Mapped fscache.dat data the stack and hashtables were imported from
+	void *cache_image;
+
 	// Custom Sourcetypes - Can be used for special applications
 	fsc_sourcetype_t custom_sourcetypes[FSC_CUSTOM_SOURCETYPE_COUNT];
 
@@ -377,12 +397,41 @@ void fsc_load_file_full_path(int source_dir_id, const void *os_path, const char
 void fsc_filesystem_initialize(fsc_filesystem_t *fs);
 void fsc_filesystem_free(fsc_filesystem_t *fs);
 void fsc_filesystem_reset(fsc_filesystem_t *fs);
+void fsc_filesystem_reset_incremental(fsc_filesystem_t *fs);
 void fsc_load_directory(fsc_filesystem_t *fs, void *os_path, int source_dir_id, fsc_errorhandler_t *eh);
+// Runs function for each index from 0 to count-1, potentially in parallel, and returns when all are done
+typedef void (*fsc_run_jobs_t)(void (*function)(void *context, int index, int thread), void *context, int count);
+void fsc_load_directory_parallel(fsc_filesystem_t *fs, void *os_path, int source_dir_id, fsc_run_jobs_t run_jobs,
+		fsc_errorhandler_t *eh);
+int fsc_update_directory(fsc_filesystem_t *fs, void *watcher, int source_dir_id, fsc_errorhandler_t *eh);
 
 /* ******************************************************************************** */
 // PK3 Handling (fsc_pk3.c)
 /* ******************************************************************************** */
 
+typedef struct {
+	const char *filename;		// Not null terminated; points into central directory data
+	int filename_length;
+	unsigned int header_position;
+	unsigned int compressed_size;
+	unsigned int uncompressed_size;
+	short compression_method;
+} fsc_pk3_entry_t;
+
+// Parsed central directory of a pk3, which can be read on any thread and registered later
+typedef struct {
+	char *cd_data;
+	fsc_pk3_entry_t *entries;
+	int entry_count;
+	int *crcs;
+	int crc_count;
+	unsigned int pk3_hash;
+	const char *error;		// Set if the pk3 could not be completely read
+} fsc_pk3_index_t;
+
+void fsc_read_pk3_index(void *os_path, fsc_pk3_index_t *index);
+void fsc_free_pk3_index(fsc_pk3_index_t *index);
+void fsc_register_pk3_index(const fsc_pk3_index_t *index, fsc_filesystem_t *fs, fsc_stackptr_t sourcefile_ptr, fsc_errorhandler_t *eh);
 // receive_hash_data is used for standalone hash calculation operations,
 // and should be nulled during normal filesystem loading
 void fsc_load_pk3(void *os_path, fsc_filesystem_t *fs, fsc_stackptr_t sourcefile_ptr, fsc_errorhandler_t *eh,
@@ -391,6 +440,7 @@ void register_pk3_hash_lookup_entry(fsc_stackptr_t pk3_file_ptr, fsc_hashtable_t
 void *fsc_pk3_handle_open(const fsc_file_frompk3_t *file, int input_buffer_size, const fsc_filesystem_t *fs, fsc_errorhandler_t *eh);
 void fsc_pk3_handle_close(void *handle);
 unsigned int fsc_pk3_handle_read(void *handle, char *buffer, unsigned int length);
+void fsc_pk3_flush_mappings(void);
 extern fsc_sourcetype_t pk3_sourcetype;
 
 /* ******************************************************************************** */
@@ -117,6 +117,8 @@ typedef struct {
 DEF_LOCAL( extern cvar_t *fs_dirs )
 DEF_LOCAL( extern cvar_t *fs_mod_settings )
 DEF_LOCAL( extern cvar_t *fs_index_cache )
+DEF_LOCAL( extern cvar_t *fs_index_threads )
+DEF_LOCAL( extern cvar_t *fs_index_watch )
 DEF_LOCAL( extern cvar_t *fs_read_inactive_mods )
 DEF_LOCAL( extern cvar_t *fs_list_inactive_mods )
 DEF_LOCAL( extern cvar_t *fs_download_manifest )
@@ -125,6 +127,8 @@ DEF_LOCAL( extern cvar_t *fs_redownload_across_mods )
 DEF_LOCAL( extern cvar_t *fs_full_pure_validation )
 DEF_LOCAL( extern cvar_t *fs_download_mode )
 DEF_LOCAL( extern cvar_t *fs_auto_refresh_enabled )
+DEF_LOCAL( extern cvar_t *fs_lookup_cache )
+DEF_LOCAL( extern cvar_t *fs_prefetch )
 #ifdef FS_SERVERCFG_ENABLED
 DEF_LOCAL( extern cvar_t *fs_servercfg )
 DEF_LOCAL( extern cvar_t *fs_servercfg_listlimit )
@@ -154,6 +158,7 @@ DEF_LOCAL( extern int checksum_feed )
 
 DEF_LOCAL( extern int connected_server_sv_pure )
 DEF_LOCAL( extern pk3_list_t connected_server_pure_list )
+DEF_LOCAL( extern int fs_generation )
 
 // State Accessors
 DEF_PUBLIC( const char *FS_GetCurrentGameDir(void) )
@@ -247,11 +252,13 @@ DEF_PUBLIC( qboolean FS_FileExists(const char *file) )
 // File read cache
 DEF_PUBLIC( void fs_cache_initialize(void) )
 DEF_PUBLIC( void fs_advance_cache_stage(void) )
+DEF_LOCAL( unsigned int fs_cache_capacity(void) )
 DEF_LOCAL( void fs_readcache_debug(void) )
 
 // Data reading
 DEF_PUBLIC( char *fs_read_data(const fsc_file_t *file, const char *path, unsigned int *size_out, const char *calling_function) )
 DEF_PUBLIC( void fs_free_data(char *data) )
+DEF_LOCAL( qboolean fs_prefetch_data(const fsc_file_t *file) )
 DEF_PUBLIC( char *fs_read_shader(const fsc_shader_t *shader) )
 
 // Direct read handle operations
@@ -444,3 +451,10 @@ DEF_LOCAL( void fs_check_core_paks(void) )
 /* ******************************************************************************** */
 
 DEF_LOCAL( qboolean fs_check_trusted_vm_hash(unsigned char *hash) )
+
+/* ******************************************************************************** */
+// Prefetch
+/* ******************************************************************************** */
+
+DEF_LOCAL( void fs_prefetch_wait(void) )
+DEF_PUBLIC( void fs_prefetch_map(const char *name, const void *bsp_data, int length) )
@@ -230,6 +230,8 @@ typedef enum {
 	// 1.32
 	G_FS_SEEK,
 
+	G_TRACEBATCH,	// ( trace_t *results, const traceRequest_t *requests, int count );
+
 	BOTLIB_SETUP = 200,				// ( void );
 	BOTLIB_SHUTDOWN,				// ( void );
 	BOTLIB_LIBVAR_SET,
@@ -261,6 +261,50 @@ void CMod_LoadBrushes( lump_t *l ) {
 
 }
 
+/*
+=================
+CMod_BuildBrushPlanes
+
+Copies the side planes of every brush into padded structure-of-arrays
+form for the trace code.  The padding planes have no normal and a huge
+distance, so every point is behind them.
+=================
+*/
+void CMod_BuildBrushPlanes( void ) {
+#ifdef CM_SIMD_PLANES
+	cbrush_t	*b;
+	float		*out;
+	int			i, j, total;
+
+	total = 0;
+	for ( i = 0, b = cm.brushes ; i < cm.numBrushes ; i++, b++ ) {
+		// room for the position tests, which start at side 6
+		b->planeStride = ( b->numsides + 6 ) & ~3;
+		total += b->planeStride * 4;
+	}
+
+	out = Hunk_Alloc( total * sizeof( *out ), h_high );
+
+	for ( i = 0, b = cm.brushes ; i < cm.numBrushes ; i++, b++ ) {
+		b->planes = out;
+		for ( j = 0 ; j < b->planeStride ; j++ ) {
+			if ( j < b->numsides ) {
+				out[j] = b->sides[j].plane->normal[0];
+				out[j + b->planeStride] = b->sides[j].plane->normal[1];
+				out[j + b->planeStride * 2] = b->sides[j].plane->normal[2];
+				out[j + b->planeStride * 3] = b->sides[j].plane->dist;
+			} else {
+				out[j] = 0;
+				out[j + b->planeStride] = 0;
+				out[j + b->planeStride * 2] = 0;
+				out[j + b->planeStride * 3] = 1e30f;
+			}
+		}
+		out += b->planeStride * 4;
+	}
+#endif
+}
+
 /*
 =================
 CMod_LoadLeafs
@@ -603,6 +647,7 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	}
 
 	// free old stuff
+	CM_StopTraceLog();
 	Com_Memset( &cm, 0, sizeof( cm ) );
 	CM_ClearLevelPatches();
 
@@ -630,6 +675,7 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 
 	last_checksum = LittleLong (Com_BlockChecksum (buf.i, length));
 	*checksum = last_checksum;
+	cm.checksum = last_checksum;
 
 	header = *(dheader_t *)buf.i;
 	for (i=0 ; i<sizeof(dheader_t)/4 ; i++) {
@@ -641,6 +687,11 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 		, name, header.version, BSP_VERSION );
 	}
 
+#if defined( NEW_FILESYSTEM ) && !defined( BSPC )
+	// start reading the files the map references in the background
+	fs_prefetch_map( name, buf.v, length );
+#endif
+
 	cmod_base = (byte *)buf.i;
 
 	// load into heap
@@ -651,6 +702,7 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	CMod_LoadPlanes (&header.lumps[LUMP_PLANES]);
 	CMod_LoadBrushSides (&header.lumps[LUMP_BRUSHSIDES]);
 	CMod_LoadBrushes (&header.lumps[LUMP_BRUSHES]);
+	CMod_BuildBrushPlanes ();
 	CMod_LoadSubmodels (&header.lumps[LUMP_MODELS]);
 	CMod_LoadNodes (&header.lumps[LUMP_NODES]);
 	CMod_LoadEntityString (&header.lumps[LUMP_ENTITIES]);
@@ -676,6 +728,7 @@ CM_ClearMap
 ==================
 */
 void CM_ClearMap( void ) {
+	CM_StopTraceLog();
 	Com_Memset( &cm, 0, sizeof( cm ) );
 	CM_ClearLevelPatches();
 }
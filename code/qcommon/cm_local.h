@@ -28,6 +28,12 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define	BOX_MODEL_HANDLE		255
 #define CAPSULE_MODEL_HANDLE	254
 
+// brush planes are also kept as a structure-of-arrays copy so that several
+// sides can be tested at once; the scalar code is used everywhere else
+#if defined( __x86_64__ ) || defined( _M_X64 ) || defined( __SSE2_MATH__ )
+#define CM_SIMD_PLANES
+#include <xmmintrin.h>
+#endif
 
 typedef struct {
 	cplane_t	*plane;
@@ -63,6 +69,8 @@ typedef struct {
 	int			numsides;
 	cbrushside_t	*sides;
 	int			checkcount;		// to avoid repeated testings
+	float		*planes;		// normal[0], normal[1], normal[2] and dist arrays, NULL if not built
+	int			planeStride;	// floats in each array, padded with planes that never clip
 } cbrush_t;
 
 
@@ -126,6 +134,8 @@ typedef struct {
 
 	int			floodvalid;
 	int			checkcount;					// incremented on each trace
+
+	int			checksum;					// of the bsp file, for trace logs
 } clipMap_t;
 
 
@@ -151,6 +161,19 @@ typedef struct
 	vec3_t		offset;
 } sphere_t;
 
+#ifdef CM_SIMD_PLANES
+// trace parameters copied into every lane, so brush sides can be tested four at a time
+typedef struct {
+	__m128		start[3];
+	__m128		end[3];
+	__m128		size[2][3];
+	__m128		sphereStart[2][3];	// start minus and plus the capsule offset
+	__m128		sphereEnd[2][3];
+	__m128		sphereOffset[3];
+	__m128		sphereRadius;
+} traceLanes_t;
+#endif
+
 typedef struct {
 	vec3_t		start;
 	vec3_t		end;
@@ -164,6 +187,9 @@ typedef struct {
 	qboolean	isPoint;	// optimized case
 	trace_t		trace;		// returned from trace call
 	sphere_t	sphere;		// sphere for oriendted capsule collision
+#ifdef CM_SIMD_PLANES
+	traceLanes_t	lanes;	// set once the fields above are final
+#endif
 } traceWork_t;
 
 typedef struct leafList_s {
@@ -188,6 +214,53 @@ cmodel_t	*CM_ClipHandleToModel( clipHandle_t handle );
 qboolean CM_BoundsIntersect( const vec3_t mins, const vec3_t maxs, const vec3_t mins2, const vec3_t maxs2 );
 qboolean CM_BoundsIntersectPoint( const vec3_t mins, const vec3_t maxs, const vec3_t point );
 
+// cm_log.c
+
+#define	CM_LOG_IDENT	(('G'<<24)+('L'<<16)+('M'<<8)+'C')	// "CMLG" little-endian
+#define	CM_LOG_VERSION	1
+
+typedef enum {
+	CM_LOG_BOXTRACE,
+	CM_LOG_TRANSFORMEDBOXTRACE,
+	CM_LOG_POINTCONTENTS
+} cmLogType_t;
+
+typedef struct {
+	int			ident;
+	int			version;
+	int			checksum;
+	char		mapname[MAX_QPATH];
+} cmLogHeader_t;
+
+// one recorded query and its result, all fields four bytes wide
+typedef struct {
+	int			type;			// cmLogType_t
+	int			model;
+	int			brushmask;
+	int			capsule;
+	vec3_t		start;			// the point for CM_LOG_POINTCONTENTS
+	vec3_t		end;
+	vec3_t		mins, maxs;
+	vec3_t		origin, angles;
+	vec3_t		boxMins, boxMaxs;	// CM_ModelBounds at the time of the call, for temp box models
+
+	float		fraction;
+	vec3_t		endpos;
+	vec3_t		normal;
+	float		dist;
+	int			surfaceFlags;
+	int			contents;
+	int			solid;			// 1 = startsolid, 2 = allsolid
+} cmLogRecord_t;
+
+extern	fileHandle_t	cm_traceLog;
+
+void CM_SwapLogRecord( cmLogRecord_t *record );
+void CM_LogTrace( cmLogType_t type, const trace_t *results, const vec3_t start, const vec3_t end,
+				 const vec3_t mins, const vec3_t maxs, clipHandle_t model, int brushmask,
+				 const vec3_t origin, const vec3_t angles, int capsule, const vec3_t boxMins, const vec3_t boxMaxs );
+void CM_LogPointContents( const vec3_t p, clipHandle_t model, const vec3_t boxMins, const vec3_t boxMaxs, int contents );
+
 // cm_patch.c
 
 struct patchCollide_s	*CM_GeneratePatchCollide( int width, int height, vec3_t *points );
@@ -0,0 +1,162 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// cm_log.c -- recording of collision queries for offline replay
+
+#include "cm_local.h"
+
+/*
+=============================================================================
+
+While a log is open every CM_BoxTrace, CM_TransformedBoxTrace and
+CM_PointContents call is written out together with its result, so that
+code/tools/cmbench can replay the same queries against the same map and
+check that the answers did not change.
+
+=============================================================================
+*/
+
+fileHandle_t	cm_traceLog;
+static int		cm_traceLogCount;
+
+/*
+==================
+CM_SwapLogRecord
+
+Every field of a record is four bytes wide
+==================
+*/
+void CM_SwapLogRecord( cmLogRecord_t *record ) {
+	int		i;
+
+	for ( i = 0 ; i < sizeof( *record ) / 4 ; i++ ) {
+		((int *)record)[i] = LittleLong( ((int *)record)[i] );
+	}
+}
+
+/*
+==================
+CM_StartTraceLog
+==================
+*/
+void CM_StartTraceLog( const char *filename ) {
+	cmLogHeader_t	header;
+
+	if ( !cm.name[0] ) {
+		Com_Printf( "CM_StartTraceLog: no map loaded.\n" );
+		return;
+	}
+
+	CM_StopTraceLog();
+
+	cm_traceLog = FS_FOpenFileWrite( filename );
+	if ( !cm_traceLog ) {
+		Com_Printf( "CM_StartTraceLog: couldn't open %s.\n", filename );
+		return;
+	}
+	cm_traceLogCount = 0;
+
+	Com_Memset( &header, 0, sizeof( header ) );
+	header.ident = LittleLong( CM_LOG_IDENT );
+	header.version = LittleLong( CM_LOG_VERSION );
+	header.checksum = LittleLong( cm.checksum );
+	Q_strncpyz( header.mapname, cm.name, sizeof( header.mapname ) );
+	FS_Write( &header, sizeof( header ), cm_traceLog );
+
+	Com_Printf( "Recording collision queries on %s to %s.\n", cm.name, filename );
+}
+
+/*
+==================
+CM_StopTraceLog
+==================
+*/
+void CM_StopTraceLog( void ) {
+	if ( !cm_traceLog ) {
+		return;
+	}
+
+	FS_FCloseFile( cm_traceLog );
+	cm_traceLog = 0;
+
+	Com_Printf( "Stopped recording collision queries, %i written.\n", cm_traceLogCount );
+}
+
+/*
+==================
+CM_LogTrace
+
+boxMins / boxMaxs are the CM_TempBoxModel bounds at the time of the call,
+which are only meaningful for the temporary box and capsule models.
+==================
+*/
+void CM_LogTrace( cmLogType_t type, const trace_t *results, const vec3_t start, const vec3_t end,
+				 const vec3_t mins, const vec3_t maxs, clipHandle_t model, int brushmask,
+				 const vec3_t origin, const vec3_t angles, int capsule, const vec3_t boxMins, const vec3_t boxMaxs ) {
+	cmLogRecord_t	record;
+
+	Com_Memset( &record, 0, sizeof( record ) );
+	record.type = type;
+	record.model = model;
+	record.brushmask = brushmask;
+	record.capsule = capsule;
+	VectorCopy( start, record.start );
+	VectorCopy( end, record.end );
+	VectorCopy( mins ? mins : vec3_origin, record.mins );
+	VectorCopy( maxs ? maxs : vec3_origin, record.maxs );
+	VectorCopy( origin, record.origin );
+	VectorCopy( angles, record.angles );
+	VectorCopy( boxMins, record.boxMins );
+	VectorCopy( boxMaxs, record.boxMaxs );
+
+	record.fraction = results->fraction;
+	VectorCopy( results->endpos, record.endpos );
+	VectorCopy( results->plane.normal, record.normal );
+	record.dist = results->plane.dist;
+	record.surfaceFlags = results->surfaceFlags;
+	record.contents = results->contents;
+	record.solid = ( results->startsolid ? 1 : 0 ) | ( results->allsolid ? 2 : 0 );
+
+	CM_SwapLogRecord( &record );
+	FS_Write( &record, sizeof( record ), cm_traceLog );
+	cm_traceLogCount++;
+}
+
+/*
+==================
+CM_LogPointContents
+==================
+*/
+void CM_LogPointContents( const vec3_t p, clipHandle_t model, const vec3_t boxMins, const vec3_t boxMaxs, int contents ) {
+	cmLogRecord_t	record;
+
+	Com_Memset( &record, 0, sizeof( record ) );
+	record.type = CM_LOG_POINTCONTENTS;
+	record.model = model;
+	VectorCopy( p, record.start );
+	VectorCopy( boxMins, record.boxMins );
+	VectorCopy( boxMaxs, record.boxMaxs );
+	record.contents = contents;
+
+	CM_SwapLogRecord( &record );
+	FS_Write( &record, sizeof( record ), cm_traceLog );
+	cm_traceLogCount++;
+}
@@ -232,11 +232,16 @@ int CM_PointContents( const vec3_t p, clipHandle_t model ) {
 	int			contents;
 	float		d;
 	cmodel_t	*clipm;
+	vec3_t		boxMins, boxMaxs;
 
 	if (!cm.numNodes) {	// map not loaded
 		return 0;
 	}
 
+	if ( cm_traceLog ) {
+		CM_ModelBounds( model, boxMins, boxMaxs );
+	}
+
 	if ( model ) {
 		clipm = CM_ClipHandleToModel( model );
 		leaf = &clipm->leaf;
@@ -269,6 +274,10 @@ int CM_PointContents( const vec3_t p, clipHandle_t model ) {
 		}
 	}
 
+	if ( cm_traceLog ) {
+		CM_LogPointContents( p, model, boxMins, boxMaxs, contents );
+	}
+
 	return contents;
 }
 
@@ -21,6 +21,11 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include "cm_local.h"
 
+#if defined( CM_SIMD_PLANES ) && defined( _MSC_VER )
+// /fp:fast would let the SSE brush tests drift from the scalar ones
+#pragma float_control( precise, on )
+#endif
+
 // always use bbox vs. bbox collision and never capsule vs. bbox or vice versa
 //#define ALWAYS_BBOX_VS_BBOX
 // always use capsule vs. capsule collision and never capsule vs. bbox or vice versa
@@ -153,6 +158,107 @@ POSITION TESTING
 ===============================================================================
 */
 
+#ifdef CM_SIMD_PLANES
+/*
+================
+CM_SetTraceLanes
+================
+*/
+static void CM_SetTraceLanes( traceWork_t *tw ) {
+	traceLanes_t	*lanes;
+	int				i;
+
+	lanes = &tw->lanes;
+	for ( i = 0 ; i < 3 ; i++ ) {
+		lanes->start[i] = _mm_set1_ps( tw->start[i] );
+		lanes->end[i] = _mm_set1_ps( tw->end[i] );
+		lanes->size[0][i] = _mm_set1_ps( tw->size[0][i] );
+		lanes->size[1][i] = _mm_set1_ps( tw->size[1][i] );
+		lanes->sphereStart[0][i] = _mm_set1_ps( tw->start[i] - tw->sphere.offset[i] );
+		lanes->sphereStart[1][i] = _mm_set1_ps( tw->start[i] + tw->sphere.offset[i] );
+		lanes->sphereEnd[0][i] = _mm_set1_ps( tw->end[i] - tw->sphere.offset[i] );
+		lanes->sphereEnd[1][i] = _mm_set1_ps( tw->end[i] + tw->sphere.offset[i] );
+		lanes->sphereOffset[i] = _mm_set1_ps( tw->sphere.offset[i] );
+	}
+	lanes->sphereRadius = _mm_set1_ps( tw->sphere.radius );
+}
+
+/*
+================
+CM_SelectLanes
+
+Per lane mask ? a : b
+================
+*/
+static ID_INLINE __m128 CM_SelectLanes( __m128 mask, __m128 a, __m128 b ) {
+	return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+}
+
+/*
+================
+CM_BrushPlaneDistances
+
+Distances of the trace start and end points from four consecutive sides of
+a brush, with each plane pushed out for the box or capsule being traced.
+Every operation is done in the same order as the scalar loops, so the
+results are bit identical to them as long as the compiler doesn't
+reassociate either one; the Makefile builds this file with
+-fno-associative-math for that.  d2 may be NULL for position tests.
+================
+*/
+static ID_INLINE void CM_BrushPlaneDistances( const traceWork_t *tw, const cbrush_t *brush, int first, __m128 *d1, __m128 *d2 ) {
+	const traceLanes_t	*lanes;
+	const float			*p;
+	__m128				nx, ny, nz, dist, mask;
+	__m128				sx, sy, sz, ex, ey, ez;
+
+	lanes = &tw->lanes;
+	p = brush->planes + first;
+	nx = _mm_loadu_ps( p );
+	ny = _mm_loadu_ps( p + brush->planeStride );
+	nz = _mm_loadu_ps( p + brush->planeStride * 2 );
+	dist = _mm_loadu_ps( p + brush->planeStride * 3 );
+
+	if ( tw->sphere.use ) {
+		// adjust the plane distance appropriately for radius
+		dist = _mm_add_ps( dist, lanes->sphereRadius );
+
+		// find the closest point on the capsule to the plane
+		mask = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, lanes->sphereOffset[0] ),
+			_mm_mul_ps( ny, lanes->sphereOffset[1] ) ), _mm_mul_ps( nz, lanes->sphereOffset[2] ) );
+		mask = _mm_cmpgt_ps( mask, _mm_setzero_ps() );
+
+		sx = CM_SelectLanes( mask, lanes->sphereStart[0][0], lanes->sphereStart[1][0] );
+		sy = CM_SelectLanes( mask, lanes->sphereStart[0][1], lanes->sphereStart[1][1] );
+		sz = CM_SelectLanes( mask, lanes->sphereStart[0][2], lanes->sphereStart[1][2] );
+		ex = CM_SelectLanes( mask, lanes->sphereEnd[0][0], lanes->sphereEnd[1][0] );
+		ey = CM_SelectLanes( mask, lanes->sphereEnd[0][1], lanes->sphereEnd[1][1] );
+		ez = CM_SelectLanes( mask, lanes->sphereEnd[0][2], lanes->sphereEnd[1][2] );
+	} else {
+		__m128	ox, oy, oz;
+
+		// adjust the plane distance appropriately for mins/maxs,
+		// picking the corner the same way as plane->signbits
+		ox = CM_SelectLanes( _mm_cmplt_ps( nx, _mm_setzero_ps() ), lanes->size[1][0], lanes->size[0][0] );
+		oy = CM_SelectLanes( _mm_cmplt_ps( ny, _mm_setzero_ps() ), lanes->size[1][1], lanes->size[0][1] );
+		oz = CM_SelectLanes( _mm_cmplt_ps( nz, _mm_setzero_ps() ), lanes->size[1][2], lanes->size[0][2] );
+		dist = _mm_sub_ps( dist, _mm_add_ps( _mm_add_ps( _mm_mul_ps( ox, nx ), _mm_mul_ps( oy, ny ) ), _mm_mul_ps( oz, nz ) ) );
+
+		sx = lanes->start[0];
+		sy = lanes->start[1];
+		sz = lanes->start[2];
+		ex = lanes->end[0];
+		ey = lanes->end[1];
+		ez = lanes->end[2];
+	}
+
+	*d1 = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( sx, nx ), _mm_mul_ps( sy, ny ) ), _mm_mul_ps( sz, nz ) ), dist );
+	if ( d2 ) {
+		*d2 = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( ex, nx ), _mm_mul_ps( ey, ny ) ), _mm_mul_ps( ez, nz ) ), dist );
+	}
+}
+#endif
+
 /*
 ================
 CM_TestBoxInBrush
@@ -182,6 +288,22 @@ void CM_TestBoxInBrush( traceWork_t *tw, cbrush_t *brush ) {
 		return;
 	}
 
+#ifdef CM_SIMD_PLANES
+	if ( brush->planes ) {
+		__m128	d1s;
+
+		// the first six planes are the axial planes, so we only
+		// need to test the remainder, four at a time
+		for ( i = 6 ; i < brush->numsides ; i += 4 ) {
+			CM_BrushPlaneDistances( tw, brush, i, &d1s, NULL );
+
+			// if completely in front of any face, no intersection
+			if ( _mm_movemask_ps( _mm_cmpgt_ps( d1s, _mm_setzero_ps() ) ) ) {
+				return;
+			}
+		}
+	} else
+#endif
    if ( tw->sphere.use ) {
 		// the first six planes are the axial planes, so we only
 		// need to test the remainder
@@ -507,6 +629,79 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 
 	leadside = NULL;
 
+#ifdef CM_SIMD_PLANES
+	if ( brush->planes ) {
+		__m128	d1s, d2s;
+		float	d1v[4], d2v[4];
+		int		startMask, endMask;
+		int		j;
+
+		//
+		// same as the scalar loops below, but four planes at a time; only
+		// the planes that the trace crosses need to be looked at one by one
+		//
+		for ( i = 0 ; i < brush->numsides ; i += 4 ) {
+			CM_BrushPlaneDistances( tw, brush, i, &d1s, &d2s );
+
+			startMask = _mm_movemask_ps( _mm_cmpgt_ps( d1s, _mm_setzero_ps() ) );
+			endMask = _mm_movemask_ps( _mm_cmpgt_ps( d2s, _mm_setzero_ps() ) );
+
+			// if completely in front of any face, no intersection with the entire brush
+			if ( startMask & _mm_movemask_ps( _mm_or_ps(
+				_mm_cmpge_ps( d2s, _mm_set1_ps( SURFACE_CLIP_EPSILON ) ),
+				_mm_cmpge_ps( d2s, d1s ) ) ) ) {
+				return;
+			}
+
+			if ( endMask ) {
+				getout = qtrue;	// endpoint is not in solid
+			}
+			if ( startMask ) {
+				startout = qtrue;
+			}
+
+			// if it doesn't cross any of the planes, they aren't relevant
+			if ( !( startMask | endMask ) ) {
+				continue;
+			}
+
+			_mm_storeu_ps( d1v, d1s );
+			_mm_storeu_ps( d2v, d2s );
+
+			for ( j = 0 ; j < 4 ; j++ ) {
+				if ( !( ( startMask | endMask ) & ( 1 << j ) ) ) {
+					continue;
+				}
+
+				d1 = d1v[j];
+				d2 = d2v[j];
+				side = brush->sides + i + j;
+				plane = side->plane;
+
+				// crosses face
+				if (d1 > d2) {	// enter
+					f = (d1-SURFACE_CLIP_EPSILON) / (d1-d2);
+					if ( f < 0 ) {
+						f = 0;
+					}
+					if (f > enterFrac) {
+						enterFrac = f;
+						clipplane = plane;
+						leadside = side;
+					}
+				} else {	// leave
+					f = (d1+SURFACE_CLIP_EPSILON) / (d1-d2);
+					if ( f > 1 ) {
+						f = 1;
+					}
+					if (f < leaveFrac) {
+						leaveFrac = f;
+					}
+				}
+			}
+		}
+	} else
+#endif
 	if ( tw->sphere.use ) {
 		//
 		// compare the trace against all planes of the brush
@@ -1263,6 +1458,10 @@ void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, vec3_t mi
 		}
 	}
 
+#ifdef CM_SIMD_PLANES
+	CM_SetTraceLanes( &tw );
+#endif
+
 	//
 	// check for position test special case
 	//
@@ -1366,7 +1565,35 @@ CM_BoxTrace
 void CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
 						  vec3_t mins, vec3_t maxs,
 						  clipHandle_t model, int brushmask, int capsule ) {
+	vec3_t		boxMins, boxMaxs;
+
+	if ( cm_traceLog ) {
+		CM_ModelBounds( model, boxMins, boxMaxs );
+	}
+
 	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, capsule, NULL );
+
+	if ( cm_traceLog ) {
+		CM_LogTrace( CM_LOG_BOXTRACE, results, start, end, mins, maxs, model, brushmask,
+			vec3_origin, vec3_origin, capsule, boxMins, boxMaxs );
+	}
+}
+
+/*
+==================
+CM_BoxTraceBatch
+
+CM_BoxTrace for each request against the same model, saving the cgame
+a system call per trace.
+==================
+*/
+void CM_BoxTraceBatch( trace_t *results, const traceRequest_t *requests, int count, clipHandle_t model ) {
+	int		i;
+
+	for ( i = 0 ; i < count ; i++ ) {
+		CM_BoxTrace( &results[i], requests[i].start, requests[i].end, (float *)requests[i].mins, (float *)requests[i].maxs,
+				model, requests[i].contentmask, requests[i].capsule );
+	}
 }
 
 /*
@@ -1392,6 +1619,7 @@ void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 	float		halfheight;
 	float		t;
 	sphere_t	sphere;
+	vec3_t		boxMins, boxMaxs;
 
 	if ( !mins ) {
 		mins = vec3_origin;
@@ -1400,6 +1628,10 @@ void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 		maxs = vec3_origin;
 	}
 
+	if ( cm_traceLog ) {
+		CM_ModelBounds( model, boxMins, boxMaxs );
+	}
+
 	// adjust so that mins and maxs are always symetric, which
 	// avoids some complications with plane expanding of rotated
 	// bmodels
@@ -1467,4 +1699,9 @@ void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 	trace.endpos[2] = start[2] + trace.fraction * (end[2] - start[2]);
 
 	*results = trace;
+
+	if ( cm_traceLog ) {
+		CM_LogTrace( CM_LOG_TRANSFORMEDBOXTRACE, results, start, end, mins, maxs, model, brushmask,
+			origin, angles, capsule, boxMins, boxMaxs );
+	}
 }
@@ -3325,6 +3325,8 @@ Com_Shutdown
 =================
 */
 void Com_Shutdown (void) {
+	Com_ShutdownJobs();
+
 	if (logfile) {
 		FS_FCloseFile (logfile);
 		logfile = 0;
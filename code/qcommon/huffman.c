@@ -29,14 +29,15 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 static int			bloc = 0;
 
+// the write path only touches the caller's offset, so several messages can
+// be encoded at once from different threads
 void	Huff_putBit( int bit, byte *fout, int *offset) {
-	bloc = *offset;
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+	int pos = *offset;
+	if ((pos&7) == 0) {
+		fout[(pos>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
-	*offset = bloc;
+	fout[(pos>>3)] |= bit << (pos&7);
+	*offset = pos + 1;
 }
 
 int		Huff_getBloc(void)
@@ -59,12 +60,12 @@ int		Huff_getBit( byte *fin, int *offset) {
 }
 
 /* Add a bit to the output file (buffered) */
-static void add_bit (char bit, byte *fout) {
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+static void add_bit (char bit, byte *fout, int *offset) {
+	if ((*offset&7) == 0) {
+		fout[(*offset>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
+	fout[(*offset>>3)] |= bit << (*offset&7);
+	(*offset)++;
 }
 
 /* Receive one bit from the input file (buffered) */
@@ -303,19 +304,19 @@ void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset, int maxo
 }
 
 /* Send the prefix code for this node */
-static void send(node_t *node, node_t *child, byte *fout, int maxoffset) {
+static void send(node_t *node, node_t *child, byte *fout, int *offset, int maxoffset) {
 	if (node->parent) {
-		send(node->parent, node, fout, maxoffset);
+		send(node->parent, node, fout, offset, maxoffset);
 	}
 	if (child) {
-		if (bloc >= maxoffset) {
-			bloc = maxoffset + 1;
+		if (*offset >= maxoffset) {
+			*offset = maxoffset + 1;
 			return;
 		}
 		if (node->right == child) {
-			add_bit(1, fout);
+			add_bit(1, fout, offset);
 		} else {
-			add_bit(0, fout);
+			add_bit(0, fout, offset);
 		}
 	}
 }
@@ -327,17 +328,136 @@ void Huff_transmit (huff_t *huff, int ch, byte *fout, int maxoffset) {
 		/* node_t hasn't been transmitted, send a NYT, then the symbol */
 		Huff_transmit(huff, NYT, fout, maxoffset);
 		for (i = 7; i >= 0; i--) {
-			add_bit((char)((ch >> i) & 0x1), fout);
+			add_bit((char)((ch >> i) & 0x1), fout, &bloc);
 		}
 	} else {
-		send(huff->loc[ch], NULL, fout, maxoffset);
+		send(huff->loc[ch], NULL, fout, &bloc, maxoffset);
 	}
 }
 
 void Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset, int maxoffset) {
-	bloc = *offset;
-	send(huff->loc[ch], NULL, fout, maxoffset);
-	*offset = bloc;
+	send(huff->loc[ch], NULL, fout, offset, maxoffset);
+}
+
+/* Flatten the current state of a tree into a table.  The tree must not be
+ * updated afterwards, since codes longer than the lookup still walk it */
+void Huff_BuildTable( huffTable_t *table, huff_t *huff ) {
+	int		ch, i, length;
+	unsigned int	code;
+	node_t	*node;
+
+	Com_Memset( table, 0, sizeof( *table ) );
+	table->tree = huff->tree;
+
+	for ( ch = 0; ch <= HMAX; ch++ ) {
+		if ( !huff->loc[ch] ) {
+			continue;
+		}
+
+		// the path is found leaf first, but sent root first
+		length = 0;
+		for ( node = huff->loc[ch]; node->parent; node = node->parent ) {
+			length++;
+		}
+		if ( length > 32 ) {
+			Com_Error( ERR_FATAL, "Huff_BuildTable: code for %i is too long", ch );
+		}
+
+		code = 0;
+		i = length;
+		for ( node = huff->loc[ch]; node->parent; node = node->parent ) {
+			i--;
+			if ( node->parent->right == node ) {
+				code |= 1u << i;
+			}
+		}
+
+		table->codes[ch] = code;
+		table->lengths[ch] = length;
+
+		if ( length <= HUFF_LOOKUP_BITS ) {
+			for ( i = 0; i < ( 1 << ( HUFF_LOOKUP_BITS - length ) ); i++ ) {
+				table->lookup[code | ( i << length )] = ch | ( length << 9 );
+			}
+		}
+	}
+}
+
+/* Get a symbol, same as Huff_offsetReceive on the tree the table was built from */
+void Huff_tableReceive( const huffTable_t *table, int *ch, const byte *fin, int *offset, int maxoffset ) {
+	int		pos = *offset;
+	int		bytes = ( maxoffset + 7 ) >> 3;
+	int		index = pos >> 3;
+	int		length;
+	unsigned int	peek;
+
+	if ( pos >= maxoffset ) {
+		*ch = 0;
+		*offset = maxoffset + 1;
+		return;
+	}
+
+	// bits past the end read as zero, the length check below catches them
+	if ( index + 2 < bytes ) {
+		peek = fin[index] | ( fin[index + 1] << 8 ) | ( fin[index + 2] << 16 );
+	} else if ( index + 1 < bytes ) {
+		peek = fin[index] | ( fin[index + 1] << 8 );
+	} else {
+		peek = fin[index];
+	}
+	peek = ( peek >> ( pos & 7 ) ) & ( ( 1 << HUFF_LOOKUP_BITS ) - 1 );
+
+	if ( !table->lookup[peek] ) {
+		Huff_offsetReceive( table->tree, ch, (byte *)fin, offset, maxoffset );
+		return;
+	}
+
+	length = table->lookup[peek] >> 9;
+	if ( pos + length > maxoffset ) {
+		*ch = 0;
+		*offset = maxoffset + 1;
+		return;
+	}
+
+	*ch = table->lookup[peek] & 0x1ff;
+	*offset = pos + length;
+}
+
+/* Send a symbol, same as Huff_offsetTransmit on the tree the table was built from */
+void Huff_tableTransmit( const huffTable_t *table, int ch, byte *fout, int *offset, int maxoffset ) {
+	int		pos = *offset;
+	int		length = table->lengths[ch];
+	unsigned int	code = table->codes[ch];
+	int		n;
+
+	// write as much as fits, a bit at a time like send does
+	if ( pos + length > maxoffset ) {
+		while ( length-- ) {
+			if ( pos >= maxoffset ) {
+				*offset = maxoffset + 1;
+				return;
+			}
+			Huff_putBit( code & 1, fout, &pos );
+			code >>= 1;
+		}
+	}
+
+	while ( length > 0 ) {
+		n = 8 - ( pos & 7 );
+		if ( n > length ) {
+			n = length;
+		}
+		if ( !( pos & 7 ) ) {
+			fout[pos >> 3] = code & ( 0xff >> ( 8 - n ) );
+		} else {
+			fout[pos >> 3] |= ( code & ( 0xff >> ( 8 - n ) ) ) << ( pos & 7 );
+		}
+		code >>= n;
+		pos += n;
+		length -= n;
+	}
+
+	*offset = pos;
 }
 
 void Huff_Decompress(msg_t *mbuf, int offset) {
@@ -392,8 +512,6 @@ void Huff_Decompress(msg_t *mbuf, int offset) {
 	Com_Memcpy(mbuf->data + offset, seq, cch);
 }
 
-extern 	int oldsize;
-
 void Huff_Compress(msg_t *mbuf, int offset) {
 	int			i, ch, size;
 	byte		seq[65536];
@@ -0,0 +1,201 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// jobs.c -- worker pool for splitting independent work across threads
+
+#include "q_shared.h"
+#include "qcommon.h"
+
+/*
+=============================================================================
+
+Worker threads are created on first use and then sleep on a semaphore
+between batches.  Only one batch can be in flight at a time, and it is
+always started and waited on by the main thread, so the rest of the
+engine never observes a job running concurrently with normal code.
+
+=============================================================================
+*/
+
+typedef struct {
+	void		(*function)( void *context, int index, int thread );
+	void		*context;
+	int			count;
+	int			nextIndex;
+	int			nextThread;
+} jobBatch_t;
+
+static struct {
+	int				numWorkers;
+	sysThread_t		*workers[MAX_JOB_THREADS - 1];
+	sysMutex_t		*mutex;
+	sysSemaphore_t	*start;
+	sysSemaphore_t	*done;
+	qboolean		shutdown;
+	jobBatch_t		batch;
+} jobs;
+
+/*
+==================
+Com_ProcessJobs
+
+Runs jobs from the current batch until there are none left.
+==================
+*/
+static void Com_ProcessJobs( int thread ) {
+	int index;
+
+	while ( 1 ) {
+		Sys_LockMutex( jobs.mutex );
+		index = jobs.batch.nextIndex++;
+		Sys_UnlockMutex( jobs.mutex );
+
+		if ( index >= jobs.batch.count ) {
+			return;
+		}
+
+		jobs.batch.function( jobs.batch.context, index, thread );
+	}
+}
+
+/*
+==================
+Com_JobWorker
+==================
+*/
+static void Com_JobWorker( void *arg ) {
+	int thread;
+
+	while ( 1 ) {
+		Sys_SemaphoreWait( jobs.start );
+		if ( jobs.shutdown ) {
+			return;
+		}
+
+		Sys_LockMutex( jobs.mutex );
+		thread = jobs.batch.nextThread++;
+		Sys_UnlockMutex( jobs.mutex );
+
+		Com_ProcessJobs( thread );
+		Sys_SemaphorePost( jobs.done );
+	}
+}
+
+/*
+==================
+Com_StartJobWorkers
+
+Returns the number of worker threads available, which may be fewer than
+requested if thread creation fails.
+==================
+*/
+static int Com_StartJobWorkers( int count ) {
+	if ( !jobs.mutex ) {
+		jobs.mutex = Sys_CreateMutex();
+		jobs.start = Sys_CreateSemaphore( 0 );
+		jobs.done = Sys_CreateSemaphore( 0 );
+	}
+
+	while ( jobs.numWorkers < count ) {
+		sysThread_t *thread = Sys_CreateThread( Com_JobWorker, NULL );
+		if ( !thread ) {
+			break;
+		}
+		jobs.workers[jobs.numWorkers++] = thread;
+		Com_DPrintf( "Started job worker thread %i\n", jobs.numWorkers );
+	}
+
+	return jobs.numWorkers;
+}
+
+/*
+==================
+Com_RunJobs
+==================
+*/
+void Com_RunJobs( void (*function)( void *context, int index, int thread ), void *context, int count, int numThreads ) {
+	int helpers;
+	int i;
+
+	if ( numThreads > MAX_JOB_THREADS ) {
+		numThreads = MAX_JOB_THREADS;
+	}
+
+	helpers = numThreads - 1;
+	if ( helpers > count - 1 ) {
+		helpers = count - 1;
+	}
+	if ( helpers > 0 ) {
+		int available = Com_StartJobWorkers( helpers );
+		if ( helpers > available ) {
+			helpers = available;
+		}
+	}
+
+	if ( helpers <= 0 ) {
+		for ( i = 0; i < count; i++ ) {
+			function( context, i, 0 );
+		}
+		return;
+	}
+
+	jobs.batch.function = function;
+	jobs.batch.context = context;
+	jobs.batch.count = count;
+	jobs.batch.nextIndex = 0;
+	jobs.batch.nextThread = 1;
+
+	for ( i = 0; i < helpers; i++ ) {
+		Sys_SemaphorePost( jobs.start );
+	}
+
+	Com_ProcessJobs( 0 );
+
+	for ( i = 0; i < helpers; i++ ) {
+		Sys_SemaphoreWait( jobs.done );
+	}
+}
+
+/*
+==================
+Com_ShutdownJobs
+==================
+*/
+void Com_ShutdownJobs( void ) {
+	int i;
+
+	if ( !jobs.mutex ) {
+		return;
+	}
+
+	jobs.shutdown = qtrue;
+	for ( i = 0; i < jobs.numWorkers; i++ ) {
+		Sys_SemaphorePost( jobs.start );
+	}
+	for ( i = 0; i < jobs.numWorkers; i++ ) {
+		Sys_JoinThread( jobs.workers[i] );
+	}
+
+	Sys_DestroySemaphore( jobs.done );
+	Sys_DestroySemaphore( jobs.start );
+	Sys_DestroyMutex( jobs.mutex );
+	Com_Memset( &jobs, 0, sizeof( jobs ) );
+}
@@ -20,6 +20,11 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 ===========================================================================
 */
 
+#ifdef __linux__
+// recvmmsg and sendmmsg
+#define _GNU_SOURCE
+#endif
+
 #include "../qcommon/q_shared.h"
 #include "../qcommon/qcommon.h"
 
@@ -50,6 +55,7 @@ typedef unsigned short sa_family_t;
 #	define EADDRNOTAVAIL	WSAEADDRNOTAVAIL
 #	define EAFNOSUPPORT		WSAEAFNOSUPPORT
 #	define ECONNRESET			WSAECONNRESET
+#	define EINTR					WSAEINTR
 typedef u_long	ioctlarg_t;
 #	define socketError		WSAGetLastError( )
 
@@ -89,6 +95,13 @@ typedef int SOCKET;
 typedef int	ioctlarg_t;
 #	define socketError			errno
 
+#	if defined(__linux__) && defined(MSG_WAITFORONE)
+#		define NET_MMSG
+#	endif
+
+#	define NET_RECV_THREAD
+#	include <fcntl.h>
+
 #endif
 
 static qboolean usingSocks = qfalse;
@@ -111,6 +124,10 @@ static cvar_t	*net_mcast6iface;
 
 static cvar_t	*net_dropsim;
 
+#ifdef NET_RECV_THREAD
+static cvar_t	*net_recvThread;
+#endif
+
 static struct sockaddr	socksRelayAddr;
 
 static SOCKET	ip_socket = INVALID_SOCKET;
@@ -513,6 +530,277 @@ qboolean	NET_IsLocalAddress( netadr_t adr ) {
 
 //=============================================================================
 
+#ifdef NET_MMSG
+/*
+=============================================================================
+
+BATCHED SOCKET I/O
+
+Each wake-up drains a socket with one recvmmsg call, and the snapshots sent
+between NET_BeginSendBatch and NET_EndSendBatch go out with one sendmmsg
+call, instead of a system call per datagram.
+
+=============================================================================
+*/
+
+#define	NET_RECV_BATCH		32
+#define	NET_SEND_BATCH		128
+#define	NET_SEND_PACKETLEN	1400		// MAX_PACKETLEN in net_chan.c, larger packets are sent directly
+
+typedef struct {
+	int				count;
+	int				current;
+	struct mmsghdr	headers[NET_RECV_BATCH];
+	struct iovec	iovecs[NET_RECV_BATCH];
+	struct sockaddr_storage	addresses[NET_RECV_BATCH];
+	byte			data[NET_RECV_BATCH][MAX_MSGLEN + 1];
+} netRecvBatch_t;
+
+typedef struct {
+	qboolean		active;
+	int				count;
+	SOCKET			sockets[NET_SEND_BATCH];
+	struct mmsghdr	headers[NET_SEND_BATCH];
+	struct iovec	iovecs[NET_SEND_BATCH];
+	struct sockaddr_storage	addresses[NET_SEND_BATCH];
+	byte			data[NET_SEND_BATCH][NET_SEND_PACKETLEN];
+} netSendBatch_t;
+
+static netRecvBatch_t	*net_recvBatches[3];	// ip_socket, ip6_socket, multicast6_socket, while open
+static netSendBatch_t	net_sendBatch;
+static qboolean			net_mmsgUnsupported;
+
+/*
+==================
+NET_RecvFrom
+
+Same as recvfrom, but returns the datagrams left over from the last
+recvmmsg on the socket before reading a new batch. Every socket has a batch
+of its own, so reading one never drops what is left of another.
+==================
+*/
+static int NET_RecvFrom( SOCKET sock, byte *data, int maxsize, struct sockaddr_storage *from, socklen_t *fromlen ) {
+	netRecvBatch_t	*batch;
+	struct msghdr	*hdr;
+	int				i, length;
+
+	if ( sock == ip_socket ) {
+		batch = net_recvBatches[0];
+	} else if ( sock == ip6_socket ) {
+		batch = net_recvBatches[1];
+	} else {
+		batch = net_recvBatches[2];
+	}
+
+	if ( !batch || net_mmsgUnsupported ) {
+		return recvfrom( sock, (void *)data, maxsize, 0, (struct sockaddr *)from, fromlen );
+	}
+
+	if ( batch->current >= batch->count ) {
+		for ( i = 0 ; i < NET_RECV_BATCH ; i++ ) {
+			batch->iovecs[i].iov_base = batch->data[i];
+			batch->iovecs[i].iov_len = sizeof( batch->data[i] );
+
+			hdr = &batch->headers[i].msg_hdr;
+			Com_Memset( hdr, 0, sizeof( *hdr ) );
+			hdr->msg_name = &batch->addresses[i];
+			hdr->msg_namelen = sizeof( batch->addresses[i] );
+			hdr->msg_iov = &batch->iovecs[i];
+			hdr->msg_iovlen = 1;
+		}
+
+		batch->current = 0;
+		batch->count = recvmmsg( sock, batch->headers, NET_RECV_BATCH, MSG_DONTWAIT, NULL );
+
+		if ( batch->count == SOCKET_ERROR ) {
+			batch->count = 0;
+			if ( socketError == ENOSYS ) {
+				net_mmsgUnsupported = qtrue;
+				return recvfrom( sock, (void *)data, maxsize, 0, (struct sockaddr *)from, fromlen );
+			}
+			return SOCKET_ERROR;
+		}
+	}
+
+	i = batch->current++;
+	hdr = &batch->headers[i].msg_hdr;
+
+	// truncated like recvfrom would, so the oversize check still sees it
+	length = MIN( (int)batch->headers[i].msg_len, maxsize );
+	Com_Memcpy( data, batch->data[i], length );
+	Com_Memcpy( from, hdr->msg_name, hdr->msg_namelen );
+	*fromlen = hdr->msg_namelen;
+
+	return length;
+}
+
+/*
+==================
+NET_AllocRecvBatches
+
+Gives every open socket a receive batch, called after opening them
+==================
+*/
+static void NET_AllocRecvBatches( void ) {
+	SOCKET	sockets[3];
+	int		i;
+
+	sockets[0] = ip_socket;
+	sockets[1] = ip6_socket;
+	sockets[2] = multicast6_socket != ip6_socket ? multicast6_socket : INVALID_SOCKET;
+
+	for ( i = 0 ; i < ARRAY_LEN( net_recvBatches ) ; i++ ) {
+		if ( sockets[i] == INVALID_SOCKET || net_mmsgUnsupported ) {
+			continue;
+		}
+
+		net_recvBatches[i] = malloc( sizeof( *net_recvBatches[i] ) );
+		if ( net_recvBatches[i] ) {
+			net_recvBatches[i]->count = 0;
+			net_recvBatches[i]->current = 0;
+		}
+	}
+}
+
+/*
+==================
+NET_FreeRecvBatches
+
+Called after closing the sockets, whose descriptors can be reused by new ones
+==================
+*/
+static void NET_FreeRecvBatches( void ) {
+	int		i;
+
+	for ( i = 0 ; i < ARRAY_LEN( net_recvBatches ) ; i++ ) {
+		free( net_recvBatches[i] );
+		net_recvBatches[i] = NULL;
+	}
+}
+
+/*
+==================
+NET_SendBatch
+
+Sends everything queued, one sendmmsg per run of packets on the same socket
+==================
+*/
+static void NET_SendBatch( void ) {
+	netSendBatch_t	*batch = &net_sendBatch;
+	int				start, end, ret, err;
+
+	for ( start = 0 ; start < batch->count ; start = end ) {
+		for ( end = start + 1 ; end < batch->count && batch->sockets[end] == batch->sockets[start] ; end++ ) {
+		}
+
+		while ( start < end ) {
+			if ( net_mmsgUnsupported ) {
+				ret = sendto( batch->sockets[start], batch->iovecs[start].iov_base, batch->iovecs[start].iov_len, 0,
+					batch->headers[start].msg_hdr.msg_name, batch->headers[start].msg_hdr.msg_namelen );
+				if ( ret != SOCKET_ERROR ) {
+					ret = 1;
+				}
+			} else {
+				ret = sendmmsg( batch->sockets[start], &batch->headers[start], end - start, 0 );
+			}
+
+			if ( ret == SOCKET_ERROR ) {
+				err = socketError;
+
+				if ( err == ENOSYS && !net_mmsgUnsupported ) {
+					net_mmsgUnsupported = qtrue;
+					continue;
+				}
+
+				// the packet that failed is dropped, like a failed sendto
+				if ( err != EAGAIN ) {
+					Com_Printf( "Sys_SendPacket: %s\n", NET_ErrorString() );
+				}
+				ret = 1;
+			}
+
+			start += ret;
+		}
+	}
+
+	batch->count = 0;
+}
+
+/*
+==================
+NET_QueueSend
+
+Returns qfalse if the packet has to be sent directly
+==================
+*/
+static qboolean NET_QueueSend( SOCKET sock, int length, const void *data, const struct sockaddr_storage *addr, socklen_t addrlen ) {
+	netSendBatch_t	*batch = &net_sendBatch;
+	struct msghdr	*hdr;
+	int				i;
+
+	if ( length > NET_SEND_PACKETLEN ) {
+		// keep the order of the packets
+		NET_SendBatch();
+		return qfalse;
+	}
+
+	if ( batch->count == NET_SEND_BATCH ) {
+		NET_SendBatch();
+	}
+
+	i = batch->count++;
+	batch->sockets[i] = sock;
+	Com_Memcpy( batch->data[i], data, length );
+	Com_Memcpy( &batch->addresses[i], addr, addrlen );
+	batch->iovecs[i].iov_base = batch->data[i];
+	batch->iovecs[i].iov_len = length;
+
+	hdr = &batch->headers[i].msg_hdr;
+	Com_Memset( hdr, 0, sizeof( *hdr ) );
+	hdr->msg_name = &batch->addresses[i];
+	hdr->msg_namelen = addrlen;
+	hdr->msg_iov = &batch->iovecs[i];
+	hdr->msg_iovlen = 1;
+
+	return qtrue;
+}
+
+/*
+==================
+NET_BeginSendBatch
+
+Queues the packets sent to clients until NET_EndSendBatch, which has to be
+called in the same function
+==================
+*/
+void NET_BeginSendBatch( void ) {
+	net_sendBatch.active = qtrue;
+}
+
+/*
+==================
+NET_EndSendBatch
+==================
+*/
+void NET_EndSendBatch( void ) {
+	NET_SendBatch();
+	net_sendBatch.active = qfalse;
+}
+
+#else
+
+#define NET_RecvFrom( sock, data, maxsize, from, fromlen )	recvfrom( sock, (void *)(data), maxsize, 0, (struct sockaddr *)(from), fromlen )
+
+void NET_BeginSendBatch( void ) {
+}
+
+void NET_EndSendBatch( void ) {
+}
+
+#endif
+
+//=============================================================================
+
 /*
 ==================
 NET_GetPacket
@@ -527,26 +815,29 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 	socklen_t	fromlen;
 	int		err;
 	
+	// rejected packets move on to the next one, as datagrams already read
+	// into a receive batch don't show up in select again
 	if(ip_socket != INVALID_SOCKET && FD_ISSET(ip_socket, fdr))
 	{
-		fromlen = sizeof(from);
-		ret = recvfrom( ip_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen );
-		
-		if (ret == SOCKET_ERROR)
+		while(1)
 		{
-			err = socketError;
+			fromlen = sizeof(from);
+			ret = NET_RecvFrom( ip_socket, net_message->data, net_message->maxsize, &from, &fromlen );
+			
+			if (ret == SOCKET_ERROR)
+			{
+				err = socketError;
 
-			if( err != EAGAIN && err != ECONNRESET )
-				Com_Printf( "NET_GetPacket: %s\n", NET_ErrorString() );
-		}
-		else
-		{
+				if( err != EAGAIN && err != ECONNRESET )
+					Com_Printf( "NET_GetPacket: %s\n", NET_ErrorString() );
+				break;
+			}
 
 			memset( ((struct sockaddr_in *)&from)->sin_zero, 0, 8 );
 		
 			if ( usingSocks && memcmp( &from, &socksRelayAddr, fromlen ) == 0 ) {
 				if ( ret < 10 || net_message->data[0] != 0 || net_message->data[1] != 0 || net_message->data[2] != 0 || net_message->data[3] != 1 ) {
-					return qfalse;
+					continue;
 				}
 				net_from->type = NA_IP;
 				net_from->ip[0] = net_message->data[4];
@@ -563,7 +854,7 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 		
 			if( ret >= net_message->maxsize ) {
 				Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
-				return qfalse;
+				continue;
 			}
 			
 			net_message->cursize = ret;
@@ -573,25 +864,27 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 	
 	if(ip6_socket != INVALID_SOCKET && FD_ISSET(ip6_socket, fdr))
 	{
-		fromlen = sizeof(from);
-		ret = recvfrom(ip6_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen);
-		
-		if (ret == SOCKET_ERROR)
+		while(1)
 		{
-			err = socketError;
+			fromlen = sizeof(from);
+			ret = NET_RecvFrom(ip6_socket, net_message->data, net_message->maxsize, &from, &fromlen);
+			
+			if (ret == SOCKET_ERROR)
+			{
+				err = socketError;
+
+				if( err != EAGAIN && err != ECONNRESET )
+					Com_Printf( "NET_GetPacket: %s\n", NET_ErrorString() );
+				break;
+			}
 
-			if( err != EAGAIN && err != ECONNRESET )
-				Com_Printf( "NET_GetPacket: %s\n", NET_ErrorString() );
-		}
-		else
-		{
 			SockadrToNetadr((struct sockaddr *) &from, net_from);
 			net_message->readcount = 0;
 		
 			if(ret >= net_message->maxsize)
 			{
 				Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
-				return qfalse;
+				continue;
 			}
 			
 			net_message->cursize = ret;
@@ -601,25 +894,27 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 
 	if(multicast6_socket != INVALID_SOCKET && multicast6_socket != ip6_socket && FD_ISSET(multicast6_socket, fdr))
 	{
-		fromlen = sizeof(from);
-		ret = recvfrom(multicast6_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen);
-		
-		if (ret == SOCKET_ERROR)
+		while(1)
 		{
-			err = socketError;
+			fromlen = sizeof(from);
+			ret = NET_RecvFrom(multicast6_socket, net_message->data, net_message->maxsize, &from, &fromlen);
+			
+			if (ret == SOCKET_ERROR)
+			{
+				err = socketError;
+
+				if( err != EAGAIN && err != ECONNRESET )
+					Com_Printf( "NET_GetPacket: %s\n", NET_ErrorString() );
+				break;
+			}
 
-			if( err != EAGAIN && err != ECONNRESET )
-				Com_Printf( "NET_GetPacket: %s\n", NET_ErrorString() );
-		}
-		else
-		{
 			SockadrToNetadr((struct sockaddr *) &from, net_from);
 			net_message->readcount = 0;
 		
 			if(ret >= net_message->maxsize)
 			{
 				Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
-				return qfalse;
+				continue;
 			}
 			
 			net_message->cursize = ret;
@@ -631,6 +926,268 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 	return qfalse;
 }
 
+#ifdef NET_RECV_THREAD
+/*
+=============================================================================
+
+RECEIVE THREAD
+
+With net_recvThread set, a thread reads the sockets as soon as datagrams
+arrive, stamps them with their arrival time, and hands them to the main
+thread through a single producer/single consumer ring.  The main thread
+sleeps on a pipe that is written when the ring stops being empty, and
+getinfo/getstatus floods are dropped by the thread without waking it.
+
+=============================================================================
+*/
+
+#define	NET_RECV_QUEUE		256			// power of two
+
+typedef struct {
+	int				time;
+	int				length;
+	struct sockaddr_storage	from;
+	byte			data[MAX_MSGLEN + 1];
+} netQueuedPacket_t;
+
+static struct {
+	sysThread_t		*thread;
+	volatile qboolean	shutdown;
+	int				wakePipe[2];
+	int				signaled;			// the main thread has been woken for the current packets
+	unsigned int	head;				// written by the receive thread
+	unsigned int	tail;				// written by the main thread
+	int				dropped;
+	qboolean		packetQueued;		// a packet from the ring is being processed
+	int				packetTime;			// and this is when it arrived
+	netQueuedPacket_t	packets[NET_RECV_QUEUE];
+} net_recv;
+
+/*
+==================
+NET_RecvThreadSocket
+
+Reads everything waiting on a socket into the queue
+==================
+*/
+static void NET_RecvThreadSocket( SOCKET sock ) {
+	netQueuedPacket_t	*packet;
+	static netQueuedPacket_t	overflow;
+	socklen_t	fromlen;
+	netadr_t	from;
+	int			ret;
+
+	while ( 1 ) {
+		if ( net_recv.head - __atomic_load_n( &net_recv.tail, __ATOMIC_ACQUIRE ) < NET_RECV_QUEUE ) {
+			packet = &net_recv.packets[net_recv.head & ( NET_RECV_QUEUE - 1 )];
+		} else {
+			// the main thread is stalled, drop new packets like a full socket buffer would
+			packet = &overflow;
+		}
+
+		fromlen = sizeof( packet->from );
+		ret = NET_RecvFrom( sock, packet->data, sizeof( packet->data ), &packet->from, &fromlen );
+		if ( ret == SOCKET_ERROR ) {
+			return;
+		}
+
+		if ( packet == &overflow ) {
+			net_recv.dropped++;
+			continue;
+		}
+
+		packet->time = Sys_Milliseconds();
+		packet->length = ret;
+
+		// only the main thread prints, so oversize packets are reported there
+		if ( ret >= 4 && ret < sizeof( packet->data ) && *(int *)packet->data == -1 && com_sv_running->integer ) {
+			packet->data[ret] = 0;
+			SockadrToNetadr( (struct sockaddr *)&packet->from, &from );
+			if ( SVC_QueryFlooded( from, (char *)packet->data + 4 ) ) {
+				continue;
+			}
+		}
+
+		__atomic_store_n( &net_recv.head, net_recv.head + 1, __ATOMIC_RELEASE );
+
+		// wake the main thread right away, the socket may not run dry during a flood
+		if ( !__atomic_exchange_n( &net_recv.signaled, 1, __ATOMIC_SEQ_CST ) ) {
+			if ( write( net_recv.wakePipe[1], "", 1 ) < 0 ) {
+				// the pipe is full, so the main thread is awake anyway
+			}
+		}
+	}
+}
+
+/*
+==================
+NET_RecvThread
+==================
+*/
+static void NET_RecvThread( void *arg ) {
+	struct timeval	timeout;
+	fd_set		fdr;
+	SOCKET		highestfd;
+
+	while ( !net_recv.shutdown ) {
+		FD_ZERO( &fdr );
+		highestfd = INVALID_SOCKET;
+
+		if ( ip_socket != INVALID_SOCKET ) {
+			FD_SET( ip_socket, &fdr );
+			highestfd = ip_socket;
+		}
+		if ( ip6_socket != INVALID_SOCKET ) {
+			FD_SET( ip6_socket, &fdr );
+			highestfd = MAX( highestfd, ip6_socket );
+		}
+		if ( multicast6_socket != INVALID_SOCKET && multicast6_socket != ip6_socket ) {
+			FD_SET( multicast6_socket, &fdr );
+			highestfd = MAX( highestfd, multicast6_socket );
+		}
+
+		// wake up now and then to check for shutdown
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 100000;
+
+		if ( select( highestfd + 1, &fdr, NULL, NULL, &timeout ) <= 0 ) {
+			continue;
+		}
+
+		if ( ip_socket != INVALID_SOCKET && FD_ISSET( ip_socket, &fdr ) ) {
+			NET_RecvThreadSocket( ip_socket );
+		}
+		if ( ip6_socket != INVALID_SOCKET && FD_ISSET( ip6_socket, &fdr ) ) {
+			NET_RecvThreadSocket( ip6_socket );
+		}
+		if ( multicast6_socket != INVALID_SOCKET && multicast6_socket != ip6_socket && FD_ISSET( multicast6_socket, &fdr ) ) {
+			NET_RecvThreadSocket( multicast6_socket );
+		}
+	}
+}
+
+/*
+==================
+NET_StartRecvThread
+==================
+*/
+static void NET_StartRecvThread( void ) {
+	if ( !net_recvThread->integer || usingSocks ) {
+		return;
+	}
+	if ( ip_socket == INVALID_SOCKET && ip6_socket == INVALID_SOCKET ) {
+		return;
+	}
+
+	if ( !net_recv.wakePipe[1] ) {
+		if ( pipe( net_recv.wakePipe ) ) {
+			Com_Printf( "WARNING: NET_StartRecvThread: pipe failed: %s\n", strerror( errno ) );
+			net_recv.wakePipe[1] = 0;
+			return;
+		}
+		fcntl( net_recv.wakePipe[0], F_SETFL, O_NONBLOCK );
+		fcntl( net_recv.wakePipe[1], F_SETFL, O_NONBLOCK );
+	}
+
+	net_recv.shutdown = qfalse;
+	net_recv.signaled = 0;
+	net_recv.head = net_recv.tail = 0;
+	net_recv.dropped = 0;
+
+	// falls back to reading the sockets in NET_Sleep
+	net_recv.thread = Sys_CreateThread( NET_RecvThread, NULL );
+	if ( net_recv.thread ) {
+		Com_Printf( "Network receive thread started\n" );
+	}
+}
+
+/*
+==================
+NET_StopRecvThread
+
+Must be called before the sockets are closed
+==================
+*/
+static void NET_StopRecvThread( void ) {
+	if ( !net_recv.thread ) {
+		return;
+	}
+
+	net_recv.shutdown = qtrue;
+	Sys_JoinThread( net_recv.thread );
+	net_recv.thread = NULL;
+
+	if ( net_recv.dropped ) {
+		Com_Printf( "Network receive thread dropped %i packets\n", net_recv.dropped );
+	}
+}
+
+/*
+==================
+NET_GetQueuedPacket
+
+Takes a packet from the receive thread
+==================
+*/
+static qboolean NET_GetQueuedPacket( netadr_t *net_from, msg_t *net_message ) {
+	netQueuedPacket_t	*packet;
+	qboolean	rearmed = qfalse;
+	char		buf[64];
+
+	while ( 1 ) {
+		if ( net_recv.tail == __atomic_load_n( &net_recv.head, __ATOMIC_ACQUIRE ) ) {
+			if ( rearmed ) {
+				net_recv.packetQueued = qfalse;
+				return qfalse;
+			}
+
+			// drain the wake-ups and ask for a new one before checking the ring again
+			while ( read( net_recv.wakePipe[0], buf, sizeof( buf ) ) > 0 ) {
+			}
+			__atomic_store_n( &net_recv.signaled, 0, __ATOMIC_SEQ_CST );
+			rearmed = qtrue;
+			continue;
+		}
+
+		packet = &net_recv.packets[net_recv.tail & ( NET_RECV_QUEUE - 1 )];
+
+		SockadrToNetadr( (struct sockaddr *)&packet->from, net_from );
+		net_message->readcount = 0;
+		net_message->cursize = MIN( packet->length, net_message->maxsize );
+		Com_Memcpy( net_message->data, packet->data, net_message->cursize );
+		net_recv.packetQueued = qtrue;
+		net_recv.packetTime = packet->time;
+
+		// copied out before processing, which can drop to the main loop
+		__atomic_store_n( &net_recv.tail, net_recv.tail + 1, __ATOMIC_RELEASE );
+
+		if ( packet->length >= net_message->maxsize ) {
+			Com_Printf( "Oversize packet from %s\n", NET_AdrToString( *net_from ) );
+			continue;
+		}
+
+		return qtrue;
+	}
+}
+#endif
+
+/*
+==================
+NET_PacketAge
+
+Milliseconds between the arrival of the packet being processed and now,
+which is only known for packets queued by the receive thread
+==================
+*/
+int NET_PacketAge( void ) {
+#ifdef NET_RECV_THREAD
+	if ( net_recv.packetQueued ) {
+		return Sys_Milliseconds() - net_recv.packetTime;
+	}
+#endif
+	return 0;
+}
+
 //=============================================================================
 
 static char socksBuf[4096];
@@ -673,6 +1230,14 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 		ret = sendto( ip_socket, socksBuf, length+10, 0, &socksRelayAddr, sizeof(socksRelayAddr) );
 	}
 	else {
+#ifdef NET_MMSG
+		if( net_sendBatch.active && ( to.type == NA_IP || to.type == NA_IP6 ) ) {
+			if( addr.ss_family == AF_INET && NET_QueueSend( ip_socket, length, data, &addr, sizeof(struct sockaddr_in) ) )
+				return;
+			if( addr.ss_family == AF_INET6 && NET_QueueSend( ip6_socket, length, data, &addr, sizeof(struct sockaddr_in6) ) )
+				return;
+		}
+#endif
 		if(addr.ss_family == AF_INET)
 			ret = sendto( ip_socket, data, length, 0, (struct sockaddr *) &addr, sizeof(struct sockaddr_in) );
 		else if(addr.ss_family == AF_INET6)
@@ -1480,6 +2045,12 @@ static qboolean NET_GetCvars( void ) {
 
 	net_dropsim = Cvar_Get("net_dropsim", "", CVAR_TEMP);
 
+#ifdef NET_RECV_THREAD
+	net_recvThread = Cvar_Get( "net_recvThread", "0", CVAR_LATCH | CVAR_ARCHIVE );
+	modified += net_recvThread->modified;
+	net_recvThread->modified = qfalse;
+#endif
+
 	return modified ? qtrue : qfalse;
 }
 
@@ -1529,6 +2100,10 @@ void NET_Config( qboolean enableNetworking ) {
 	}
 
 	if( stop ) {
+#ifdef NET_RECV_THREAD
+		NET_StopRecvThread();
+#endif
+
 		if ( ip_socket != INVALID_SOCKET ) {
 			closesocket( ip_socket );
 			ip_socket = INVALID_SOCKET;
@@ -1551,7 +2126,11 @@ void NET_Config( qboolean enableNetworking ) {
 			closesocket( socks_socket );
 			socks_socket = INVALID_SOCKET;
 		}
-		
+
+#ifdef NET_MMSG
+		NET_FreeRecvBatches();
+		net_sendBatch.count = 0;
+#endif
 	}
 
 	if( start )
@@ -1560,6 +2139,12 @@ void NET_Config( qboolean enableNetworking ) {
 		{
 			NET_OpenIP();
 			NET_SetMulticast6();
+#ifdef NET_MMSG
+			NET_AllocRecvBatches();
+#endif
+#ifdef NET_RECV_THREAD
+			NET_StartRecvThread();
+#endif
 		}
 	}
 }
@@ -1626,7 +2211,11 @@ void NET_Event(fd_set *fdr)
 	{
 		MSG_Init(&netmsg, bufData, sizeof(bufData));
 
+#ifdef NET_RECV_THREAD
+		if(net_recv.thread ? NET_GetQueuedPacket(&from, &netmsg) : NET_GetPacket(&from, &netmsg, fdr))
+#else
 		if(NET_GetPacket(&from, &netmsg, fdr))
+#endif
 		{
 			if(net_dropsim->value > 0.0f && net_dropsim->value <= 100.0f)
 			{
@@ -1639,6 +2228,10 @@ void NET_Event(fd_set *fdr)
 				Com_RunAndTimeServerPacket(&from, &netmsg);
 			else
 				CL_PacketEvent(from, &netmsg);
+#ifdef NET_RECV_THREAD
+			// loopback packets are processed elsewhere and must not get this age
+			net_recv.packetQueued = qfalse;
+#endif
 		}
 		else
 			break;
@@ -1664,18 +2257,30 @@ void NET_Sleep(int msec)
 
 	FD_ZERO(&fdr);
 
-	if(ip_socket != INVALID_SOCKET)
+#ifdef NET_RECV_THREAD
+	if(net_recv.thread)
 	{
-		FD_SET(ip_socket, &fdr);
+		// the sockets belong to the receive thread
+		FD_SET(net_recv.wakePipe[0], &fdr);
 
-		highestfd = ip_socket;
+		highestfd = net_recv.wakePipe[0];
 	}
-	if(ip6_socket != INVALID_SOCKET)
+	else
+#endif
 	{
-		FD_SET(ip6_socket, &fdr);
+		if(ip_socket != INVALID_SOCKET)
+		{
+			FD_SET(ip_socket, &fdr);
 
-		if(highestfd == INVALID_SOCKET || ip6_socket > highestfd)
-			highestfd = ip6_socket;
+			highestfd = ip_socket;
+		}
+		if(ip6_socket != INVALID_SOCKET)
+		{
+			FD_SET(ip6_socket, &fdr);
+
+			if(highestfd == INVALID_SOCKET || ip6_socket > highestfd)
+				highestfd = ip6_socket;
+		}
 	}
 
 #ifdef _WIN32
@@ -1692,7 +2297,8 @@ void NET_Sleep(int msec)
 
 	retval = select(highestfd + 1, &fdr, NULL, NULL, &timeout);
 
-	if(retval == SOCKET_ERROR)
+	// a signal such as the VM profiler's timer can interrupt the wait
+	if(retval == SOCKET_ERROR && socketError != EINTR)
 		Com_Printf("Warning: select() syscall failed: %s\n", NET_ErrorString());
 	else if(retval > 0)
 		NET_Event(&fdr);
@@ -1030,6 +1030,17 @@ typedef struct {
 	int			entityNum;	// entity the contacted sirface is a part of
 } trace_t;
 
+// one trace of a trap_TraceBatch / trap_CM_BoxTraceBatch call
+typedef struct {
+	vec3_t		start;
+	vec3_t		end;
+	vec3_t		mins;
+	vec3_t		maxs;
+	int			passEntityNum;	// not used by trap_CM_BoxTraceBatch
+	int			contentmask;
+	qboolean	capsule;
+} traceRequest_t;
+
 // trace->entityNum can also be 0 to (MAX_GENTITIES-1)
 // or ENTITYNUM_NONE, ENTITYNUM_WORLD
 
@@ -71,6 +71,7 @@ struct entityState_s;
 struct playerState_s;
 
 void MSG_WriteBits( msg_t *msg, int value, int bits );
+void MSG_WriteEncodedBits( msg_t *msg, const byte *data, int bits );
 
 void MSG_WriteChar (msg_t *sb, int c);
 void MSG_WriteByte (msg_t *sb, int c);
@@ -175,6 +176,8 @@ void		NET_Shutdown( void );
 void		NET_Restart_f( void );
 void		NET_Config( qboolean enableNetworking );
 void		NET_FlushPacketQueue(void);
+void		NET_BeginSendBatch( void );
+void		NET_EndSendBatch( void );
 void		NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t to);
 void		QDECL NET_OutOfBandPrint( netsrc_t net_socket, netadr_t adr, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
 void		QDECL NET_OutOfBandData( netsrc_t sock, netadr_t adr, byte *format, int len );
@@ -190,6 +193,7 @@ qboolean	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, msg_t *net_messag
 void		NET_JoinMulticast6(void);
 void		NET_LeaveMulticast6(void);
 void		NET_Sleep(int msec);
+int			NET_PacketAge( void );
 
 
 #define	MAX_MSGLEN				16384		// max length of a message, which may
@@ -376,6 +380,7 @@ void	VM_Debug( int level );
 
 void	*VM_ArgPtr( intptr_t intValue );
 void	*VM_ExplicitArgPtr( vm_t *vm, intptr_t intValue );
+void	VM_CheckArray( intptr_t intValue, intptr_t count, int elementSize, const char *name );
 
 #define	VMA(x) VM_ArgPtr(args[x])
 static ID_INLINE float _vmf(intptr_t x)
@@ -854,6 +859,15 @@ qboolean		Com_PlayerNameToFieldString( char *str, int length, const char *name )
 qboolean		Com_FieldStringToPlayerName( char *name, int length, const char *rawname );
 int QDECL	Com_strCompare( const void *a, const void *b );
 
+#define	MAX_JOB_THREADS		16
+
+void		Com_RunJobs( void (*function)( void *context, int index, int thread ), void *context, int count, int numThreads );
+// calls function for every index in [0, count) using up to numThreads threads,
+// including the calling one, and returns once all of them have completed.
+// thread is in [0, numThreads) and can be used to select per-thread scratch data.
+// Jobs must not call Com_Printf, Com_Error or the zone allocator.
+void		Com_ShutdownJobs( void );
+
 
 extern	cvar_t	*com_developer;
 extern	cvar_t	*com_dedicated;
@@ -1055,6 +1069,7 @@ void SV_Init( void );
 void SV_Shutdown( char *finalmsg );
 void SV_Frame( int msec );
 void SV_PacketEvent( netadr_t from, msg_t *msg );
+qboolean SVC_QueryFlooded( netadr_t from, const char *command );
 int SV_FrameMsec(void);
 qboolean SV_GameCommand( void );
 int SV_SendQueuedPackets(void);
@@ -1106,6 +1121,8 @@ int		Sys_Milliseconds (void);
 
 qboolean Sys_RandomBytes( byte *string, int len );
 
+int		Sys_PID( void );
+
 // the system console is shown when a dedicated server is running
 void	Sys_DisplaySystemConsole( qboolean show );
 
@@ -1170,6 +1187,25 @@ dialogResult_t Sys_Dialog( dialogType_t type, const char *message, const char *t
 void Sys_RemovePIDFile( const char *gamedir );
 void Sys_InitPIDFile( const char *gamedir );
 
+// threads are only used by optional worker pools, callers are expected to
+// fall back to doing the work inline if Sys_CreateThread returns NULL
+typedef struct sysThread_s sysThread_t;
+typedef struct sysMutex_s sysMutex_t;
+typedef struct sysSemaphore_s sysSemaphore_t;
+
+sysThread_t *Sys_CreateThread( void (*function)( void *arg ), void *arg );
+void	Sys_JoinThread( sysThread_t *thread );
+
+sysMutex_t *Sys_CreateMutex( void );
+void	Sys_DestroyMutex( sysMutex_t *mutex );
+void	Sys_LockMutex( sysMutex_t *mutex );
+void	Sys_UnlockMutex( sysMutex_t *mutex );
+
+sysSemaphore_t *Sys_CreateSemaphore( int count );
+void	Sys_DestroySemaphore( sysSemaphore_t *semaphore );
+void	Sys_SemaphoreWait( sysSemaphore_t *semaphore );
+void	Sys_SemaphorePost( sysSemaphore_t *semaphore );
+
 /* This is based on the Adaptive Huffman algorithm described in Sayood's Data
  * Compression book.  The ranks are not actually stored, but implicitly defined
  * by the location of a node within a doubly-linked list */
@@ -1206,6 +1242,17 @@ typedef struct {
 	huff_t		decompressor;
 } huffman_t;
 
+// flattened form of a tree that is no longer updated, such as the one used
+// for all netchan messages, so symbols can be coded without walking nodes
+#define HUFF_LOOKUP_BITS	11
+
+typedef struct {
+	unsigned int	codes[HMAX+1];		// in the order sent, first bit in bit 0
+	byte			lengths[HMAX+1];	// 0 if the symbol has no code
+	unsigned short	lookup[1 << HUFF_LOOKUP_BITS];	// symbol | length << 9, 0 if the code is longer
+	node_t			*tree;				// for codes too long for the lookup
+} huffTable_t;
+
 void	Huff_Compress(msg_t *buf, int offset);
 void	Huff_Decompress(msg_t *buf, int offset);
 void	Huff_Init(huffman_t *huff);
@@ -1214,6 +1261,9 @@ int		Huff_Receive (node_t *node, int *ch, byte *fin);
 void	Huff_transmit (huff_t *huff, int ch, byte *fout, int maxoffset);
 void	Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset, int maxoffset);
 void	Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset, int maxoffset);
+void	Huff_BuildTable( huffTable_t *table, huff_t *huff );
+void	Huff_tableReceive( const huffTable_t *table, int *ch, const byte *fin, int *offset, int maxoffset );
+void	Huff_tableTransmit( const huffTable_t *table, int ch, byte *fout, int *offset, int maxoffset );
 void	Huff_putBit( int bit, byte *fout, int *offset);
 int		Huff_getBit( byte *fout, int *offset);
 
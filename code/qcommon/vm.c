@@ -35,6 +35,16 @@ and one exported function: Perform
 
 #include "vm_local.h"
 
+#ifdef VM_GUARD_REGION
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#endif
+#ifdef VM_SAMPLE_PROFILER
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
 
 vm_t	*currentVM = NULL;
 vm_t	*lastVM    = NULL;
@@ -50,6 +60,37 @@ vm_t	vmTable[MAX_VM];
 void VM_VmInfo_f( void );
 void VM_VmProfile_f( void );
 
+#ifdef VM_SAMPLE_PROFILER
+#define	VM_PROFILE_DEPTH	32
+#define	VM_PROFILE_SAMPLES	8192		// collected before they are merged into stacks
+#define	VM_PROFILE_HASH		1024
+
+typedef struct {
+	int		vm;
+	int		depth;
+	int		functions[VM_PROFILE_DEPTH];	// innermost first, -1 for engine code
+} vmSample_t;
+
+typedef struct vmProfileStack_s {
+	struct vmProfileStack_s	*next;
+	int		count;
+	char	text[1];		// variable sized
+} vmProfileStack_t;
+
+static struct {
+	qboolean			running;
+	pthread_t			thread;
+	struct sigaction	oldAction;
+	vmSample_t			*samples;
+	volatile int		numSamples;
+	int					engineSamples;
+	int					droppedSamples;
+	vmProfileStack_t	*stacks[VM_PROFILE_HASH];
+} vm_profile;
+
+static void VM_ProfileFlush( void );
+#endif
+
 
 
 #if 0 // 64bit!
@@ -73,6 +114,13 @@ void VM_Init( void ) {
 	Cvar_Get( "vm_cgame", "2", CVAR_ARCHIVE );	// !@# SHIP WITH SET TO 2
 	Cvar_Get( "vm_game", "2", CVAR_ARCHIVE );	// !@# SHIP WITH SET TO 2
 	Cvar_Get( "vm_ui", "2", CVAR_ARCHIVE );		// !@# SHIP WITH SET TO 2
+	Cvar_Get( "vm_optimize", "1", CVAR_ARCHIVE );
+#ifndef NO_VM_COMPILED
+	Cvar_Get( "vm_codeCache", "1", CVAR_ARCHIVE );
+#endif
+#ifdef VM_GUARD_REGION
+	Cvar_Get( "vm_guardRegion", "0", CVAR_ARCHIVE );
+#endif
 
 	Cmd_AddCommand ("vmprofile", VM_VmProfile_f );
 	Cmd_AddCommand ("vminfo", VM_VmInfo_f );
@@ -356,6 +404,355 @@ intptr_t QDECL VM_DllSyscall( intptr_t arg, ... ) {
 }
 
 
+#ifdef VM_GUARD_REGION
+static struct sigaction	vm_oldSegvAction;
+static qboolean			vm_guardHandlerInstalled;
+static sigjmp_buf		*vm_guardJump;		// innermost VM_Call of a guarded vm
+static vm_t				*vm_guardFaultVM;
+
+/*
+=================
+VM_GuardHandler
+
+Jumps back to the innermost VM_Call of a guarded vm on faults in a guard
+region, which then raises the error. Anything else goes to the handler that
+was installed before.
+=================
+*/
+static void VM_GuardHandler( int sig, siginfo_t *info, void *context ) {
+	byte	*addr = info->si_addr;
+	int		i;
+
+	for ( i = 0 ; vm_guardJump && i < MAX_VM ; i++ ) {
+		vm_t	*vm = &vmTable[i];
+
+		if ( vm->dataGuarded && addr >= vm->dataBase && addr < vm->dataBase + VM_GUARD_SIZE ) {
+			vm_guardFaultVM = vm;
+			siglongjmp( *vm_guardJump, 1 );
+		}
+	}
+
+	if ( vm_oldSegvAction.sa_flags & SA_SIGINFO ) {
+		vm_oldSegvAction.sa_sigaction( sig, info, context );
+	} else if ( vm_oldSegvAction.sa_handler != SIG_DFL && vm_oldSegvAction.sa_handler != SIG_IGN ) {
+		vm_oldSegvAction.sa_handler( sig );
+	} else {
+		// the default action ends the process, so there is nothing left to stay installed for
+		sigaction( SIGSEGV, &vm_oldSegvAction, NULL );
+		raise( sig );
+	}
+}
+
+/*
+=================
+VM_AllocGuarded
+
+Reserves the address space for a data segment that doesn't need masking,
+leaves vm->dataBase unset if that isn't possible
+=================
+*/
+static void VM_AllocGuarded( vm_t *vm ) {
+	struct sigaction	action;
+	void				*base;
+
+	if ( !vm_guardHandlerInstalled ) {
+		// SA_NODEFER, as the handler jumps out instead of returning
+		Com_Memset( &action, 0, sizeof( action ) );
+		action.sa_sigaction = VM_GuardHandler;
+		action.sa_flags = SA_SIGINFO | SA_NODEFER;
+		sigemptyset( &action.sa_mask );
+		if ( sigaction( SIGSEGV, &action, &vm_oldSegvAction ) ) {
+			return;
+		}
+		vm_guardHandlerInstalled = qtrue;
+	}
+
+	base = mmap( NULL, VM_GUARD_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+	if ( base == MAP_FAILED ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't reserve guard region for %s\n", vm->name );
+		return;
+	}
+	if ( mprotect( base, vm->dataAlloc, PROT_READ | PROT_WRITE ) ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't map guard region for %s\n", vm->name );
+		munmap( base, VM_GUARD_SIZE );
+		return;
+	}
+
+	vm->dataBase = base;
+	vm->dataGuarded = qtrue;
+}
+#endif
+
+#ifndef NO_VM_COMPILED
+/*
+=============================================================================
+
+COMPILED CODE CACHE
+
+Compiled code is saved in the homepath together with a copy of the bytecode
+it was made from, and only used again if the bytecode, the engine build and
+the compiler options all match.  The files get the dll extension, so neither
+a VM nor a download can write one.
+
+=============================================================================
+*/
+
+#define	VM_CACHE_IDENT		(('C'<<24)+('M'<<16)+('V'<<8)+'Q')
+#define	VM_CACHE_VERSION	2
+
+typedef struct {
+	int		ident;
+	int		version;
+	char	build[64];			// set by the compiler, changes with every build of it
+	int		flags;				// compiler options the code depends on
+	int		bytecodeLength;
+	int		numJumpTableTargets;
+	int		instructionCount;
+	int		dataMask;
+	int		stubLength;			// host specific code in front, not stored
+	int		codeLength;
+	int		entryOfs;
+	int		bodyChecksum;		// over the code after the stub
+	// followed by the bytecode, the jump table targets, the code after
+	// the stub and the instruction offsets
+} vmCacheHeader_t;
+
+/*
+=================
+VM_CodeCachePath
+
+Returns qfalse if the cache is disabled or the homepath isn't writable
+=================
+*/
+static qboolean VM_CodeCachePath( vm_t *vm, vmHeader_t *header, int flags, qboolean write,
+		char *path, int size ) {
+	char	name[MAX_QPATH];
+
+	if ( !Cvar_VariableIntegerValue( "vm_codeCache" ) ) {
+		return qfalse;
+	}
+
+	Com_sprintf( name, sizeof( name ), "%s-%08x-%x" DLL_EXT, vm->name,
+		Com_BlockChecksum( (byte *)header + header->codeOffset, header->codeLength ), flags );
+
+#ifdef NEW_FILESYSTEM
+	return fs_generate_path_writedir( "vmcache", name, write ? FS_CREATE_DIRECTORIES : 0,
+		FS_ALLOW_DLL, path, size ) != 0;
+#else
+	Q_strncpyz( path, FS_BuildOSPath( Cvar_VariableString( "fs_homepath" ), "vmcache", name ), size );
+	if ( write && FS_CreatePath( path ) ) {
+		return qfalse;
+	}
+	return qtrue;
+#endif
+}
+
+/*
+=================
+VM_ReadCodeCache
+
+Copies cached code after the first stubLength bytes of code and fills in the
+relative instruction pointers, returns qfalse if there is no valid entry
+=================
+*/
+qboolean VM_ReadCodeCache( vm_t *vm, vmHeader_t *header, const char *build, int flags,
+		byte *code, int stubLength, int maxLength, int *codeLength ) {
+	char			path[MAX_OSPATH];
+	vmCacheHeader_t	cache;
+	FILE			*f;
+	byte			*data;
+	int				*offsets;
+	int				jumpTableLength, bodyLength, dataLength;
+	int				i;
+	qboolean		valid;
+
+	if ( !VM_CodeCachePath( vm, header, flags, qfalse, path, sizeof( path ) ) ) {
+		return qfalse;
+	}
+	f = fopen( path, "rb" );
+	if ( !f ) {
+		return qfalse;
+	}
+
+	jumpTableLength = vm->numJumpTableTargets * sizeof( int );
+	valid = fread( &cache, sizeof( cache ), 1, f ) == 1
+		&& cache.ident == VM_CACHE_IDENT
+		&& cache.version == VM_CACHE_VERSION
+		&& !strncmp( cache.build, build, sizeof( cache.build ) )
+		&& cache.flags == flags
+		&& cache.bytecodeLength == header->codeLength
+		&& cache.numJumpTableTargets == vm->numJumpTableTargets
+		&& cache.instructionCount == vm->instructionCount
+		&& cache.dataMask == vm->dataMask
+		&& cache.stubLength == stubLength
+		&& cache.codeLength > stubLength && cache.codeLength <= maxLength
+		&& cache.entryOfs >= stubLength && cache.entryOfs < cache.codeLength;
+	if ( !valid ) {
+		fclose( f );
+		return qfalse;
+	}
+
+	bodyLength = cache.codeLength - stubLength;
+	dataLength = header->codeLength + jumpTableLength + bodyLength + vm->instructionCount * sizeof( int );
+	data = Z_Malloc( dataLength + 1 );
+	offsets = (int *)( data + header->codeLength + jumpTableLength + bodyLength );
+
+	valid = fread( data, dataLength, 1, f ) == 1 && fgetc( f ) == EOF
+		&& !memcmp( data, (byte *)header + header->codeOffset, header->codeLength )
+		&& !memcmp( data + header->codeLength, vm->jumpTableTargets, jumpTableLength )
+		&& Com_BlockChecksum( data + header->codeLength + jumpTableLength, bodyLength ) == cache.bodyChecksum;
+	fclose( f );
+
+	for ( i = 0 ; valid && i < vm->instructionCount ; i++ ) {
+		if ( offsets[i] < stubLength || offsets[i] >= cache.codeLength ) {
+			valid = qfalse;
+		}
+		vm->instructionPointers[i] = offsets[i];
+	}
+
+	if ( valid ) {
+		Com_Memcpy( code + stubLength, data + header->codeLength + jumpTableLength, bodyLength );
+		vm->entryOfs = cache.entryOfs;
+		*codeLength = cache.codeLength;
+	}
+	Z_Free( data );
+
+	return valid;
+}
+
+/*
+=================
+VM_WriteCodeCache
+
+Saves code compiled from header, except for its first stubLength bytes,
+together with vm->entryOfs and the relative instruction pointers
+=================
+*/
+void VM_WriteCodeCache( vm_t *vm, vmHeader_t *header, const char *build, int flags,
+		const byte *code, int stubLength, int codeLength ) {
+	char			path[MAX_OSPATH], temp[MAX_OSPATH];
+	vmCacheHeader_t	cache;
+	FILE			*f;
+	int				offset;
+	int				i;
+	qboolean		valid;
+
+	if ( !VM_CodeCachePath( vm, header, flags, qtrue, path, sizeof( path ) ) ) {
+		return;
+	}
+
+	Com_Memset( &cache, 0, sizeof( cache ) );
+	cache.ident = VM_CACHE_IDENT;
+	cache.version = VM_CACHE_VERSION;
+	Q_strncpyz( cache.build, build, sizeof( cache.build ) );
+	cache.flags = flags;
+	cache.bytecodeLength = header->codeLength;
+	cache.numJumpTableTargets = vm->numJumpTableTargets;
+	cache.instructionCount = vm->instructionCount;
+	cache.dataMask = vm->dataMask;
+	cache.stubLength = stubLength;
+	cache.codeLength = codeLength;
+	cache.entryOfs = vm->entryOfs;
+	cache.bodyChecksum = Com_BlockChecksum( code + stubLength, codeLength - stubLength );
+
+	// written under a name of this process first and renamed into place, so
+	// servers sharing the homepath don't write into each other's files; the
+	// checksum catches anything that still ends up damaged
+	Com_sprintf( temp, sizeof( temp ), "%s.%i.tmp", path, Sys_PID() );
+	f = fopen( temp, "wb" );
+	if ( !f ) {
+		return;
+	}
+
+	valid = fwrite( &cache, sizeof( cache ), 1, f ) == 1
+		&& fwrite( (byte *)header + header->codeOffset, header->codeLength, 1, f ) == 1
+		&& ( !vm->numJumpTableTargets
+			|| fwrite( vm->jumpTableTargets, vm->numJumpTableTargets * sizeof( int ), 1, f ) == 1 )
+		&& fwrite( code + stubLength, codeLength - stubLength, 1, f ) == 1;
+	for ( i = 0 ; valid && i < vm->instructionCount ; i++ ) {
+		offset = vm->instructionPointers[i];
+		valid = fwrite( &offset, sizeof( offset ), 1, f ) == 1;
+	}
+
+	if ( fclose( f ) || !valid ) {
+		remove( temp );
+		return;
+	}
+	// fails on Windows if another process got there first, which is as good
+	if ( rename( temp, path ) ) {
+		remove( temp );
+		return;
+	}
+
+	Com_DPrintf( "Wrote compiled code of %s to %s\n", vm->name, path );
+}
+#endif
+
+/*
+=================
+VM_FindFunctions
+
+Lists the functions of a qvm by their OP_ENTER instructions
+=================
+*/
+static void VM_FindFunctions( vm_t *vm, vmHeader_t *header ) {
+	byte	*code;
+	int		pass, pc, instruction, count;
+	int		op;
+
+	code = (byte *)header + header->codeOffset;
+	for ( pass = 0 ; pass < 2 ; pass++ ) {
+		count = 0;
+		pc = 0;
+		for ( instruction = 0 ; instruction < header->instructionCount && pc < header->codeLength ; instruction++ ) {
+			op = code[pc++];
+			if ( op == OP_ENTER ) {
+				if ( pass ) {
+					vm->functions[count].instruction = instruction;
+				}
+				count++;
+			}
+
+			// these are the only opcodes that aren't a single byte
+			switch ( op ) {
+			case OP_ENTER:
+			case OP_CONST:
+			case OP_LOCAL:
+			case OP_LEAVE:
+			case OP_EQ:
+			case OP_NE:
+			case OP_LTI:
+			case OP_LEI:
+			case OP_GTI:
+			case OP_GEI:
+			case OP_LTU:
+			case OP_LEU:
+			case OP_GTU:
+			case OP_GEU:
+			case OP_EQF:
+			case OP_NEF:
+			case OP_LTF:
+			case OP_LEF:
+			case OP_GTF:
+			case OP_GEF:
+			case OP_BLOCK_COPY:
+				pc += 4;
+				break;
+			case OP_ARG:
+				pc++;
+				break;
+			default:
+				break;
+			}
+		}
+
+		if ( !pass ) {
+			vm->numFunctions = count;
+			vm->functions = Hunk_Alloc( count * sizeof( *vm->functions ), h_high );
+		}
+	}
+}
+
 /*
 =================
 VM_LoadQVM
@@ -461,8 +858,14 @@ vmHeader_t *VM_LoadQVM( vm_t *vm, qboolean alloc, qboolean unpure)
 		// allocate zero filled space for initialized and uninitialized data
 		// leave some space beyond data mask so we can secure all mask operations
 		vm->dataAlloc = dataLength + 4;
-		vm->dataBase = Hunk_Alloc(vm->dataAlloc, h_high);
 		vm->dataMask = dataLength - 1;
+
+#ifdef VM_GUARD_REGION
+		if(Cvar_VariableIntegerValue("vm_guardRegion"))
+			VM_AllocGuarded(vm);
+		if(!vm->dataBase)
+#endif
+		vm->dataBase = Hunk_Alloc(vm->dataAlloc, h_high);
 	}
 	else
 	{
@@ -710,6 +1113,8 @@ vm_t *VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *),
 		VM_PrepareInterpreter( vm, header );
 	}
 
+	VM_FindFunctions( vm, header );
+
 	// free the original file
 	FS_FreeFile( header );
 
@@ -731,6 +1136,7 @@ VM_Free
 ==============
 */
 void VM_Free( vm_t *vm ) {
+	int		i;
 
 	if(!vm) {
 		return;
@@ -745,6 +1151,16 @@ void VM_Free( vm_t *vm ) {
 		}
 	}
 
+#ifdef VM_SAMPLE_PROFILER
+	// samples refer to the functions of loaded vms
+	VM_ProfileFlush();
+#endif
+	for ( i = 0 ; i < vm->numFunctions ; i++ ) {
+		if ( vm->functions[i].name ) {
+			Z_Free( vm->functions[i].name );
+		}
+	}
+
 	if(vm->destroy)
 		vm->destroy(vm);
 
@@ -752,6 +1168,11 @@ void VM_Free( vm_t *vm ) {
 		Sys_UnloadDll( vm->dllHandle );
 		Com_Memset( vm, 0, sizeof( *vm ) );
 	}
+#ifdef VM_GUARD_REGION
+	if ( vm->dataGuarded ) {
+		munmap( vm->dataBase, VM_GUARD_SIZE );
+	}
+#endif
 #if 0	// now automatically freed by hunk
 	if ( vm->codeBase ) {
 		Z_Free( vm->codeBase );
@@ -778,6 +1199,10 @@ void VM_Clear(void) {
 
 void VM_Forced_Unload_Start(void) {
 	forced_unload = 1;
+#ifdef VM_GUARD_REGION
+	// the error unwinds every running VM_Call
+	vm_guardJump = NULL;
+#endif
 }
 
 void VM_Forced_Unload_Done(void) {
@@ -800,6 +1225,32 @@ void *VM_ArgPtr( intptr_t intValue ) {
 	}
 }
 
+/*
+============
+VM_CheckArray
+
+Makes sure an array passed to a system call lies within the data of an
+interpreted or compiled vm, where VM_ArgPtr only masks the start address.
+============
+*/
+void VM_CheckArray( intptr_t intValue, intptr_t count, int elementSize, const char *name ) {
+	unsigned int	dataSize;
+
+	if ( count < 0 ) {
+		Com_Error( ERR_DROP, "%s: bad count %i", name, (int)count );
+	}
+
+	if ( !currentVM || currentVM->entryPoint ) {
+		return;
+	}
+
+	dataSize = (unsigned int)currentVM->dataMask + 1;
+	if ( count > dataSize / elementSize
+		|| (unsigned int)( intValue & currentVM->dataMask ) + (unsigned int)count * elementSize > dataSize ) {
+		Com_Error( ERR_DROP, "%s: array out of vm data", name );
+	}
+}
+
 void *VM_ExplicitArgPtr( vm_t *vm, intptr_t intValue ) {
 	if ( !intValue ) {
 		return NULL;
@@ -848,6 +1299,10 @@ intptr_t QDECL VM_Call( vm_t *vm, int callnum, ... )
 	vm_t	*oldVM;
 	intptr_t r;
 	int i;
+#ifdef VM_GUARD_REGION
+	sigjmp_buf	guardJump;
+	sigjmp_buf	*oldGuardJump;
+#endif
 
 	if(!vm || !vm->name[0])
 		Com_Error(ERR_FATAL, "VM_Call with NULL vm");
@@ -861,6 +1316,16 @@ intptr_t QDECL VM_Call( vm_t *vm, int callnum, ... )
 	}
 
 	++vm->callLevel;
+#ifdef VM_GUARD_REGION
+	oldGuardJump = vm_guardJump;
+	if ( vm->dataGuarded ) {
+		if ( sigsetjmp( guardJump, 0 ) ) {
+			vm_guardJump = oldGuardJump;
+			Com_Error( ERR_DROP, "VM %s accessed memory outside of its data segment", vm_guardFaultVM->name );
+		}
+		vm_guardJump = &guardJump;
+	}
+#endif
 	// if we have a dll loaded, call it directly
 	if ( vm->entryPoint ) {
 		//rcg010207 -  see dissertation at top of VM_DllSyscall() in this file.
@@ -905,6 +1370,15 @@ intptr_t QDECL VM_Call( vm_t *vm, int callnum, ... )
 #endif
 	}
 	--vm->callLevel;
+#ifdef VM_GUARD_REGION
+	vm_guardJump = oldGuardJump;
+#endif
+
+#ifdef VM_SAMPLE_PROFILER
+	if ( vm_profile.numSamples >= VM_PROFILE_SAMPLES / 2 ) {
+		VM_ProfileFlush();
+	}
+#endif
 
 	if ( oldVM != NULL )
 	  currentVM = oldVM;
@@ -928,6 +1402,289 @@ static int QDECL VM_ProfileSort( const void *a, const void *b ) {
 	return 0;
 }
 
+#ifdef VM_SAMPLE_PROFILER
+/*
+==============
+VM_ProfileHandler
+
+Records the VM call stack of the main thread on every profiling timer tick
+==============
+*/
+static void VM_ProfileHandler( int sig, siginfo_t *info, void *context ) {
+	vm_t		*vm = currentVM;
+	vmSample_t	*sample;
+
+	if ( !vm_profile.running || !pthread_equal( pthread_self(), vm_profile.thread ) ) {
+		return;
+	}
+	if ( !vm || !vm->callLevel ) {
+		vm_profile.engineSamples++;
+		return;
+	}
+	if ( vm_profile.numSamples == VM_PROFILE_SAMPLES ) {
+		vm_profile.droppedSamples++;
+		return;
+	}
+
+	// interpreted vms only get their total
+	sample = &vm_profile.samples[vm_profile.numSamples];
+	sample->vm = vm - vmTable;
+	sample->depth = 0;
+	if ( vm->compiled ) {
+		sample->depth = VM_SampleCompiled( vm, context, sample->functions, VM_PROFILE_DEPTH );
+	}
+	vm_profile.numSamples++;
+}
+
+/*
+==============
+VM_ProfileLoadNames
+
+Names the functions of a vm from its map file, if there is one
+==============
+*/
+static void VM_ProfileLoadNames( vm_t *vm ) {
+	union {
+		char	*c;
+		void	*v;
+	} mapfile;
+	char	name[MAX_QPATH];
+	char	symbols[MAX_QPATH];
+	char	*text_p, *token;
+	int		segment, value;
+	int		low, high, mid;
+
+	vm->functionNamesLoaded = qtrue;
+
+	COM_StripExtension( vm->name, name, sizeof( name ) );
+	Com_sprintf( symbols, sizeof( symbols ), "vm/%s.map", name );
+	FS_ReadFile( symbols, &mapfile.v );
+	if ( !mapfile.c ) {
+		return;
+	}
+
+	text_p = mapfile.c;
+	while ( 1 ) {
+		token = COM_Parse( &text_p );
+		if ( !token[0] ) {
+			break;
+		}
+		segment = ParseHex( token );
+		value = ParseHex( COM_Parse( &text_p ) );
+		token = COM_Parse( &text_p );
+		if ( segment || !token[0] ) {
+			continue;
+		}
+
+		// code symbols are instruction numbers
+		low = 0;
+		high = vm->numFunctions - 1;
+		while ( low <= high ) {
+			mid = ( low + high ) / 2;
+			if ( vm->functions[mid].instruction < value ) {
+				low = mid + 1;
+			} else if ( vm->functions[mid].instruction > value ) {
+				high = mid - 1;
+			} else {
+				if ( !vm->functions[mid].name ) {
+					vm->functions[mid].name = CopyString( token );
+				}
+				break;
+			}
+		}
+	}
+
+	FS_FreeFile( mapfile.v );
+}
+
+/*
+==============
+VM_ProfileAdd
+==============
+*/
+static void VM_ProfileAdd( const char *text, int count ) {
+	vmProfileStack_t	*stack;
+	const char			*p;
+	unsigned			hash;
+
+	hash = 0;
+	for ( p = text ; *p ; p++ ) {
+		hash = hash * 31 + *p;
+	}
+	hash &= VM_PROFILE_HASH - 1;
+
+	for ( stack = vm_profile.stacks[hash] ; stack ; stack = stack->next ) {
+		if ( !strcmp( stack->text, text ) ) {
+			stack->count += count;
+			return;
+		}
+	}
+
+	stack = Z_Malloc( sizeof( *stack ) + strlen( text ) );
+	strcpy( stack->text, text );
+	stack->count = count;
+	stack->next = vm_profile.stacks[hash];
+	vm_profile.stacks[hash] = stack;
+}
+
+/*
+==============
+VM_ProfileFlush
+
+Merges the collected samples into collapsed stacks, which stay valid after
+their vm is freed
+==============
+*/
+static void VM_ProfileFlush( void ) {
+	char		text[VM_PROFILE_DEPTH * MAX_QPATH];
+	sigset_t	set, oldSet;
+	vmSample_t	*sample;
+	vm_t		*vm;
+	int			function;
+	int			i, j;
+
+	if ( !vm_profile.numSamples ) {
+		return;
+	}
+
+	// the handler runs on this thread
+	sigemptyset( &set );
+	sigaddset( &set, SIGPROF );
+	pthread_sigmask( SIG_BLOCK, &set, &oldSet );
+
+	for ( i = 0 ; i < vm_profile.numSamples ; i++ ) {
+		sample = &vm_profile.samples[i];
+		vm = &vmTable[sample->vm];
+		if ( !vm->functionNamesLoaded ) {
+			VM_ProfileLoadNames( vm );
+		}
+
+		Q_strncpyz( text, vm->name, sizeof( text ) );
+		for ( j = sample->depth - 1 ; j >= 0 ; j-- ) {
+			function = sample->functions[j];
+			if ( function < 0 ) {
+				Q_strcat( text, sizeof( text ), ";[engine]" );
+			} else if ( vm->functions[function].name ) {
+				Q_strcat( text, sizeof( text ), va( ";%s", vm->functions[function].name ) );
+			} else {
+				Q_strcat( text, sizeof( text ), va( ";0x%x", vm->functions[function].instruction ) );
+			}
+		}
+		VM_ProfileAdd( text, 1 );
+	}
+	vm_profile.numSamples = 0;
+
+	pthread_sigmask( SIG_SETMASK, &oldSet, NULL );
+}
+
+/*
+==============
+VM_ProfileStart
+==============
+*/
+static void VM_ProfileStart( int rate ) {
+	static qboolean		installed;
+	struct sigaction	action;
+	struct itimerval	timer;
+
+	if ( vm_profile.running ) {
+		Com_Printf( "VM profiler is already running\n" );
+		return;
+	}
+
+	// the handler is left installed, so a late tick can't kill the process
+	if ( !installed ) {
+		Com_Memset( &action, 0, sizeof( action ) );
+		action.sa_sigaction = VM_ProfileHandler;
+		action.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset( &action.sa_mask );
+		if ( sigaction( SIGPROF, &action, NULL ) ) {
+			Com_Printf( "Couldn't install the profiling signal handler\n" );
+			return;
+		}
+		installed = qtrue;
+	}
+
+	rate = Com_Clamp( 1, 10000, rate );
+	vm_profile.samples = Z_Malloc( VM_PROFILE_SAMPLES * sizeof( *vm_profile.samples ) );
+	vm_profile.numSamples = 0;
+	vm_profile.engineSamples = 0;
+	vm_profile.droppedSamples = 0;
+	vm_profile.thread = pthread_self();
+	vm_profile.running = qtrue;
+
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = 1000000 / rate;
+	timer.it_value = timer.it_interval;
+	setitimer( ITIMER_PROF, &timer, NULL );
+
+	Com_Printf( "Sampling VMs %i times per second of CPU time\n", rate );
+}
+
+/*
+==============
+VM_ProfileStop
+
+Writes the samples as collapsed stacks, one "frame;frame;... count" line
+per distinct stack, which flamegraph tools read directly
+==============
+*/
+static void VM_ProfileStop( const char *filename ) {
+	struct itimerval	timer;
+	vmProfileStack_t	*stack, *next;
+	fileHandle_t		f;
+	char				*line;
+	int					total, vmSamples;
+	int					i;
+
+	if ( !vm_profile.running ) {
+		Com_Printf( "VM profiler is not running\n" );
+		return;
+	}
+
+	Com_Memset( &timer, 0, sizeof( timer ) );
+	setitimer( ITIMER_PROF, &timer, NULL );
+	vm_profile.running = qfalse;
+
+	VM_ProfileFlush();
+	if ( vm_profile.engineSamples ) {
+		VM_ProfileAdd( "[engine]", vm_profile.engineSamples );
+	}
+
+	f = FS_FOpenFileWrite( filename );
+	if ( !f ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: couldn't write %s\n", filename );
+	}
+
+	total = 0;
+	for ( i = 0 ; i < VM_PROFILE_HASH ; i++ ) {
+		for ( stack = vm_profile.stacks[i] ; stack ; stack = next ) {
+			next = stack->next;
+			if ( f ) {
+				line = va( "%s %i\n", stack->text, stack->count );
+				FS_Write( line, strlen( line ), f );
+			}
+			total += stack->count;
+			Z_Free( stack );
+		}
+		vm_profile.stacks[i] = NULL;
+	}
+	if ( f ) {
+		FS_FCloseFile( f );
+	}
+
+	vmSamples = total - vm_profile.engineSamples;
+	Com_Printf( "%i samples, %i in VMs (%.1f%%), %i dropped\n", total, vmSamples,
+		total ? 100.0f * vmSamples / total : 0.0f, vm_profile.droppedSamples );
+	if ( f ) {
+		Com_Printf( "Wrote collapsed stacks to %s\n", filename );
+	}
+
+	Z_Free( vm_profile.samples );
+	vm_profile.samples = NULL;
+}
+#endif
+
 /*
 ==============
 VM_VmProfile_f
@@ -940,6 +1697,17 @@ void VM_VmProfile_f( void ) {
 	int			i;
 	double		total;
 
+#ifdef VM_SAMPLE_PROFILER
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "start" ) ) {
+		VM_ProfileStart( Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 1000 );
+		return;
+	}
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "stop" ) ) {
+		VM_ProfileStop( Cmd_Argc() > 2 ? Cmd_Argv( 2 ) : "vmprofile.txt" );
+		return;
+	}
+#endif
+
 	if ( !lastVM ) {
 		return;
 	}
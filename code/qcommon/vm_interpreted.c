@@ -161,6 +161,127 @@ void VM_StackTrace( vm_t *vm, int programCounter, int programStack ) {
 
 }
 
+/*
+=============================================================================
+
+DIRECT THREADED INTERPRETER
+
+Every code word gets the address of the label that handles it, and each
+handler jumps straight to the next one instead of going back through the
+switch.  This needs the "labels as values" extension, so other compilers
+and DEBUG_VM builds, which trace every instruction, only have the switch.
+
+A few common instruction pairs are fused into superinstructions.  The
+fused handler is only stored on the first instruction of the pair, the
+second keeps its own handler for code that jumps straight to it.
+
+=============================================================================
+*/
+
+#if defined( __GNUC__ ) && !defined( DEBUG_VM )
+#define VM_THREADED
+
+// gcc otherwise merges the handler tails into a few shared indirect jumps,
+// which loses most of the per handler branch prediction
+#ifdef __clang__
+#define VM_THREADED_ATTRIBUTE
+#else
+#define VM_THREADED_ATTRIBUTE	__attribute__(( optimize( "no-crossjumping" ) ))
+#endif
+#endif
+
+#ifdef VM_THREADED
+typedef enum {
+	OPX_LOCAL_LOAD4 = OP_CVFI + 1,
+	OPX_CONST_LOAD4,
+	OPX_CONST_ADD,
+	OPX_CONST_ADD_LOAD4,	// structure member read
+
+	// constant compared with the top of the stack, in OP_EQ .. OP_GEI order
+	OPX_CONST_EQ,
+	OPX_CONST_NE,
+	OPX_CONST_LTI,
+	OPX_CONST_LEI,
+	OPX_CONST_GTI,
+	OPX_CONST_GEI,
+
+	OPX_NOP,		// values the switch interpreter skips over
+	OPX_END,		// one past the last code word
+
+	OPX_NUM
+} opcodeThreaded_t;
+
+static void	**threadedLabels;
+
+static int VM_CallThreaded( vm_t *vm, int *args ) VM_THREADED_ATTRIBUTE;
+
+/*
+====================
+VM_PrepareThreaded
+
+Builds vm->threadedCode from the expanded code words
+====================
+*/
+static void VM_PrepareThreaded( vm_t *vm ) {
+	int		*codeBase;
+	void	**code;
+	int		i, op, nextOp;
+	int		pc, next;
+
+	if ( !threadedLabels ) {
+		VM_CallThreaded( NULL, NULL );
+	}
+
+	codeBase = (int *)vm->codeBase;
+	code = Hunk_Alloc( ( vm->codeLength + 1 ) * sizeof( *code ), h_high );
+
+	// operand words get the handler for their value as an opcode, so a bad
+	// return address behaves the same as in the switch interpreter
+	for ( pc = 0; pc < vm->codeLength; pc++ ) {
+		op = codeBase[pc];
+		if ( op <= OP_IGNORE || op > OP_CVFI ) {
+			op = OPX_NOP;
+		}
+		code[pc] = threadedLabels[op];
+	}
+	code[vm->codeLength] = threadedLabels[OPX_END];
+
+	for ( i = 0; i < vm->instructionCount; i++ ) {
+		pc = vm->instructionPointers[i];
+		op = codeBase[pc];
+
+		// handlers jump through branch targets without checking them
+		if ( op >= OP_EQ && op <= OP_GEF ) {
+			if ( (unsigned)codeBase[pc + 1] >= vm->codeLength ) {
+				Com_Error( ERR_DROP, "VM_PrepareThreaded: Jump to invalid instruction number" );
+			}
+		}
+
+		if ( i == vm->instructionCount - 1 ) {
+			break;
+		}
+		next = vm->instructionPointers[i + 1];
+		nextOp = codeBase[next];
+
+		if ( op == OP_LOCAL && nextOp == OP_LOAD4 ) {
+			code[pc] = threadedLabels[OPX_LOCAL_LOAD4];
+		} else if ( op == OP_CONST && nextOp == OP_LOAD4 ) {
+			code[pc] = threadedLabels[OPX_CONST_LOAD4];
+		} else if ( op == OP_CONST && nextOp == OP_ADD ) {
+			if ( i + 2 < vm->instructionCount && codeBase[vm->instructionPointers[i + 2]] == OP_LOAD4 ) {
+				code[pc] = threadedLabels[OPX_CONST_ADD_LOAD4];
+			} else {
+				code[pc] = threadedLabels[OPX_CONST_ADD];
+			}
+		} else if ( op == OP_CONST && nextOp >= OP_EQ && nextOp <= OP_GEI ) {
+			code[pc] = threadedLabels[OPX_CONST_EQ + nextOp - OP_EQ];
+		}
+	}
+
+	vm->threadedCode = code;
+}
+#endif
+
 
 /*
 ====================
@@ -287,6 +408,10 @@ void VM_PrepareInterpreter( vm_t *vm, vmHeader_t *header ) {
 		}
 
 	}
+
+#ifdef VM_THREADED
+	VM_PrepareThreaded( vm );
+#endif
 }
 
 /*
@@ -331,6 +456,12 @@ int	VM_CallInterpreted( vm_t *vm, int *args ) {
 	vmSymbol_t	*profileSymbol;
 #endif
 
+#ifdef VM_THREADED
+	if ( vm->threadedCode ) {
+		return VM_CallThreaded( vm, args );
+	}
+#endif
+
 	// interpret the code
 	vm->currentlyInterpreting = qtrue;
 
@@ -899,3 +1030,464 @@ done:
 	// return the result
 	return opStack[opStackOfs];
 }
+
+#ifdef VM_THREADED
+/*
+==============
+VM_CallThreaded
+
+Same stack layout and results as VM_CallInterpreted.  Program counters
+are still code word indexes, so saved return addresses and stack traces
+don't change; at each handler programCounter is the instruction's own
+word and its operand is the word after it.
+
+Called with a NULL vm to set up threadedLabels.
+==============
+*/
+static int VM_CallThreaded( vm_t *vm, int *args ) {
+	static void	*labels[OPX_NUM] = {
+		[OP_UNDEF]			= &&op_nop,
+		[OP_IGNORE]			= &&op_nop,
+		[OP_BREAK]			= &&op_break,
+		[OP_ENTER]			= &&op_enter,
+		[OP_LEAVE]			= &&op_leave,
+		[OP_CALL]			= &&op_call,
+		[OP_PUSH]			= &&op_push,
+		[OP_POP]			= &&op_pop,
+		[OP_CONST]			= &&op_const,
+		[OP_LOCAL]			= &&op_local,
+		[OP_JUMP]			= &&op_jump,
+		[OP_EQ]				= &&op_eq,
+		[OP_NE]				= &&op_ne,
+		[OP_LTI]			= &&op_lti,
+		[OP_LEI]			= &&op_lei,
+		[OP_GTI]			= &&op_gti,
+		[OP_GEI]			= &&op_gei,
+		[OP_LTU]			= &&op_ltu,
+		[OP_LEU]			= &&op_leu,
+		[OP_GTU]			= &&op_gtu,
+		[OP_GEU]			= &&op_geu,
+		[OP_EQF]			= &&op_eqf,
+		[OP_NEF]			= &&op_nef,
+		[OP_LTF]			= &&op_ltf,
+		[OP_LEF]			= &&op_lef,
+		[OP_GTF]			= &&op_gtf,
+		[OP_GEF]			= &&op_gef,
+		[OP_LOAD1]			= &&op_load1,
+		[OP_LOAD2]			= &&op_load2,
+		[OP_LOAD4]			= &&op_load4,
+		[OP_STORE1]			= &&op_store1,
+		[OP_STORE2]			= &&op_store2,
+		[OP_STORE4]			= &&op_store4,
+		[OP_ARG]			= &&op_arg,
+		[OP_BLOCK_COPY]		= &&op_block_copy,
+		[OP_SEX8]			= &&op_sex8,
+		[OP_SEX16]			= &&op_sex16,
+		[OP_NEGI]			= &&op_negi,
+		[OP_ADD]			= &&op_add,
+		[OP_SUB]			= &&op_sub,
+		[OP_DIVI]			= &&op_divi,
+		[OP_DIVU]			= &&op_divu,
+		[OP_MODI]			= &&op_modi,
+		[OP_MODU]			= &&op_modu,
+		[OP_MULI]			= &&op_muli,
+		[OP_MULU]			= &&op_mulu,
+		[OP_BAND]			= &&op_band,
+		[OP_BOR]			= &&op_bor,
+		[OP_BXOR]			= &&op_bxor,
+		[OP_BCOM]			= &&op_bcom,
+		[OP_LSH]			= &&op_lsh,
+		[OP_RSHI]			= &&op_rshi,
+		[OP_RSHU]			= &&op_rshu,
+		[OP_NEGF]			= &&op_negf,
+		[OP_ADDF]			= &&op_addf,
+		[OP_SUBF]			= &&op_subf,
+		[OP_DIVF]			= &&op_divf,
+		[OP_MULF]			= &&op_mulf,
+		[OP_CVIF]			= &&op_cvif,
+		[OP_CVFI]			= &&op_cvfi,
+		[OPX_LOCAL_LOAD4]	= &&opx_local_load4,
+		[OPX_CONST_LOAD4]	= &&opx_const_load4,
+		[OPX_CONST_ADD]		= &&opx_const_add,
+		[OPX_CONST_ADD_LOAD4]	= &&opx_const_add_load4,
+		[OPX_CONST_EQ]		= &&opx_const_eq,
+		[OPX_CONST_NE]		= &&opx_const_ne,
+		[OPX_CONST_LTI]		= &&opx_const_lti,
+		[OPX_CONST_LEI]		= &&opx_const_lei,
+		[OPX_CONST_GTI]		= &&opx_const_gti,
+		[OPX_CONST_GEI]		= &&opx_const_gei,
+		[OPX_NOP]			= &&op_nop,
+		[OPX_END]			= &&op_end
+	};
+	byte	stack[OPSTACK_SIZE + 15];
+	int		*opStack;
+	uint8_t	opStackOfs;
+	int		programCounter;
+	int		programStack;
+	int		stackOnEntry;
+	byte	*image;
+	int		*codeImage;
+	void	**code;
+	int		dataMask;
+	int		arg;
+	int		r0, r1;
+	int		tos;
+
+	if ( !vm ) {
+		threadedLabels = labels;
+		return 0;
+	}
+
+	vm->currentlyInterpreting = qtrue;
+
+	// we might be called recursively, so this might not be the very top
+	programStack = stackOnEntry = vm->programStack;
+
+	image = vm->dataBase;
+	codeImage = (int *)vm->codeBase;
+	code = vm->threadedCode;
+	dataMask = vm->dataMask;
+
+	programCounter = 0;
+
+	programStack -= ( 8 + 4 * MAX_VMMAIN_ARGS );
+
+	for ( arg = 0; arg < MAX_VMMAIN_ARGS; arg++ )
+		*(int *)&image[ programStack + 8 + arg * 4 ] = args[ arg ];
+
+	*(int *)&image[ programStack + 4 ] = 0;	// return stack
+	*(int *)&image[ programStack ] = -1;	// will terminate the loop on return
+
+	VM_Debug(0);
+
+	opStack = PADP(stack, 16);
+	*opStack = 0xDEADBEEF;
+	opStackOfs = 0;
+
+	// the top of the stack is kept in tos as well as in memory, so handlers
+	// don't have to wait on a reload of the value the previous one stored
+	tos = *opStack;
+
+#define	DISPATCH()	goto *code[ programCounter ]
+#define	NEXT( n )	programCounter += ( n ); DISPATCH()
+#define	OPERAND		codeImage[ programCounter + 1 ]
+#define	TOP			opStack[ opStackOfs ]
+#define	SECOND		opStack[ (uint8_t)( opStackOfs - 1 ) ]
+#define	FSTACK( ofs )	( (float *)opStack )[ (uint8_t)( ofs ) ]
+#define	SET_TOS( v )	tos = ( v ); TOP = tos
+#define	PUSH( v )		opStackOfs++; SET_TOS( v )
+#define	POP( n )		opStackOfs -= ( n ); tos = TOP
+
+	// pops two values and branches to the operand if the condition holds
+#define	BRANCH( cond ) \
+	r0 = tos; \
+	r1 = SECOND; \
+	POP( 2 ); \
+	if ( cond ) { \
+		programCounter = OPERAND; \
+		DISPATCH(); \
+	} \
+	NEXT( 2 )
+
+#define	BRANCHF( op ) \
+	opStackOfs -= 2; \
+	r0 = FSTACK( opStackOfs + 1 ) op FSTACK( opStackOfs + 2 ); \
+	tos = TOP; \
+	if ( r0 ) { \
+		programCounter = OPERAND; \
+		DISPATCH(); \
+	} \
+	NEXT( 2 )
+
+	// CONST followed by an integer compare, the branch target is the compare's operand
+#define	BRANCH_CONST( op ) \
+	r0 = OPERAND; \
+	r1 = tos; \
+	opStack[ (uint8_t)( opStackOfs + 1 ) ] = r0; \
+	POP( 1 ); \
+	if ( r1 op r0 ) { \
+		programCounter = codeImage[ programCounter + 3 ]; \
+		DISPATCH(); \
+	} \
+	NEXT( 4 )
+
+	// pops two values and pushes the result
+#define	BINARY( type, op ) \
+	r0 = tos; \
+	opStackOfs--; \
+	SET_TOS( ( (type)TOP ) op ( (type)r0 ) ); \
+	NEXT( 1 )
+
+#define	BINARYF( op ) \
+	opStackOfs--; \
+	FSTACK( opStackOfs ) = FSTACK( opStackOfs ) op FSTACK( opStackOfs + 1 ); \
+	tos = TOP; \
+	NEXT( 1 )
+
+	DISPATCH();
+
+op_nop:
+	NEXT( 1 );
+op_end:
+	Com_Error( ERR_DROP, "VM program counter out of range" );
+	return 0;
+op_break:
+	vm->breakCount++;
+	NEXT( 1 );
+
+op_const:
+	PUSH( OPERAND );
+	NEXT( 2 );
+op_local:
+	PUSH( OPERAND + programStack );
+	NEXT( 2 );
+
+op_load4:
+	SET_TOS( *(int *)&image[ tos & dataMask ] );
+	NEXT( 1 );
+op_load2:
+	SET_TOS( *(unsigned short *)&image[ tos & dataMask ] );
+	NEXT( 1 );
+op_load1:
+	SET_TOS( image[ tos & dataMask ] );
+	NEXT( 1 );
+
+op_store4:
+	*(int *)&image[ SECOND & dataMask ] = tos;
+	POP( 2 );
+	NEXT( 1 );
+op_store2:
+	*(short *)&image[ SECOND & dataMask ] = tos;
+	POP( 2 );
+	NEXT( 1 );
+op_store1:
+	image[ SECOND & dataMask ] = tos;
+	POP( 2 );
+	NEXT( 1 );
+
+op_arg:
+	// single byte offset from programStack
+	*(int *)&image[ ( OPERAND + programStack ) & dataMask ] = tos;
+	POP( 1 );
+	NEXT( 2 );
+
+op_block_copy:
+	VM_BlockCopy( SECOND, tos, OPERAND );
+	POP( 2 );
+	NEXT( 2 );
+
+op_call:
+	// save the return address
+	*(int *)&image[ programStack ] = programCounter + 1;
+
+	r0 = tos;
+	POP( 1 );
+	if ( r0 < 0 ) {
+		// system call
+		int		r;
+
+		// save the stack to allow recursive VM entry
+		vm->programStack = programStack - 4;
+		*(int *)&image[ programStack + 4 ] = -1 - r0;
+
+		// the vm has ints on the stack, we expect
+		// pointers so we might have to convert it
+		if ( sizeof( intptr_t ) != sizeof( int ) ) {
+			intptr_t	argarr[ MAX_VMSYSCALL_ARGS ];
+			int			*imagePtr = (int *)&image[ programStack ];
+			int			i;
+
+			for ( i = 0; i < ARRAY_LEN( argarr ); ++i ) {
+				argarr[i] = *(++imagePtr);
+			}
+			r = vm->systemCall( argarr );
+		} else {
+			intptr_t	*argptr = (intptr_t *)&image[ programStack + 4 ];
+			r = vm->systemCall( argptr );
+		}
+
+		// save return value
+		PUSH( r );
+
+		// the system call may have written over the return address
+		programCounter = *(int *)&image[ programStack ];
+		if ( (unsigned)programCounter >= vm->codeLength ) {
+			Com_Error( ERR_DROP, "VM program counter out of range in OP_CALL" );
+			return 0;
+		}
+		DISPATCH();
+	}
+	if ( (unsigned)r0 >= vm->instructionCount ) {
+		Com_Error( ERR_DROP, "VM program counter out of range in OP_CALL" );
+		return 0;
+	}
+	programCounter = vm->instructionPointers[ r0 ];
+	DISPATCH();
+
+	// push and pop are only needed for discarded or bad function return values
+op_push:
+	opStackOfs++;
+	tos = TOP;
+	NEXT( 1 );
+op_pop:
+	POP( 1 );
+	NEXT( 1 );
+
+op_enter:
+	// get size of stack frame
+	programStack -= OPERAND;
+	NEXT( 2 );
+op_leave:
+	// remove our stack frame
+	programStack += OPERAND;
+
+	// grab the saved program counter
+	programCounter = *(int *)&image[ programStack ];
+
+	// check for leaving the VM
+	if ( programCounter == -1 ) {
+		goto done;
+	} else if ( (unsigned)programCounter >= vm->codeLength ) {
+		Com_Error( ERR_DROP, "VM program counter out of range in OP_LEAVE" );
+		return 0;
+	}
+	DISPATCH();
+
+op_jump:
+	if ( (unsigned)tos >= vm->instructionCount ) {
+		Com_Error( ERR_DROP, "VM program counter out of range in OP_JUMP" );
+		return 0;
+	}
+	programCounter = vm->instructionPointers[ tos ];
+	POP( 1 );
+	DISPATCH();
+
+op_eq:	BRANCH( r1 == r0 );
+op_ne:	BRANCH( r1 != r0 );
+op_lti:	BRANCH( r1 < r0 );
+op_lei:	BRANCH( r1 <= r0 );
+op_gti:	BRANCH( r1 > r0 );
+op_gei:	BRANCH( r1 >= r0 );
+op_ltu:	BRANCH( (unsigned)r1 < (unsigned)r0 );
+op_leu:	BRANCH( (unsigned)r1 <= (unsigned)r0 );
+op_gtu:	BRANCH( (unsigned)r1 > (unsigned)r0 );
+op_geu:	BRANCH( (unsigned)r1 >= (unsigned)r0 );
+
+op_eqf:	BRANCHF( == );
+op_nef:	BRANCHF( != );
+op_ltf:	BRANCHF( < );
+op_lef:	BRANCHF( <= );
+op_gtf:	BRANCHF( > );
+op_gef:	BRANCHF( >= );
+
+op_negi:
+	SET_TOS( -tos );
+	NEXT( 1 );
+op_add:		BINARY( int, + );
+op_sub:		BINARY( int, - );
+op_divi:	BINARY( int, / );
+op_divu:	BINARY( unsigned, / );
+op_modi:	BINARY( int, % );
+op_modu:	BINARY( unsigned, % );
+op_muli:	BINARY( int, * );
+op_mulu:	BINARY( unsigned, * );
+
+op_band:	BINARY( unsigned, & );
+op_bor:		BINARY( unsigned, | );
+op_bxor:	BINARY( unsigned, ^ );
+op_bcom:
+	SET_TOS( ~( (unsigned)tos ) );
+	NEXT( 1 );
+
+op_lsh:
+	r0 = tos;
+	opStackOfs--;
+	SET_TOS( TOP << r0 );
+	NEXT( 1 );
+op_rshi:
+	r0 = tos;
+	opStackOfs--;
+	SET_TOS( TOP >> r0 );
+	NEXT( 1 );
+op_rshu:
+	r0 = tos;
+	opStackOfs--;
+	SET_TOS( ( (unsigned)TOP ) >> r0 );
+	NEXT( 1 );
+
+op_negf:
+	FSTACK( opStackOfs ) = -FSTACK( opStackOfs );
+	tos = TOP;
+	NEXT( 1 );
+op_addf:	BINARYF( + );
+op_subf:	BINARYF( - );
+op_divf:	BINARYF( / );
+op_mulf:	BINARYF( * );
+
+op_cvif:
+	FSTACK( opStackOfs ) = (float)tos;
+	tos = TOP;
+	NEXT( 1 );
+op_cvfi:
+	SET_TOS( Q_ftol( FSTACK( opStackOfs ) ) );
+	NEXT( 1 );
+op_sex8:
+	SET_TOS( (signed char)tos );
+	NEXT( 1 );
+op_sex16:
+	SET_TOS( (short)tos );
+	NEXT( 1 );
+
+	//===================================================================
+	// superinstructions, these skip the rest of the sequence
+
+opx_local_load4:
+	PUSH( *(int *)&image[ ( OPERAND + programStack ) & dataMask ] );
+	NEXT( 3 );
+opx_const_load4:
+	PUSH( *(int *)&image[ OPERAND & dataMask ] );
+	NEXT( 3 );
+opx_const_add:
+	// the constant is still left in the free slot above the top, like OP_CONST would
+	opStack[ (uint8_t)( opStackOfs + 1 ) ] = OPERAND;
+	SET_TOS( tos + OPERAND );
+	NEXT( 3 );
+opx_const_add_load4:
+	opStack[ (uint8_t)( opStackOfs + 1 ) ] = OPERAND;
+	SET_TOS( *(int *)&image[ ( tos + OPERAND ) & dataMask ] );
+	NEXT( 4 );
+
+opx_const_eq:	BRANCH_CONST( == );
+opx_const_ne:	BRANCH_CONST( != );
+opx_const_lti:	BRANCH_CONST( < );
+opx_const_lei:	BRANCH_CONST( <= );
+opx_const_gti:	BRANCH_CONST( > );
+opx_const_gei:	BRANCH_CONST( >= );
+
+#undef DISPATCH
+#undef NEXT
+#undef OPERAND
+#undef TOP
+#undef SECOND
+#undef FSTACK
+#undef SET_TOS
+#undef PUSH
+#undef POP
+#undef BRANCH
+#undef BRANCHF
+#undef BRANCH_CONST
+#undef BINARY
+#undef BINARYF
+
+done:
+	vm->currentlyInterpreting = qfalse;
+
+	if (opStackOfs != 1 || *opStack != 0xDEADBEEF)
+		Com_Error(ERR_DROP, "Interpreter error: opStack[0] = %X, opStackOfs = %d", opStack[0], opStackOfs);
+
+	vm->programStack = stackOnEntry;
+
+	// return the result
+	return opStack[opStackOfs];
+}
+#endif
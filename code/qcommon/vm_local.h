@@ -38,6 +38,17 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 // don't change
 // Hardcoded in q3asm a reserved at end of bss
 #define	PROGRAM_STACK_SIZE	0x10000
+
+// 64 bit Linux can give each data segment 4 GiB of address space plus guard
+// pages, so compiled code doesn't have to mask 32 bit addresses, as long as
+// it adds no more than PROGRAM_STACK_SIZE to them
+#if idx64 && defined(__linux__) && !defined(NO_VM_COMPILED)
+#define VM_GUARD_REGION
+#define	VM_GUARD_SIZE		( 0x100000000ULL + 2 * PROGRAM_STACK_SIZE )
+
+// compiled code there can also be sampled from a profiling timer signal
+#define VM_SAMPLE_PROFILER
+#endif
 #define	PROGRAM_STACK_MASK	(PROGRAM_STACK_SIZE-1)
 
 typedef enum {
@@ -138,6 +149,11 @@ typedef struct vmSymbol_s {
 	char	symName[1];		// variable sized
 } vmSymbol_t;
 
+typedef struct {
+	int		instruction;		// of its OP_ENTER
+	char	*name;				// from the map file, loaded by the sampling profiler
+} vmFunction_t;
+
 #define	VM_OFFSET_PROGRAM_STACK		0
 #define	VM_OFFSET_SYSTEM_CALL		4
 
@@ -163,6 +179,7 @@ struct vm_s {
 
 	// for interpreted modules
 	qboolean	currentlyInterpreting;
+	void		**threadedCode;		// handler for each code word, see VM_PrepareThreaded
 
 	qboolean	compiled;
 	byte		*codeBase;
@@ -175,6 +192,7 @@ struct vm_s {
 	byte		*dataBase;
 	int			dataMask;
 	int			dataAlloc;			// actually allocated
+	qboolean	dataGuarded;		// dataBase starts a VM_GUARD_SIZE region
 
 	int			stackBottom;		// if programStack < stackBottom, error
 
@@ -187,6 +205,10 @@ struct vm_s {
 
 	byte		*jumpTableTargets;
 	int			numJumpTableTargets;
+
+	vmFunction_t	*functions;		// in code order
+	int			numFunctions;
+	qboolean	functionNamesLoaded;
 };
 
 
@@ -196,6 +218,14 @@ extern	int		vm_debugLevel;
 void VM_Compile( vm_t *vm, vmHeader_t *header );
 int	VM_CallCompiled( vm_t *vm, int *args );
 
+qboolean VM_ReadCodeCache( vm_t *vm, vmHeader_t *header, const char *build, int flags,
+		byte *code, int stubLength, int maxLength, int *codeLength );
+void VM_WriteCodeCache( vm_t *vm, vmHeader_t *header, const char *build, int flags,
+		const byte *code, int stubLength, int codeLength );
+#ifdef VM_SAMPLE_PROFILER
+int VM_SampleCompiled( vm_t *vm, void *context, int *functions, int maxFunctions );
+#endif
+
 void VM_PrepareInterpreter( vm_t *vm, vmHeader_t *header );
 int	VM_CallInterpreted( vm_t *vm, int *args );
 
@@ -21,8 +21,17 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 // vm_x86.c -- load time compiler and execution environment for x86
 
+#if defined(__linux__) && defined(__x86_64__)
+  // for the register names in ucontext_t
+  #define _GNU_SOURCE
+#endif
+
 #include "vm_local.h"
 
+#ifdef VM_SAMPLE_PROFILER
+  #include <ucontext.h>
+#endif
+
 #ifdef _WIN32
   #include <windows.h>
 #else
@@ -44,6 +53,10 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 static void VM_Destroy_Compiled(vm_t* self);
 
+// opStack bytes that generated code may address beyond either end of the
+// opStack, as the optimizing compiler defers updates of bl
+#define OPSTACK_MARGIN	128
+
 /*
 
   eax		scratch
@@ -68,6 +81,9 @@ static	int		pc = 0;
 
 #define FTOL_PTR
 
+// cached code is only used again by the build it was compiled by
+#define VM_CACHE_BUILD	Q3_VERSION " " __DATE__ " " __TIME__
+
 static	int	instruction, pass;
 static	int	lastConst = 0;
 static	int	oc0, oc1, pop0, pop1;
@@ -84,7 +100,8 @@ typedef enum
 typedef enum
 {
 	VM_JMP_VIOLATION = 0,
-	VM_BLOCK_COPY = 1
+	VM_BLOCK_COPY = 1,
+	VM_STACK_VIOLATION = 2
 } ESysCallType;
 
 static	ELastCommand	LastCommand;
@@ -406,10 +423,21 @@ int vm_programStack;
 int *vm_opStackBase;
 uint8_t vm_opStackOfs;
 intptr_t vm_arg;
+#ifdef VM_SAMPLE_PROFILER
+intptr_t *vm_syscallFrame;
+
+// the return addresses of compiled code above the running syscall
+static intptr_t *vm_syscallStack;
+#endif
 
 static void DoSyscall(void)
 {
 	vm_t *savedVM;
+#ifdef VM_SAMPLE_PROFILER
+	intptr_t *syscallStack = vm_syscallStack;
+
+	vm_syscallStack = vm_syscallFrame;
+#endif
 
 	// save currentVM so as to allow for recursive VM entry
 	savedVM = currentVM;
@@ -451,6 +479,9 @@ static void DoSyscall(void)
 			
 			VM_BlockCopy(vm_opStackBase[(vm_opStackOfs - 1)], vm_opStackBase[vm_opStackOfs], vm_arg);
 		break;
+		case VM_STACK_VIOLATION:
+			Com_Error(ERR_DROP, "programStack out of range in compiled code");
+		break;
 		default:
 			Com_Error(ERR_DROP, "Unknown VM operation %d", vm_syscallNum);
 		break;
@@ -458,6 +489,9 @@ static void DoSyscall(void)
 	}
 
 	currentVM = savedVM;
+#ifdef VM_SAMPLE_PROFILER
+	vm_syscallStack = syscallStack;
+#endif
 }
 
 /*
@@ -516,6 +550,12 @@ int EmitCallDoSyscall(vm_t *vm)
 	EmitString("89 C8");			// mov eax, ecx
 	EmitString("A3");			// mov [0x12345678], eax
 	EmitPtr(&vm_arg);
+#ifdef VM_SAMPLE_PROFILER
+	// vm_syscallFrame, above the five registers pushed
+	EmitRexString(0x48, "8D 44 24 28");	// lea rax, [rsp + 40]
+	EmitRexString(0x48, "A3");		// mov [0x12345678], rax
+	EmitPtr(&vm_syscallFrame);
+#endif
 	
 	// align the stack pointer to a 16-byte-boundary
 	EmitString("55");			// push ebp
@@ -1062,161 +1102,1301 @@ qboolean ConstOptimize(vm_t *vm, int callProcOfsSyscall)
 	return qfalse;
 }
 
+#if idx64
 /*
 =================
-VM_Compile
+Optimizing compiler
+
+Instead of translating every instruction against the opStack in memory,
+the compiler keeps a model of the top OPT_MAX_ITEMS entries, which may be
+held in registers, or still be constants or programStack offsets that are
+folded into the instructions using them.  Entries and the pending change
+of bl are only written out at the end of a basic block, before calls, or
+when the registers run out.  programStack relative accesses are checked
+once per block instead of being masked one by one, or not at all with a
+guarded data segment.
+
+Only instructions that are jump or call targets get an entry point, the
+others point at the jump violation handler, so a block can't be entered
+in the middle with the cached state missing.
+
+  r10-r15	cached opStack entries
+  edx		scratch for writing entries back
+  xmm0-1	float operations
 =================
 */
-void VM_Compile(vm_t *vm, vmHeader_t *header)
+
+#define OPT_MAX_ITEMS	8	// opStack entries tracked at compile time
+#define OPT_MAX_DELTA	16	// opStack offset change pending before bl is updated
+
+enum
 {
-	int		op;
-	int		maxLength;
-	int		v;
-	int		i;
-        int		callProcOfsSyscall, callProcOfs, callDoSyscallOfs;
+	R_EAX, R_ECX, R_EDX, R_EBX, R_ESP, R_EBP, R_ESI, R_EDI,
+	R_R8, R_R9, R_R10, R_R11, R_R12, R_R13, R_R14, R_R15,
+	R_NONE = -1
+};
 
-	jusedSize = header->instructionCount + 2;
+typedef enum
+{
+	OPT_MEM,		// in its opStack slot
+	OPT_REG,		// value is the register
+	OPT_CONST,		// value is the constant
+	OPT_LOCAL		// value is the offset from programStack
+} optKind_t;
 
-	// allocate a very large temp buffer, we will shrink it later
-	maxLength = header->codeLength * 8 + 64;
-	buf = Z_Malloc(maxLength);
-	jused = Z_Malloc(jusedSize);
-	code = Z_Malloc(header->codeLength+32);
-	
-	Com_Memset(jused, 0, jusedSize);
-	Com_Memset(buf, 0, maxLength);
+typedef struct
+{
+	optKind_t	kind;
+	int		value;		// opStack displacement for popped OPT_MEM entries
+} optItem_t;
 
-	// copy code in larger buffer and put some zeros at the end
-	// so we can safely look ahead for a few instructions in it
-	// without a chance to get false-positive because of some garbage bytes
-	Com_Memset(code, 0, header->codeLength+32);
-	Com_Memcpy(code, (byte *)header + header->codeOffset, header->codeLength );
+typedef struct
+{
+	int		base, index, disp;
+} optAddr_t;
 
-	// ensure that the optimisation pass knows about all the jump
-	// table targets
-	pc = -1; // a bogus value to be printed in out-of-bounds error messages
-	for( i = 0; i < vm->numJumpTableTargets; i++ ) {
-		JUSED( *(int *)(vm->jumpTableTargets + ( i * sizeof( int ) ) ) );
+static const int optRegs[] = { R_R10, R_R11, R_R12, R_R13, R_R14, R_R15 };
+
+static	optItem_t	optStack[OPT_MAX_ITEMS];
+static	int		optDepth;		// entries tracked in optStack
+static	int		optTop;			// opStack offset of the top entry relative to bl
+static	qboolean	optRegUsed[16];
+static	int		optLocalLimit;		// LOCAL offsets up to this are checked, -1 if unchecked
+static	int		optBlockPc, optBlockInstruction;
+static	int		optErrJumpOfs, optErrStackOfs;
+static	int		optCodeLength, optInstructionCount;
+
+static void EmitRex(int reg, int index, int base)
+{
+	int rex = 0x40;
+
+	if(reg & 8)
+		rex |= 4;
+	if(index != R_NONE && (index & 8))
+		rex |= 2;
+	if(base & 8)
+		rex |= 1;
+
+	if(rex != 0x40)
+		Emit1(rex);
+}
+
+/*
+=================
+EmitOpReg
+Instruction with a register as ModRM operand
+=================
+*/
+static void EmitOpReg(int prefix, const char *opcode, int reg, int rm)
+{
+	if(prefix)
+		Emit1(prefix);
+	EmitRex(reg, R_NONE, rm);
+	EmitString(opcode);
+	Emit1(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/*
+=================
+EmitOpMem
+Instruction with [base + index * (1 << scale) + disp] as ModRM operand
+=================
+*/
+static void EmitOpMem(int prefix, const char *opcode, int reg, int base, int index, int scale, int disp)
+{
+	int mod;
+
+	if(prefix)
+		Emit1(prefix);
+	EmitRex(reg, index, base);
+	EmitString(opcode);
+
+	if(!disp && (base & 7) != R_EBP)
+		mod = 0;
+	else if(iss8(disp))
+		mod = 1;
+	else
+		mod = 2;
+
+	if(index != R_NONE || (base & 7) == R_ESP)
+	{
+		Emit1((mod << 6) | ((reg & 7) << 3) | 4);
+		Emit1((scale << 6) | (((index != R_NONE ? index : R_ESP) & 7) << 3) | (base & 7));
 	}
+	else
+		Emit1((mod << 6) | ((reg & 7) << 3) | (base & 7));
 
-	// Start buffer with x86-VM specific procedures
-	compiledOfs = 0;
+	if(mod == 1)
+		Emit1(disp);
+	else if(mod == 2)
+		Emit4(disp);
+}
 
-	callDoSyscallOfs = compiledOfs;
-	callProcOfs = EmitCallDoSyscall(vm);
-	callProcOfsSyscall = EmitCallProcedure(vm, callDoSyscallOfs);
-	vm->entryOfs = compiledOfs;
+// op rm, imm for the 0x81 opcode group
+static void EmitOpImm(int ext, int rm, int v)
+{
+	if(iss8(v))
+	{
+		EmitOpReg(0, "83", ext, rm);
+		Emit1(v);
+	}
+	else
+	{
+		EmitOpReg(0, "81", ext, rm);
+		Emit4(v);
+	}
+}
 
-	for(pass=0; pass < 3; pass++) {
-	oc0 = -23423;
-	oc1 = -234354;
-	pop0 = -43435;
-	pop1 = -545455;
+static void OptMoveTo(int reg, const optItem_t *item)
+{
+	switch(item->kind)
+	{
+	case OPT_REG:
+		if(item->value != reg)
+			EmitOpReg(0, "8B", reg, item->value);			// mov reg, item
+		break;
+	case OPT_MEM:
+		EmitOpMem(0, "8B", reg, R_EDI, R_EBX, 2, item->value);	// mov reg, dword ptr disp[edi + ebx * 4]
+		break;
+	case OPT_CONST:
+		EmitRex(0, R_NONE, reg);
+		Emit1(0xB8 | (reg & 7));					// mov reg, 0x12345678
+		Emit4(item->value);
+		break;
+	case OPT_LOCAL:
+		EmitOpMem(0, "8D", reg, R_ESI, R_NONE, 0, item->value);	// lea reg, [esi + 0x12345678]
+		break;
+	}
+}
 
-	// translate all instructions
-	pc = 0;
-	instruction = 0;
-	//code = (byte *)header + header->codeOffset;
-	compiledOfs = vm->entryOfs;
+// Writes the tracked entry back to its opStack slot
+static void OptWriteItem(int i)
+{
+	optItem_t *item = &optStack[i];
+	int disp = (optTop - (optDepth - 1 - i)) * 4;
 
-	LastCommand = LAST_COMMAND_NONE;
+	switch(item->kind)
+	{
+	case OPT_MEM:
+		return;
+	case OPT_REG:
+		EmitOpMem(0, "89", item->value, R_EDI, R_EBX, 2, disp);	// mov dword ptr disp[edi + ebx * 4], reg
+		optRegUsed[item->value] = qfalse;
+		break;
+	case OPT_CONST:
+		EmitOpMem(0, "C7", 0, R_EDI, R_EBX, 2, disp);		// mov dword ptr disp[edi + ebx * 4], 0x12345678
+		Emit4(item->value);
+		break;
+	case OPT_LOCAL:
+		OptMoveTo(R_EDX, item);
+		EmitOpMem(0, "89", R_EDX, R_EDI, R_EBX, 2, disp);	// mov dword ptr disp[edi + ebx * 4], edx
+		break;
+	}
 
-	while(instruction < header->instructionCount)
+	item->kind = OPT_MEM;
+}
+
+static int OptAllocReg(void)
+{
+	int i;
+
+	for(i = 0; i < ARRAY_LEN(optRegs); i++)
 	{
-		if(compiledOfs > maxLength - 16)
+		if(!optRegUsed[optRegs[i]])
 		{
-	        	VMFREE_BUFFERS();
-			Com_Error(ERR_DROP, "VM_CompileX86: maxLength exceeded");
+			optRegUsed[optRegs[i]] = qtrue;
+			return optRegs[i];
 		}
+	}
 
-		vm->instructionPointers[ instruction ] = compiledOfs;
+	// spill the deepest entry held in a register
+	for(i = 0; i < optDepth; i++)
+	{
+		if(optStack[i].kind == OPT_REG)
+		{
+			int reg = optStack[i].value;
 
-		if ( !vm->jumpTableTargets )
-			jlabel = 1;
-		else 
-			jlabel = jused[ instruction ];
+			OptWriteItem(i);
+			optRegUsed[reg] = qtrue;
+			return reg;
+		}
+	}
 
-		instruction++;
+	VMFREE_BUFFERS();
+	Com_Error(ERR_DROP, "VM_CompileX86: out of registers");
+	return R_NONE;
+}
 
-		if(pc > header->codeLength)
-		{
-		        VMFREE_BUFFERS();
-			Com_Error(ERR_DROP, "VM_CompileX86: pc > header->codeLength");
-		}
+static void OptFree(const optItem_t *item)
+{
+	if(item->kind == OPT_REG)
+		optRegUsed[item->value] = qfalse;
+}
 
-		op = code[ pc ];
-		pc++;
-		switch ( op ) {
-		case 0:
-			break;
-		case OP_BREAK:
-			EmitString("CC");				// int 3
-			break;
-		case OP_ENTER:
-			EmitString("81 EE");				// sub esi, 0x12345678
-			Emit4(Constant4());
-			break;
-		case OP_CONST:
-			if(ConstOptimize(vm, callProcOfsSyscall))
-				break;
+static void OptToReg(optItem_t *item)
+{
+	int reg;
 
-			EmitPushStack(vm);
-			EmitString("C7 04 9F");				// mov dword ptr [edi + ebx * 4], 0x12345678
-			lastConst = Constant4();
+	if(item->kind == OPT_REG)
+		return;
 
-			Emit4(lastConst);
-			if(code[pc] == OP_JUMP)
-				JUSED(lastConst);
+	reg = OptAllocReg();
+	OptMoveTo(reg, item);
+	item->kind = OPT_REG;
+	item->value = reg;
+}
 
+static void OptPush(optKind_t kind, int value)
+{
+	if(optDepth == OPT_MAX_ITEMS)
+	{
+		OptWriteItem(0);
+		memmove(optStack, optStack + 1, (OPT_MAX_ITEMS - 1) * sizeof(optStack[0]));
+		optDepth--;
+	}
+
+	optStack[optDepth].kind = kind;
+	optStack[optDepth].value = value;
+	optDepth++;
+	optTop++;
+}
+
+// Popped OPT_MEM entries carry their slot displacement, which is only valid until bl changes
+static void OptPop(optItem_t *item)
+{
+	if(optDepth)
+		*item = optStack[--optDepth];
+	else
+		item->kind = OPT_MEM;
+
+	if(item->kind == OPT_MEM)
+		item->value = optTop * 4;
+
+	optTop--;
+}
+
+/*
+=================
+OptFlush
+Writes out all tracked entries and updates bl, as expected at block boundaries
+=================
+*/
+static void OptFlush(void)
+{
+	int i;
+
+	for(i = 0; i < optDepth; i++)
+		OptWriteItem(i);
+	optDepth = 0;
+
+	if(optTop)
+		STACK_PUSH(optTop);				// add bl, optTop
+	optTop = 0;
+
+	optLocalLimit = -1;
+	optBlockPc = -1;
+}
+
+// Keeps opStack displacements within OPSTACK_MARGIN
+static void OptRebase(void)
+{
+	if(optTop > OPT_MAX_DELTA || optTop < -OPT_MAX_DELTA)
+	{
+		STACK_PUSH(optTop);				// add bl, optTop
+		optTop = 0;
+	}
+}
+
+static int OptOperandSize(int op)
+{
+	switch(op)
+	{
+	case OP_ENTER:
+	case OP_LEAVE:
+	case OP_CONST:
+	case OP_LOCAL:
+	case OP_BLOCK_COPY:
+		return 4;
+	case OP_ARG:
+		return 1;
+	default:
+		if(op >= OP_EQ && op <= OP_GEF)
+			return 4;
+		return 0;
+	}
+}
+
+/*
+=================
+OptBlockLocals
+Largest programStack offset used by LOCAL and ARG in the current block
+=================
+*/
+static int OptBlockLocals(void)
+{
+	int blockPc = optBlockPc;
+	int i = optBlockInstruction;
+	int op, v, max = 0;
+
+	while(blockPc < optCodeLength && i < optInstructionCount)
+	{
+		op = code[blockPc];
+		if(blockPc != optBlockPc && (jused[i] || op == OP_ENTER))
 			break;
-		case OP_LOCAL:
-			EmitPushStack(vm);
-			EmitString("8D 86");				// lea eax, [0x12345678 + esi]
-			oc0 = oc1;
-			oc1 = Constant4();
-			Emit4(oc1);
-			EmitCommand(LAST_COMMAND_MOV_STACK_EAX);	// mov dword ptr [edi + ebx * 4], eax
-			break;
-		case OP_ARG:
-			EmitMovEAXStack(vm, 0);				// mov eax, dword ptr [edi + ebx * 4]
-			EmitString("8B D6");				// mov edx, esi
-			EmitString("81 C2");				// add edx, 0x12345678
-			Emit4((Constant1() & 0xFF));
-			MASK_REG("E2", vm->dataMask);			// and edx, 0x12345678
-#if idx64
-			EmitRexString(0x41, "89 04 11");		// mov dword ptr [r9 + edx], eax
-#else
-			EmitString("89 82");				// mov dword ptr [edx + 0x12345678], eax
-			Emit4((intptr_t) vm->dataBase);
-#endif
-			EmitCommand(LAST_COMMAND_SUB_BL_1);		// sub bl, 1
-			break;
-		case OP_CALL:
-			EmitCallRel(vm, callProcOfs);
-			break;
-		case OP_PUSH:
-			EmitPushStack(vm);
-			break;
-		case OP_POP:
-			EmitCommand(LAST_COMMAND_SUB_BL_1);		// sub bl, 1
-			break;
-		case OP_LEAVE:
-			v = Constant4();
-			EmitString("81 C6");				// add	esi, 0x12345678
-			Emit4(v);
-			EmitString("C3");				// ret
+
+		if(op == OP_LOCAL)
+			v = code[blockPc + 1] | (code[blockPc + 2] << 8) | (code[blockPc + 3] << 16) | ((unsigned int) code[blockPc + 4] << 24);
+		else if(op == OP_ARG)
+			v = code[blockPc + 1];
+		else
+			v = 0;
+
+		if(v > max && v < PROGRAM_STACK_SIZE)
+			max = v;
+
+		blockPc += 1 + OptOperandSize(op);
+		i++;
+
+		if(op == OP_CALL || op == OP_LEAVE || op == OP_JUMP || (op >= OP_EQ && op <= OP_GEF))
 			break;
-		case OP_LOAD4:
-			if (code[pc] == OP_CONST && code[pc+5] == OP_ADD && code[pc+6] == OP_STORE4)
-			{
-				if(oc0 == oc1 && pop0 == OP_LOCAL && pop1 == OP_LOCAL)
-				{
-					compiledOfs -= 12;
-					vm->instructionPointers[instruction - 1] = compiledOfs;
-				}
+	}
 
-				pc++;				// OP_CONST
-				v = Constant4();
+	return max;
+}
+
+/*
+=================
+OptLocalChecked
+Returns qtrue if [esi + offset] can be accessed without masking. The first
+access in a block checks esi against the largest offset used in the block
+=================
+*/
+static qboolean OptLocalChecked(vm_t *vm, int offset, int size)
+{
+	if(offset < 0 || offset >= PROGRAM_STACK_SIZE)
+		return qfalse;
+
+	// covered by the guard pages
+	if(vm->dataGuarded)
+		return qtrue;
+
+	if(optLocalLimit < 0)
+	{
+		optLocalLimit = OptBlockLocals();
+		if(offset > optLocalLimit)
+			optLocalLimit = offset;
+
+		EmitString("81 FE");				// cmp esi, 0x12345678
+		Emit4(vm->dataMask + 1 - optLocalLimit - 4);
+		EmitString("0F 87");				// ja errStack
+		Emit4(optErrStackOfs - compiledOfs - 4);
+	}
+
+	return offset + size <= optLocalLimit + 4;
+}
+
+// Address operand for a popped entry
+static void OptAddress(vm_t *vm, optItem_t *item, int size, optAddr_t *addr)
+{
+	addr->base = R_R9;
+	addr->index = R_NONE;
+	addr->disp = 0;
+
+	switch(item->kind)
+	{
+	case OPT_CONST:
+		addr->disp = item->value & vm->dataMask;
+		return;
+	case OPT_LOCAL:
+		if(OptLocalChecked(vm, item->value, size))
+		{
+			addr->index = R_ESI;
+			addr->disp = item->value;
+			return;
+		}
+		break;
+	case OPT_REG:
+		if(!vm->dataGuarded)
+		{
+			EmitOpReg(0, "81", 4, item->value);	// and reg, 0x12345678
+			Emit4(vm->dataMask);
+		}
+		addr->index = item->value;
+		return;
+	default:
+		break;
+	}
+
+	// 32 bit operations clear the upper half of the register, so a guarded
+	// data segment can be indexed without masking
+	OptMoveTo(R_EAX, item);
+	if(!vm->dataGuarded)
+	{
+		EmitString("25");				// and eax, 0x12345678
+		Emit4(vm->dataMask);
+	}
+	addr->index = R_EAX;
+}
+
+static void OptLoad(vm_t *vm, int op)
+{
+	optItem_t a;
+	optAddr_t addr;
+	int reg;
+
+	OptPop(&a);
+	reg = (a.kind == OPT_REG) ? a.value : OptAllocReg();
+
+	switch(op)
+	{
+	case OP_LOAD4:
+		OptAddress(vm, &a, 4, &addr);
+		EmitOpMem(0, "8B", reg, addr.base, addr.index, 0, addr.disp);		// mov reg, dword ptr [r9 + addr]
+		break;
+	case OP_LOAD2:
+		OptAddress(vm, &a, 2, &addr);
+		EmitOpMem(0, "0F B7", reg, addr.base, addr.index, 0, addr.disp);	// movzx reg, word ptr [r9 + addr]
+		break;
+	default:
+		OptAddress(vm, &a, 1, &addr);
+		EmitOpMem(0, "0F B6", reg, addr.base, addr.index, 0, addr.disp);	// movzx reg, byte ptr [r9 + addr]
+		break;
+	}
+
+	OptPush(OPT_REG, reg);
+}
+
+static void OptStoreValue(int op, const optItem_t *v, const optAddr_t *addr)
+{
+	if(v->kind == OPT_CONST)
+	{
+		switch(op)
+		{
+		case OP_STORE4:
+			EmitOpMem(0, "C7", 0, addr->base, addr->index, 0, addr->disp);		// mov dword ptr [r9 + addr], 0x12345678
+			Emit4(v->value);
+			break;
+		case OP_STORE2:
+			EmitOpMem(0x66, "C7", 0, addr->base, addr->index, 0, addr->disp);	// mov word ptr [r9 + addr], 0x1234
+			Emit2(v->value);
+			break;
+		default:
+			EmitOpMem(0, "C6", 0, addr->base, addr->index, 0, addr->disp);		// mov byte ptr [r9 + addr], 0x12
+			Emit1(v->value);
+			break;
+		}
+	}
+	else
+	{
+		switch(op)
+		{
+		case OP_STORE4:
+			EmitOpMem(0, "89", v->value, addr->base, addr->index, 0, addr->disp);	// mov dword ptr [r9 + addr], reg
+			break;
+		case OP_STORE2:
+			EmitOpMem(0x66, "89", v->value, addr->base, addr->index, 0, addr->disp);	// mov word ptr [r9 + addr], reg
+			break;
+		default:
+			EmitOpMem(0, "88", v->value, addr->base, addr->index, 0, addr->disp);	// mov byte ptr [r9 + addr], reg
+			break;
+		}
+	}
+}
+
+static void OptStore(vm_t *vm, int op)
+{
+	optItem_t a, v;
+	optAddr_t addr;
+
+	OptPop(&v);
+	OptPop(&a);
+	if(v.kind != OPT_CONST)
+		OptToReg(&v);
+
+	OptAddress(vm, &a, op == OP_STORE4 ? 4 : (op == OP_STORE2 ? 2 : 1), &addr);
+	OptStoreValue(op, &v, &addr);
+
+	OptFree(&v);
+	OptFree(&a);
+}
+
+static void OptArg(vm_t *vm, int offset)
+{
+	optItem_t a, v;
+	optAddr_t addr;
+
+	OptPop(&v);
+	if(v.kind != OPT_CONST)
+		OptToReg(&v);
+
+	a.kind = OPT_LOCAL;
+	a.value = offset;
+	OptAddress(vm, &a, 4, &addr);
+	OptStoreValue(OP_STORE4, &v, &addr);
+
+	OptFree(&v);
+}
+
+static int OptFold(int op, int a, int b)
+{
+	switch(op)
+	{
+	case OP_ADD:
+		return (unsigned int) a + b;
+	case OP_SUB:
+		return (unsigned int) a - b;
+	case OP_BAND:
+		return a & b;
+	case OP_BOR:
+		return a | b;
+	case OP_BXOR:
+		return a ^ b;
+	default:
+		return (unsigned int) a * b;
+	}
+}
+
+static void OptBinary(int op)
+{
+	optItem_t a, b, t;
+	const char *opcode;
+	int ext;
+
+	OptPop(&b);
+	OptPop(&a);
+
+	// keep constants and memory on the right side of commutative operations
+	if(op != OP_SUB && (a.kind == OPT_CONST || (a.kind != OPT_REG && b.kind == OPT_REG)))
+	{
+		t = a;
+		a = b;
+		b = t;
+	}
+
+	if(b.kind == OPT_CONST)
+	{
+		if(a.kind == OPT_CONST)
+		{
+			OptPush(OPT_CONST, OptFold(op, a.value, b.value));
+			return;
+		}
+		if(a.kind == OPT_LOCAL && (op == OP_ADD || op == OP_SUB))
+		{
+			OptPush(OPT_LOCAL, OptFold(op, a.value, b.value));
+			return;
+		}
+	}
+
+	switch(op)
+	{
+	case OP_ADD:
+		opcode = "03";
+		ext = 0;
+		break;
+	case OP_SUB:
+		opcode = "2B";
+		ext = 5;
+		break;
+	case OP_BAND:
+		opcode = "23";
+		ext = 4;
+		break;
+	case OP_BOR:
+		opcode = "0B";
+		ext = 1;
+		break;
+	case OP_BXOR:
+		opcode = "33";
+		ext = 6;
+		break;
+	default:
+		// the low 32 bits are the same for signed and unsigned multiplication
+		opcode = "0F AF";
+		ext = -1;
+		break;
+	}
+
+	OptToReg(&a);
+
+	if(b.kind == OPT_CONST)
+	{
+		if(ext >= 0)
+			EmitOpImm(ext, a.value, b.value);		// op reg, 0x12345678
+		else if(iss8(b.value))
+		{
+			EmitOpReg(0, "6B", a.value, a.value);		// imul reg, reg, 0x7F
+			Emit1(b.value);
+		}
+		else
+		{
+			EmitOpReg(0, "69", a.value, a.value);		// imul reg, reg, 0x12345678
+			Emit4(b.value);
+		}
+	}
+	else if(b.kind == OPT_MEM)
+		EmitOpMem(0, opcode, a.value, R_EDI, R_EBX, 2, b.value);	// op reg, dword ptr disp[edi + ebx * 4]
+	else
+	{
+		OptToReg(&b);
+		EmitOpReg(0, opcode, a.value, b.value);		// op reg, reg
+		OptFree(&b);
+	}
+
+	OptPush(OPT_REG, a.value);
+}
+
+static void OptDivide(int op)
+{
+	optItem_t a, b;
+	qboolean isSigned = (op == OP_DIVI || op == OP_MODI);
+
+	OptPop(&b);
+	OptPop(&a);
+
+	// registers are allocated first, spilling may use edx
+	OptToReg(&a);
+	if(b.kind != OPT_MEM)
+		OptToReg(&b);
+
+	OptMoveTo(R_EAX, &a);					// mov eax, a
+	if(isSigned)
+		EmitString("99");				// cdq
+	else
+		EmitString("31 D2");				// xor edx, edx
+
+	if(b.kind == OPT_MEM)
+		EmitOpMem(0, "F7", isSigned ? 7 : 6, R_EDI, R_EBX, 2, b.value);	// (i)div dword ptr disp[edi + ebx * 4]
+	else
+		EmitOpReg(0, "F7", isSigned ? 7 : 6, b.value);	// (i)div reg
+
+	if(op == OP_DIVI || op == OP_DIVU)
+		EmitOpReg(0, "8B", a.value, R_EAX);		// mov reg, eax
+	else
+		EmitOpReg(0, "8B", a.value, R_EDX);		// mov reg, edx
+
+	OptFree(&b);
+	OptPush(OPT_REG, a.value);
+}
+
+static void OptShift(int op)
+{
+	optItem_t a, b;
+	int ext;
+
+	if(op == OP_LSH)
+		ext = 4;
+	else if(op == OP_RSHI)
+		ext = 7;
+	else
+		ext = 5;
+
+	OptPop(&b);
+	OptPop(&a);
+	OptToReg(&a);
+
+	if(b.kind == OPT_CONST)
+	{
+		EmitOpReg(0, "C1", ext, a.value);		// shift reg, 0x12
+		Emit1(b.value & 31);
+	}
+	else
+	{
+		OptMoveTo(R_ECX, &b);				// mov ecx, b
+		EmitOpReg(0, "D3", ext, a.value);		// shift reg, cl
+		OptFree(&b);
+	}
+
+	OptPush(OPT_REG, a.value);
+}
+
+static void OptUnary(int op)
+{
+	optItem_t a;
+
+	OptPop(&a);
+	OptToReg(&a);
+
+	switch(op)
+	{
+	case OP_SEX8:
+		EmitOpReg(0, "0F BE", a.value, a.value);	// movsx reg, reg8
+		break;
+	case OP_SEX16:
+		EmitOpReg(0, "0F BF", a.value, a.value);	// movsx reg, reg16
+		break;
+	case OP_NEGI:
+		EmitOpReg(0, "F7", 3, a.value);			// neg reg
+		break;
+	case OP_BCOM:
+		EmitOpReg(0, "F7", 2, a.value);			// not reg
+		break;
+	case OP_NEGF:
+		EmitOpImm(6, a.value, 0x80000000);		// xor reg, 0x80000000
+		break;
+	case OP_CVIF:
+		EmitOpReg(0xF3, "0F 2A", 0, a.value);		// cvtsi2ss xmm0, reg
+		EmitOpReg(0x66, "0F 7E", 0, a.value);		// movd reg, xmm0
+		break;
+	default:
+		// truncates like Q_VMftol
+		EmitOpReg(0x66, "0F 6E", 0, a.value);		// movd xmm0, reg
+		EmitOpReg(0xF3, "0F 2C", a.value, 0);		// cvttss2si reg, xmm0
+		break;
+	}
+
+	OptPush(OPT_REG, a.value);
+}
+
+static void OptFloat(int op)
+{
+	optItem_t a, b;
+	const char *opcode;
+
+	switch(op)
+	{
+	case OP_ADDF:
+		opcode = "0F 58";				// addss
+		break;
+	case OP_SUBF:
+		opcode = "0F 5C";				// subss
+		break;
+	case OP_MULF:
+		opcode = "0F 59";				// mulss
+		break;
+	default:
+		opcode = "0F 5E";				// divss
+		break;
+	}
+
+	OptPop(&b);
+	OptPop(&a);
+	OptToReg(&a);
+	if(b.kind != OPT_MEM)
+		OptToReg(&b);
+
+	EmitOpReg(0x66, "0F 6E", 0, a.value);			// movd xmm0, reg
+	if(b.kind == OPT_MEM)
+		EmitOpMem(0xF3, opcode, 0, R_EDI, R_EBX, 2, b.value);	// op xmm0, dword ptr disp[edi + ebx * 4]
+	else
+	{
+		EmitOpReg(0x66, "0F 6E", 1, b.value);		// movd xmm1, reg
+		EmitOpReg(0xF3, opcode, 0, 1);			// op xmm0, xmm1
+	}
+	EmitOpReg(0x66, "0F 7E", 0, a.value);			// movd reg, xmm0
+
+	OptFree(&b);
+	OptPush(OPT_REG, a.value);
+}
+
+static void OptCompare(vm_t *vm, int op)
+{
+	optItem_t a, b;
+
+	OptPop(&b);
+	OptPop(&a);
+	OptToReg(&a);
+	if(b.kind != OPT_CONST)
+		OptToReg(&b);
+
+	OptFlush();
+
+	if(b.kind == OPT_CONST)
+		EmitOpImm(7, a.value, b.value);			// cmp reg, 0x12345678
+	else
+		EmitOpReg(0, "3B", a.value, b.value);		// cmp reg, reg
+
+	EmitBranchConditions(vm, op);
+
+	OptFree(&a);
+	OptFree(&b);
+}
+
+static void OptCompareFloat(vm_t *vm, int op)
+{
+	optItem_t a, b;
+	qboolean zero;
+
+	OptPop(&b);
+	OptPop(&a);
+	OptToReg(&a);
+
+	zero = (op == OP_EQF || op == OP_NEF) && b.kind == OPT_CONST && !b.value;
+	if(!zero)
+		OptToReg(&b);
+
+	OptFlush();
+
+	if(zero)
+	{
+		// integer test like the classic compiler, so -0.0 equals 0.0
+		EmitOpReg(0, "F7", 0, a.value);			// test reg, 0x7FFFFFFF
+		Emit4(0x7FFFFFFF);
+		EmitJumpIns(vm, op == OP_EQF ? "0F 84" : "0F 85", Constant4());	// jz/jnz 0x12345678
+	}
+	else
+	{
+		// ucomiss sets ZF and CF like fcomp sets C3 and C0, unordered included
+		EmitOpReg(0x66, "0F 6E", 0, a.value);		// movd xmm0, reg
+		EmitOpReg(0x66, "0F 6E", 1, b.value);		// movd xmm1, reg
+		EmitString("0F 2E C1");				// ucomiss xmm0, xmm1
+
+		switch(op)
+		{
+		case OP_EQF:
+			EmitJumpIns(vm, "0F 84", Constant4());	// je 0x12345678
+			break;
+		case OP_NEF:
+			EmitJumpIns(vm, "0F 85", Constant4());	// jne 0x12345678
+			break;
+		case OP_LTF:
+			EmitJumpIns(vm, "0F 82", Constant4());	// jb 0x12345678
+			break;
+		case OP_LEF:
+			EmitJumpIns(vm, "0F 86", Constant4());	// jbe 0x12345678
+			break;
+		case OP_GTF:
+			EmitJumpIns(vm, "0F 87", Constant4());	// ja 0x12345678
+			break;
+		default:
+			EmitJumpIns(vm, "0F 83", Constant4());	// jae 0x12345678
+			break;
+		}
+	}
+
+	OptFree(&a);
+	OptFree(&b);
+}
+
+static void OptCall(vm_t *vm, int callProcOfs, int callProcOfsSyscall)
+{
+	optItem_t a;
+
+	if(optDepth && optStack[optDepth - 1].kind == OPT_CONST)
+	{
+		OptPop(&a);
+		OptFlush();
+		EmitCallConst(vm, a.value, callProcOfsSyscall);
+	}
+	else
+	{
+		// the call procedure takes the destination from the opStack
+		OptFlush();
+		EmitCallRel(vm, callProcOfs);
+	}
+
+	// the return value is in the top slot, bl was updated by the callee
+}
+
+static void OptJump(vm_t *vm)
+{
+	optItem_t a;
+
+	OptPop(&a);
+
+	if(a.kind == OPT_CONST)
+	{
+		OptFlush();
+		EmitJumpIns(vm, "E9", a.value);			// jmp 0x12345678
+		return;
+	}
+
+	OptToReg(&a);
+	OptFlush();
+
+	EmitOpImm(7, a.value, vm->instructionCount);		// cmp reg, vm->instructionCount
+	EmitString("0F 83");					// jae errJump
+	Emit4(optErrJumpOfs - compiledOfs - 4);
+	EmitOpMem(0, "FF", 4, R_R8, a.value, 3, 0);		// jmp qword ptr [r8 + reg * 8]
+
+	OptFree(&a);
+}
+
+/*
+=================
+VM_CompileOptimized
+Returns qfalse if the code should be left to the classic compiler
+=================
+*/
+static qboolean VM_CompileOptimized(vm_t *vm, vmHeader_t *header, int maxLength, int callDoSyscallOfs,
+	int callProcOfs, int callProcOfsSyscall)
+{
+	int op, v, i;
+	int entryOfs = vm->entryOfs;
+	optItem_t a;
+
+	optCodeLength = header->codeLength;
+	optInstructionCount = header->instructionCount;
+
+	compiledOfs = entryOfs;
+	optErrJumpOfs = compiledOfs;
+	EmitCallErrJump(vm, callDoSyscallOfs);
+	optErrStackOfs = compiledOfs;
+	EmitString("B8");					// mov eax, 0x12345678
+	Emit4(VM_STACK_VIOLATION);
+	EmitCallRel(vm, callDoSyscallOfs);
+	vm->entryOfs = compiledOfs;
+
+	for(pass = 0; pass < 3; pass++)
+	{
+		pc = 0;
+		instruction = 0;
+		compiledOfs = vm->entryOfs;
+
+		optDepth = 0;
+		optTop = 0;
+		optLocalLimit = -1;
+		optBlockPc = -1;
+		Com_Memset(optRegUsed, 0, sizeof(optRegUsed));
+
+		while(instruction < header->instructionCount)
+		{
+			if(compiledOfs > maxLength - 256 || pc >= header->codeLength)
+			{
+				vm->entryOfs = entryOfs;
+				return qfalse;
+			}
+
+			op = code[pc];
+
+			// functions may also be called through pointers
+			if(op == OP_ENTER)
+				jused[instruction] = 1;
+
+			if(jused[instruction])
+				OptFlush();
+			else
+				OptRebase();
+
+			if(optBlockPc < 0)
+			{
+				optBlockPc = pc;
+				optBlockInstruction = instruction;
+			}
+
+			vm->instructionPointers[instruction] = compiledOfs;
+			instruction++;
+			pc++;
+
+			switch(op)
+			{
+			case OP_UNDEF:
+				break;
+			case OP_BREAK:
+				EmitString("CC");			// int 3
+				break;
+			case OP_ENTER:
+				EmitString("81 EE");			// sub esi, 0x12345678
+				Emit4(Constant4());
+				break;
+			case OP_LEAVE:
+				v = Constant4();
+				OptFlush();
+				EmitString("81 C6");			// add esi, 0x12345678
+				Emit4(v);
+				EmitString("C3");			// ret
+				break;
+			case OP_CALL:
+				OptCall(vm, callProcOfs, callProcOfsSyscall);
+				break;
+			case OP_PUSH:
+				OptPush(OPT_MEM, 0);
+				break;
+			case OP_POP:
+				OptPop(&a);
+				OptFree(&a);
+				break;
+			case OP_CONST:
+				OptPush(OPT_CONST, Constant4());
+				break;
+			case OP_LOCAL:
+				OptPush(OPT_LOCAL, Constant4());
+				break;
+			case OP_JUMP:
+				OptJump(vm);
+				break;
+			case OP_EQ:
+			case OP_NE:
+			case OP_LTI:
+			case OP_LEI:
+			case OP_GTI:
+			case OP_GEI:
+			case OP_LTU:
+			case OP_LEU:
+			case OP_GTU:
+			case OP_GEU:
+				OptCompare(vm, op);
+				break;
+			case OP_EQF:
+			case OP_NEF:
+			case OP_LTF:
+			case OP_LEF:
+			case OP_GTF:
+			case OP_GEF:
+				OptCompareFloat(vm, op);
+				break;
+			case OP_LOAD1:
+			case OP_LOAD2:
+			case OP_LOAD4:
+				OptLoad(vm, op);
+				break;
+			case OP_STORE1:
+			case OP_STORE2:
+			case OP_STORE4:
+				OptStore(vm, op);
+				break;
+			case OP_ARG:
+				OptArg(vm, Constant1());
+				break;
+			case OP_BLOCK_COPY:
+				v = Constant4();
+				OptFlush();
+				EmitString("B8");			// mov eax, 0x12345678
+				Emit4(VM_BLOCK_COPY);
+				EmitString("B9");			// mov ecx, 0x12345678
+				Emit4(v);
+				EmitCallRel(vm, callDoSyscallOfs);
+				optTop = -2;				// sub bl, 2 is left to the next flush
+				break;
+			case OP_SEX8:
+			case OP_SEX16:
+			case OP_NEGI:
+			case OP_BCOM:
+			case OP_NEGF:
+			case OP_CVIF:
+			case OP_CVFI:
+				OptUnary(op);
+				break;
+			case OP_ADD:
+			case OP_SUB:
+			case OP_BAND:
+			case OP_BOR:
+			case OP_BXOR:
+			case OP_MULI:
+			case OP_MULU:
+				OptBinary(op);
+				break;
+			case OP_DIVI:
+			case OP_DIVU:
+			case OP_MODI:
+			case OP_MODU:
+				OptDivide(op);
+				break;
+			case OP_LSH:
+			case OP_RSHI:
+			case OP_RSHU:
+				OptShift(op);
+				break;
+			case OP_ADDF:
+			case OP_SUBF:
+			case OP_MULF:
+			case OP_DIVF:
+				OptFloat(op);
+				break;
+			default:
+				vm->entryOfs = entryOfs;
+				return qfalse;
+			}
+		}
+
+		OptFlush();
+	}
+
+	// everything else must not be entered from outside its block
+	for(i = 0; i < header->instructionCount; i++)
+	{
+		if(!jused[i])
+			vm->instructionPointers[i] = optErrJumpOfs;
+	}
+
+	return qtrue;
+}
+#endif
+
+/*
+=================
+VM_Compile
+=================
+*/
+void VM_Compile(vm_t *vm, vmHeader_t *header)
+{
+	int		op;
+	int		maxLength;
+	int		v;
+	int		i;
+        int		callProcOfsSyscall, callProcOfs, callDoSyscallOfs;
+	qboolean	optimized = qfalse;
+#if idx64
+	int		stubLength, cacheFlags = 0;
+	qboolean	cached = qfalse;
+#endif
+
+	jusedSize = header->instructionCount + 2;
+
+	// allocate a very large temp buffer, we will shrink it later
+	maxLength = header->codeLength * 8 + 64;
+	buf = Z_Malloc(maxLength);
+	jused = Z_Malloc(jusedSize);
+	code = Z_Malloc(header->codeLength+32);
+	
+	Com_Memset(jused, 0, jusedSize);
+	Com_Memset(buf, 0, maxLength);
+
+	// copy code in larger buffer and put some zeros at the end
+	// so we can safely look ahead for a few instructions in it
+	// without a chance to get false-positive because of some garbage bytes
+	Com_Memset(code, 0, header->codeLength+32);
+	Com_Memcpy(code, (byte *)header + header->codeOffset, header->codeLength );
+
+	// ensure that the optimisation pass knows about all the jump
+	// table targets
+	pc = -1; // a bogus value to be printed in out-of-bounds error messages
+	for( i = 0; i < vm->numJumpTableTargets; i++ ) {
+		JUSED( *(int *)(vm->jumpTableTargets + ( i * sizeof( int ) ) ) );
+	}
+
+	// Start buffer with x86-VM specific procedures
+	compiledOfs = 0;
+
+	callDoSyscallOfs = compiledOfs;
+	callProcOfs = EmitCallDoSyscall(vm);
+	callProcOfsSyscall = EmitCallProcedure(vm, callDoSyscallOfs);
+	vm->entryOfs = compiledOfs;
+
+#if idx64
+	if(vm->jumpTableTargets && Cvar_VariableIntegerValue("vm_optimize"))
+	{
+		// everything but the stubs above is position independent, so
+		// optimized code can be reused by later runs
+		stubLength = compiledOfs;
+		if(vm->dataGuarded)
+			cacheFlags |= 1;
+
+		if(VM_ReadCodeCache(vm, header, VM_CACHE_BUILD, cacheFlags, buf, stubLength,
+			maxLength, &compiledOfs))
+		{
+			cached = optimized = qtrue;
+		}
+		else
+		{
+			optimized = VM_CompileOptimized(vm, header, maxLength, callDoSyscallOfs,
+				callProcOfs, callProcOfsSyscall);
+			if(optimized)
+				VM_WriteCodeCache(vm, header, VM_CACHE_BUILD, cacheFlags, buf, stubLength,
+					compiledOfs);
+		}
+	}
+#endif
+
+	for(pass=0; pass < 3 && !optimized; pass++) {
+	oc0 = -23423;
+	oc1 = -234354;
+	pop0 = -43435;
+	pop1 = -545455;
+
+	// translate all instructions
+	pc = 0;
+	instruction = 0;
+	//code = (byte *)header + header->codeOffset;
+	compiledOfs = vm->entryOfs;
+
+	LastCommand = LAST_COMMAND_NONE;
+
+	while(instruction < header->instructionCount)
+	{
+		if(compiledOfs > maxLength - 16)
+		{
+	        	VMFREE_BUFFERS();
+			Com_Error(ERR_DROP, "VM_CompileX86: maxLength exceeded");
+		}
+
+		vm->instructionPointers[ instruction ] = compiledOfs;
+
+		if ( !vm->jumpTableTargets )
+			jlabel = 1;
+		else 
+			jlabel = jused[ instruction ];
+
+		instruction++;
+
+		if(pc > header->codeLength)
+		{
+		        VMFREE_BUFFERS();
+			Com_Error(ERR_DROP, "VM_CompileX86: pc > header->codeLength");
+		}
+
+		op = code[ pc ];
+		pc++;
+		switch ( op ) {
+		case 0:
+			break;
+		case OP_BREAK:
+			EmitString("CC");				// int 3
+			break;
+		case OP_ENTER:
+			EmitString("81 EE");				// sub esi, 0x12345678
+			Emit4(Constant4());
+			break;
+		case OP_CONST:
+			if(ConstOptimize(vm, callProcOfsSyscall))
+				break;
+
+			EmitPushStack(vm);
+			EmitString("C7 04 9F");				// mov dword ptr [edi + ebx * 4], 0x12345678
+			lastConst = Constant4();
+
+			Emit4(lastConst);
+			if(code[pc] == OP_JUMP)
+				JUSED(lastConst);
+
+			break;
+		case OP_LOCAL:
+			EmitPushStack(vm);
+			EmitString("8D 86");				// lea eax, [0x12345678 + esi]
+			oc0 = oc1;
+			oc1 = Constant4();
+			Emit4(oc1);
+			EmitCommand(LAST_COMMAND_MOV_STACK_EAX);	// mov dword ptr [edi + ebx * 4], eax
+			break;
+		case OP_ARG:
+			EmitMovEAXStack(vm, 0);				// mov eax, dword ptr [edi + ebx * 4]
+			EmitString("8B D6");				// mov edx, esi
+			EmitString("81 C2");				// add edx, 0x12345678
+			Emit4((Constant1() & 0xFF));
+			MASK_REG("E2", vm->dataMask);			// and edx, 0x12345678
+#if idx64
+			EmitRexString(0x41, "89 04 11");		// mov dword ptr [r9 + edx], eax
+#else
+			EmitString("89 82");				// mov dword ptr [edx + 0x12345678], eax
+			Emit4((intptr_t) vm->dataBase);
+#endif
+			EmitCommand(LAST_COMMAND_SUB_BL_1);		// sub bl, 1
+			break;
+		case OP_CALL:
+			EmitCallRel(vm, callProcOfs);
+			break;
+		case OP_PUSH:
+			EmitPushStack(vm);
+			break;
+		case OP_POP:
+			EmitCommand(LAST_COMMAND_SUB_BL_1);		// sub bl, 1
+			break;
+		case OP_LEAVE:
+			v = Constant4();
+			EmitString("81 C6");				// add	esi, 0x12345678
+			Emit4(v);
+			EmitString("C3");				// ret
+			break;
+		case OP_LOAD4:
+			if (code[pc] == OP_CONST && code[pc+5] == OP_ADD && code[pc+6] == OP_STORE4)
+			{
+				if(oc0 == oc1 && pop0 == OP_LOCAL && pop1 == OP_LOCAL)
+				{
+					compiledOfs -= 12;
+					vm->instructionPointers[instruction - 1] = compiledOfs;
+				}
+
+				pc++;				// OP_CONST
+				v = Constant4();
 
 				EmitMovEDXStack(vm, vm->dataMask);
 				if(v == 1 && oc0 == oc1 && pop0 == OP_LOCAL && pop1 == OP_LOCAL)
@@ -1680,7 +2860,14 @@ void VM_Compile(vm_t *vm, vmHeader_t *header)
 	Z_Free( code );
 	Z_Free( buf );
 	Z_Free( jused );
-	Com_Printf( "VM file %s compiled to %i bytes of code\n", vm->name, compiledOfs );
+#if idx64
+	if(cached)
+		Com_Printf( "VM file %s loaded %i bytes of optimized code from the cache\n", vm->name,
+			compiledOfs );
+	else
+#endif
+	Com_Printf( "VM file %s compiled to %i bytes of %scode\n", vm->name, compiledOfs,
+		optimized ? "optimized " : "" );
 
 	vm->destroy = VM_Destroy_Compiled;
 
@@ -1690,6 +2877,82 @@ void VM_Compile(vm_t *vm, vmHeader_t *header)
 	}
 }
 
+#ifdef VM_SAMPLE_PROFILER
+/*
+=================
+VM_CompiledFunction
+
+Returns the function containing a code address, or -1 for the stubs in
+front of the first function
+=================
+*/
+static int VM_CompiledFunction(vm_t *vm, byte *address)
+{
+	int low, high, mid;
+
+	if(!vm->numFunctions || address < (byte *) vm->instructionPointers[vm->functions[0].instruction])
+		return -1;
+
+	// both compilers lay out functions in bytecode order
+	low = 0;
+	high = vm->numFunctions - 1;
+	while(low < high)
+	{
+		mid = (low + high + 1) / 2;
+		if((byte *) vm->instructionPointers[vm->functions[mid].instruction] <= address)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	return low;
+}
+
+/*
+=================
+VM_SampleCompiled
+
+Called from the profiling signal handler, stores the functions on the VM
+call stack of the interrupted context, innermost first, and returns how
+many there are. Compiled code keeps nothing but return addresses on the
+native stack, so that is walked instead of the program stack. Engine code
+called from the VM is stored as -1.
+=================
+*/
+int VM_SampleCompiled(vm_t *vm, void *context, int *functions, int maxFunctions)
+{
+	mcontext_t *regs = &((ucontext_t *) context)->uc_mcontext;
+	byte *address = (byte *) regs->gregs[REG_RIP];
+	intptr_t *sp = (intptr_t *) regs->gregs[REG_RSP];
+	byte *codeEnd = vm->codeBase + vm->codeLength;
+	int count, words, function;
+
+	count = 0;
+	if(address >= vm->codeBase && address < codeEnd)
+		functions[count++] = VM_CompiledFunction(vm, address);
+	else
+	{
+		functions[count++] = -1;
+		if(vm_syscallStack)
+			sp = vm_syscallStack;
+	}
+
+	// calls through the call stub leave a return address into it as well
+	for(words = 0; count < maxFunctions && words < 2 * maxFunctions; words++, sp++)
+	{
+		address = (byte *) *sp;
+		if(address <= vm->codeBase || address > codeEnd)
+			break;
+
+		function = VM_CompiledFunction(vm, address - 1);
+		if(function >= 0)
+			functions[count++] = function;
+	}
+
+	return count;
+}
+#endif
+
 void VM_Destroy_Compiled(vm_t* self)
 {
 #ifdef VM_X86_MMAP
@@ -1715,7 +2978,7 @@ extern uint8_t qvmcall64(int *programStack, int *opStack, intptr_t *instructionP
 
 int VM_CallCompiled(vm_t *vm, int *args)
 {
-	byte	stack[OPSTACK_SIZE + 15];
+	byte	stack[OPSTACK_SIZE + 2 * OPSTACK_MARGIN + 15];
 	void	*entryPoint;
 	int		programStack, stackOnEntry;
 	byte	*image;
@@ -1744,7 +3007,7 @@ int VM_CallCompiled(vm_t *vm, int *args)
 
 	// off we go into generated code...
 	entryPoint = vm->codeBase + vm->entryOfs;
-	opStack = PADP(stack, 16);
+	opStack = PADP(stack + OPSTACK_MARGIN, 16);
 	*opStack = 0xDEADBEEF;
 	opStackOfs = 0;
 
@@ -50,14 +50,16 @@ typedef struct voipServerPacket_s
 
 typedef struct svEntity_s {
 	struct worldSector_s *worldSector;
+	struct worldNode_s *worldNode;		// used instead of worldSector with sv_worldOctree
 	struct svEntity_s *nextEntityInWorldSector;
+	int			sectorNum;			// with the octree, the sector and link order the entity
+	unsigned int	linkSequence;		// would have, so area queries return the same order
 	
 	entityState_t	baseline;		// for delta compression of initial sighting
 	int			numClusters;		// if -1, use headnode instead
 	int			clusternums[MAX_ENT_CLUSTERS];
 	int			lastCluster;		// if all the clusters don't fit in clusternums
 	int			areanum, areanum2;
-	int			snapshotCounter;	// used to prevent double adding from portal views
 } svEntity_t;
 
 typedef enum {
@@ -75,7 +77,6 @@ typedef struct {
 	// https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=475
 	// the serverId associated with the current checksumFeed (always <= serverId)
 	int       checksumFeedServerId;	
-	int				snapshotCounter;	// incremented for each snapshot built
 	int				timeResidual;		// <= 1000 / sv_frame->value
 	int				nextFrameTime;		// when time > nextFrameTime, process world
 	char			*configstrings[MAX_CONFIGSTRINGS];
@@ -107,6 +108,7 @@ typedef struct {
 	int				first_entity;		// into the circular sv_packet_entities[]
 										// the entities MUST be in increasing state number
 										// order, otherwise the delta compression will fail
+	int				sharedSnapshot;		// id of the shared snapshot the entities are in, 0 for none
 	int				messageSent;		// time the message was transmitted
 	int				messageAcked;		// time the message was acked
 	int				messageSize;		// used to rate drop packets
@@ -168,6 +170,7 @@ typedef struct client_s {
 	int				lastPacketTime;		// svs.time when packet was last received
 	int				lastConnectTime;	// svs.time when connection started
 	int				lastSnapshotTime;	// svs.time of last sent snapshot
+	int				lastSnapshotRealTime;	// Sys_Milliseconds of the last message, for sv_subframeSnapshots
 	qboolean		rateDelayed;		// true if nextSnapshotTime was set based on rate instead of snapshotMsec
 	int				timeoutCount;		// must timeout a few frames in a row so debugging doesn't break
 	clientSnapshot_t	frames[PACKET_BACKUP];	// updates can be delta'd from here
@@ -228,6 +231,15 @@ typedef struct {
 	qboolean	connected;
 } challenge_t;
 
+// with sv_sharedSnapshotEntities, the entity states sent in one pass over
+// the clients are stored once and the client frames only index them
+#define	MAX_SHARED_SNAPSHOTS	4096	// must be a power of two
+
+typedef struct {
+	int			refCount;				// client frames indexing these states
+	int			firstState;				// into svs.sharedStates
+} sharedSnapshot_t;
+
 // this structure will be cleared only when the game dll changes
 typedef struct {
 	qboolean	initialized;				// sv_init has completed
@@ -239,7 +251,15 @@ typedef struct {
 	client_t	*clients;					// [sv_maxclients->integer];
 	int			numSnapshotEntities;		// sv_maxclients->integer*PACKET_BACKUP*MAX_SNAPSHOT_ENTITIES
 	int			nextSnapshotEntities;		// next snapshotEntities to use
-	entityState_t	*snapshotEntities;		// [numSnapshotEntities]
+	entityState_t	*snapshotEntities;		// [numSnapshotEntities], NULL with shared snapshots
+	int			*snapshotEntityStates;		// [numSnapshotEntities], absolute indexes into sharedStates
+	int			numSharedStates;
+	int			nextSharedState;			// next sharedStates to use
+	entityState_t	*sharedStates;			// [numSharedStates], NULL without shared snapshots
+	int			sharedStateIndexes[MAX_GENTITIES];	// entity states already in the newest shared snapshot
+	sharedSnapshot_t	sharedSnapshots[MAX_SHARED_SNAPSHOTS];
+	int			sharedSnapshotHead;			// id of the newest shared snapshot
+	int			sharedSnapshotTail;			// ids below this have been released
 	int			nextHeartbeatTime;
 	challenge_t	challenges[MAX_CHALLENGES];	// to prevent invalid IPs from connecting
 	netadr_t	redirectAddress;			// for rcon return messages
@@ -293,6 +313,10 @@ extern	cvar_t	*sv_gametype;
 extern	cvar_t	*sv_pure;
 extern	cvar_t	*sv_floodProtect;
 extern	cvar_t	*sv_lanForceRate;
+extern	cvar_t	*sv_snapshotThreads;
+extern	cvar_t	*sv_subframeSnapshots;
+extern	cvar_t	*sv_sharedSnapshotEntities;
+extern	cvar_t	*sv_worldOctree;
 #ifndef STANDALONE
 extern	cvar_t	*sv_strictAuth;
 #endif
@@ -333,6 +357,8 @@ extern leakyBucket_t outboundLeakyBucket;
 
 qboolean SVC_RateLimit( leakyBucket_t *bucket, int burst, int period );
 qboolean SVC_RateLimitAddress( netadr_t from, int burst, int period );
+void SVC_InvalidateQueryCache( void );
+void SVC_CheckQueryCache( void );
 
 void SV_FinalMessage (char *message);
 void QDECL SV_SendServerCommand( client_t *cl, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
@@ -402,6 +428,10 @@ void SV_WriteFrameToClient (client_t *client, msg_t *msg);
 void SV_SendMessageToClient( msg_t *msg, client_t *client );
 void SV_SendClientMessages( void );
 void SV_SendClientSnapshot( client_t *client );
+void SV_SendSubframeSnapshot( client_t *client );
+void SV_InitSnapshotEntities( void );
+void SV_ReleaseSnapshotEntities( client_t *client );
+entityState_t *SV_SnapshotEntity( const clientSnapshot_t *frame, int index );
 
 //
 // sv_game.c
@@ -450,6 +480,10 @@ void SV_LinkEntity( sharedEntity_t *ent );
 // Needs to be called any time an entity changes origin, mins, maxs,
 // or solid.  Automatically unlinks if needed.
 // sets ent->r.absmin and ent->r.absmax
+
+extern	int		sv_linkGeneration;
+// bumped whenever linking or unlinking changes the areas or clusters of an
+// entity, never reset
 // sets ent->leafnums[] for pvs determination even if the entity
 // is not solid
 
@@ -474,6 +508,7 @@ int SV_PointContents( const vec3_t p, int passEntityNum );
 
 
 void SV_Trace( trace_t *results, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule );
+void SV_TraceBatch( trace_t *results, const traceRequest_t *requests, int count );
 // mins and maxs are relative
 
 // if the entire move stays in a solid volume, trace.allsolid will be set,
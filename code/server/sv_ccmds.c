@@ -1472,6 +1472,40 @@ static void SV_KillServer_f( void ) {
 	SV_Shutdown( "killserver" );
 }
 
+/*
+=================
+SV_TraceRecord_f
+
+Records the collision queries made on the current map for replaying
+with cmbench
+=================
+*/
+static void SV_TraceRecord_f( void ) {
+	char	filename[MAX_QPATH];
+
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "Usage: tracerecord <name>\n" );
+		return;
+	}
+
+	Com_sprintf( filename, sizeof( filename ), "traces/%s.cmlog", Cmd_Argv( 1 ) );
+	CM_StartTraceLog( filename );
+}
+
+/*
+=================
+SV_TraceStop_f
+=================
+*/
+static void SV_TraceStop_f( void ) {
+	CM_StopTraceLog();
+}
+
 //===========================================================
 
 /*
@@ -1554,6 +1588,8 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("dumpuser", SV_DumpUser_f);
 	Cmd_AddCommand ("map_restart", SV_MapRestart_f);
 	Cmd_AddCommand ("sectorlist", SV_SectorList_f);
+	Cmd_AddCommand ("tracerecord", SV_TraceRecord_f);
+	Cmd_AddCommand ("tracestop", SV_TraceStop_f);
 	Cmd_AddCommand ("map", SV_Map_f);
 	Cmd_SetCommandCompletionFunc( "map", SV_CompleteMapName );
 #ifndef PRE_RELEASE_DEMO
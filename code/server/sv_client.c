@@ -622,6 +622,7 @@ void SV_FreeClient(client_t *client)
 
 	SV_Netchan_FreeQueue(client);
 	SV_CloseDownload(client);
+	SV_ReleaseSnapshotEntities(client);
 }
 
 /*
@@ -1733,6 +1734,8 @@ static void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta ) {
 	usercmd_t	nullcmd;
 	usercmd_t	cmds[MAX_PACKET_USERCMDS];
 	usercmd_t	*cmd, *oldcmd;
+	clientSnapshot_t	*frame;
+	qboolean	thought;
 
 	if ( delta ) {
 		cl->deltaMessage = cl->messageAcknowledge;
@@ -1767,8 +1770,10 @@ static void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta ) {
 		oldcmd = cmd;
 	}
 
-	// save time for ping calculation
-	cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked = svs.time;
+	// save time for ping calculation, back to when the packet arrived if
+	// the receive thread knows, but never before the snapshot was sent
+	frame = &cl->frames[ cl->messageAcknowledge & PACKET_MASK ];
+	frame->messageAcked = MAX( svs.time - NET_PacketAge(), frame->messageSent );
 
 #ifndef NEW_FILESYSTEM
 	// TTimo
@@ -1809,6 +1814,7 @@ static void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta ) {
 	// usually, the first couple commands will be duplicates
 	// of ones we have previously received, but the servertimes
 	// in the commands will cause them to be immediately discarded
+	thought = qfalse;
 	for ( i =  0 ; i < cmdCount ; i++ ) {
 		// if this is a cmd from before a map_restart ignore it
 		if ( cmds[i].serverTime > cmds[cmdCount-1].serverTime ) {
@@ -1824,6 +1830,11 @@ static void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta ) {
 			continue;
 		}
 		SV_ClientThink (cl, &cmds[ i ]);
+		thought = qtrue;
+	}
+
+	if ( thought ) {
+		SV_SendSubframeSnapshot( cl );
 	}
 }
 
@@ -450,8 +450,7 @@ void SV_SpawnServer( char *server, qboolean killBots ) {
 	FS_ClearPakReferences(0);
 
 	// allocate the snapshot entities on the hunk
-	svs.snapshotEntities = Hunk_Alloc( sizeof(entityState_t)*svs.numSnapshotEntities, h_high );
-	svs.nextSnapshotEntities = 0;
+	SV_InitSnapshotEntities();
 
 	// toggle the server bit so clients can detect that a
 	// server has changed
@@ -616,6 +615,7 @@ void SV_SpawnServer( char *server, qboolean killBots ) {
 
 	SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO ) );
 	cvar_modifiedFlags &= ~CVAR_SERVERINFO;
+	SVC_InvalidateQueryCache();
 
 	// any media configstring setting now should issue a warning
 	// and any configstring changes should be reliably transmitted
@@ -705,6 +705,12 @@ void SV_Init (void)
 	sv_killserver = Cvar_Get ("sv_killserver", "0", 0);
 	sv_mapChecksum = Cvar_Get ("sv_mapChecksum", "", CVAR_ROM);
 	sv_lanForceRate = Cvar_Get ("sv_lanForceRate", "1", CVAR_ARCHIVE );
+	sv_snapshotThreads = Cvar_Get ("sv_snapshotThreads", "0", CVAR_ARCHIVE );
+	Cvar_CheckRange( sv_snapshotThreads, 0, MAX_JOB_THREADS, qtrue );
+	sv_subframeSnapshots = Cvar_Get ("sv_subframeSnapshots", "0", CVAR_ARCHIVE );
+	Cvar_CheckRange( sv_subframeSnapshots, 0, 1000, qtrue );
+	sv_sharedSnapshotEntities = Cvar_Get ("sv_sharedSnapshotEntities", "0", CVAR_ARCHIVE );
+	sv_worldOctree = Cvar_Get ("sv_worldOctree", "0", CVAR_ARCHIVE );
 #ifndef STANDALONE
 	sv_strictAuth = Cvar_Get ("sv_strictAuth", "1", CVAR_ARCHIVE );
 #endif
@@ -768,6 +774,8 @@ void SV_Shutdown( char *finalmsg ) {
 
 	Com_Printf( "----- Server Shutdown (%s) -----\n", finalmsg );
 
+	// an error while sending snapshots leaves the batch open
+	NET_EndSendBatch();
 	NET_LeaveMulticast6();
 
 	if ( svs.clients && !com_errorEntered ) {
@@ -777,6 +785,7 @@ void SV_Shutdown( char *finalmsg ) {
 	SV_RemoveOperatorCommands();
 	SV_MasterShutdown();
 	SV_ShutdownGameProgs();
+	CM_StopTraceLog();
 
 	// free current level
 	SV_ClearServer();
@@ -58,6 +58,10 @@ cvar_t	*sv_gametype;
 cvar_t	*sv_pure;
 cvar_t	*sv_floodProtect;
 cvar_t	*sv_lanForceRate; // dedicated 1 (LAN) server forces local client rates to 99999 (bug #491)
+cvar_t	*sv_snapshotThreads;	// build client snapshots on this many threads, 0 for the serial path
+cvar_t	*sv_subframeSnapshots;	// snapshots per second a client can get right after its usercmds, 0 to only send them on frames
+cvar_t	*sv_sharedSnapshotEntities;	// store the entity states of a snapshot pass once for all clients, read on map load
+cvar_t	*sv_worldOctree;		// link entities into a loose octree instead of the fixed sectors, read on map load
 #ifndef STANDALONE
 cvar_t	*sv_strictAuth;
 #endif
@@ -517,51 +521,144 @@ qboolean SVC_RateLimitAddress( netadr_t from, int burst, int period ) {
 
 /*
 ================
-SVC_Status
+SVC_QueryFlooded
 
-Responds with all the info that qplug or qspy can see about the server
-and all connected players.  Used for getting detailed information after
-the simple info query.
+Called from the network receive thread for each connectionless packet, so
+getinfo and getstatus floods are dropped without waking the main thread.
+It has its own buckets, as the ones above belong to the main thread, but
+applies the same limits as SVC_Info and SVC_Status.
 ================
 */
-static void SVC_Status( netadr_t from ) {
-	char	player[1024];
-	char	status[MAX_MSGLEN];
-	int		i;
-	client_t	*cl;
-	playerState_t	*ps;
-	int		statusLength;
-	int		playerLength;
-	char	infostring[MAX_INFO_STRING];
+static leakyBucket_t queryBuckets[ MAX_HASHES ];
+static leakyBucket_t queryOutboundBucket;
 
-	// ignore if we are in single player
-	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableValue("ui_singlePlayerActive")) {
-		return;
+qboolean SVC_QueryFlooded( netadr_t from, const char *command ) {
+	leakyBucket_t	*bucket;
+	int				length;
+
+	length = !Q_stricmpn( command, "getinfo", 7 ) ? 7 : !Q_stricmpn( command, "getstatus", 9 ) ? 9 : 0;
+	if ( !length || (unsigned char)command[ length ] > ' ' ) {
+		return qfalse;
 	}
 
-	// Prevent using getstatus as an amplifier
-	if ( SVC_RateLimitAddress( from, 10, 1000 ) ) {
-		Com_DPrintf( "SVC_Status: rate limit from %s exceeded, dropping request\n",
-			NET_AdrToString( from ) );
-		return;
+	if ( from.type != NA_IP && from.type != NA_IP6 ) {
+		return qfalse;
 	}
 
-	// Allow getstatus to be DoSed relatively easily, but prevent
-	// excess outbound bandwidth usage when being flooded inbound
-	if ( SVC_RateLimit( &outboundLeakyBucket, 10, 100 ) ) {
-		Com_DPrintf( "SVC_Status: rate limit exceeded, dropping request\n" );
-		return;
+	// one bucket per hash, an address that collides just takes it over
+	bucket = &queryBuckets[ SVC_HashForAddress( from ) ];
+	if ( bucket->type != from.type || memcmp( bucket->ipv._6, from.type == NA_IP ? from.ip : from.ip6,
+			from.type == NA_IP ? 4 : 16 ) ) {
+		Com_Memset( bucket, 0, sizeof( *bucket ) );
+		bucket->type = from.type;
+		Com_Memcpy( bucket->ipv._6, from.type == NA_IP ? from.ip : from.ip6, from.type == NA_IP ? 4 : 16 );
 	}
 
-	// A maximum challenge length of 128 should be more than plenty.
-	if(strlen(Cmd_Argv(1)) > 128)
-		return;
+	return SVC_RateLimit( bucket, 10, 1000 ) || SVC_RateLimit( &queryOutboundBucket, 10, 100 );
+}
 
-	strcpy( infostring, Cvar_InfoString( CVAR_SERVERINFO ) );
+/*
+==============================================================================
 
-	// echo back the parameter to status. so master servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+QUERY REPLY CACHE
+
+The getinfo and getstatus replies are kept between queries, so answering
+one does not depend on the number of players.  Serverinfo and systeminfo
+cvar changes are seen through cvar_modifiedFlags, and SVC_CheckQueryCache
+compares the players once per frame.  Only the challenge is added per query.
+
+==============================================================================
+*/
+
+typedef struct {
+	qboolean	connected;
+	qboolean	bot;
+	int			score;
+	int			ping;
+	char		name[MAX_NAME_LENGTH];
+} queryPlayer_t;
+
+static struct {
+	qboolean	infoValid;
+	char		info[MAX_INFO_STRING];			// infoResponse without the challenge
+
+	qboolean	statusValid;
+	char		serverinfo[MAX_INFO_STRING];
+	char		players[MAX_MSGLEN];
+
+	queryPlayer_t	lastPlayers[MAX_CLIENTS];
+} queryCache;
+
+/*
+================
+SVC_InvalidateQueryCache
+================
+*/
+void SVC_InvalidateQueryCache( void ) {
+	queryCache.infoValid = qfalse;
+	queryCache.statusValid = qfalse;
+}
+
+/*
+================
+SVC_CheckQueryCache
+
+Called every frame after the game has run
+================
+*/
+void SVC_CheckQueryCache( void ) {
+	queryPlayer_t	*p;
+	client_t		*cl;
+	qboolean		connected, bot;
+	int				i, score;
+
+	for ( i = 0, cl = svs.clients, p = queryCache.lastPlayers ; i < sv_maxclients->integer ; i++, cl++, p++ ) {
+		connected = cl->state >= CS_CONNECTED;
+		bot = connected && cl->netchan.remoteAddress.type == NA_BOT;
+
+		if ( connected != p->connected || bot != p->bot ) {
+			SVC_InvalidateQueryCache();
+			p->connected = connected;
+			p->bot = bot;
+		}
+
+		if ( !connected ) {
+			continue;
+		}
+
+		score = SV_GameClientNum( i )->persistant[PERS_SCORE];
+		if ( score != p->score || cl->ping != p->ping || strcmp( cl->name, p->name ) ) {
+			queryCache.statusValid = qfalse;
+			p->score = score;
+			p->ping = cl->ping;
+			Q_strncpyz( p->name, cl->name, sizeof( p->name ) );
+		}
+	}
+}
+
+/*
+================
+SVC_QueryCvarsChanged
+
+Serverinfo or systeminfo cvars changed and SV_Frame hasn't caught up yet
+================
+*/
+static qboolean SVC_QueryCvarsChanged( void ) {
+	return ( cvar_modifiedFlags & ( CVAR_SERVERINFO | CVAR_SYSTEMINFO ) ) ? qtrue : qfalse;
+}
+
+/*
+================
+SVC_StatusPlayers
+================
+*/
+static void SVC_StatusPlayers( char *status, int size ) {
+	char	player[1024];
+	int		i;
+	client_t	*cl;
+	playerState_t	*ps;
+	int		statusLength;
+	int		playerLength;
 
 	status[0] = 0;
 	statusLength = 0;
@@ -573,28 +670,25 @@ static void SVC_Status( netadr_t from ) {
 			Com_sprintf (player, sizeof(player), "%i %i \"%s\"\n", 
 				ps->persistant[PERS_SCORE], cl->ping, cl->name);
 			playerLength = strlen(player);
-			if (statusLength + playerLength >= sizeof(status) ) {
+			if (statusLength + playerLength >= size ) {
 				break;		// can't hold any more
 			}
 			strcpy (status + statusLength, player);
 			statusLength += playerLength;
 		}
 	}
-
-	NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s\n%s", infostring, status );
 }
 
 /*
 ================
-SVC_Info
+SVC_Status
 
-Responds with a short info message that should be enough to determine
-if a user is interested in a server to do a full status
+Responds with all the info that qplug or qspy can see about the server
+and all connected players.  Used for getting detailed information after
+the simple info query.
 ================
 */
-void SVC_Info( netadr_t from ) {
-	int		i, count, humans;
-	char	*gamedir;
+static void SVC_Status( netadr_t from ) {
 	char	infostring[MAX_INFO_STRING];
 
 	// ignore if we are in single player
@@ -602,29 +696,50 @@ void SVC_Info( netadr_t from ) {
 		return;
 	}
 
-	// Prevent using getinfo as an amplifier
+	// Prevent using getstatus as an amplifier
 	if ( SVC_RateLimitAddress( from, 10, 1000 ) ) {
-		Com_DPrintf( "SVC_Info: rate limit from %s exceeded, dropping request\n",
+		Com_DPrintf( "SVC_Status: rate limit from %s exceeded, dropping request\n",
 			NET_AdrToString( from ) );
 		return;
 	}
 
-	// Allow getinfo to be DoSed relatively easily, but prevent
+	// Allow getstatus to be DoSed relatively easily, but prevent
 	// excess outbound bandwidth usage when being flooded inbound
 	if ( SVC_RateLimit( &outboundLeakyBucket, 10, 100 ) ) {
-		Com_DPrintf( "SVC_Info: rate limit exceeded, dropping request\n" );
+		Com_DPrintf( "SVC_Status: rate limit exceeded, dropping request\n" );
 		return;
 	}
 
-	/*
-	 * Check whether Cmd_Argv(1) has a sane length. This was not done in the original Quake3 version which led
-	 * to the Infostring bug discovered by Luigi Auriemma. See http://aluigi.altervista.org/ for the advisory.
-	 */
-
 	// A maximum challenge length of 128 should be more than plenty.
 	if(strlen(Cmd_Argv(1)) > 128)
 		return;
 
+	if ( !queryCache.statusValid || SVC_QueryCvarsChanged() ) {
+		Q_strncpyz( queryCache.serverinfo, Cvar_InfoString( CVAR_SERVERINFO ), sizeof( queryCache.serverinfo ) );
+		SVC_StatusPlayers( queryCache.players, sizeof( queryCache.players ) );
+		queryCache.statusValid = qtrue;
+	}
+
+	strcpy( infostring, queryCache.serverinfo );
+
+	// echo back the parameter to status. so master servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+
+	NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s\n%s", infostring, queryCache.players );
+}
+
+/*
+================
+SVC_InfoString
+
+Adds everything but the challenge to an infoResponse
+================
+*/
+static void SVC_InfoString( char *infostring ) {
+	int		i, count, humans;
+	char	*gamedir;
+
 	// don't count privateclients
 	count = humans = 0;
 	for ( i = sv_privateClients->integer ; i < sv_maxclients->integer ; i++ ) {
@@ -636,12 +751,6 @@ void SVC_Info( netadr_t from ) {
 		}
 	}
 
-	infostring[0] = 0;
-
-	// echo back the parameter to status. so servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
-
 	Info_SetValueForKey( infostring, "gamename", com_gamename->string );
 
 #ifdef LEGACY_PROTOCOL
@@ -677,8 +786,67 @@ void SVC_Info( netadr_t from ) {
 	if( *gamedir ) {
 		Info_SetValueForKey( infostring, "game", gamedir );
 	}
+}
 
-	NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s", infostring );
+/*
+================
+SVC_Info
+
+Responds with a short info message that should be enough to determine
+if a user is interested in a server to do a full status
+================
+*/
+void SVC_Info( netadr_t from ) {
+	char	infostring[MAX_INFO_STRING];
+
+	// ignore if we are in single player
+	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableValue("ui_singlePlayerActive")) {
+		return;
+	}
+
+	// Prevent using getinfo as an amplifier
+	if ( SVC_RateLimitAddress( from, 10, 1000 ) ) {
+		Com_DPrintf( "SVC_Info: rate limit from %s exceeded, dropping request\n",
+			NET_AdrToString( from ) );
+		return;
+	}
+
+	// Allow getinfo to be DoSed relatively easily, but prevent
+	// excess outbound bandwidth usage when being flooded inbound
+	if ( SVC_RateLimit( &outboundLeakyBucket, 10, 100 ) ) {
+		Com_DPrintf( "SVC_Info: rate limit exceeded, dropping request\n" );
+		return;
+	}
+
+	/*
+	 * Check whether Cmd_Argv(1) has a sane length. This was not done in the original Quake3 version which led
+	 * to the Infostring bug discovered by Luigi Auriemma. See http://aluigi.altervista.org/ for the advisory.
+	 */
+
+	// A maximum challenge length of 128 should be more than plenty.
+	if(strlen(Cmd_Argv(1)) > 128)
+		return;
+
+	if ( !queryCache.infoValid || SVC_QueryCvarsChanged() ) {
+		queryCache.info[0] = 0;
+		SVC_InfoString( queryCache.info );
+		queryCache.infoValid = qtrue;
+	}
+
+	infostring[0] = 0;
+
+	// echo back the parameter to status. so servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+
+	// the keys set after it end up in front of it
+	if ( strlen( queryCache.info ) + strlen( infostring ) < MAX_INFO_STRING ) {
+		NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s%s", queryCache.info, infostring );
+	} else {
+		// some keys wouldn't fit with the challenge, so do it the long way
+		SVC_InfoString( infostring );
+		NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s", infostring );
+	}
 }
 
 /*
@@ -1116,10 +1284,12 @@ void SV_Frame( int msec ) {
 	if ( cvar_modifiedFlags & CVAR_SERVERINFO ) {
 		SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO ) );
 		cvar_modifiedFlags &= ~CVAR_SERVERINFO;
+		SVC_InvalidateQueryCache();
 	}
 	if ( cvar_modifiedFlags & CVAR_SYSTEMINFO ) {
 		SV_SetConfigstring( CS_SYSTEMINFO, Cvar_InfoString_Big( CVAR_SYSTEMINFO ) );
 		cvar_modifiedFlags &= ~CVAR_SYSTEMINFO;
+		SVC_InvalidateQueryCache();
 	}
 
 	if ( com_speeds->integer ) {
@@ -1143,6 +1313,9 @@ void SV_Frame( int msec ) {
 		VM_Call (gvm, GAME_RUN_FRAME, sv.time);
 	}
 
+	// scores changed by the game and the pings from SV_CalcPings
+	SVC_CheckQueryCache();
+
 	if ( com_speeds->integer ) {
 		time_game = Sys_Milliseconds () - startTime;
 	}
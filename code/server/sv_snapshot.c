@@ -45,14 +45,174 @@ A normal server packet will look like:
 =============================================================================
 */
 
+typedef struct {
+	int		numSnapshotEntities;
+	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES];	
+} snapshotEntityNumbers_t;
+
+// Delta encoded entities are cached for the rest of the server frame, since
+// clients that acknowledged the same state of an entity get exactly the same
+// bits for it.  The encoded bits don't depend on where they end up in the
+// message, so they can be copied straight into each client's message.
+// Entries keep the new state as well, as snapshots sent between frames see
+// the entity states changed by the usercmds run since.
+#define	DELTA_CACHE_ENTRIES	2048	// must be a power of two
+#define	DELTA_CACHE_PROBES	8
+#define	DELTA_CACHE_BYTES	0x10000
+#define	DELTA_CACHE_RESERVE	1024	// more than the largest entity delta
+
+typedef struct {
+	int				frame;		// deltaCacheFrame when recorded, stale otherwise
+	unsigned int	hash;
+	int				number;
+	qboolean		force;
+	entityState_t	from;
+	entityState_t	to;
+	int				offset;		// into deltaCache_t.data
+	int				bits;
+} deltaCacheEntry_t;
+
+typedef struct {
+	int					frame;
+	int					dataUsed;
+	deltaCacheEntry_t	entries[DELTA_CACHE_ENTRIES];
+	byte				data[DELTA_CACHE_BYTES];
+} deltaCache_t;
+
+// bumped every server frame, so the cache data gets reused
+static int	deltaCacheFrame;
+
+// state used while building a snapshot, every thread building snapshots
+// at the same time needs its own
+typedef struct {
+	int			snapshotCounter;						// incremented for each snapshot built
+	int			entitySnapshotCounters[MAX_GENTITIES];	// used to prevent double adding from portal views
+	const char	*error;		// job threads can't call Com_Error, so it is raised afterwards
+	deltaCache_t	*deltaCache;	// on the hunk, NULL for threads added since the map loaded
+} snapshotThread_t;
+
+static snapshotThread_t	snapshotThreads[MAX_JOB_THREADS];
+
+/*
+=============
+SV_InitDeltaCaches
+
+Only the threads sv_snapshotThreads uses when the map loads get a cache,
+the others write their deltas uncached.
+=============
+*/
+static void SV_InitDeltaCaches( void ) {
+	int		i, numThreads;
+
+	numThreads = MAX( sv_snapshotThreads->integer, 1 );
+	for ( i = 0 ; i < MAX_JOB_THREADS ; i++ ) {
+		snapshotThreads[i].deltaCache = i < numThreads ? Hunk_Alloc( sizeof( deltaCache_t ), h_high ) : NULL;
+	}
+}
+
+/*
+=============
+SV_HashEntityDelta
+=============
+*/
+static unsigned int SV_HashEntityDelta( const entityState_t *from, const entityState_t *to, qboolean force ) {
+	const int		*words = (const int *)from;
+	unsigned int	hash = 2166136261u ^ ( to->number << 1 ) ^ force;
+	int				i;
+
+	for ( i = 0 ; i < sizeof( *from ) / 4 ; i++ ) {
+		hash = ( hash ^ words[i] ) * 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+=============
+SV_WriteDeltaEntity
+
+MSG_WriteDeltaEntity, reusing the bits already encoded for an identical
+transition earlier in the frame when possible.
+=============
+*/
+static void SV_WriteDeltaEntity( snapshotThread_t *thread, msg_t *msg, entityState_t *from, entityState_t *to, qboolean force ) {
+	deltaCache_t		*cache = thread->deltaCache;
+	deltaCacheEntry_t	*entry, *freeEntry;
+	unsigned int		hash;
+	int					i;
+	msg_t				encoded;
+
+	// MSG_WriteDeltaEntity would raise this on the job thread
+	if ( to && ( to->number < 0 || to->number >= MAX_GENTITIES ) ) {
+		thread->error = "MSG_WriteDeltaEntity: Bad entity number";
+		return;
+	}
+
+	// removals and unchanged entities are cheaper to just write
+	if ( !cache || !to || !memcmp( from, to, sizeof( *from ) ) ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	if ( cache->frame != deltaCacheFrame ) {
+		cache->frame = deltaCacheFrame;
+		cache->dataUsed = 0;
+	}
+
+	hash = SV_HashEntityDelta( from, to, force );
+	freeEntry = NULL;
+	for ( i = 0 ; i < DELTA_CACHE_PROBES ; i++ ) {
+		entry = &cache->entries[ ( hash + i ) & ( DELTA_CACHE_ENTRIES - 1 ) ];
+		if ( entry->frame != cache->frame ) {
+			freeEntry = entry;
+			break;
+		}
+		if ( entry->hash == hash && entry->number == to->number && entry->force == force
+				&& !memcmp( &entry->from, from, sizeof( *from ) ) && !memcmp( &entry->to, to, sizeof( *to ) ) ) {
+			MSG_WriteEncodedBits( msg, cache->data + entry->offset, entry->bits );
+			return;
+		}
+	}
+
+	// stop recording once the cache is full for this frame
+	if ( !freeEntry || cache->dataUsed + DELTA_CACHE_RESERVE > DELTA_CACHE_BYTES ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	MSG_Init( &encoded, cache->data + cache->dataUsed, DELTA_CACHE_BYTES - cache->dataUsed );
+	MSG_WriteDeltaEntity( &encoded, from, to, force );
+	if ( encoded.overflowed ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	freeEntry->frame = cache->frame;
+	freeEntry->hash = hash;
+	freeEntry->number = to->number;
+	freeEntry->force = force;
+	freeEntry->from = *from;
+	freeEntry->to = *to;
+	freeEntry->offset = cache->dataUsed;
+	freeEntry->bits = encoded.bit;
+	cache->dataUsed += ( encoded.bit + 7 ) >> 3;
+
+	MSG_WriteEncodedBits( msg, encoded.data, encoded.bit );
+}
+
 /*
 =============
 SV_EmitPacketEntities
 
 Writes a delta update of an entityState_t list to the message.
+
+The new states are read straight from the game entities listed in
+newEntities rather than from the stored frame, so the message can be
+written before the frame's entity states are stored.
 =============
 */
-static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to, msg_t *msg ) {
+static void SV_EmitPacketEntities( snapshotThread_t *thread, clientSnapshot_t *from,
+		const snapshotEntityNumbers_t *newEntities, msg_t *msg ) {
 	entityState_t	*oldent, *newent;
 	int		oldindex, newindex;
 	int		oldnum, newnum;
@@ -69,18 +229,18 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 	oldent = NULL;
 	newindex = 0;
 	oldindex = 0;
-	while ( newindex < to->num_entities || oldindex < from_num_entities ) {
-		if ( newindex >= to->num_entities ) {
+	while ( newindex < newEntities->numSnapshotEntities || oldindex < from_num_entities ) {
+		if ( newindex >= newEntities->numSnapshotEntities ) {
 			newnum = 9999;
 		} else {
-			newent = &svs.snapshotEntities[(to->first_entity+newindex) % svs.numSnapshotEntities];
+			newent = &SV_GentityNum( newEntities->snapshotEntities[newindex] )->s;
 			newnum = newent->number;
 		}
 
 		if ( oldindex >= from_num_entities ) {
 			oldnum = 9999;
 		} else {
-			oldent = &svs.snapshotEntities[(from->first_entity+oldindex) % svs.numSnapshotEntities];
+			oldent = SV_SnapshotEntity( from, oldindex );
 			oldnum = oldent->number;
 		}
 
@@ -88,7 +248,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 			// delta update from old position
 			// because the force parm is qfalse, this will not result
 			// in any bytes being emitted if the entity has not changed at all
-			MSG_WriteDeltaEntity (msg, oldent, newent, qfalse );
+			SV_WriteDeltaEntity( thread, msg, oldent, newent, qfalse );
 			oldindex++;
 			newindex++;
 			continue;
@@ -96,14 +256,14 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 		if ( newnum < oldnum ) {
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity (msg, &sv.svEntities[newnum].baseline, newent, qtrue );
+			SV_WriteDeltaEntity( thread, msg, &sv.svEntities[newnum].baseline, newent, qtrue );
 			newindex++;
 			continue;
 		}
 
 		if ( newnum > oldnum ) {
 			// the old entity isn't present in the new message
-			MSG_WriteDeltaEntity (msg, oldent, NULL, qtrue );
+			SV_WriteDeltaEntity( thread, msg, oldent, NULL, qtrue );
 			oldindex++;
 			continue;
 		}
@@ -116,42 +276,60 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 /*
 ==================
-SV_WriteSnapshotToClient
+SV_SnapshotDeltaFrame
+
+Picks the previous frame to delta compress the new snapshot against, or NULL
+if a full snapshot has to be sent.  Must be called after the new frame's
+entities have been allocated.
 ==================
 */
-static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
-	clientSnapshot_t	*frame, *oldframe;
-	int					lastframe;
-	int					i;
-	int					snapFlags;
-
-	// this is the snapshot we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+static clientSnapshot_t *SV_SnapshotDeltaFrame( client_t *client, int *lastframe ) {
+	clientSnapshot_t	*oldframe;
 
 	// try to use a previous frame as the source for delta compressing the snapshot
 	if ( client->deltaMessage <= 0 || client->state != CS_ACTIVE ) {
 		// client is asking for a retransmit
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 	} else if ( client->netchan.outgoingSequence - client->deltaMessage 
 		>= (PACKET_BACKUP - 3) ) {
 		// client hasn't gotten a good message through in a long time
 		Com_DPrintf ("%s: Delta request from out of date packet.\n", client->name);
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 	} else {
 		// we have a valid snapshot to delta from
 		oldframe = &client->frames[ client->deltaMessage & PACKET_MASK ];
-		lastframe = client->netchan.outgoingSequence - client->deltaMessage;
+		*lastframe = client->netchan.outgoingSequence - client->deltaMessage;
 
 		// the snapshot's entities may still have rolled off the buffer, though
-		if ( oldframe->first_entity <= svs.nextSnapshotEntities - svs.numSnapshotEntities ) {
+		if ( oldframe->first_entity <= svs.nextSnapshotEntities - svs.numSnapshotEntities ||
+			( svs.sharedStates && oldframe->num_entities && oldframe->sharedSnapshot < svs.sharedSnapshotTail ) ) {
 			Com_DPrintf ("%s: Delta request from out of date entities.\n", client->name);
 			oldframe = NULL;
-			lastframe = 0;
+			*lastframe = 0;
 		}
 	}
 
+	return oldframe;
+}
+
+/*
+==================
+SV_WriteSnapshotToClient
+
+Safe to call from a job thread.
+==================
+*/
+static void SV_WriteSnapshotToClient( snapshotThread_t *thread, client_t *client, clientSnapshot_t *oldframe, int lastframe,
+		const snapshotEntityNumbers_t *entityNumbers, msg_t *msg ) {
+	clientSnapshot_t	*frame;
+	int					i;
+	int					snapFlags;
+
+	// this is the snapshot we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
 	MSG_WriteByte (msg, svc_snapshot);
 
 	// NOTE, MRE: now sent at the start of every message from server to client
@@ -197,7 +375,7 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 	}
 
 	// delta encode the entities
-	SV_EmitPacketEntities (oldframe, frame, msg);
+	SV_EmitPacketEntities (thread, oldframe, entityNumbers, msg);
 
 	// padding for rate debugging
 	if ( sv_padPackets->integer ) {
@@ -235,11 +413,6 @@ Build a client snapshot structure
 =============================================================================
 */
 
-typedef struct {
-	int		numSnapshotEntities;
-	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES];	
-} snapshotEntityNumbers_t;
-
 /*
 =======================
 SV_QsortEntityNumbers
@@ -251,15 +424,14 @@ static int QDECL SV_QsortEntityNumbers( const void *a, const void *b ) {
 	ea = (int *)a;
 	eb = (int *)b;
 
-	if ( *ea == *eb ) {
-		Com_Error( ERR_DROP, "SV_QsortEntityStates: duplicated entity" );
-	}
-
 	if ( *ea < *eb ) {
 		return -1;
 	}
+	if ( *ea > *eb ) {
+		return 1;
+	}
 
-	return 1;
+	return 0;
 }
 
 
@@ -268,12 +440,12 @@ static int QDECL SV_QsortEntityNumbers( const void *a, const void *b ) {
 SV_AddEntToSnapshot
 ===============
 */
-static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
+static void SV_AddEntToSnapshot( snapshotThread_t *thread, sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
 	// if we have already added this entity to this snapshot, don't add again
-	if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+	if ( thread->entitySnapshotCounters[ gEnt->s.number ] == thread->snapshotCounter ) {
 		return;
 	}
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	thread->entitySnapshotCounters[ gEnt->s.number ] = thread->snapshotCounter;
 
 	// if we are full, silently discard entities
 	if ( eNums->numSnapshotEntities == MAX_SNAPSHOT_ENTITIES ) {
@@ -285,39 +457,189 @@ static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapsh
 }
 
 /*
-===============
-SV_AddEntitiesVisibleFromPoint
-===============
+=============================================================================
+
+Entity visibility index
+
+Rather than having every client walk every entity, the linked entities are
+grouped by PVS cluster and area once per server frame.  Each snapshot then
+only looks at the clusters in its PVS and the areas connected to the viewer,
+and combines the results as entity bitsets.
+
+=============================================================================
 */
-static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame, 
-									snapshotEntityNumbers_t *eNums, qboolean portal ) {
-	int		e, i;
-	sharedEntity_t *ent;
-	svEntity_t	*svEnt;
-	int		l;
-	int		clientarea, clientcluster;
-	int		leafnum;
-	byte	*clientpvs;
-	byte	*bitvector;
+
+#define	ENTITY_WORDS		( MAX_GENTITIES / 32 )
+#define	MAX_VIS_AREAS		( MAX_MAP_AREA_BYTES * 8 + 1 )	// slot 0 holds entities outside any area
+#define	MAX_VIS_CLUSTERS	( MAX_GENTITIES * MAX_ENT_CLUSTERS )
+
+typedef struct {
+	int		cluster;
+	int		entityNum;
+} visClusterEntry_t;
+
+typedef struct {
+	int		cluster;
+	int		firstEntry;
+	int		numEntries;
+} visClusterGroup_t;
+
+typedef struct {
+	qboolean		valid;
+	int				linkGeneration;				// sv_linkGeneration when built
+	int				numEntities;
+	byte			entityFlags[MAX_GENTITIES];	// SV_EntityVisFlags when built
+	int				numWords;					// words covering sv.num_entities
+
+	unsigned int	sendable[ENTITY_WORDS];		// linked and not SVF_NOCLIENT
+	unsigned int	broadcast[ENTITY_WORDS];	// SVF_BROADCAST
+	unsigned int	overflow[ENTITY_WORDS];		// touching more clusters than clusternums holds
+
+	// entities by areanum and areanum2, only the slots listed in areaSlots are valid
+	int				numAreaSlots;
+	int				areaSlots[MAX_VIS_AREAS];
+	qboolean		areaSlotUsed[MAX_VIS_AREAS];
+	unsigned int	areaEntities[MAX_VIS_AREAS][ENTITY_WORDS];
+
+	// (cluster, entity) pairs sorted by cluster, and the run for each cluster
+	int					numClusterEntries;
+	visClusterEntry_t	clusterEntries[MAX_VIS_CLUSTERS];
+	int					numClusterGroups;
+	visClusterGroup_t	clusterGroups[MAX_VIS_CLUSTERS];
+} entityVisibility_t;
+
+static entityVisibility_t	entityVis;
+
+/*
+=======================
+SV_QsortClusterEntries
+=======================
+*/
+static int QDECL SV_QsortClusterEntries( const void *a, const void *b ) {
+	const visClusterEntry_t	*ea = (const visClusterEntry_t *)a;
+	const visClusterEntry_t	*eb = (const visClusterEntry_t *)b;
+
+	if ( ea->cluster != eb->cluster ) {
+		return ea->cluster < eb->cluster ? -1 : 1;
+	}
+	return ea->entityNum - eb->entityNum;
+}
+
+/*
+=======================
+SV_AddVisAreaEntity
+=======================
+*/
+static void SV_AddVisAreaEntity( int area, int entityNum ) {
+	int		slot = area + 1;
+
+	if ( slot < 0 || slot >= MAX_VIS_AREAS ) {
+		Com_Error( ERR_DROP, "SV_AddVisAreaEntity: bad area %i", area );
+	}
+
+	if ( !entityVis.areaSlotUsed[slot] ) {
+		entityVis.areaSlotUsed[slot] = qtrue;
+		entityVis.areaSlots[entityVis.numAreaSlots++] = slot;
+		Com_Memset( entityVis.areaEntities[slot], 0, sizeof( entityVis.areaEntities[slot] ) );
+	}
+
+	entityVis.areaEntities[slot][entityNum >> 5] |= 1u << ( entityNum & 31 );
+}
+
+/*
+=======================
+SV_EntityVisFlags
+
+The parts of an entity the visibility index depends on besides its links
+=======================
+*/
+static int SV_EntityVisFlags( sharedEntity_t *ent ) {
+	if ( !ent->r.linked ) {
+		return 0;
+	}
+	if ( ent->r.svFlags & SVF_NOCLIENT ) {
+		return 1;
+	}
+	return 2 | ( ent->r.svFlags & SVF_BROADCAST ? 4 : 0 );
+}
+
+/*
+=======================
+SV_EntityVisibilityCurrent
+
+Returns qtrue if no entity has been linked into other areas or clusters,
+or had the flags the index uses changed, since it was built
+=======================
+*/
+static qboolean SV_EntityVisibilityCurrent( void ) {
+	int				e;
+	sharedEntity_t	*ent;
+
+	if ( !entityVis.valid || entityVis.linkGeneration != sv_linkGeneration
+		|| entityVis.numEntities != sv.num_entities ) {
+		return qfalse;
+	}
+
+	for ( e = 0 ; e < sv.num_entities ; e++ ) {
+		ent = SV_GentityNum( e );
+		if ( SV_EntityVisFlags( ent ) != entityVis.entityFlags[e] ) {
+			return qfalse;
+		}
+		// the snapshots index by s.number, the rebuild fixes it
+		if ( ent->r.linked && ent->s.number != e ) {
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+=======================
+SV_UpdateEntityVisibility
+
+Rebuilds the visibility index from the current entity links, unless they
+haven't changed since the last call.  Must be called on the main thread
+before building snapshots.
+=======================
+*/
+static void SV_UpdateEntityVisibility( void ) {
+	int				e, i;
+	sharedEntity_t	*ent;
+	svEntity_t		*svEnt;
+	unsigned int	bit;
+	visClusterEntry_t	*entry;
+	visClusterGroup_t	*group;
 
 	// during an error shutdown message we may need to transmit
-	// the shutdown message after the server has shutdown, so
-	// specfically check for it
+	// the shutdown message after the server has shutdown
 	if ( !sv.state ) {
+		entityVis.valid = qfalse;
 		return;
 	}
 
-	leafnum = CM_PointLeafnum (origin);
-	clientarea = CM_LeafArea (leafnum);
-	clientcluster = CM_LeafCluster (leafnum);
+	if ( SV_EntityVisibilityCurrent() ) {
+		return;
+	}
 
-	// calculate the visible areas
-	frame->areabytes = CM_WriteAreaBits( frame->areabits, clientarea );
+	entityVis.valid = qfalse;
+	entityVis.linkGeneration = sv_linkGeneration;
+	entityVis.numEntities = sv.num_entities;
 
-	clientpvs = CM_ClusterPVS (clientcluster);
+	for ( i = 0 ; i < entityVis.numAreaSlots ; i++ ) {
+		entityVis.areaSlotUsed[entityVis.areaSlots[i]] = qfalse;
+	}
+	entityVis.numAreaSlots = 0;
+	entityVis.numClusterEntries = 0;
+	entityVis.numClusterGroups = 0;
+	entityVis.numWords = ( sv.num_entities + 31 ) >> 5;
+	Com_Memset( entityVis.sendable, 0, sizeof( entityVis.sendable ) );
+	Com_Memset( entityVis.broadcast, 0, sizeof( entityVis.broadcast ) );
+	Com_Memset( entityVis.overflow, 0, sizeof( entityVis.overflow ) );
 
 	for ( e = 0 ; e < sv.num_entities ; e++ ) {
 		ent = SV_GentityNum(e);
+		entityVis.entityFlags[e] = SV_EntityVisFlags( ent );
 
 		// never send entities that aren't linked in
 		if ( !ent->r.linked ) {
@@ -334,95 +656,199 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 			continue;
 		}
 
-		// entities can be flagged to be sent to only one client
-		if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
-			if ( ent->r.singleClient != frame->ps.clientNum ) {
-				continue;
-			}
-		}
-		// entities can be flagged to be sent to everyone but one client
-		if ( ent->r.svFlags & SVF_NOTSINGLECLIENT ) {
-			if ( ent->r.singleClient == frame->ps.clientNum ) {
-				continue;
-			}
+		bit = 1u << ( e & 31 );
+		entityVis.sendable[e >> 5] |= bit;
+
+		// broadcast entities are always sent
+		if ( ent->r.svFlags & SVF_BROADCAST ) {
+			entityVis.broadcast[e >> 5] |= bit;
+			continue;
 		}
-		// entities can be flagged to be sent to a given mask of clients
-		if ( ent->r.svFlags & SVF_CLIENTMASK ) {
-			if (frame->ps.clientNum >= 32)
-				Com_Error( ERR_DROP, "SVF_CLIENTMASK: clientNum >= 32" );
-			if (~ent->r.singleClient & (1 << frame->ps.clientNum))
-				continue;
+
+		svEnt = &sv.svEntities[ e ];
+
+		SV_AddVisAreaEntity( svEnt->areanum, e );
+		if ( svEnt->areanum2 != svEnt->areanum ) {
+			SV_AddVisAreaEntity( svEnt->areanum2, e );
 		}
 
-		svEnt = SV_SvEntityForGentity( ent );
+		for ( i = 0 ; i < svEnt->numClusters ; i++ ) {
+			entry = &entityVis.clusterEntries[entityVis.numClusterEntries++];
+			entry->cluster = svEnt->clusternums[i];
+			entry->entityNum = e;
+		}
 
-		// don't double add an entity through portals
-		if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
-			continue;
+		if ( svEnt->numClusters && svEnt->lastCluster ) {
+			entityVis.overflow[e >> 5] |= bit;
 		}
+	}
 
-		// broadcast entities are always sent
-		if ( ent->r.svFlags & SVF_BROADCAST ) {
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
-			continue;
+	qsort( entityVis.clusterEntries, entityVis.numClusterEntries, sizeof( entityVis.clusterEntries[0] ),
+			SV_QsortClusterEntries );
+
+	group = NULL;
+	for ( i = 0 ; i < entityVis.numClusterEntries ; i++ ) {
+		entry = &entityVis.clusterEntries[i];
+		if ( !group || group->cluster != entry->cluster ) {
+			group = &entityVis.clusterGroups[entityVis.numClusterGroups++];
+			group->cluster = entry->cluster;
+			group->firstEntry = i;
+			group->numEntries = 0;
 		}
+		group->numEntries++;
+	}
 
-		// ignore if not touching a PV leaf
-		// check area
-		if ( !CM_AreasConnected( clientarea, svEnt->areanum ) ) {
-			// doors can legally straddle two areas, so
-			// we may need to check another one
-			if ( !CM_AreasConnected( clientarea, svEnt->areanum2 ) ) {
-				continue;		// blocked by a door
-			}
+	entityVis.valid = qtrue;
+}
+
+/*
+=======================
+SV_OverflowClustersVisible
+
+Checks the clusters of an entity that didn't fit in clusternums, with the
+same results as the original per-entity cluster scan.
+=======================
+*/
+static qboolean SV_OverflowClustersVisible( svEntity_t *svEnt, byte *bitvector ) {
+	int		l;
+
+	l = svEnt->clusternums[svEnt->numClusters - 1];
+	for ( ; l <= svEnt->lastCluster ; l++ ) {
+		if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
+			break;
 		}
+	}
+	if ( l == svEnt->lastCluster ) {
+		return qfalse;	// not visible
+	}
+	return qtrue;
+}
+
+/*
+===============
+SV_AddEntitiesVisibleFromPoint
+===============
+*/
+static void SV_AddEntitiesVisibleFromPoint( snapshotThread_t *thread, vec3_t origin, clientSnapshot_t *frame, 
+									snapshotEntityNumbers_t *eNums, qboolean portal ) {
+	int		e, i, j, w;
+	sharedEntity_t *ent;
+	svEntity_t	*svEnt;
+	int		clientarea, clientcluster;
+	int		leafnum;
+	byte	*clientpvs;
+	unsigned int	bits, bit;
+	unsigned int	areaBits[ENTITY_WORDS];
+	unsigned int	pvsBits[ENTITY_WORDS];
+	unsigned int	candidates[ENTITY_WORDS];
+	visClusterGroup_t	*group;
+
+	if ( !entityVis.valid ) {
+		return;
+	}
+
+	leafnum = CM_PointLeafnum (origin);
+	clientarea = CM_LeafArea (leafnum);
+	clientcluster = CM_LeafCluster (leafnum);
+
+	// calculate the visible areas
+	frame->areabytes = CM_WriteAreaBits( frame->areabits, clientarea );
+
+	clientpvs = CM_ClusterPVS (clientcluster);
 
-		bitvector = clientpvs;
+	// gather everything in an area connected to the viewer, doors
+	// can legally straddle two areas so entities are listed in both
+	Com_Memset( areaBits, 0, entityVis.numWords * sizeof( areaBits[0] ) );
+	for ( i = 0 ; i < entityVis.numAreaSlots ; i++ ) {
+		int slot = entityVis.areaSlots[i];
+		if ( !CM_AreasConnected( clientarea, slot - 1 ) ) {
+			continue;		// blocked by a door
+		}
+		for ( w = 0 ; w < entityVis.numWords ; w++ ) {
+			areaBits[w] |= entityVis.areaEntities[slot][w];
+		}
+	}
 
-		// check individual leafs
-		if ( !svEnt->numClusters ) {
+	// gather everything touching a PV leaf
+	Com_Memset( pvsBits, 0, entityVis.numWords * sizeof( pvsBits[0] ) );
+	for ( i = 0, group = entityVis.clusterGroups ; i < entityVis.numClusterGroups ; i++, group++ ) {
+		if ( !( clientpvs[group->cluster >> 3] & ( 1 << ( group->cluster & 7 ) ) ) ) {
 			continue;
 		}
-		l = 0;
-		for ( i=0 ; i < svEnt->numClusters ; i++ ) {
-			l = svEnt->clusternums[i];
-			if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
-				break;
-			}
+		for ( j = 0 ; j < group->numEntries ; j++ ) {
+			e = entityVis.clusterEntries[group->firstEntry + j].entityNum;
+			pvsBits[e >> 5] |= 1u << ( e & 31 );
 		}
+	}
 
-		// if we haven't found it to be visible,
-		// check overflow clusters that coudln't be stored
-		if ( i == svEnt->numClusters ) {
-			if ( svEnt->lastCluster ) {
-				for ( ; l <= svEnt->lastCluster ; l++ ) {
-					if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
-						break;
-					}
+	// overflow entities still get their remaining clusters checked below
+	for ( w = 0 ; w < entityVis.numWords ; w++ ) {
+		candidates[w] = entityVis.sendable[w] & ( entityVis.broadcast[w] |
+				( areaBits[w] & ( pvsBits[w] | entityVis.overflow[w] ) ) );
+	}
+
+	for ( w = 0 ; w < entityVis.numWords ; w++ ) {
+		for ( bits = candidates[w] ; bits ; bits &= ~bit ) {
+			for ( e = 0 ; !( bits & ( 1u << e ) ) ; e++ ) {
+			}
+			bit = 1u << e;
+			e += w << 5;
+			ent = SV_GentityNum(e);
+
+			// entities can be flagged to be sent to only one client
+			if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
+				if ( ent->r.singleClient != frame->ps.clientNum ) {
+					continue;
 				}
-				if ( l == svEnt->lastCluster ) {
-					continue;	// not visible
+			}
+			// entities can be flagged to be sent to everyone but one client
+			if ( ent->r.svFlags & SVF_NOTSINGLECLIENT ) {
+				if ( ent->r.singleClient == frame->ps.clientNum ) {
+					continue;
+				}
+			}
+			// entities can be flagged to be sent to a given mask of clients
+			if ( ent->r.svFlags & SVF_CLIENTMASK ) {
+				if ( frame->ps.clientNum >= 32 ) {
+					thread->error = "SVF_CLIENTMASK: clientNum >= 32";
+					return;
 				}
-			} else {
+				if (~ent->r.singleClient & (1 << frame->ps.clientNum))
+					continue;
+			}
+
+			// don't double add an entity through portals
+			if ( thread->entitySnapshotCounters[ e ] == thread->snapshotCounter ) {
 				continue;
 			}
-		}
 
-		// add it
-		SV_AddEntToSnapshot( svEnt, ent, eNums );
+			if ( entityVis.broadcast[w] & bit ) {
+				SV_AddEntToSnapshot( thread, ent, eNums );
+				continue;
+			}
 
-		// if it's a portal entity, add everything visible from its camera position
-		if ( ent->r.svFlags & SVF_PORTAL ) {
-			if ( ent->s.generic1 ) {
-				vec3_t dir;
-				VectorSubtract(ent->s.origin, origin, dir);
-				if ( VectorLengthSquared(dir) > (float) ent->s.generic1 * ent->s.generic1 ) {
-					continue;
+			// if we haven't found it to be visible,
+			// check overflow clusters that couldn't be stored
+			svEnt = &sv.svEntities[ e ];
+			if ( !( pvsBits[w] & bit ) && !SV_OverflowClustersVisible( svEnt, clientpvs ) ) {
+				continue;
+			}
+
+			// add it
+			SV_AddEntToSnapshot( thread, ent, eNums );
+
+			// if it's a portal entity, add everything visible from its camera position
+			if ( ent->r.svFlags & SVF_PORTAL ) {
+				if ( ent->s.generic1 ) {
+					vec3_t dir;
+					VectorSubtract(ent->s.origin, origin, dir);
+					if ( VectorLengthSquared(dir) > (float) ent->s.generic1 * ent->s.generic1 ) {
+						continue;
+					}
 				}
+				SV_AddEntitiesVisibleFromPoint( thread, ent->s.origin2, frame, eNums, qtrue );
 			}
-			SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums, qtrue );
 		}
-
 	}
 }
 
@@ -431,34 +857,35 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 SV_BuildClientSnapshot
 
 Decides which entities are going to be visible to the client, and
-copies off the playerstate and areabits.
+copies off the playerstate and areabits.  The entity numbers are returned
+in entityNumbers, the states are stored by SV_StoreSnapshotEntities.
 
 This properly handles multiple recursive portals, but the render
 currently doesn't.
 
 For viewing through other player's eyes, clent can be something other than client->gentity
+
+Safe to call from a job thread, errors are left in thread->error.
+Returns qfalse if there is nothing to build and the frame should be left
+without entities.
 =============
 */
-static void SV_BuildClientSnapshot( client_t *client ) {
+static qboolean SV_BuildClientSnapshot( client_t *client, snapshotThread_t *thread, snapshotEntityNumbers_t *entityNumbers ) {
 	vec3_t						org;
 	clientSnapshot_t			*frame;
-	snapshotEntityNumbers_t		entityNumbers;
 	int							i;
-	sharedEntity_t				*ent;
-	entityState_t				*state;
-	svEntity_t					*svEnt;
 	sharedEntity_t				*clent;
 	int							clientNum;
 	playerState_t				*ps;
 
 	// bump the counter used to prevent double adding
-	sv.snapshotCounter++;
+	thread->snapshotCounter++;
 
 	// this is the frame we are creating
 	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	// clear everything in this snapshot
-	entityNumbers.numSnapshotEntities = 0;
+	entityNumbers->numSnapshotEntities = 0;
 	Com_Memset( frame->areabits, 0, sizeof( frame->areabits ) );
 
   // https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=62
@@ -466,7 +893,7 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	
 	clent = client->gentity;
 	if ( !clent || client->state == CS_ZOMBIE ) {
-		return;
+		return qfalse;
 	}
 
 	// grab the current playerState_t
@@ -477,11 +904,11 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	// be regenerated from the playerstate
 	clientNum = frame->ps.clientNum;
 	if ( clientNum < 0 || clientNum >= MAX_GENTITIES ) {
-		Com_Error( ERR_DROP, "SV_SvEntityForGentity: bad gEnt" );
+		thread->error = "SV_SvEntityForGentity: bad gEnt";
+		return qfalse;
 	}
-	svEnt = &sv.svEntities[ clientNum ];
 
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	thread->entitySnapshotCounters[ clientNum ] = thread->snapshotCounter;
 
 	// find the client's viewpoint
 	VectorCopy( ps->origin, org );
@@ -489,34 +916,307 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 
 	// add all the entities directly visible to the eye, which
 	// may include portal entities that merge other viewpoints
-	SV_AddEntitiesVisibleFromPoint( org, frame, &entityNumbers, qfalse );
+	SV_AddEntitiesVisibleFromPoint( thread, org, frame, entityNumbers, qfalse );
 
 	// if there were portals visible, there may be out of order entities
 	// in the list which will need to be resorted for the delta compression
 	// to work correctly.  This also catches the error condition
 	// of an entity being included twice.
-	qsort( entityNumbers.snapshotEntities, entityNumbers.numSnapshotEntities, 
-		sizeof( entityNumbers.snapshotEntities[0] ), SV_QsortEntityNumbers );
-
+	qsort( entityNumbers->snapshotEntities, entityNumbers->numSnapshotEntities, 
+		sizeof( entityNumbers->snapshotEntities[0] ), SV_QsortEntityNumbers );
+	for ( i = 1 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+		if ( entityNumbers->snapshotEntities[i] == entityNumbers->snapshotEntities[i - 1] ) {
+			thread->error = "SV_QsortEntityStates: duplicated entity";
+			return qfalse;
+		}
+	}
+
 	// now that all viewpoint's areabits have been OR'd together, invert
 	// all of them to make it a mask vector, which is what the renderer wants
 	for ( i = 0 ; i < MAX_MAP_AREA_BYTES/4 ; i++ ) {
 		((int *)frame->areabits)[i] = ((int *)frame->areabits)[i] ^ -1;
 	}
 
-	// copy the entity states out
-	frame->num_entities = 0;
+	return qtrue;
+}
+
+/*
+=============================================================================
+
+Snapshot entity storage
+
+Normally every frame copies its entity states into its own stretch of the
+svs.snapshotEntities ring.  With sv_sharedSnapshotEntities, a frame only
+gets a list of indexes in svs.snapshotEntityStates, and the states are
+stored in svs.sharedStates once per shared snapshot.  A shared snapshot
+covers one pass over the clients, during which the game can't change any
+entity.  Snapshots sent between the passes add to the newest shared
+snapshot, and only store the states that changed since they were stored in
+it.  The client frames count references to their shared snapshot, and
+ring space is reclaimed from the oldest shared snapshot once no frame uses
+it.  If the ring runs full anyway, the oldest shared snapshots are dropped
+and the frames using them are no longer valid delta sources, the same as
+frames that rolled off svs.snapshotEntities.
+
+=============================================================================
+*/
+
+/*
+=============
+SV_InitSnapshotEntities
+
+Allocates the snapshot entity storage and the delta caches on the hunk,
+called on every map load.
+The frames of clients that stay connected keep the ids of old shared
+snapshots, so the ids keep counting and everything before the next one is
+released.
+=============
+*/
+void SV_InitSnapshotEntities( void ) {
+	int		i;
+
+	SV_InitDeltaCaches();
+
+	svs.nextSnapshotEntities = 0;
+	svs.nextSharedState = 0;
+	svs.sharedSnapshotTail = svs.sharedSnapshotHead + 1;
+
+	if ( !sv_sharedSnapshotEntities->integer ) {
+		svs.snapshotEntities = Hunk_Alloc( sizeof(entityState_t)*svs.numSnapshotEntities, h_high );
+		svs.snapshotEntityStates = NULL;
+		svs.sharedStates = NULL;
+		return;
+	}
+
+	// a pass over the clients rarely stores more than a few hundred states,
+	// snapshots between the passes mostly reuse them, and the frames only go
+	// back PACKET_BACKUP snapshots
+	svs.numSharedStates = ( com_dedicated->integer ? PACKET_BACKUP : 4 ) * MAX_GENTITIES;
+	if ( svs.numSharedStates > svs.numSnapshotEntities ) {
+		svs.numSharedStates = MAX( svs.numSnapshotEntities, MAX_GENTITIES );
+	}
+
+	svs.snapshotEntities = NULL;
+	svs.snapshotEntityStates = Hunk_Alloc( sizeof(int)*svs.numSnapshotEntities, h_high );
+	svs.sharedStates = Hunk_Alloc( sizeof(entityState_t)*svs.numSharedStates, h_high );
+
+	for ( i = 0 ; i < MAX_GENTITIES ; i++ ) {
+		svs.sharedStateIndexes[i] = -1;
+	}
+}
+
+/*
+=============
+SV_SnapshotEntity
+
+Returns the state of the index'th entity in a frame.
+=============
+*/
+entityState_t *SV_SnapshotEntity( const clientSnapshot_t *frame, int index ) {
+	index = ( frame->first_entity + index ) % svs.numSnapshotEntities;
+
+	if ( svs.sharedStates ) {
+		return &svs.sharedStates[ svs.snapshotEntityStates[index] % svs.numSharedStates ];
+	}
+	return &svs.snapshotEntities[index];
+}
+
+// the game may have changed entities since the newest shared snapshot began
+static qboolean	sharedSnapshotChanged;
+
+/*
+=============
+SV_BeginSharedSnapshot
+
+Starts a new shared snapshot for the frames built until the next call.
+Called before each pass over the clients.
+=============
+*/
+static void SV_BeginSharedSnapshot( void ) {
+	sharedSnapshot_t	*shared;
+
+	if ( !svs.sharedStates ) {
+		return;
+	}
+
+	sharedSnapshotChanged = qfalse;
+
+	svs.sharedSnapshotHead++;
+	if ( svs.sharedSnapshotHead - svs.sharedSnapshotTail >= MAX_SHARED_SNAPSHOTS ) {
+		svs.sharedSnapshotTail = svs.sharedSnapshotHead - MAX_SHARED_SNAPSHOTS + 1;
+	}
+
+	shared = &svs.sharedSnapshots[ svs.sharedSnapshotHead & ( MAX_SHARED_SNAPSHOTS - 1 ) ];
+	shared->refCount = 0;
+	shared->firstState = svs.nextSharedState;
+
+	// reclaim everything no frame uses anymore
+	while ( svs.sharedSnapshotTail < svs.sharedSnapshotHead &&
+		svs.sharedSnapshots[ svs.sharedSnapshotTail & ( MAX_SHARED_SNAPSHOTS - 1 ) ].refCount <= 0 ) {
+		svs.sharedSnapshotTail++;
+	}
+}
+
+/*
+=============
+SV_ContinueSharedSnapshot
+
+Called before building a snapshot outside a pass over the clients.  The
+frame is added to the newest shared snapshot, which then checks the states
+it already has against the game entities.  A new one is started if there
+is none, or once the newest has grown to half the ring.
+=============
+*/
+static void SV_ContinueSharedSnapshot( void ) {
+	sharedSnapshot_t	*shared;
+
+	if ( !svs.sharedStates ) {
+		return;
+	}
+
+	shared = &svs.sharedSnapshots[ svs.sharedSnapshotHead & ( MAX_SHARED_SNAPSHOTS - 1 ) ];
+	if ( svs.sharedSnapshotTail > svs.sharedSnapshotHead
+		|| svs.nextSharedState - shared->firstState > svs.numSharedStates / 2 ) {
+		SV_BeginSharedSnapshot();
+	}
+
+	sharedSnapshotChanged = qtrue;
+}
+
+/*
+=============
+SV_ReleaseSharedSnapshot
+=============
+*/
+static void SV_ReleaseSharedSnapshot( clientSnapshot_t *frame ) {
+	if ( frame->sharedSnapshot >= svs.sharedSnapshotTail && frame->sharedSnapshot <= svs.sharedSnapshotHead ) {
+		svs.sharedSnapshots[ frame->sharedSnapshot & ( MAX_SHARED_SNAPSHOTS - 1 ) ].refCount--;
+	}
+	frame->sharedSnapshot = 0;
+}
+
+/*
+=============
+SV_ReleaseSnapshotEntities
+
+Drops the references a client's frames hold on shared snapshots.
+=============
+*/
+void SV_ReleaseSnapshotEntities( client_t *client ) {
+	int		i;
+
+	for ( i = 0 ; i < PACKET_BACKUP ; i++ ) {
+		SV_ReleaseSharedSnapshot( &client->frames[i] );
+	}
+}
+
+/*
+=============
+SV_AllocSharedStates
+
+Points the frame's entity indexes at the newest shared snapshot, reserving
+states for the entities that aren't in it yet, or changed since they were
+stored in it.  Returns the first reserved state, which
+SV_StoreSnapshotEntities has to fill.
+=============
+*/
+static int SV_AllocSharedStates( clientSnapshot_t *frame, const snapshotEntityNumbers_t *entityNumbers ) {
+	sharedSnapshot_t	*shared;
+	int		firstState;
+	int		needed;
+	int		i, num;
+
+	SV_ReleaseSharedSnapshot( frame );
+
+	shared = &svs.sharedSnapshots[ svs.sharedSnapshotHead & ( MAX_SHARED_SNAPSHOTS - 1 ) ];
+	needed = 0;
+	for ( i = 0 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+		num = entityNumbers->snapshotEntities[i];
+
+		// the frames that use the old state keep pointing at it
+		if ( sharedSnapshotChanged && svs.sharedStateIndexes[num] >= shared->firstState
+			&& memcmp( &svs.sharedStates[ svs.sharedStateIndexes[num] % svs.numSharedStates ],
+				&SV_GentityNum(num)->s, sizeof( entityState_t ) ) ) {
+			svs.sharedStateIndexes[num] = -1;
+		}
+
+		if ( svs.sharedStateIndexes[num] < shared->firstState ) {
+			needed++;
+		}
+	}
+
+	// drop the oldest shared snapshots if their states are in the way
+	while ( svs.sharedSnapshotTail < svs.sharedSnapshotHead &&
+		svs.nextSharedState + needed - svs.sharedSnapshots[ svs.sharedSnapshotTail & ( MAX_SHARED_SNAPSHOTS - 1 ) ].firstState
+		> svs.numSharedStates ) {
+		svs.sharedSnapshotTail++;
+	}
+
+	firstState = svs.nextSharedState;
+	for ( i = 0 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+		num = entityNumbers->snapshotEntities[i];
+		if ( svs.sharedStateIndexes[num] < shared->firstState ) {
+			svs.sharedStateIndexes[num] = svs.nextSharedState++;
+		}
+		svs.snapshotEntityStates[(frame->first_entity + i) % svs.numSnapshotEntities] = svs.sharedStateIndexes[num];
+	}
+
+	frame->sharedSnapshot = svs.sharedSnapshotHead;
+	shared->refCount++;
+
+	return firstState;
+}
+
+/*
+=============
+SV_AllocSnapshotEntities
+
+Reserves room for the entities of a new frame.  The returned value is
+passed on to SV_StoreSnapshotEntities.
+=============
+*/
+static int SV_AllocSnapshotEntities( clientSnapshot_t *frame, const snapshotEntityNumbers_t *entityNumbers ) {
+	frame->num_entities = entityNumbers->numSnapshotEntities;
 	frame->first_entity = svs.nextSnapshotEntities;
-	for ( i = 0 ; i < entityNumbers.numSnapshotEntities ; i++ ) {
-		ent = SV_GentityNum(entityNumbers.snapshotEntities[i]);
-		state = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
-		*state = ent->s;
-		svs.nextSnapshotEntities++;
-		// this should never hit, map should always be restarted first in SV_Frame
-		if ( svs.nextSnapshotEntities >= 0x7FFFFFFE ) {
-			Com_Error(ERR_FATAL, "svs.nextSnapshotEntities wrapped");
+	svs.nextSnapshotEntities += frame->num_entities;
+
+	// this should never hit, map should always be restarted first in SV_Frame
+	if ( svs.nextSnapshotEntities >= 0x7FFFFFFE ) {
+		Com_Error(ERR_FATAL, "svs.nextSnapshotEntities wrapped");
+	}
+
+	if ( svs.sharedStates ) {
+		return SV_AllocSharedStates( frame, entityNumbers );
+	}
+	return frame->first_entity;
+}
+
+/*
+=============
+SV_StoreSnapshotEntities
+
+Copies the entity states out to the space reserved for the frame.  With
+shared snapshots only the states from firstState on are copied, the others
+belong to frames that were allocated earlier.
+Safe to call from a job thread.
+=============
+*/
+static void SV_StoreSnapshotEntities( clientSnapshot_t *frame, const snapshotEntityNumbers_t *entityNumbers, int firstState ) {
+	int		i, state;
+
+	if ( svs.sharedStates ) {
+		for ( i = 0 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+			state = svs.snapshotEntityStates[(frame->first_entity + i) % svs.numSnapshotEntities];
+			if ( state >= firstState ) {
+				svs.sharedStates[state % svs.numSharedStates] = SV_GentityNum(entityNumbers->snapshotEntities[i])->s;
+			}
 		}
-		frame->num_entities++;
+		return;
+	}
+
+	for ( i = 0 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+		svs.snapshotEntities[(frame->first_entity + i) % svs.numSnapshotEntities] =
+				SV_GentityNum(entityNumbers->snapshotEntities[i])->s;
 	}
 }
 
@@ -580,6 +1280,7 @@ void SV_SendMessageToClient(msg_t *msg, client_t *client)
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = msg->cursize;
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = svs.time;
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = -1;
+	client->lastSnapshotRealTime = Sys_Milliseconds();
 
 	// send the datagram
 	SV_Netchan_Transmit(client, msg);
@@ -588,18 +1289,80 @@ void SV_SendMessageToClient(msg_t *msg, client_t *client)
 
 /*
 =======================
-SV_SendClientSnapshot
+SV_BeginSnapshotMessage
 
-Also called by SV_FinalMessage
+Writes everything that precedes the snapshot itself.
+Safe to call from a job thread.
+=======================
+*/
+static void SV_BeginSnapshotMessage( client_t *client, msg_t *msg ) {
+	// NOTE, MRE: all server->client messages now acknowledge
+	// let the client know which reliable clientCommands we have received
+	MSG_WriteLong( msg, client->lastClientCommand );
+
+	// (re)send any reliable server commands
+	SV_UpdateServerCommandsToClient( client, msg );
+}
 
+/*
+=======================
+SV_FinishSnapshotMessage
 =======================
 */
-void SV_SendClientSnapshot( client_t *client ) {
+static void SV_FinishSnapshotMessage( client_t *client, msg_t *msg ) {
+#ifdef USE_VOIP
+	SV_WriteVoipToClient( client, msg );
+#endif
+
+	// check for overflow
+	if ( msg->overflowed ) {
+		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
+		MSG_Clear (msg);
+	}
+
+	SV_SendMessageToClient( msg, client );
+}
+
+/*
+=======================
+SV_CheckSnapshotErrors
+
+Raises the first error left by the snapshot threads
+=======================
+*/
+static void SV_CheckSnapshotErrors( int numThreads ) {
+	int		i;
+
+	for ( i = 0 ; i < numThreads ; i++ ) {
+		if ( snapshotThreads[i].error ) {
+			Com_Error( ERR_DROP, "%s", snapshotThreads[i].error );
+		}
+	}
+}
+
+/*
+=======================
+SV_SendClientSnapshotInternal
+
+The entity visibility index must be up to date.
+=======================
+*/
+static void SV_SendClientSnapshotInternal( client_t *client ) {
 	byte		msg_buf[MAX_MSGLEN];
 	msg_t		msg;
+	snapshotThread_t		*thread = &snapshotThreads[0];
+	snapshotEntityNumbers_t	entityNumbers;
+	clientSnapshot_t		*frame;
+	clientSnapshot_t		*oldframe;
+	int						lastframe;
 
 	// build the snapshot
-	SV_BuildClientSnapshot( client );
+	thread->error = NULL;
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+	if ( SV_BuildClientSnapshot( client, thread, &entityNumbers ) ) {
+		SV_StoreSnapshotEntities( frame, &entityNumbers, SV_AllocSnapshotEntities( frame, &entityNumbers ) );
+	}
+	SV_CheckSnapshotErrors( 1 );
 
 	// bots need to have their snapshots build, but
 	// the query them directly without needing to be sent
@@ -610,28 +1373,190 @@ void SV_SendClientSnapshot( client_t *client ) {
 	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
 	msg.allowoverflow = qtrue;
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
-
-	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+	SV_BeginSnapshotMessage( client, &msg );
 
 	// send over all the relevant entityState_t
 	// and the playerState_t
-	SV_WriteSnapshotToClient( client, &msg );
+	oldframe = SV_SnapshotDeltaFrame( client, &lastframe );
+	SV_WriteSnapshotToClient( thread, client, oldframe, lastframe, &entityNumbers, &msg );
+	SV_CheckSnapshotErrors( 1 );
 
-#ifdef USE_VOIP
-	SV_WriteVoipToClient( client, &msg );
-#endif
+	SV_FinishSnapshotMessage( client, &msg );
+}
 
-	// check for overflow
-	if ( msg.overflowed ) {
-		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
-		MSG_Clear (&msg);
+/*
+=======================
+SV_SendClientSnapshot
+
+Also called by SV_FinalMessage
+
+=======================
+*/
+void SV_SendClientSnapshot( client_t *client ) {
+	SV_UpdateEntityVisibility();
+	SV_ContinueSharedSnapshot();
+	SV_SendClientSnapshotInternal( client );
+}
+
+/*
+=======================
+SV_SendSubframeSnapshot
+
+Called after a client's usercmds have been run.  With sv_subframeSnapshots
+set, the client gets a snapshot with its new player state right away
+instead of on the next server frame, at most sv_subframeSnapshots times
+per second and only when the frame snapshots wouldn't be held back either.
+
+The snapshot carries the frame's sv.time, as its entities haven't moved
+since.  Clients only adjust their time delta on the first snapshot of a
+serverTime, see CL_AdjustTimeDelta.
+=======================
+*/
+void SV_SendSubframeSnapshot( client_t *client ) {
+	if ( sv_subframeSnapshots->integer <= 0 || client->state != CS_ACTIVE ) {
+		return;
+	}
+
+	if ( *client->downloadName || client->netchan.unsentFragments || client->netchan_start_queue ) {
+		return;
+	}
+
+	if ( Sys_Milliseconds() - client->lastSnapshotRealTime < 1000 / sv_subframeSnapshots->integer ) {
+		return;
+	}
+
+	if ( !( client->netchan.remoteAddress.type == NA_LOOPBACK ||
+		( sv_lanForceRate->integer && Sys_IsLANAddress( client->netchan.remoteAddress ) ) ) ) {
+		if ( SV_RateMsec( client ) > 0 ) {
+			return;
+		}
+	}
+
+	// the client's think may have linked or unlinked entities
+	SV_SendClientSnapshot( client );
+}
+
+/*
+=============================================================================
+
+Threaded snapshot building
+
+With sv_snapshotThreads set, the snapshots for all clients due in a frame
+are built and encoded by the job threads.  Everything touching shared state
+(the snapshot entity allocation, printing, the network) is done on the
+main thread in client order, so the output is identical to the serial path.
+
+=============================================================================
+*/
+
+typedef struct {
+	client_t				*client;
+	qboolean				built;
+	snapshotEntityNumbers_t	entityNumbers;
+	int						firstState;		// from SV_AllocSnapshotEntities
+	clientSnapshot_t		*oldframe;
+	int						lastframe;
+	msg_t					msg;
+	byte					msgBuffer[MAX_MSGLEN];
+} snapshotJob_t;
+
+static snapshotJob_t	snapshotJobs[MAX_CLIENTS];
+
+/*
+=======================
+SV_IsBotSnapshotJob
+=======================
+*/
+static qboolean SV_IsBotSnapshotJob( snapshotJob_t *job ) {
+	return job->client->gentity && ( job->client->gentity->r.svFlags & SVF_BOT ) ? qtrue : qfalse;
+}
+
+/*
+=======================
+SV_BuildSnapshotJob
+=======================
+*/
+static void SV_BuildSnapshotJob( void *context, int index, int thread ) {
+	snapshotJob_t *job = &((snapshotJob_t *)context)[index];
+	job->built = SV_BuildClientSnapshot( job->client, &snapshotThreads[thread], &job->entityNumbers );
+}
+
+/*
+=======================
+SV_WriteSnapshotJob
+=======================
+*/
+static void SV_WriteSnapshotJob( void *context, int index, int thread ) {
+	snapshotJob_t *job = &((snapshotJob_t *)context)[index];
+
+	if ( SV_IsBotSnapshotJob( job ) ) {
+		return;
 	}
 
-	SV_SendMessageToClient( &msg, client );
+	SV_BeginSnapshotMessage( job->client, &job->msg );
+	SV_WriteSnapshotToClient( &snapshotThreads[thread], job->client, job->oldframe, job->lastframe, &job->entityNumbers, &job->msg );
+}
+
+/*
+=======================
+SV_StoreSnapshotJob
+=======================
+*/
+static void SV_StoreSnapshotJob( void *context, int index, int thread ) {
+	snapshotJob_t *job = &((snapshotJob_t *)context)[index];
+
+	if ( job->built ) {
+		SV_StoreSnapshotEntities( &job->client->frames[ job->client->netchan.outgoingSequence & PACKET_MASK ],
+				&job->entityNumbers, job->firstState );
+	}
+}
+
+/*
+=======================
+SV_SendClientSnapshots
+
+Threaded equivalent of calling SV_SendClientSnapshot for each job's client.
+=======================
+*/
+static void SV_SendClientSnapshots( snapshotJob_t *jobs, int numJobs, int numThreads ) {
+	int			i;
+	snapshotJob_t	*job;
+
+	for ( i = 0 ; i < numThreads ; i++ ) {
+		snapshotThreads[i].error = NULL;
+	}
+
+	Com_RunJobs( SV_BuildSnapshotJob, jobs, numJobs, numThreads );
+	SV_CheckSnapshotErrors( numThreads );
+
+	// allocate the entity space in the same order as the serial path, and
+	// pick the delta frames once each client's allocation has been made
+	for ( i = 0, job = jobs ; i < numJobs ; i++, job++ ) {
+		if ( job->built ) {
+			job->firstState = SV_AllocSnapshotEntities( &job->client->frames[ job->client->netchan.outgoingSequence & PACKET_MASK ],
+					&job->entityNumbers );
+		}
+
+		if ( SV_IsBotSnapshotJob( job ) ) {
+			continue;
+		}
+
+		job->oldframe = SV_SnapshotDeltaFrame( job->client, &job->lastframe );
+		MSG_Init( &job->msg, job->msgBuffer, sizeof( job->msgBuffer ) );
+		job->msg.allowoverflow = qtrue;
+	}
+
+	// the old frames are read out of the snapshot entity storage while writing,
+	// so the new entity states can only be stored once that is done
+	Com_RunJobs( SV_WriteSnapshotJob, jobs, numJobs, numThreads );
+	SV_CheckSnapshotErrors( numThreads );
+	Com_RunJobs( SV_StoreSnapshotJob, jobs, numJobs, numThreads );
+
+	for ( i = 0, job = jobs ; i < numJobs ; i++, job++ ) {
+		if ( !SV_IsBotSnapshotJob( job ) ) {
+			SV_FinishSnapshotMessage( job->client, &job->msg );
+		}
+	}
 }
 
 
@@ -644,6 +1569,11 @@ void SV_SendClientMessages(void)
 {
 	int		i;
 	client_t	*c;
+	int		numJobs = 0;
+	qboolean	visibilityUpdated = qfalse;
+
+	// queued while the snapshots are built and flushed with a single system call
+	NET_BeginSendBatch();
 
 	// send a message to each connected client
 	for(i=0; i < sv_maxclients->integer; i++)
@@ -677,9 +1607,37 @@ void SV_SendClientMessages(void)
 			}
 		}
 
+		if(!visibilityUpdated)
+		{
+			deltaCacheFrame++;
+			SV_UpdateEntityVisibility();
+			SV_BeginSharedSnapshot();
+			visibilityUpdated = qtrue;
+		}
+
+		if(sv_snapshotThreads->integer > 0)
+		{
+			// sent below, the checks above don't depend on other clients
+			snapshotJobs[numJobs++].client = c;
+			continue;
+		}
+
 		// generate and send a new message
-		SV_SendClientSnapshot(c);
+		SV_SendClientSnapshotInternal(c);
 		c->lastSnapshotTime = svs.time;
 		c->rateDelayed = qfalse;
 	}
+
+	if(numJobs)
+	{
+		SV_SendClientSnapshots(snapshotJobs, numJobs, sv_snapshotThreads->integer);
+
+		for(i = 0; i < numJobs; i++)
+		{
+			snapshotJobs[i].client->lastSnapshotTime = svs.time;
+			snapshotJobs[i].client->rateDelayed = qfalse;
+		}
+	}
+
+	NET_EndSendBatch();
 }
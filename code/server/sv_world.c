@@ -73,7 +73,61 @@ typedef struct worldSector_s {
 
 worldSector_t	sv_worldSectors[AREA_NODES];
 int			sv_numworldSectors;
+static unsigned int	sv_linkSequence;
 
+int			sv_linkGeneration;
+
+
+/*
+===============================================================================
+
+With sv_worldOctree set, entities are kept in a loose octree instead.  Each
+entity sits in the smallest node whose cell holds its center and is at least
+as large as the entity, so nodes only need checking when a query touches the
+cell expanded by half its size on every side.  Nodes are created as entities
+move into them and freed again once empty.
+
+===============================================================================
+*/
+
+typedef struct worldNode_s {
+	vec3_t	center;
+	float	halfSize;			// of the cell, entities can stick out by as much again
+	int		depth;
+	int		numEntities;		// in this node and all below it
+	struct worldNode_s	*parent;
+	struct worldNode_s	*children[8];
+	svEntity_t	*entities;
+} worldNode_t;
+
+#define	OCTREE_DEPTH	8
+#define	OCTREE_NODES	4096
+
+static worldNode_t	sv_worldNodes[OCTREE_NODES];
+static worldNode_t	*sv_freeWorldNodes;
+static worldNode_t	*sv_worldOctreeRoot;	// NULL when using the sectors
+
+
+/*
+===============
+SV_CountWorldNodes_r
+===============
+*/
+static void SV_CountWorldNodes_r( worldNode_t *node, int *nodes, int *entities ) {
+	svEntity_t	*ent;
+	int			i;
+
+	nodes[node->depth]++;
+	for ( ent = node->entities ; ent ; ent = ent->nextEntityInWorldSector ) {
+		entities[node->depth]++;
+	}
+
+	for ( i = 0 ; i < 8 ; i++ ) {
+		if ( node->children[i] ) {
+			SV_CountWorldNodes_r( node->children[i], nodes, entities );
+		}
+	}
+}
 
 /*
 ===============
@@ -85,6 +139,19 @@ void SV_SectorList_f( void ) {
 	worldSector_t	*sec;
 	svEntity_t		*ent;
 
+	if ( sv_worldOctreeRoot ) {
+		int		nodes[OCTREE_DEPTH + 1];
+		int		entities[OCTREE_DEPTH + 1];
+
+		Com_Memset( nodes, 0, sizeof( nodes ) );
+		Com_Memset( entities, 0, sizeof( entities ) );
+		SV_CountWorldNodes_r( sv_worldOctreeRoot, nodes, entities );
+		for ( i = 0 ; i <= OCTREE_DEPTH ; i++ ) {
+			Com_Printf( "depth %i: %i nodes, %i entities\n", i, nodes[i], entities[i] );
+		}
+		return;
+	}
+
 	for ( i = 0 ; i < AREA_NODES ; i++ ) {
 		sec = &sv_worldSectors[i];
 
@@ -138,6 +205,63 @@ static worldSector_t *SV_CreateworldSector( int depth, vec3_t mins, vec3_t maxs
 	return anode;
 }
 
+/*
+===============
+SV_AllocWorldNode
+===============
+*/
+static worldNode_t *SV_AllocWorldNode( worldNode_t *parent, int child ) {
+	worldNode_t	*node;
+	int			i;
+
+	node = sv_freeWorldNodes;
+	if ( !node ) {
+		return NULL;
+	}
+	sv_freeWorldNodes = node->parent;
+
+	Com_Memset( node, 0, sizeof( *node ) );
+	node->parent = parent;
+	node->depth = parent->depth + 1;
+	node->halfSize = parent->halfSize * 0.5f;
+	for ( i = 0 ; i < 3 ; i++ ) {
+		if ( child & ( 1 << i ) ) {
+			node->center[i] = parent->center[i] + node->halfSize;
+		} else {
+			node->center[i] = parent->center[i] - node->halfSize;
+		}
+	}
+
+	parent->children[child] = node;
+	return node;
+}
+
+/*
+===============
+SV_CreateWorldOctree
+===============
+*/
+static void SV_CreateWorldOctree( vec3_t mins, vec3_t maxs ) {
+	int		i;
+
+	Com_Memset( sv_worldNodes, 0, sizeof( sv_worldNodes ) );
+
+	// the free list is chained through the parent pointers
+	sv_freeWorldNodes = NULL;
+	for ( i = OCTREE_NODES - 1 ; i > 0 ; i-- ) {
+		sv_worldNodes[i].parent = sv_freeWorldNodes;
+		sv_freeWorldNodes = &sv_worldNodes[i];
+	}
+
+	sv_worldOctreeRoot = &sv_worldNodes[0];
+	for ( i = 0 ; i < 3 ; i++ ) {
+		sv_worldOctreeRoot->center[i] = 0.5f * ( mins[i] + maxs[i] );
+		if ( 0.5f * ( maxs[i] - mins[i] ) > sv_worldOctreeRoot->halfSize ) {
+			sv_worldOctreeRoot->halfSize = 0.5f * ( maxs[i] - mins[i] );
+		}
+	}
+}
+
 /*
 ===============
 SV_ClearWorld
@@ -150,21 +274,123 @@ void SV_ClearWorld( void ) {
 
 	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
 	sv_numworldSectors = 0;
+	sv_worldOctreeRoot = NULL;
+	sv_linkGeneration++;
 
 	// get world map bounds
 	h = CM_InlineModel( 0 );
 	CM_ModelBounds( h, mins, maxs );
+
+	// the octree still uses the sectors to order query results
 	SV_CreateworldSector( 0, mins, maxs );
+
+	if ( sv_worldOctree->integer ) {
+		SV_CreateWorldOctree( mins, maxs );
+	}
+}
+
+/*
+===============
+SV_LinkEntityToOctree
+===============
+*/
+static void SV_LinkEntityToOctree( svEntity_t *ent, sharedEntity_t *gEnt ) {
+	worldNode_t	*node, *next;
+	vec3_t		center;
+	float		extent, size;
+	int			i, child;
+
+	node = sv_worldOctreeRoot;
+
+	extent = 0;
+	for ( i = 0 ; i < 3 ; i++ ) {
+		center[i] = 0.5f * ( gEnt->r.absmin[i] + gEnt->r.absmax[i] );
+		size = 0.5f * ( gEnt->r.absmax[i] - gEnt->r.absmin[i] );
+		if ( size > extent ) {
+			extent = size;
+		}
+		// anything centered outside the world stays in the root
+		if ( fabs( center[i] - node->center[i] ) > node->halfSize ) {
+			extent = node->halfSize;
+		}
+	}
+
+	// go down as long as the entity fits in the loose bounds of the child,
+	// with a unit to spare for rounding
+	while ( node->depth < OCTREE_DEPTH && extent + 1 <= node->halfSize * 0.5f ) {
+		child = 0;
+		for ( i = 0 ; i < 3 ; i++ ) {
+			if ( center[i] >= node->center[i] ) {
+				child |= 1 << i;
+			}
+		}
+
+		next = node->children[child];
+		if ( !next ) {
+			next = SV_AllocWorldNode( node, child );
+			if ( !next ) {
+				break;		// out of nodes, a higher node works just as well
+			}
+		}
+		node = next;
+	}
+
+	ent->worldNode = node;
+	ent->nextEntityInWorldSector = node->entities;
+	node->entities = ent;
+
+	for ( ; node ; node = node->parent ) {
+		node->numEntities++;
+	}
+}
+
+/*
+===============
+SV_UnlinkEntityFromOctree
+===============
+*/
+static void SV_UnlinkEntityFromOctree( svEntity_t *ent ) {
+	worldNode_t		*node, *parent;
+	svEntity_t		**scan;
+	int				i;
+
+	node = ent->worldNode;
+	ent->worldNode = NULL;
+
+	for ( scan = &node->entities ; *scan != ent ; scan = &(*scan)->nextEntityInWorldSector ) {
+		if ( !*scan ) {
+			Com_Printf( "WARNING: SV_UnlinkEntity: not found in octree\n" );
+			return;
+		}
+	}
+	*scan = ent->nextEntityInWorldSector;
+
+	for ( parent = node ; parent ; parent = parent->parent ) {
+		parent->numEntities--;
+	}
+
+	// free the nodes that have nothing left below them
+	while ( node != sv_worldOctreeRoot && !node->numEntities ) {
+		parent = node->parent;
+		for ( i = 0 ; i < 8 ; i++ ) {
+			if ( parent->children[i] == node ) {
+				parent->children[i] = NULL;
+			}
+		}
+		node->parent = sv_freeWorldNodes;
+		sv_freeWorldNodes = node;
+		node = parent;
+	}
 }
 
 
 /*
 ===============
-SV_UnlinkEntity
+SV_UnlinkEntityFromWorld
 
 ===============
 */
-void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
+static void SV_UnlinkEntityFromWorld( sharedEntity_t *gEnt ) {
 	svEntity_t		*ent;
 	svEntity_t		*scan;
 	worldSector_t	*ws;
@@ -173,6 +399,11 @@ void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 
 	gEnt->r.linked = qfalse;
 
+	if ( ent->worldNode ) {
+		SV_UnlinkEntityFromOctree( ent );
+		return;
+	}
+
 	ws = ent->worldSector;
 	if ( !ws ) {
 		return;		// not linked in anywhere
@@ -194,15 +425,29 @@ void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 	Com_Printf( "WARNING: SV_UnlinkEntity: not found in worldSector\n" );
 }
 
+/*
+===============
+SV_UnlinkEntity
+
+===============
+*/
+void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
+	if ( gEnt->r.linked ) {
+		sv_linkGeneration++;
+	}
+
+	SV_UnlinkEntityFromWorld( gEnt );
+}
+
 
 /*
 ===============
-SV_LinkEntity
+SV_LinkEntityInternal
 
 ===============
 */
 #define MAX_TOTAL_ENT_LEAFS		128
-void SV_LinkEntity( sharedEntity_t *gEnt ) {
+static void SV_LinkEntityInternal( sharedEntity_t *gEnt ) {
 	worldSector_t	*node;
 	int			leafs[MAX_TOTAL_ENT_LEAFS];
 	int			cluster;
@@ -215,8 +460,8 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	ent = SV_SvEntityForGentity( gEnt );
 
-	if ( ent->worldSector ) {
-		SV_UnlinkEntity( gEnt );	// unlink from old position
+	if ( ent->worldSector || ent->worldNode ) {
+		SV_UnlinkEntityFromWorld( gEnt );	// unlink from old position
 	}
 
 	// encode the size into the entityState_t for client prediction
@@ -345,6 +590,14 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 		else
 			break;		// crosses the node
 	}
+
+	if ( sv_worldOctreeRoot ) {
+		ent->sectorNum = node - sv_worldSectors;
+		ent->linkSequence = ++sv_linkSequence;
+		SV_LinkEntityToOctree( ent, gEnt );
+		gEnt->r.linked = qtrue;
+		return;
+	}
 	
 	// link it in
 	ent->worldSector = node;
@@ -354,6 +607,39 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	gEnt->r.linked = qtrue;
 }
 
+/*
+===============
+SV_LinkEntity
+
+Entities are relinked whenever they move, but the visibility index for
+snapshots only has to be rebuilt when they are linked into other areas or
+clusters than before
+===============
+*/
+void SV_LinkEntity( sharedEntity_t *gEnt ) {
+	svEntity_t	*ent;
+	qboolean	linked;
+	int			numClusters, lastCluster, areanum, areanum2;
+	int			clusternums[MAX_ENT_CLUSTERS];
+
+	ent = SV_SvEntityForGentity( gEnt );
+
+	linked = gEnt->r.linked;
+	numClusters = ent->numClusters;
+	lastCluster = ent->lastCluster;
+	areanum = ent->areanum;
+	areanum2 = ent->areanum2;
+	Com_Memcpy( clusternums, ent->clusternums, sizeof( clusternums ) );
+
+	SV_LinkEntityInternal( gEnt );
+
+	if ( gEnt->r.linked != linked || ent->numClusters != numClusters || ent->lastCluster != lastCluster
+		|| ent->areanum != areanum || ent->areanum2 != areanum2
+		|| memcmp( clusternums, ent->clusternums, numClusters * sizeof( clusternums[0] ) ) ) {
+		sv_linkGeneration++;
+	}
+}
+
 /*
 ============================================================================
 
@@ -418,6 +704,77 @@ static void SV_AreaEntities_r( worldSector_t *node, areaParms_t *ap ) {
 	}
 }
 
+/*
+====================
+SV_AreaEntitiesOctree_r
+
+Same as SV_AreaEntities_r for the octree.  The entities found are the same,
+but SV_AreaEntities has to sort them into the order of the sectors, and
+gets all of them so the same ones are left over at maxcount.
+====================
+*/
+static void SV_AreaEntitiesOctree_r( worldNode_t *node, areaParms_t *ap ) {
+	svEntity_t	*check;
+	sharedEntity_t *gcheck;
+	worldNode_t	*child;
+	float		loose;
+	int			i;
+
+	for ( check = node->entities ; check ; check = check->nextEntityInWorldSector ) {
+		gcheck = SV_GEntityForSvEntity( check );
+
+		if ( gcheck->r.absmin[0] > ap->maxs[0]
+		|| gcheck->r.absmin[1] > ap->maxs[1]
+		|| gcheck->r.absmin[2] > ap->maxs[2]
+		|| gcheck->r.absmax[0] < ap->mins[0]
+		|| gcheck->r.absmax[1] < ap->mins[1]
+		|| gcheck->r.absmax[2] < ap->mins[2]) {
+			continue;
+		}
+
+		ap->list[ap->count] = check - sv.svEntities;
+		ap->count++;
+	}
+
+	for ( i = 0 ; i < 8 ; i++ ) {
+		child = node->children[i];
+		if ( !child ) {
+			continue;
+		}
+
+		// everything in the child is within twice its half size of the center
+		loose = 2 * child->halfSize;
+		if ( ap->mins[0] > child->center[0] + loose
+		|| ap->mins[1] > child->center[1] + loose
+		|| ap->mins[2] > child->center[2] + loose
+		|| ap->maxs[0] < child->center[0] - loose
+		|| ap->maxs[1] < child->center[1] - loose
+		|| ap->maxs[2] < child->center[2] - loose ) {
+			continue;
+		}
+
+		SV_AreaEntitiesOctree_r( child, ap );
+	}
+}
+
+/*
+====================
+SV_CompareSectorOrder
+
+Sectors list their entities most recently linked first, and are searched
+in the order they were created in
+====================
+*/
+static int SV_CompareSectorOrder( const void *a, const void *b ) {
+	const svEntity_t	*ea = &sv.svEntities[*(const int *)a];
+	const svEntity_t	*eb = &sv.svEntities[*(const int *)b];
+
+	if ( ea->sectorNum != eb->sectorNum ) {
+		return ea->sectorNum - eb->sectorNum;
+	}
+	return (int)( eb->linkSequence - ea->linkSequence );
+}
+
 /*
 ================
 SV_AreaEntities
@@ -425,6 +782,8 @@ SV_AreaEntities
 */
 int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount ) {
 	areaParms_t		ap;
+	int				list[MAX_GENTITIES];
+	int				i, j, num;
 
 	ap.mins = mins;
 	ap.maxs = maxs;
@@ -432,7 +791,34 @@ int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int
 	ap.count = 0;
 	ap.maxcount = maxcount;
 
-	SV_AreaEntities_r( sv_worldSectors, &ap );
+	if ( !sv_worldOctreeRoot ) {
+		SV_AreaEntities_r( sv_worldSectors, &ap );
+		return ap.count;
+	}
+
+	ap.list = list;
+	ap.maxcount = MAX_GENTITIES;
+	SV_AreaEntitiesOctree_r( sv_worldOctreeRoot, &ap );
+
+	// the order decides equal fraction trace hits and the touch order in the
+	// game, so it has to be the one of the sectors; usually only a few are found
+	if ( ap.count > 32 ) {
+		qsort( list, ap.count, sizeof( list[0] ), SV_CompareSectorOrder );
+	} else {
+		for ( i = 1 ; i < ap.count ; i++ ) {
+			num = list[i];
+			for ( j = i ; j > 0 && SV_CompareSectorOrder( &num, &list[j - 1] ) < 0 ; j-- ) {
+				list[j] = list[j - 1];
+			}
+			list[j] = num;
+		}
+	}
+
+	if ( ap.count > maxcount ) {
+		Com_Printf ("SV_AreaEntities: MAXCOUNT\n");
+		ap.count = maxcount;
+	}
+	Com_Memcpy( entityList, list, ap.count * sizeof( entityList[0] ) );
 
 	return ap.count;
 }
@@ -499,21 +885,18 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 
 /*
 ====================
-SV_ClipMoveToEntities
+SV_ClipMoveToEntityList
 
 ====================
 */
-static void SV_ClipMoveToEntities( moveclip_t *clip ) {
-	int			i, num;
-	int			touchlist[MAX_GENTITIES];
+static void SV_ClipMoveToEntityList( moveclip_t *clip, const int *touchlist, int num ) {
+	int			i;
 	sharedEntity_t *touch;
 	int			passOwnerNum;
 	trace_t		trace;
 	clipHandle_t	clipHandle;
 	float		*origin, *angles;
 
-	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
-
 	if ( clip->passEntityNum != ENTITYNUM_NONE ) {
 		passOwnerNum = ( SV_GentityNum( clip->passEntityNum ) )->r.ownerNum;
 		if ( passOwnerNum == ENTITYNUM_NONE ) {
@@ -585,6 +968,82 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 }
 
 
+/*
+====================
+SV_ClipMoveToEntities
+
+====================
+*/
+static void SV_ClipMoveToEntities( moveclip_t *clip ) {
+	int			num;
+	int			touchlist[MAX_GENTITIES];
+
+	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
+
+	SV_ClipMoveToEntityList( clip, touchlist, num );
+}
+
+
+/*
+==================
+SV_MoveClipBounds
+
+Returns the bounding box of the entire move, with a unit to spare.
+==================
+*/
+static void SV_MoveClipBounds( const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end,
+		vec3_t boxmins, vec3_t boxmaxs ) {
+	int		i;
+
+	for ( i=0 ; i<3 ; i++ ) {
+		if ( end[i] > start[i] ) {
+			boxmins[i] = start[i] + mins[i] - 1;
+			boxmaxs[i] = end[i] + maxs[i] + 1;
+		} else {
+			boxmins[i] = end[i] + mins[i] - 1;
+			boxmaxs[i] = start[i] + maxs[i] + 1;
+		}
+	}
+}
+
+/*
+==================
+SV_StartMoveClip
+
+Clips the move to the world and sets up the clip for the entities.
+Returns qfalse if the world blocks the move immediately, so clip->trace
+is already the final result.
+==================
+*/
+static qboolean SV_StartMoveClip( moveclip_t *clip, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end,
+		int passEntityNum, int contentmask, int capsule ) {
+	Com_Memset ( clip, 0, sizeof ( moveclip_t ) );
+
+	// clip to world
+	CM_BoxTrace( &clip->trace, start, end, mins, maxs, 0, contentmask, capsule );
+	clip->trace.entityNum = clip->trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+	if ( clip->trace.fraction == 0 ) {
+		return qfalse;		// blocked immediately by the world
+	}
+
+	clip->contentmask = contentmask;
+	clip->start = start;
+//	VectorCopy( clip->trace.endpos, clip->end );
+	VectorCopy( end, clip->end );
+	clip->mins = mins;
+	clip->maxs = maxs;
+	clip->passEntityNum = passEntityNum;
+	clip->capsule = capsule;
+
+	// create the bounding box of the entire move
+	// we can limit it to the part of the move not
+	// already clipped off by the world, which can be
+	// a significant savings for line of sight and shot traces
+	SV_MoveClipBounds( clip->start, clip->mins, clip->maxs, clip->end, clip->boxmins, clip->boxmaxs );
+
+	return qtrue;
+}
+
 /*
 ==================
 SV_Trace
@@ -595,7 +1054,6 @@ passEntityNum and entities owned by passEntityNum are explicitly not checked.
 */
 void SV_Trace( trace_t *results, const vec3_t start, vec3_t mins, vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule ) {
 	moveclip_t	clip;
-	int			i;
 
 	if ( !mins ) {
 		mins = vec3_origin;
@@ -604,43 +1062,82 @@ void SV_Trace( trace_t *results, const vec3_t start, vec3_t mins, vec3_t maxs, c
 		maxs = vec3_origin;
 	}
 
-	Com_Memset ( &clip, 0, sizeof ( moveclip_t ) );
+	if ( SV_StartMoveClip( &clip, start, mins, maxs, end, passEntityNum, contentmask, capsule ) ) {
+		// clip to other solid entities
+		SV_ClipMoveToEntities ( &clip );
+	}
 
-	// clip to world
-	CM_BoxTrace( &clip.trace, start, end, mins, maxs, 0, contentmask, capsule );
-	clip.trace.entityNum = clip.trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
-	if ( clip.trace.fraction == 0 ) {
-		*results = clip.trace;
-		return;		// blocked immediately by the world
-	}
-
-	clip.contentmask = contentmask;
-	clip.start = start;
-//	VectorCopy( clip.trace.endpos, clip.end );
-	VectorCopy( end, clip.end );
-	clip.mins = mins;
-	clip.maxs = maxs;
-	clip.passEntityNum = passEntityNum;
-	clip.capsule = capsule;
+	*results = clip.trace;
+}
 
-	// create the bounding box of the entire move
-	// we can limit it to the part of the move not
-	// already clipped off by the world, which can be
-	// a significant savings for line of sight and shot traces
-	for ( i=0 ; i<3 ; i++ ) {
-		if ( end[i] > start[i] ) {
-			clip.boxmins[i] = clip.start[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.end[i] + clip.maxs[i] + 1;
-		} else {
-			clip.boxmins[i] = clip.end[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.start[i] + clip.maxs[i] + 1;
-		}
+/*
+==================
+SV_TraceBatch
+
+Same as calling SV_Trace for each request, but the entities near the moves
+are only gathered once for the whole batch.  Each trace then clips against
+the entities touching its own move, in the same order SV_AreaEntities
+would have returned them.
+==================
+*/
+#define	MAX_BATCH_TOUCH_ENTITIES	256		// gather per trace when more are near the batch
+
+void SV_TraceBatch( trace_t *results, const traceRequest_t *requests, int count ) {
+	const traceRequest_t	*req;
+	moveclip_t		clip;
+	int				touchlist[MAX_GENTITIES];
+	int				cliplist[MAX_GENTITIES];
+	int				numTouch, numClip;
+	int				i, j;
+	vec3_t			mins, maxs;
+	vec3_t			boxmins, boxmaxs;
+	sharedEntity_t	*touch;
+
+	if ( count <= 0 ) {
+		return;
 	}
 
-	// clip to other solid entities
-	SV_ClipMoveToEntities ( &clip );
+	ClearBounds( mins, maxs );
+	for ( i = 0, req = requests ; i < count ; i++, req++ ) {
+		SV_MoveClipBounds( req->start, req->mins, req->maxs, req->end, boxmins, boxmaxs );
+		AddPointToBounds( boxmins, mins, maxs );
+		AddPointToBounds( boxmaxs, mins, maxs );
+	}
 
-	*results = clip.trace;
+	numTouch = SV_AreaEntities( mins, maxs, touchlist, MAX_GENTITIES );
+
+	for ( i = 0, req = requests ; i < count ; i++, req++ ) {
+		if ( !SV_StartMoveClip( &clip, req->start, (float *)req->mins, (float *)req->maxs, req->end,
+				req->passEntityNum, req->contentmask, req->capsule ) ) {
+			results[i] = clip.trace;
+			continue;
+		}
+
+		if ( numTouch > MAX_BATCH_TOUCH_ENTITIES ) {
+			SV_ClipMoveToEntities( &clip );
+			results[i] = clip.trace;
+			continue;
+		}
+
+		numClip = 0;
+		for ( j = 0 ; j < numTouch ; j++ ) {
+			touch = SV_GentityNum( touchlist[j] );
+
+			if ( touch->r.absmin[0] > clip.boxmaxs[0]
+			|| touch->r.absmin[1] > clip.boxmaxs[1]
+			|| touch->r.absmin[2] > clip.boxmaxs[2]
+			|| touch->r.absmax[0] < clip.boxmins[0]
+			|| touch->r.absmax[1] < clip.boxmins[1]
+			|| touch->r.absmax[2] < clip.boxmins[2]) {
+				continue;
+			}
+
+			cliplist[numClip++] = touchlist[j];
+		}
+
+		SV_ClipMoveToEntityList( &clip, cliplist, numClip );
+		results[i] = clip.trace;
+	}
 }
 
 
@@ -38,6 +38,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <fcntl.h>
 #include <fenv.h>
 #include <sys/wait.h>
+#include <pthread.h>
 
 qboolean stdinIsATTY;
 
@@ -974,3 +975,166 @@ qboolean Sys_DllExtension( const char *name ) {
 
 	return qfalse;
 }
+
+/*
+==============================================================
+
+THREADS
+
+==============================================================
+*/
+
+struct sysThread_s {
+	pthread_t	thread;
+	void		(*function)( void *arg );
+	void		*arg;
+};
+
+struct sysMutex_s {
+	pthread_mutex_t	mutex;
+};
+
+// unnamed POSIX semaphores are not available on macOS
+struct sysSemaphore_s {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	int				count;
+};
+
+/*
+==================
+Sys_ThreadMain
+==================
+*/
+static void *Sys_ThreadMain( void *arg ) {
+	sysThread_t *thread = (sysThread_t *)arg;
+	sigset_t set;
+
+	// leave signal handling to the main thread
+	sigfillset( &set );
+	pthread_sigmask( SIG_BLOCK, &set, NULL );
+
+	thread->function( thread->arg );
+	return NULL;
+}
+
+/*
+==================
+Sys_CreateThread
+==================
+*/
+sysThread_t *Sys_CreateThread( void (*function)( void *arg ), void *arg ) {
+	sysThread_t *thread = Z_Malloc( sizeof( *thread ) );
+	int err;
+
+	thread->function = function;
+	thread->arg = arg;
+
+	err = pthread_create( &thread->thread, NULL, Sys_ThreadMain, thread );
+	if ( err ) {
+		Com_Printf( "WARNING: pthread_create failed: %s\n", strerror( err ) );
+		Z_Free( thread );
+		return NULL;
+	}
+
+	return thread;
+}
+
+/*
+==================
+Sys_JoinThread
+==================
+*/
+void Sys_JoinThread( sysThread_t *thread ) {
+	pthread_join( thread->thread, NULL );
+	Z_Free( thread );
+}
+
+/*
+==================
+Sys_CreateMutex
+==================
+*/
+sysMutex_t *Sys_CreateMutex( void ) {
+	sysMutex_t *mutex = Z_Malloc( sizeof( *mutex ) );
+	pthread_mutex_init( &mutex->mutex, NULL );
+	return mutex;
+}
+
+/*
+==================
+Sys_DestroyMutex
+==================
+*/
+void Sys_DestroyMutex( sysMutex_t *mutex ) {
+	pthread_mutex_destroy( &mutex->mutex );
+	Z_Free( mutex );
+}
+
+/*
+==================
+Sys_LockMutex
+==================
+*/
+void Sys_LockMutex( sysMutex_t *mutex ) {
+	pthread_mutex_lock( &mutex->mutex );
+}
+
+/*
+==================
+Sys_UnlockMutex
+==================
+*/
+void Sys_UnlockMutex( sysMutex_t *mutex ) {
+	pthread_mutex_unlock( &mutex->mutex );
+}
+
+/*
+==================
+Sys_CreateSemaphore
+==================
+*/
+sysSemaphore_t *Sys_CreateSemaphore( int count ) {
+	sysSemaphore_t *semaphore = Z_Malloc( sizeof( *semaphore ) );
+	pthread_mutex_init( &semaphore->mutex, NULL );
+	pthread_cond_init( &semaphore->cond, NULL );
+	semaphore->count = count;
+	return semaphore;
+}
+
+/*
+==================
+Sys_DestroySemaphore
+==================
+*/
+void Sys_DestroySemaphore( sysSemaphore_t *semaphore ) {
+	pthread_cond_destroy( &semaphore->cond );
+	pthread_mutex_destroy( &semaphore->mutex );
+	Z_Free( semaphore );
+}
+
+/*
+==================
+Sys_SemaphoreWait
+==================
+*/
+void Sys_SemaphoreWait( sysSemaphore_t *semaphore ) {
+	pthread_mutex_lock( &semaphore->mutex );
+	while ( semaphore->count <= 0 ) {
+		pthread_cond_wait( &semaphore->cond, &semaphore->mutex );
+	}
+	semaphore->count--;
+	pthread_mutex_unlock( &semaphore->mutex );
+}
+
+/*
+==================
+Sys_SemaphorePost
+==================
+*/
+void Sys_SemaphorePost( sysSemaphore_t *semaphore ) {
+	pthread_mutex_lock( &semaphore->mutex );
+	semaphore->count++;
+	pthread_cond_signal( &semaphore->cond );
+	pthread_mutex_unlock( &semaphore->mutex );
+}
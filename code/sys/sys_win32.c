@@ -861,3 +861,149 @@ Check if filename should be allowed to be loaded as a DLL.
 qboolean Sys_DllExtension( const char *name ) {
 	return COM_CompareExtension( name, DLL_EXT );
 }
+
+/*
+==============================================================
+
+THREADS
+
+==============================================================
+*/
+
+struct sysThread_s {
+	HANDLE		handle;
+	void		(*function)( void *arg );
+	void		*arg;
+};
+
+struct sysMutex_s {
+	CRITICAL_SECTION	section;
+};
+
+struct sysSemaphore_s {
+	HANDLE		handle;
+};
+
+/*
+==================
+Sys_ThreadMain
+==================
+*/
+static DWORD WINAPI Sys_ThreadMain( LPVOID arg ) {
+	sysThread_t *thread = (sysThread_t *)arg;
+	thread->function( thread->arg );
+	return 0;
+}
+
+/*
+==================
+Sys_CreateThread
+==================
+*/
+sysThread_t *Sys_CreateThread( void (*function)( void *arg ), void *arg ) {
+	sysThread_t *thread = Z_Malloc( sizeof( *thread ) );
+
+	thread->function = function;
+	thread->arg = arg;
+	thread->handle = CreateThread( NULL, 0, Sys_ThreadMain, thread, 0, NULL );
+
+	if ( !thread->handle ) {
+		Com_Printf( "WARNING: CreateThread failed: %i\n", (int)GetLastError( ) );
+		Z_Free( thread );
+		return NULL;
+	}
+
+	return thread;
+}
+
+/*
+==================
+Sys_JoinThread
+==================
+*/
+void Sys_JoinThread( sysThread_t *thread ) {
+	WaitForSingleObject( thread->handle, INFINITE );
+	CloseHandle( thread->handle );
+	Z_Free( thread );
+}
+
+/*
+==================
+Sys_CreateMutex
+==================
+*/
+sysMutex_t *Sys_CreateMutex( void ) {
+	sysMutex_t *mutex = Z_Malloc( sizeof( *mutex ) );
+	InitializeCriticalSection( &mutex->section );
+	return mutex;
+}
+
+/*
+==================
+Sys_DestroyMutex
+==================
+*/
+void Sys_DestroyMutex( sysMutex_t *mutex ) {
+	DeleteCriticalSection( &mutex->section );
+	Z_Free( mutex );
+}
+
+/*
+==================
+Sys_LockMutex
+==================
+*/
+void Sys_LockMutex( sysMutex_t *mutex ) {
+	EnterCriticalSection( &mutex->section );
+}
+
+/*
+==================
+Sys_UnlockMutex
+==================
+*/
+void Sys_UnlockMutex( sysMutex_t *mutex ) {
+	LeaveCriticalSection( &mutex->section );
+}
+
+/*
+==================
+Sys_CreateSemaphore
+==================
+*/
+sysSemaphore_t *Sys_CreateSemaphore( int count ) {
+	sysSemaphore_t *semaphore = Z_Malloc( sizeof( *semaphore ) );
+	semaphore->handle = CreateSemaphore( NULL, count, 0x7fffffff, NULL );
+	if ( !semaphore->handle ) {
+		Com_Error( ERR_FATAL, "CreateSemaphore failed: %i", (int)GetLastError( ) );
+	}
+	return semaphore;
+}
+
+/*
+==================
+Sys_DestroySemaphore
+==================
+*/
+void Sys_DestroySemaphore( sysSemaphore_t *semaphore ) {
+	CloseHandle( semaphore->handle );
+	Z_Free( semaphore );
+}
+
+/*
+==================
+Sys_SemaphoreWait
+==================
+*/
+void Sys_SemaphoreWait( sysSemaphore_t *semaphore ) {
+	WaitForSingleObject( semaphore->handle, INFINITE );
+}
+
+/*
+==================
+Sys_SemaphorePost
+==================
+*/
+void Sys_SemaphorePost( sysSemaphore_t *semaphore ) {
+	ReleaseSemaphore( semaphore->handle, 1, NULL );
+}
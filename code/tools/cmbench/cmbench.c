@@ -0,0 +1,390 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// cmbench.c -- replays a collision query log recorded with "tracerecord"
+
+/*
+=============================================================================
+
+Loads the bsp through CM_LoadMap with just enough of the engine stubbed
+out for the collision code, then runs every recorded CM_BoxTrace,
+CM_TransformedBoxTrace and CM_PointContents query and reports throughput
+and latency percentiles.  Results are compared against the ones stored in
+the log, so a collision change can be checked against real play.
+
+usage: cmbench [-repeat <count>] <log> <bsp>
+
+=============================================================================
+*/
+
+#include "../../qcommon/cm_local.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static const char	*bspPath;
+
+/*
+===============================================================================
+
+ENGINE STUBS
+
+===============================================================================
+*/
+
+void QDECL Com_Printf( const char *fmt, ... ) {
+	va_list		argptr;
+
+	va_start( argptr, fmt );
+	vprintf( fmt, argptr );
+	va_end( argptr );
+}
+
+void QDECL Com_DPrintf( const char *fmt, ... ) {
+}
+
+void QDECL Com_Error( int level, const char *fmt, ... ) {
+	va_list		argptr;
+
+	va_start( argptr, fmt );
+	fprintf( stderr, "ERROR: " );
+	vfprintf( stderr, fmt, argptr );
+	fprintf( stderr, "\n" );
+	va_end( argptr );
+	exit( 1 );
+}
+
+void *Hunk_Alloc( int size, ha_pref preference ) {
+	void	*buf;
+
+	buf = calloc( 1, size );
+	if ( !buf ) {
+		Com_Error( ERR_FATAL, "Hunk_Alloc: failed on %i bytes", size );
+	}
+	return buf;
+}
+
+void *Z_Malloc( int size ) {
+	return Hunk_Alloc( size, h_high );
+}
+
+void Z_Free( void *ptr ) {
+	free( ptr );
+}
+
+cvar_t *Cvar_Get( const char *var_name, const char *value, int flags ) {
+	cvar_t	*var;
+
+	var = calloc( 1, sizeof( *var ) );
+	var->value = atof( value );
+	var->integer = atoi( value );
+	return var;
+}
+
+// the map is always read from the path given on the command line
+long FS_ReadFile( const char *qpath, void **buffer ) {
+	FILE	*f;
+	long	length;
+
+	f = fopen( bspPath, "rb" );
+	if ( !f ) {
+		*buffer = NULL;
+		return -1;
+	}
+	fseek( f, 0, SEEK_END );
+	length = ftell( f );
+	fseek( f, 0, SEEK_SET );
+
+	*buffer = malloc( length + 1 );
+	if ( fread( *buffer, 1, length, f ) != length ) {
+		Com_Error( ERR_FATAL, "couldn't read %s", bspPath );
+	}
+	fclose( f );
+	return length;
+}
+
+void FS_FreeFile( void *buffer ) {
+	free( buffer );
+}
+
+// trace logs are never written by the benchmark
+fileHandle_t FS_FOpenFileWrite( const char *qpath ) {
+	return 0;
+}
+
+int FS_Write( const void *buffer, int len, fileHandle_t f ) {
+	return 0;
+}
+
+void FS_FCloseFile( fileHandle_t f ) {
+}
+
+// referenced by CM_DrawDebugSurface, which is never called here
+void BotDrawDebugPolygons( void (*drawPoly)(int color, int numPoints, float *points), int value ) {
+}
+
+#ifdef NEW_FILESYSTEM
+void fs_register_current_map( const char *name ) {
+}
+
+void fs_prefetch_map( const char *name, const void *bsp_data, int length ) {
+}
+#endif
+
+/*
+===============================================================================
+
+REPLAY
+
+===============================================================================
+*/
+
+static const char *queryNames[] = {
+	"CM_BoxTrace",
+	"CM_TransformedBoxTrace",
+	"CM_PointContents"
+};
+
+#define	NUM_QUERY_TYPES		ARRAY_LEN( queryNames )
+
+/*
+==================
+Bench_Nanoseconds
+==================
+*/
+static double Bench_Nanoseconds( void ) {
+#ifdef _WIN32
+	static LARGE_INTEGER	frequency;
+	LARGE_INTEGER			count;
+
+	if ( !frequency.QuadPart ) {
+		QueryPerformanceFrequency( &frequency );
+	}
+	QueryPerformanceCounter( &count );
+	return (double)count.QuadPart * 1e9 / (double)frequency.QuadPart;
+#else
+	struct timespec	ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+/*
+==================
+Bench_CompareFloats
+==================
+*/
+static int Bench_CompareFloats( const void *a, const void *b ) {
+	float	fa = *(const float *)a;
+	float	fb = *(const float *)b;
+
+	return ( fa > fb ) - ( fa < fb );
+}
+
+/*
+==================
+Bench_Replay
+
+Runs one query and returns qtrue if the result matches the recording
+==================
+*/
+static qboolean Bench_Replay( const cmLogRecord_t *r ) {
+	trace_t			trace;
+	clipHandle_t	model;
+	int				contents;
+
+	model = r->model;
+	if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE ) {
+		CM_TempBoxModel( r->boxMins, r->boxMaxs, qfalse );
+	}
+
+	switch ( r->type ) {
+	case CM_LOG_BOXTRACE:
+		CM_BoxTrace( &trace, r->start, r->end, (float *)r->mins, (float *)r->maxs,
+			model, r->brushmask, r->capsule );
+		break;
+	case CM_LOG_TRANSFORMEDBOXTRACE:
+		CM_TransformedBoxTrace( &trace, r->start, r->end, (float *)r->mins, (float *)r->maxs,
+			model, r->brushmask, r->origin, r->angles, r->capsule );
+		break;
+	default:
+		contents = CM_PointContents( r->start, model );
+		return contents == r->contents;
+	}
+
+	return trace.fraction == r->fraction
+		&& VectorCompare( trace.endpos, r->endpos )
+		&& VectorCompare( trace.plane.normal, r->normal )
+		&& trace.plane.dist == r->dist
+		&& trace.surfaceFlags == r->surfaceFlags
+		&& trace.contents == r->contents
+		&& ( ( trace.startsolid ? 1 : 0 ) | ( trace.allsolid ? 2 : 0 ) ) == r->solid;
+}
+
+/*
+==================
+Bench_Report
+==================
+*/
+static void Bench_Report( const char *name, float *latencies, int count ) {
+	double	total;
+	int		i;
+
+	if ( !count ) {
+		return;
+	}
+
+	total = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		total += latencies[i];
+	}
+
+	qsort( latencies, count, sizeof( latencies[0] ), Bench_CompareFloats );
+
+	Com_Printf( "%-24s %9i %10.0f/s %8.0f %8.0f %8.0f %8.0f %8.0f %8.0f\n", name, count,
+		count * 1e9 / total, total / count,
+		latencies[count / 2], latencies[count * 9 / 10], latencies[count * 99 / 100],
+		latencies[(int)( count * 0.999 )], latencies[count - 1] );
+}
+
+/*
+==================
+main
+==================
+*/
+int main( int argc, char **argv ) {
+	cmLogHeader_t	header;
+	cmLogRecord_t	*records;
+	float			*latencies[NUM_QUERY_TYPES], *all;
+	int				counts[NUM_QUERY_TYPES];
+	int				numRecords, numSamples, mismatches;
+	int				repeat, checksum;
+	int				i, pass;
+	double			start, elapsed;
+	long			length;
+	FILE			*f;
+
+	repeat = 1;
+	for ( i = 1 ; i < argc - 2 ; i++ ) {
+		if ( !strcmp( argv[i], "-repeat" ) && i + 1 < argc - 2 ) {
+			repeat = atoi( argv[++i] );
+		} else {
+			break;
+		}
+	}
+	if ( i != argc - 2 || repeat < 1 ) {
+		fprintf( stderr, "usage: cmbench [-repeat <count>] <log> <bsp>\n" );
+		return 1;
+	}
+	bspPath = argv[i + 1];
+
+	//
+	// read the log
+	//
+	f = fopen( argv[i], "rb" );
+	if ( !f ) {
+		Com_Error( ERR_FATAL, "couldn't open %s", argv[i] );
+	}
+	if ( fread( &header, sizeof( header ), 1, f ) != 1
+		|| LittleLong( header.ident ) != CM_LOG_IDENT
+		|| LittleLong( header.version ) != CM_LOG_VERSION ) {
+		Com_Error( ERR_FATAL, "%s is not a version %i trace log", argv[i], CM_LOG_VERSION );
+	}
+	header.mapname[sizeof( header.mapname ) - 1] = 0;
+
+	fseek( f, 0, SEEK_END );
+	length = ftell( f ) - sizeof( header );
+	fseek( f, sizeof( header ), SEEK_SET );
+
+	numRecords = length / sizeof( *records );
+	records = malloc( numRecords * sizeof( *records ) + 1 );
+	if ( fread( records, sizeof( *records ), numRecords, f ) != numRecords ) {
+		Com_Error( ERR_FATAL, "couldn't read %s", argv[i] );
+	}
+	fclose( f );
+
+	for ( i = 0 ; i < numRecords ; i++ ) {
+		CM_SwapLogRecord( &records[i] );
+		if ( records[i].type < 0 || records[i].type >= NUM_QUERY_TYPES ) {
+			Com_Error( ERR_FATAL, "bad query type %i in record %i", records[i].type, i );
+		}
+	}
+
+	//
+	// load the map it was recorded on
+	//
+	CM_LoadMap( header.mapname, qfalse, &checksum );
+	if ( checksum != LittleLong( header.checksum ) ) {
+		Com_Printf( "WARNING: %s does not match the checksum of the recorded %s\n", bspPath, header.mapname );
+	}
+
+	Com_Printf( "%s: %i queries on %s, %i passes\n", argv[argc - 2], numRecords, header.mapname, repeat );
+
+	//
+	// replay
+	//
+	numSamples = numRecords * repeat;
+	all = malloc( numSamples * sizeof( *all ) + 1 );
+	for ( i = 0 ; i < NUM_QUERY_TYPES ; i++ ) {
+		latencies[i] = malloc( numSamples * sizeof( *latencies[i] ) + 1 );
+		counts[i] = 0;
+	}
+
+	mismatches = 0;
+	elapsed = 0;
+	for ( pass = 0 ; pass < repeat ; pass++ ) {
+		for ( i = 0 ; i < numRecords ; i++ ) {
+			const cmLogRecord_t	*r = &records[i];
+			qboolean			match;
+			float				ns;
+
+			start = Bench_Nanoseconds();
+			match = Bench_Replay( r );
+			ns = Bench_Nanoseconds() - start;
+
+			if ( !match && !pass ) {
+				mismatches++;
+			}
+			elapsed += ns;
+			all[pass * numRecords + i] = ns;
+			latencies[r->type][counts[r->type]++] = ns;
+		}
+	}
+
+	Com_Printf( "%-24s %9s %12s %8s %8s %8s %8s %8s %8s\n", "query (ns)", "count",
+		"throughput", "mean", "p50", "p90", "p99", "p99.9", "max" );
+	for ( i = 0 ; i < NUM_QUERY_TYPES ; i++ ) {
+		Bench_Report( queryNames[i], latencies[i], counts[i] );
+	}
+	Bench_Report( "all", all, numSamples );
+	Com_Printf( "%.1f ms total, %i of %i results differ from the recording\n",
+		elapsed / 1e6, mismatches, numRecords );
+
+	return mismatches ? 2 : 0;
+}